@@ -1384,6 +1384,9 @@ void NetDemo::readSnapshot(const netdemo_index_entry_t *snap)
 
 	readSnapshotData(snapbuf, len);
 	netdemotic = snap->ticnum - header.starting_gametic;
+
+	// pick up the reliable stream wherever the demo is now
+	CL_ResetReliableStream(true);
 }
 
 
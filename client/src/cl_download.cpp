@@ -22,6 +22,7 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <map>
 #include <sstream>
 #include <iomanip>
 
@@ -65,14 +66,28 @@ struct download_s
 	public:
 		std::string filename;
 		std::string md5;
-		buf_t *buf;
-		size_t got_bytes;
+		size_t got_bytes;		// from the start, in order and hashed
+		size_t received;		// including what came out of order
+		size_t size;			// 0 until it's known
         dtime_t timeout;
 		int retrycount;
-		
+		bool acks;		// the server sent svc_wadwindow
+
+		// what came after a missing chunk, start -> end
+		std::map<size_t, size_t> ranges;
+
+		FILE *file;				// <filename>.part, as big as the wad
+		std::string partname;
+		md5_state_t md5state;	// of the first got_bytes
+
+		size_t requested;		// where the last rewind was asked for
+		dtime_t requested_time;
+		dtime_t saved_time;		// ranges last written next to the file
+		bool dirty;
+
 		download_s()
 		{
-			buf = NULL;
+			file = NULL;
 			this->clear();
 			timeout = 0;
 		}
@@ -85,15 +100,31 @@ struct download_s
 		{
 			filename = "";
 			md5 = "";
-			got_bytes = 0;
             timeout = 0;
             retrycount = 0;
-            
-			if (buf != NULL)
+            acks = false;
+			this->reset();
+		}
+
+		// forget the file, not which one it is
+		void reset()
+		{
+			got_bytes = 0;
+			received = 0;
+			size = 0;
+			ranges.clear();
+			requested = 0;
+			requested_time = 0;
+			saved_time = 0;
+			dirty = false;
+			md5_init(&md5state);
+
+			if (file != NULL)
 			{
-				delete buf;
-				buf = NULL;
+				fclose(file);
+				file = NULL;
 			}
+			partname = "";
 		}
 } download;
 
@@ -142,22 +173,295 @@ void ClearDownloadProgressBar()
 }
 
 
+//
+// CL_DownloadDirs
+//
+// Where a download is saved, in the order they're tried -- Hyper_Eye
+//
+static std::vector<std::string> CL_DownloadDirs()
+{
+    std::vector<std::string> dirs;
+#ifdef _WIN32
+    const char separator = ';';
+#else
+    const char separator = ':';
+#endif
+
+    D_AddSearchDir(dirs, cl_waddownloaddir.cstring(), separator);
+    D_AddSearchDir(dirs, Args.CheckValue("-waddir"), separator);
+    D_AddSearchDir(dirs, getenv("DOOMWADDIR"), separator);
+    D_AddSearchDir(dirs, getenv("DOOMWADPATH"), separator);
+    D_AddSearchDir(dirs, waddirs.cstring(), separator);
+    dirs.push_back(startdir);
+    dirs.push_back(progdir);
+
+    dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+
+    for (size_t i = 0; i < dirs.size(); i++)
+    {
+        if (dirs[i].empty() || dirs[i][dirs[i].length() - 1] != PATHSEPCHAR)
+            dirs[i] += PATHSEP;
+    }
+
+    return dirs;
+}
+
+//
+// CL_SaveDownloadRanges
+//
+// Writes down what's in the partial file next to it, so the download can
+// pick up where it left off after a disconnect.  Only for wads the server
+// gave a checksum for, nothing else can be told apart from a different wad
+// with the same name.
+//
+static void CL_SaveDownloadRanges()
+{
+	if (download.file == NULL || download.md5.empty() || !download.dirty)
+		return;
+
+	// don't claim anything that isn't in the file yet
+	fflush(download.file);
+
+	download.dirty = false;
+	download.saved_time = I_GetTime();
+
+	FILE *fp = fopen((download.partname + ".ranges").c_str(), "w");
+	if (fp == NULL)
+		return;
+
+	fprintf(fp, "%s\n%u\n", download.md5.c_str(), (unsigned int)download.size);
+
+	if (download.got_bytes)
+		fprintf(fp, "0 %u\n", (unsigned int)download.got_bytes);
+
+	for (std::map<size_t, size_t>::const_iterator it = download.ranges.begin();
+		 it != download.ranges.end(); ++it)
+		fprintf(fp, "%u %u\n", (unsigned int)it->first, (unsigned int)it->second);
+
+	fclose(fp);
+}
+
+//
+// CL_CloseDownload
+//
+// Closes the partial file and keeps it to resume from, or deletes it.
+//
+static void CL_CloseDownload(bool keep)
+{
+	if (download.file == NULL)
+		return;
+
+	if (download.md5.empty())
+		keep = false;
+
+	if (keep)
+		CL_SaveDownloadRanges();
+
+	fclose(download.file);
+	download.file = NULL;
+
+	if (!keep)
+	{
+		remove(download.partname.c_str());
+		remove((download.partname + ".ranges").c_str());
+	}
+
+	download.reset();
+}
+
+//
+// CL_AddDownloadRange
+//
+// Marks the bytes from start to end as received and returns how many of
+// them weren't already.
+//
+static size_t CL_AddDownloadRange(size_t start, size_t end)
+{
+	if (end <= download.got_bytes)
+		return 0;
+
+	start = MAX(start, download.got_bytes);
+
+	size_t added = end - start;
+	size_t merged_start = start, merged_end = end;
+
+	// ranges that overlap or touch this one are merged with it
+	std::map<size_t, size_t>::iterator it = download.ranges.upper_bound(start);
+	if (it != download.ranges.begin())
+	{
+		std::map<size_t, size_t>::iterator prev = it;
+		--prev;
+		if (prev->second >= start)
+			it = prev;
+	}
+
+	while (it != download.ranges.end() && it->first <= end)
+	{
+		size_t lo = MAX(it->first, start), hi = MIN(it->second, end);
+		if (hi > lo)
+			added -= hi - lo;
+
+		merged_start = MIN(merged_start, it->first);
+		merged_end = MAX(merged_end, it->second);
+		download.ranges.erase(it++);
+	}
+
+	download.ranges[merged_start] = merged_end;
+
+	return added;
+}
+
+//
+// CL_CatchUpDownload
+//
+// Hashes whatever follows the first got_bytes without a gap, reading it
+// back from the partial file.
+//
+static bool CL_CatchUpDownload()
+{
+	static byte buf[65536];
+
+	while (!download.ranges.empty() && download.ranges.begin()->first <= download.got_bytes)
+	{
+		size_t end = download.ranges.begin()->second;
+		download.ranges.erase(download.ranges.begin());
+
+		if (end <= download.got_bytes)
+			continue;
+
+		if (fseek(download.file, download.got_bytes, SEEK_SET) != 0)
+			return false;
+
+		while (download.got_bytes < end)
+		{
+			size_t len = MIN(sizeof(buf), end - download.got_bytes);
+			if (fread(buf, 1, len, download.file) != len)
+				return false;
+
+			md5_append(&download.md5state, buf, len);
+			download.got_bytes += len;
+		}
+	}
+
+	return true;
+}
+
+//
+// CL_OpenPartialDownload
+//
+// Looks for what an earlier download of the same wad left behind.
+//
+static void CL_OpenPartialDownload()
+{
+	if (download.md5.empty())
+		return;
+
+	std::vector<std::string> dirs = CL_DownloadDirs();
+
+	for (size_t i = 0; i < dirs.size(); i++)
+	{
+		std::string partname = dirs[i] + download.filename + ".part";
+
+		FILE *fp = fopen((partname + ".ranges").c_str(), "r");
+		if (fp == NULL)
+			continue;
+
+		char md5[64];
+		unsigned int size, start, end;
+		std::vector<std::pair<size_t, size_t> > saved;
+
+		bool ok = fscanf(fp, "%63s %u", md5, &size) == 2 && download.md5 == md5 && size > 0;
+		while (ok && fscanf(fp, "%u %u", &start, &end) == 2)
+		{
+			if (start < end && end <= size)
+				saved.push_back(std::make_pair((size_t)start, (size_t)end));
+		}
+		fclose(fp);
+
+		if (!ok)
+			continue;
+
+		download.file = fopen(partname.c_str(), "r+b");
+		if (download.file == NULL)
+			continue;
+
+		if (M_FileLength(download.file) != (SDWORD)size)
+		{
+			download.reset();
+			continue;
+		}
+
+		download.partname = partname;
+		download.size = size;
+
+		for (size_t j = 0; j < saved.size(); j++)
+			download.received += CL_AddDownloadRange(saved[j].first, saved[j].second);
+
+		if (!CL_CatchUpDownload())
+		{
+			CL_CloseDownload(false);
+			continue;
+		}
+
+		Printf(PRINT_HIGH, "Found %s of %s from an earlier download\n",
+			FormatNBytes(download.received).c_str(), FormatNBytes(download.size).c_str());
+		return;
+	}
+}
+
+//
+// CL_CreatePartialDownload
+//
+// Makes the file the download goes into, as big as the wad from the start
+// so chunks can be written wherever they belong.
+//
+static bool CL_CreatePartialDownload(size_t size)
+{
+	std::vector<std::string> dirs = CL_DownloadDirs();
+
+	for (size_t i = 0; i < dirs.size(); i++)
+	{
+		std::string partname = dirs[i] + download.filename + ".part";
+
+		FILE *fp = fopen(partname.c_str(), "w+b");
+		if (fp == NULL)
+			continue;
+
+		if (fseek(fp, size - 1, SEEK_SET) != 0 || fputc(0, fp) == EOF)
+		{
+			fclose(fp);
+			remove(partname.c_str());
+			continue;
+		}
+
+		remove((partname + ".ranges").c_str());
+
+		download.file = fp;
+		download.partname = partname;
+		download.size = size;
+		return true;
+	}
+
+	return false;
+}
+
 void IntDownloadComplete(void)
 {
-    std::string actual_md5 = MD5SUM(download.buf->ptr(), download.buf->maxsize());
+    std::string actual_md5 = MD5SUM(&download.md5state);
 
-	Printf(PRINT_HIGH, "\nDownload complete, got %u bytes\n", download.buf->maxsize());
+	Printf(PRINT_HIGH, "\nDownload complete, got %u bytes\n", (unsigned int)download.size);
 	Printf(PRINT_HIGH, "%s\n %s\n", download.filename.c_str(), actual_md5.c_str());
 
 	if(download.md5 == "")
 	{
-		Printf(PRINT_HIGH, "Server gave no checksum, assuming valid\n", (int)download.buf->maxsize());
+		Printf(PRINT_HIGH, "Server gave no checksum, assuming valid\n");
 	}
 	else if(actual_md5 != download.md5)
 	{
 		Printf(PRINT_HIGH, " %s on server\n", download.md5.c_str());
 		Printf(PRINT_HIGH, "Download failed: bad checksum\n");
 
+		CL_CloseDownload(false);
 		download.clear();
         CL_QuitNetGame();
 
@@ -167,49 +471,27 @@ void IntDownloadComplete(void)
     }
 
     // got the wad! save it!
-    std::vector<std::string> dirs;
-    std::string filename;
-    size_t i;
-#ifdef _WIN32
-    const char separator = ';';
-#else
-    const char separator = ':';
-#endif
-
-    // Try to save to the wad paths in this order -- Hyper_Eye
-    D_AddSearchDir(dirs, cl_waddownloaddir.cstring(), separator);
-    D_AddSearchDir(dirs, Args.CheckValue("-waddir"), separator);
-    D_AddSearchDir(dirs, getenv("DOOMWADDIR"), separator);
-    D_AddSearchDir(dirs, getenv("DOOMWADPATH"), separator);
-    D_AddSearchDir(dirs, waddirs.cstring(), separator);
-    dirs.push_back(startdir);
-    dirs.push_back(progdir);
+    fclose(download.file);
+    download.file = NULL;
 
-    dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+    std::string partname = download.partname;
+    std::string filename = partname.substr(0, partname.length() - strlen(".part"));
 
-    for(i = 0; i < dirs.size(); i++)
+    // there is an existing file, so use a new file whose name includes the checksum
+    if(M_FileExists(filename))
     {
-        filename.clear();
-        filename = dirs[i];
-        if(filename[filename.length() - 1] != PATHSEPCHAR)
-            filename += PATHSEP;
-        filename += download.filename;
-
-        // check for existing file
-   	    if(M_FileExists(filename))
-   	    {
-   	        // there is an existing file, so use a new file whose name includes the checksum
-   	        filename += ".";
-   	        filename += actual_md5;
-   	    }
-
-        if (M_WriteFile(filename, download.buf->ptr(), download.buf->maxsize()))
-            break;
+        filename += ".";
+        filename += actual_md5;
     }
 
+    remove((partname + ".ranges").c_str());
+
     // Unable to write
-    if(i == dirs.size())
+    if (rename(partname.c_str(), filename.c_str()) != 0)
     {
+        Printf(PRINT_HIGH, "Unable to save download as \"%s\"\n", filename.c_str());
+
+        remove(partname.c_str());
 		download.clear();
         CL_QuitNetGame();
         return;
@@ -236,11 +518,17 @@ void CL_RequestDownload(std::string filename, std::string filehash)
 		if ((download.filename != filename) ||
 			(download.md5 != filehash))
 		{
+			CL_CloseDownload(true);
+
 			download.filename = filename;
 			download.md5 = filehash;
-			download.got_bytes = 0;
+
+			CL_OpenPartialDownload();
 		}
 
+		// the server says again if it wants acks
+		download.acks = false;
+
 		// denis todo clear previous downloads
 		MSG_WriteMarker(&net_buffer, clc_wantwad);
 		MSG_WriteString(&net_buffer, filename.c_str());
@@ -257,8 +545,8 @@ void CL_RequestDownload(std::string filename, std::string filehash)
 		// reconnect a couple of times and this will let the checksum system do its
 		// work
 
-		if ((download.buf != NULL) &&
-			(download.got_bytes >= download.buf->maxsize()))
+		if ((download.file != NULL) &&
+			(download.got_bytes >= download.size))
 		{
 			IntDownloadComplete();
 		}
@@ -288,28 +576,41 @@ void CL_DownloadStart()
 	}
 
     // [Russell] - Allow resumeable downloads
-	if (download.got_bytes == 0)
+	if (download.file != NULL && download.size == file_len)
     {
-        if (download.buf != NULL)
-        {
-            delete download.buf;
-            download.buf = NULL;
-        }
-
-        download.buf = new buf_t ((size_t)file_len);
-
-        memset(download.buf->ptr(), 0, file_len);
+        if (download.received)
+            Printf(PRINT_HIGH, "Resuming download of %s...\n", download.filename.c_str());
     }
     else
-        Printf(PRINT_HIGH, "Resuming download of %s...\n", download.filename.c_str());
-
+    {
+        CL_CloseDownload(false);
 
+        if (file_len == 0 || !CL_CreatePartialDownload(file_len))
+        {
+            Printf(PRINT_HIGH, "Unable to create a file to download %s to, aborting\n",
+                download.filename.c_str());
+            CL_QuitNetGame();
+            return;
+        }
+    }
 
 	Printf(PRINT_HIGH, "Downloading %s bytes...\n",
         FormatNBytes(file_len).c_str());
 
 	// Make initial 0% show
-	SetDownloadPercentage(0);
+	SetDownloadPercentage(download.received * 100 / download.size);
+}
+
+//
+// CL_DownloadWindow
+// server will wait for us to ack what we've got
+//
+void CL_DownloadWindow()
+{
+	MSG_ReadLong();
+
+	if (gamestate == GS_DOWNLOAD)
+		download.acks = true;
 }
 
 // Resets the timeout for a packet retry
@@ -329,6 +630,10 @@ void CL_DownloadTicker()
 		return;
     }
 
+	// keep what's on disk resumable, a second's worth at most is lost
+	if (download.dirty && I_GetTime() - download.saved_time >= I_ConvertTimeFromMs(1000))
+		CL_SaveDownloadRanges();
+
     if (download.timeout)
     {
         // Calculate how many seconds have elapsed since the last server 
@@ -377,6 +682,9 @@ void CL_DownloadTicker()
 // CL_Download
 // denis - get a little chunk of the file and store it, much like a hampster. Well, hamster; but hampsters can dance and sing. Also much like Scraps, the Ice Age squirrel thing, stores his acorn. Only with a bit more success. Actually, quite a bit more success, specifically as in that the world doesn't crack apart when we store our chunk and it does when Scraps stores his (or her?) acorn. But when Scraps does it, it is funnier. The rest of Ice Age mostly sucks.
 //
+// Chunks are kept wherever they land in the file, a missing one is asked
+// for again and what came after it doesn't have to be.
+//
 void CL_Download()
 {
 	DWORD offset = MSG_ReadLong();
@@ -387,7 +695,7 @@ void CL_Download()
 	if(gamestate != GS_DOWNLOAD)
 		return;
 
-	if (download.buf == NULL)
+	if (download.file == NULL)
 	{
 		// We must have not received the svc_wadinfo message
 		Printf(PRINT_HIGH, "Unable to start download, aborting\n");
@@ -397,10 +705,11 @@ void CL_Download()
 	}
 
 	// check ranges
-	if(offset + len > download.buf->maxsize() || len > left || p == NULL)
+	if(offset + len > download.size || len > left || p == NULL)
 	{
-		Printf(PRINT_HIGH, "Bad download packet (%d, %d) encountered (%d), aborting\n", (int)offset, (int)left, (int)download.buf->size());
+		Printf(PRINT_HIGH, "Bad download packet (%d, %d) encountered (%d), aborting\n", (int)offset, (int)left, (int)download.size);
 
+		CL_CloseDownload(true);
 		download.clear();
 		CL_QuitNetGame();
 		return;
@@ -408,32 +717,81 @@ void CL_Download()
 
 	// Reset retransmission timer
 	CL_DownloadTick();
-	
-	if (offset < download.got_bytes)
-        return;
-	
-	// check for missing packet, re-request
-	if(offset > download.got_bytes)
+
+	size_t added = CL_AddDownloadRange(offset, offset + len);
+	if (added)
 	{
-		DPrintf("Missed a packet after %d bytes (got %d), re-requesting\n", download.got_bytes, offset);
+		if (fseek(download.file, offset, SEEK_SET) != 0 ||
+			fwrite(p, 1, len, download.file) != len)
+		{
+			Printf(PRINT_HIGH, "Unable to write to \"%s\", aborting\n", download.partname.c_str());
+
+			CL_CloseDownload(false);
+			download.clear();
+			CL_QuitNetGame();
+			return;
+		}
+
+		download.received += added;
+		download.dirty = true;
+
+		// the usual case, the chunk is right after what's been hashed
+		std::map<size_t, size_t>::iterator first = download.ranges.begin();
+		if (offset <= download.got_bytes && first->first == download.got_bytes &&
+			first->second == offset + len)
+		{
+			md5_append(&download.md5state, (byte *)p + (download.got_bytes - offset),
+				offset + len - download.got_bytes);
+			download.got_bytes = offset + len;
+			download.ranges.erase(first);
+		}
+		else if (!CL_CatchUpDownload())
+		{
+			Printf(PRINT_HIGH, "Unable to read back \"%s\", aborting\n", download.partname.c_str());
+
+			CL_CloseDownload(false);
+			download.clear();
+			CL_QuitNetGame();
+			return;
+		}
+	}
+
+	// a server that doesn't take acks has to be told to skip what came
+	// before a missing chunk as well
+	bool behind = !download.acks && offset + len < download.got_bytes;
+
+	// check for missing packet, re-request, but not again until the server
+	// has had time to go back for it
+	dtime_t now = I_GetTime();
+	if ((offset > download.got_bytes || behind) &&
+		(download.requested != download.got_bytes ||
+		 now - download.requested_time >= I_ConvertTimeFromMs(1000)))
+	{
+		if (behind)
+			DPrintf("Already have %d bytes (got %d), skipping ahead\n", download.got_bytes, offset);
+		else
+			DPrintf("Missed a packet after %d bytes (got %d), re-requesting\n", download.got_bytes, offset);
+
 		MSG_WriteMarker(&net_buffer, clc_wantwad);
 		MSG_WriteString(&net_buffer, download.filename.c_str());
 		MSG_WriteString(&net_buffer, download.md5.c_str());
 		MSG_WriteLong(&net_buffer, download.got_bytes);
-		NET_SendPacket(net_buffer, serveraddr);
-		return;
+
+		download.requested = download.got_bytes;
+		download.requested_time = now;
 	}
 
-	// send keepalive
+	// send keepalive, with an ack if the server wants them
+	if (download.acks)
+	{
+		MSG_WriteMarker(&net_buffer, clc_wadack);
+		MSG_WriteLong(&net_buffer, download.got_bytes);
+	}
 	NET_SendPacket(net_buffer, serveraddr);
 
-	// copy into downloaded buffer
-	memcpy(download.buf->ptr() + offset, p, len);
-	download.got_bytes += len;
-
 	// calculate percentage for the user
 	static size_t old_percent = 0;
-	size_t percent = (download.got_bytes*100)/download.buf->maxsize();
+	size_t percent = (download.received*100)/download.size;
 	if(percent != old_percent)
 	{
         SetDownloadPercentage(percent);
@@ -446,7 +804,7 @@ void CL_Download()
 	// pause at 100% if the server disconnected you previously, you can
 	// reconnect a couple of times and this will let the checksum system do its
 	// work
-	if(download.got_bytes >= download.buf->maxsize())
+	if(download.got_bytes >= download.size)
 	{
         IntDownloadComplete();
 	}
@@ -50,6 +50,7 @@
 #include "w_ident.h"
 #include "md5.h"
 #include "m_fileio.h"
+#include "r_main.h"
 #include "r_sky.h"
 #include "cl_demo.h"
 #include "cl_download.h"
@@ -116,8 +117,22 @@ BOOL      connected;
 netadr_t  serveraddr; // address of a server
 netadr_t  lastconaddr;
 
-int       packetseq[256];
-byte      packetnum;
+int       packetseq[256];	// indexed by sequence & 0xff
+
+// for clc_ackbits: the newest packet received, and bit n set if packet
+// ack_sequence - n - 1 was received as well
+int       ack_sequence = -1;
+DWORD     ack_bits = 0;
+
+// [NETCAP_RELIABLE] the server sends its reliable messages in numbered
+// chunks, see CL_ReliableChunk
+bool      reliable_stream = false;
+int       reliable_next = 0;	// -1 to pick up the stream wherever it is
+std::map<int, std::vector<byte> > reliable_held;
+
+// chunks that can be held while waiting for a missing one; the server
+// never sends more than RELIABLE_MAX_SPAN past the oldest one we're missing
+static const size_t MAX_RELIABLE_HELD = 1024;
 
 // denis - unique session key provided by the server
 std::string digest;
@@ -143,6 +158,9 @@ std::set<byte> teleported_players;
 // [SL] 2012-04-06 - moving sector snapshots received from the server
 std::map<unsigned short, SectorSnapshotManager> sector_snaps;
 
+// the server sends the monster counts, see CL_LevelStats
+static bool server_levelstats = false;
+
 EXTERN_CVAR (sv_weaponstay)
 
 EXTERN_CVAR (cl_predictsectors)
@@ -282,7 +300,7 @@ void CL_PlayerTimes (void);
 void CL_GetServerSettings(void);
 void CL_RequestDownload(std::string filename, std::string filehash = "");
 void CL_TryToConnect(DWORD server_token);
-void CL_Decompress(int sequence);
+bool CL_Decompress(int sequence);
 
 void CL_LocalDemoTic(void);
 void CL_NetDemoStop(void);
@@ -1424,21 +1442,11 @@ void CL_TeamPoints (void)
 }
 
 //
-// CL_MoveMobj
+// CL_ApplyMoveMobj
 //
-void CL_MoveMobj(void)
+static void CL_ApplyMoveMobj(int netid, byte rndindex, fixed_t x, fixed_t y, fixed_t z)
 {
-	AActor  *mo;
-	int      netid;
-	fixed_t  x, y, z;
-
-	netid = MSG_ReadShort();
-	mo = P_FindThingById (netid);
-
-	byte rndindex = MSG_ReadByte();
-	x = MSG_ReadLong();
-	y = MSG_ReadLong();
-	z = MSG_ReadLong();
+	AActor *mo = P_FindThingById(netid);
 
 	if (!mo)
 		return;
@@ -1463,6 +1471,36 @@ void CL_MoveMobj(void)
 	}
 }
 
+//
+// CL_MoveMobj
+//
+void CL_MoveMobj(void)
+{
+	int netid = MSG_ReadShort();
+	byte rndindex = MSG_ReadByte();
+	fixed_t x = MSG_ReadLong();
+	fixed_t y = MSG_ReadLong();
+	fixed_t z = MSG_ReadLong();
+
+	CL_ApplyMoveMobj(netid, rndindex, x, y, z);
+}
+
+//
+// CL_MoveMobjPacked
+//
+void CL_MoveMobjPacked(void)
+{
+	BitReader bits(&net_message);
+
+	int netid = bits.ReadBits(16);
+	byte rndindex = bits.ReadBits(8);
+	fixed_t x = bits.ReadFixed(NET_POSITION_FRACBITS);
+	fixed_t y = bits.ReadFixed(NET_POSITION_FRACBITS);
+	fixed_t z = bits.ReadFixed(NET_POSITION_FRACBITS);
+
+	CL_ApplyMoveMobj(netid, rndindex, x, y, z);
+}
+
 //
 // CL_DamageMobj
 //
@@ -1692,7 +1730,11 @@ bool CL_Connect(void)
 	players.clear();
 
 	memset(packetseq, -1, sizeof(packetseq) );
-	packetnum = 0;
+	ack_sequence = -1;
+	ack_bits = 0;
+
+	// a netdemo can start anywhere in the stream
+	CL_ResetReliableStream(netdemo.isPlaying());
 
 	MSG_WriteMarker(&net_buffer, clc_ack);
 	MSG_WriteLong(&net_buffer, 0);
@@ -1707,6 +1749,7 @@ bool CL_Connect(void)
     network_game = true;
 	serverside = false;
 	simulated_connection = netdemo.isPlaying();
+	server_levelstats = false;
 
 	CL_Decompress(0);
 	CL_ParseCommands();
@@ -1812,6 +1855,9 @@ void CL_TryToConnect(DWORD server_token)
 
         MSG_WriteString(&net_buffer, (char *)connectpasshash.c_str());
 
+		// protocol extensions this client understands
+		MSG_WriteLong(&net_buffer, NETCAP_SUPPORTED);
+
 		NET_SendPacket(net_buffer, serveraddr);
 		SZ_Clear(&net_buffer);
 	}
@@ -1932,27 +1978,18 @@ void CL_ClearPlayerJustTeleported(player_t *player)
 		teleported_players.erase(player->id);
 }
 
-void CL_UpdatePlayer()
+//
+// CL_MovePlayer
+//
+// Applies another player's position update, however it was encoded.
+//
+static void CL_MovePlayer(byte who, fixed_t x, fixed_t y, fixed_t z,
+						  angle_t angle, angle_t pitch, int frame,
+						  fixed_t momx, fixed_t momy, fixed_t momz,
+						  int invisibility)
 {
-	byte who = MSG_ReadByte();
 	player_t *p = &idplayer(who);
 
-	MSG_ReadLong();	// Read and ignore for now
-
-	fixed_t x = MSG_ReadLong();
-	fixed_t y = MSG_ReadLong();
-	fixed_t z = MSG_ReadLong();
-
-	angle_t angle = MSG_ReadShort() << FRACBITS;
-	angle_t pitch = MSG_ReadShort() << FRACBITS;
-
-	int frame = MSG_ReadByte();
-	fixed_t momx = MSG_ReadLong();
-	fixed_t momy = MSG_ReadLong();
-	fixed_t momz = MSG_ReadLong();
-
-	int invisibility = MSG_ReadByte();
-
 	if	(!validplayer(*p) || !p->mo)
 		return;
 
@@ -2004,6 +2041,66 @@ void CL_UpdatePlayer()
 	p->snapshots.addSnapshot(newsnap);
 }
 
+//
+// CL_UpdatePlayer
+//
+void CL_UpdatePlayer()
+{
+	byte who = MSG_ReadByte();
+
+	MSG_ReadLong();	// Read and ignore for now
+
+	fixed_t x = MSG_ReadLong();
+	fixed_t y = MSG_ReadLong();
+	fixed_t z = MSG_ReadLong();
+
+	angle_t angle = MSG_ReadShort() << FRACBITS;
+	angle_t pitch = MSG_ReadShort() << FRACBITS;
+
+	int frame = MSG_ReadByte();
+	fixed_t momx = MSG_ReadLong();
+	fixed_t momy = MSG_ReadLong();
+	fixed_t momz = MSG_ReadLong();
+
+	int invisibility = MSG_ReadByte();
+
+	CL_MovePlayer(who, x, y, z, angle, pitch, frame, momx, momy, momz, invisibility);
+}
+
+//
+// CL_UpdatePlayerPacked
+//
+// svc_packedmoveplayer, see SV_WritePackedPlayerMove
+//
+void CL_UpdatePlayerPacked()
+{
+	byte who = MSG_ReadByte();
+
+	BitReader bits(&net_message);
+	bits.ReadVarint();	// tic, ignored like in svc_moveplayer
+
+	fixed_t x = bits.ReadFixed(NET_POSITION_FRACBITS);
+	fixed_t y = bits.ReadFixed(NET_POSITION_FRACBITS);
+	fixed_t z = bits.ReadFixed(NET_POSITION_FRACBITS);
+
+	angle_t angle = bits.ReadBits(16) << FRACBITS;
+	angle_t pitch = bits.ReadBits(16) << FRACBITS;
+
+	int frame = bits.ReadBits(8);
+
+	fixed_t momx = 0, momy = 0, momz = 0;
+	if (bits.ReadBit())
+	{
+		momx = bits.ReadFixedVarint(NET_MOMENTUM_FRACBITS);
+		momy = bits.ReadFixedVarint(NET_MOMENTUM_FRACBITS);
+		momz = bits.ReadFixedVarint(NET_MOMENTUM_FRACBITS);
+	}
+
+	int invisibility = bits.ReadBit() ? bits.ReadBits(8) : 0;
+
+	CL_MovePlayer(who, x, y, z, angle, pitch, frame, momx, momy, momz, invisibility);
+}
+
 BOOL P_GiveWeapon(player_t *player, weapontype_t weapon, BOOL dropped);
 
 void CL_UpdatePlayerState(void)
@@ -2158,6 +2255,18 @@ void CL_UpdateIntTimeLeft(void)
 	level.inttimeleft = MSG_ReadShort();	// convert from seconds to tics
 }
 
+//
+// CL_LevelStats
+// The server only sends the monsters near us, so it counts them for us
+//
+void CL_LevelStats(void)
+{
+	level.total_monsters = MSG_ReadShort();
+	level.killed_monsters = MSG_ReadShort();
+
+	server_levelstats = true;
+}
+
 
 //
 // CL_SpawnMobj
@@ -2207,7 +2316,7 @@ void CL_SpawnMobj()
 		CL_SetMobjSpeedAndAngle();
 	}
 
-    if (mo->flags & MF_COUNTKILL)
+    if (mo->flags & MF_COUNTKILL && !server_levelstats)
 		level.total_monsters++;
 
 	if (connected && (mo->flags & MF_MISSILE ) && mo->info->seesound)
@@ -2266,7 +2375,7 @@ void CL_Corpse(void)
 	if (mo->player)
 		mo->player->playerstate = PST_DEAD;
 
-    if (mo->flags & MF_COUNTKILL)
+    if (mo->flags & MF_COUNTKILL && !server_levelstats)
 		level.killed_monsters++;
 }
 
@@ -2417,20 +2526,12 @@ void CL_PlayerInfo(void)
 }
 
 //
-// CL_SetMobjSpeedAndAngle
+// CL_ApplyMobjSpeedAndAngle
 //
-void CL_SetMobjSpeedAndAngle(void)
+static void CL_ApplyMobjSpeedAndAngle(int netid, angle_t angle,
+									  fixed_t momx, fixed_t momy, fixed_t momz)
 {
-	AActor *mo;
-	int     netid;
-
-	netid = MSG_ReadShort();
-	mo = P_FindThingById(netid);
-
-	angle_t angle = MSG_ReadLong();
-	fixed_t momx = MSG_ReadLong();
-	fixed_t momy = MSG_ReadLong();
-	fixed_t momz = MSG_ReadLong();
+	AActor *mo = P_FindThingById(netid);
 
 	if (!mo)
 		return;
@@ -2457,6 +2558,41 @@ void CL_SetMobjSpeedAndAngle(void)
 	}
 }
 
+//
+// CL_SetMobjSpeedAndAngle
+//
+void CL_SetMobjSpeedAndAngle(void)
+{
+	int netid = MSG_ReadShort();
+	angle_t angle = MSG_ReadLong();
+	fixed_t momx = MSG_ReadLong();
+	fixed_t momy = MSG_ReadLong();
+	fixed_t momz = MSG_ReadLong();
+
+	CL_ApplyMobjSpeedAndAngle(netid, angle, momx, momy, momz);
+}
+
+//
+// CL_SetMobjSpeedAndAnglePacked
+//
+void CL_SetMobjSpeedAndAnglePacked(void)
+{
+	BitReader bits(&net_message);
+
+	int netid = bits.ReadBits(16);
+	angle_t angle = bits.ReadBits(16) << FRACBITS;
+
+	fixed_t momx = 0, momy = 0, momz = 0;
+	if (bits.ReadBit())
+	{
+		momx = bits.ReadFixedVarint(NET_MOMENTUM_FRACBITS);
+		momy = bits.ReadFixedVarint(NET_MOMENTUM_FRACBITS);
+		momz = bits.ReadFixedVarint(NET_MOMENTUM_FRACBITS);
+	}
+
+	CL_ApplyMobjSpeedAndAngle(netid, angle, momx, momy, momz);
+}
+
 //
 // CL_ExplodeMissile
 //
@@ -2584,7 +2720,7 @@ void CL_KillMobj(void)
 
 	target->health = health;
 
-    if (!serverside && target->flags & MF_COUNTKILL)
+    if (!serverside && !server_levelstats && target->flags & MF_COUNTKILL)
 		level.killed_monsters++;
 
 	if (target->player == &consoleplayer())
@@ -2964,66 +3100,196 @@ void CL_CheckMissedPacket(void)
 	sequence = MSG_ReadLong();
 	size = MSG_ReadShort();
 
-	for (int n=0; n<256; n++)
+	// skip a duplicated packet
+	if (packetseq[sequence & 0xff] == sequence)
 	{
-		// skip a duplicated packet
-		if (packetseq[n] == sequence)
-		{
-            MSG_ReadChunk(size);
+		MSG_ReadChunk(size);
 
-			#ifdef _DEBUG
-                Printf (PRINT_LOW, "warning: duplicate packet\n");
-			#endif
-			return;
-		}
+		#ifdef _DEBUG
+			Printf (PRINT_LOW, "warning: duplicate packet\n");
+		#endif
+		return;
 	}
+
+	// it is parsed as the rest of this packet, don't take another copy
+	packetseq[sequence & 0xff] = sequence;
 }
 
-// Decompress the packet sequence
-// [Russell] - reason this was failing is because of huffman routines, so just
-// use minilzo for now (cuts a packet size down by roughly 45%), huffman is the
-// if 0'd sections
-void CL_Decompress(int sequence)
+//
+// CL_ResetReliableStream
+//
+// With 'resync', the stream is picked up from the first chunk that comes in.
+//
+void CL_ResetReliableStream(bool resync)
 {
-	if(!MSG_BytesLeft() || MSG_NextByte() != svc_compressed)
+	reliable_stream = false;
+	reliable_next = resync ? -1 : 0;
+	reliable_held.clear();
+}
+
+//
+// CL_ParseReliableStream
+//
+// Parses a run of chunks on their own, then goes back to the packet.
+//
+static void CL_ParseReliableStream(const std::vector<byte> &stream)
+{
+	buf_t packet = net_message;
+
+	net_message.clear();
+	if (stream.size() >= net_message.maxsize())
+		net_message.resize(stream.size() + 1);
+
+	SZ_Write(&net_message, &stream[0], stream.size());
+
+	CL_ParseCommands();
+
+	net_message = packet;
+}
+
+//
+// CL_ReliableChunk
+//
+// A numbered piece of the server's reliable messages.  Chunks are parsed in
+// order: those that arrive ahead of a missing one are held until it shows
+// up, those already parsed are skipped.
+//
+void CL_ReliableChunk()
+{
+	int chunk = MSG_ReadLong();
+	size_t size = MSG_ReadShort() & 0xFFFF;
+
+	if (!netdemo.isPlaying())
+		reliable_stream = true;
+
+	if (reliable_next < 0)
+		reliable_next = chunk;
+
+	if (chunk != reliable_next)
+	{
+		byte *data = (byte *)MSG_ReadChunk(size);
+
+		if (data && chunk > reliable_next && reliable_held.size() < MAX_RELIABLE_HELD)
+			reliable_held[chunk].assign(data, data + size);
+
+		return;
+	}
+
+	reliable_next++;
+
+	// nothing held behind it, the messages are parsed as the rest of the packet
+	if (reliable_held.empty() || reliable_held.begin()->first != reliable_next)
 		return;
+
+	byte *data = (byte *)MSG_ReadChunk(size);
+	if (!data)
+		return;
+
+	std::vector<byte> stream(data, data + size);
+
+	while (!reliable_held.empty() && reliable_held.begin()->first == reliable_next)
+	{
+		const std::vector<byte> &held = reliable_held.begin()->second;
+		stream.insert(stream.end(), held.begin(), held.end());
+
+		reliable_held.erase(reliable_held.begin());
+		reliable_next++;
+	}
+
+	CL_ParseReliableStream(stream);
+}
+
+//
+// CL_Decompress
+//
+// Decompresses the packet sequence.  Returns false if it can't be, because
+// it was compressed with an adaptive codec that has been replaced since.
+//
+bool CL_Decompress(int sequence)
+{
+	if(!MSG_BytesLeft() || MSG_NextByte() != svc_compressed)
+		return true;
 	else
 		MSG_ReadByte();
 
 	byte method = MSG_ReadByte();
 
-#if 0
+	// even uncompressed packets can tell that the server switched codecs
+	huffman *codec = compressor.codec_for_received(sequence, method & adaptive_select_mask);
+
 	if(method & adaptive_mask)
-		MSG_DecompressAdaptive(compressor.codec_for_received(method & adaptive_select_mask ? 1 : 0));
-	else
 	{
-		// otherwise compressed packets can still contain codec updates
-		compressor.codec_for_received(method & adaptive_select_mask ? 1 : 0);
+		if(!codec || !MSG_DecompressAdaptive(*codec))
+		{
+			DPrintf("CL_Decompress: no codec for packet %d\n", sequence);
+			return false;
+		}
 	}
-#endif
 
 	if(method & minilzo_mask)
-		MSG_DecompressMinilzo();
-#if 0
+	{
+		if(!MSG_DecompressMinilzo())
+			return false;
+	}
+
+	// the server extends its codec with this packet once we ack it
 	if(method & adaptive_record_mask)
-		compressor.ack_sent(net_message.ptr(), MSG_BytesLeft());
-#endif
+		compressor.ack_sent(sequence, net_message.ptr() + net_message.BytesRead(), MSG_BytesLeft());
+
+	return true;
 }
 
 //
 // CL_ReadPacketHeader
 //
-void CL_ReadPacketHeader(void)
+// Returns false if the packet has to be thrown away.
+//
+bool CL_ReadPacketHeader(void)
 {
 	unsigned int sequence = MSG_ReadLong();
 
-	MSG_WriteMarker(&net_buffer, clc_ack);
-	MSG_WriteLong(&net_buffer, sequence);
+	// don't ack what couldn't be read, the server will resend its reliable
+	// part and not count on us having the packet's codec update
+	if (!CL_Decompress(sequence))
+		return false;
 
-	CL_Decompress(sequence);
+	int delta = (int)sequence - ack_sequence;
 
-	packetseq[packetnum] = sequence;
-	packetnum++;
+	if (ack_sequence < 0)
+	{
+		ack_sequence = sequence;
+		ack_bits = 0;
+	}
+	else if (delta > 0)
+	{
+		ack_bits = delta < 32 ? ack_bits << delta : 0;
+		if (delta <= 32)
+			ack_bits |= 1u << (delta - 1);
+
+		ack_sequence = sequence;
+	}
+	else if (delta < 0 && delta >= -32)
+	{
+		ack_bits |= 1u << (-delta - 1);
+	}
+
+	// once the server has shown it speaks the reliable stream, every ack
+	// repeats the last 32 so that losing one doesn't matter
+	if (reliable_stream)
+	{
+		MSG_WriteMarker(&net_buffer, clc_ackbits);
+		MSG_WriteLong(&net_buffer, ack_sequence);
+		MSG_WriteLong(&net_buffer, ack_bits);
+	}
+	else
+	{
+		MSG_WriteMarker(&net_buffer, clc_ack);
+		MSG_WriteLong(&net_buffer, sequence);
+	}
+
+	packetseq[sequence & 0xff] = sequence;
+
+	return true;
 }
 
 void CL_GetServerSettings(void)
@@ -3161,6 +3427,81 @@ void CL_Actor_Tracer()
 	actor->tracer = tracer->ptr();
 }
 
+//
+// CL_MobjDelta
+//
+// Only the fields that changed since the last update we acknowledged are
+// present; the mask says which.
+//
+void CL_MobjDelta()
+{
+	AActor *mo = P_FindThingById(MSG_ReadShort());
+	unsigned int mask = MSG_ReadShort() & 0xFFFF;
+
+	int values[NUM_MOBJDELTA_FIELDS];
+	for (int i = 0; i < NUM_MOBJDELTA_FIELDS; i++)
+	{
+		if (!(mask & (1 << i)))
+			continue;
+
+		switch (i)
+		{
+		case MDF_RNDINDEX_BIT:
+		case MDF_MOVEDIR_BIT:
+			values[i] = MSG_ReadByte();
+			break;
+		case MDF_TARGET_BIT:
+		case MDF_TRACER_BIT:
+			values[i] = MSG_ReadShort() & 0xFFFF;
+			break;
+		default:
+			values[i] = MSG_ReadLong();
+			break;
+		}
+	}
+
+	if (!mo || mo->player)
+		return;
+
+	if (mask & MDF_POSITION)
+	{
+		fixed_t x = (mask & (1 << MDF_X_BIT)) ? values[MDF_X_BIT] : mo->x;
+		fixed_t y = (mask & (1 << MDF_Y_BIT)) ? values[MDF_Y_BIT] : mo->y;
+		fixed_t z = (mask & (1 << MDF_Z_BIT)) ? values[MDF_Z_BIT] : mo->z;
+
+		CL_MoveThing(mo, x, y, z);
+	}
+
+	if (mask & (1 << MDF_ANGLE_BIT))
+		mo->angle = values[MDF_ANGLE_BIT];
+	if (mask & (1 << MDF_MOMX_BIT))
+		mo->momx = values[MDF_MOMX_BIT];
+	if (mask & (1 << MDF_MOMY_BIT))
+		mo->momy = values[MDF_MOMY_BIT];
+	if (mask & (1 << MDF_MOMZ_BIT))
+		mo->momz = values[MDF_MOMZ_BIT];
+	if (mask & MDF_RNDINDEX)
+		mo->rndindex = values[MDF_RNDINDEX_BIT];
+	if ((mask & MDF_MOVEDIR) && values[MDF_MOVEDIR_BIT] < 8)
+		mo->movedir = values[MDF_MOVEDIR_BIT];
+	if (mask & MDF_MOVECOUNT)
+		mo->movecount = values[MDF_MOVECOUNT_BIT];
+
+	if (mask & MDF_TARGET)
+	{
+		AActor *target = P_FindThingById(values[MDF_TARGET_BIT]);
+		if (target)
+			mo->target = target->ptr();
+	}
+
+	if (mask & MDF_TRACER)
+	{
+		AActor *tracer = P_FindThingById(values[MDF_TRACER_BIT]);
+		if (tracer)
+			mo->tracer = tracer->ptr();
+	}
+}
+
 //
 // CL_MobjTranslation
 //
@@ -3502,6 +3843,7 @@ void CL_InitCommands(void)
 	cmds[svc_consoleplayer]		= &CL_ConsolePlayer;
 	cmds[svc_updatefrags]		= &CL_UpdateFrags;
 	cmds[svc_moveplayer]		= &CL_UpdatePlayer;
+	cmds[svc_packedmoveplayer]	= &CL_UpdatePlayerPacked;
 	cmds[svc_updatelocalplayer]	= &CL_UpdateLocalPlayer;
 	cmds[svc_userinfo]			= &CL_SetupUserInfo;
 	cmds[svc_teampoints]		= &CL_TeamPoints;
@@ -3510,12 +3852,14 @@ void CL_InitCommands(void)
 	cmds[svc_updateping]		= &CL_UpdatePing;
 	cmds[svc_spawnmobj]			= &CL_SpawnMobj;
 	cmds[svc_mobjspeedangle]	= &CL_SetMobjSpeedAndAngle;
+	cmds[svc_packedmobjspeedangle]	= &CL_SetMobjSpeedAndAnglePacked;
 	cmds[svc_mobjinfo]			= &CL_UpdateMobjInfo;
 	cmds[svc_explodemissile]	= &CL_ExplodeMissile;
 	cmds[svc_removemobj]		= &CL_RemoveMobj;
 
 	cmds[svc_killmobj]			= &CL_KillMobj;
 	cmds[svc_movemobj]			= &CL_MoveMobj;
+	cmds[svc_packedmovemobj]	= &CL_MoveMobjPacked;
 	cmds[svc_damagemobj]		= &CL_DamageMobj;
 	cmds[svc_corpse]			= &CL_Corpse;
 	cmds[svc_spawnplayer]		= &CL_SpawnPlayer;
@@ -3550,7 +3894,9 @@ void CL_InitCommands(void)
 	cmds[svc_actor_movedir]		= &CL_Actor_Movedir;
 	cmds[svc_actor_target]		= &CL_Actor_Target;
 	cmds[svc_actor_tracer]		= &CL_Actor_Tracer;
+	cmds[svc_mobjdelta]			= &CL_MobjDelta;
 	cmds[svc_missedpacket]		= &CL_CheckMissedPacket;
+	cmds[svc_reliable]			= &CL_ReliableChunk;
 	cmds[svc_forceteam]			= &CL_ForceSetTeam;
 
 	cmds[svc_ctfevent]			= &CL_CTFEvent;
@@ -3562,6 +3908,8 @@ void CL_InitCommands(void)
 
 	cmds[svc_wadinfo]			= &CL_DownloadStart;
 	cmds[svc_wadchunk]			= &CL_Download;
+	cmds[svc_wadwindow]			= &CL_DownloadWindow;
+	cmds[svc_levelstats]		= &CL_LevelStats;
 
 	cmds[svc_challenge]			= &CL_Clear;
 	cmds[svc_launcher_challenge]= &CL_Clear;
@@ -3647,6 +3995,12 @@ void CL_SaveCmd(void)
 	netcmd->fromPlayer(&consoleplayer());
 	netcmd->setTic(gametic);
 	netcmd->setWorldIndex(world_index);
+
+	// other players are drawn between their world_index - 1 and world_index
+	// positions, so tell the server how far short of world_index they were
+	// when this tic's input was read
+	fixed_t behind = FRACUNIT - clamp(render_lerp_amount, 0, FRACUNIT);
+	netcmd->setLerpBehind(MIN(behind >> (FRACBITS - 8), 255));
 }
 
 extern int outrate;
@@ -433,6 +433,9 @@ public:
 	// [SL] changed to use a bitfield instead of a vector for O(1) lookups
 	PlayerBitField	players_aware;
 
+	// players whose interest set this is in, see sv_interest.cpp
+	PlayerBitField	players_interested;
+
 	AActorPtr		goal;			// Monster's goal if not chasing anything
 	translationref_t translation;	// Translation table (or NULL)
 	fixed_t			translucency;	// 65536=fully opaque, 0=fully invisible
@@ -51,6 +51,7 @@
 #include "m_argv.h"
 #include "m_fileio.h"
 #include "c_console.h"
+#include "c_dispatch.h"
 #include "i_system.h"
 #include "g_game.h"
 #include "p_setup.h"
@@ -61,6 +62,8 @@
 #include "s_sound.h"
 #include "gi.h"
 #include "w_ident.h"
+#include "i_net.h"
+#include "stats.h"
 
 #ifdef GEKKO
 #include "i_wii.h"
@@ -80,6 +83,10 @@ std::vector<std::string> missingfiles, missinghashes;
 bool lastWadRebootSuccess = true;
 extern bool step_mode;
 
+#ifdef SERVER_APP
+void SV_GetPackets();
+#endif
+
 bool capfps = true;
 float maxfps = 35.0f;
 
@@ -1087,6 +1094,35 @@ void STACK_ARGS D_ClearTaskSchedulers()
 	display_scheduler = NULL;
 }
 
+// how well D_RunTics sleeps, see the schedstats command
+static const size_t SCHED_SAMPLES = 4096;
+
+struct scheduler_stats_t
+{
+	QWORD	sleeps;
+	QWORD	wakeups;			// times the sleep loop came round
+	QWORD	packet_wakeups;		// of those, how many were for a packet
+	dtime_t	late_total;			// how far past the wake time we got up
+	dtime_t	late_max;
+	dtime_t	late[SCHED_SAMPLES];	// the last few sleeps' lateness
+
+	scheduler_stats_t() : sleeps(0), wakeups(0), packet_wakeups(0),
+		late_total(0), late_max(0) {}
+};
+
+static scheduler_stats_t sched_stats;
+
+//
+// D_RecordLateness
+//
+static void D_RecordLateness(dtime_t late)
+{
+	sched_stats.late[sched_stats.sleeps % SCHED_SAMPLES] = late;
+	sched_stats.sleeps++;
+	sched_stats.late_total += late;
+	sched_stats.late_max = MAX(sched_stats.late_max, late);
+}
+
 //
 // D_RunTics
 //
@@ -1097,7 +1133,8 @@ void STACK_ARGS D_ClearTaskSchedulers()
 // TICRATE times a second. If the framerate is uncapped, the simulation function
 // will still be called TICRATE times a second but the display function will
 // be called as often as possible. After each iteration through the loop,
-// the program yields briefly to the operating system.
+// the program sleeps until the next task is due. The server sleeps on its
+// socket so packets are read as soon as they arrive.
 //
 void D_RunTics(void (*sim_func)(), void(*display_func)())
 {
@@ -1122,11 +1159,79 @@ void D_RunTics(void (*sim_func)(), void(*display_func)())
 	// Sleep until the next scheduled task.
 	dtime_t simulation_wake_time = simulation_scheduler->getNextTime();
 	dtime_t display_wake_time = display_scheduler->getNextTime();
+	dtime_t wake_time = MIN(simulation_wake_time, display_wake_time);
+
+	dtime_t now = I_GetTime();
+	if (now >= wake_time)
+	{
+		I_Yield();
+		return;
+	}
 
+#ifdef SERVER_APP
+	// Block on the socket instead of polling it every millisecond and
+	// read whatever arrives straight away rather than at the next tic.
+	while (now < wake_time)
+	{
+		sched_stats.wakeups++;
+		if (NET_WaitForPacket(wake_time - now))
+		{
+			sched_stats.packet_wakeups++;
+
+			SCOPED_STAT(SV_GetPacketsBetweenTics);
+			SV_GetPackets();
+		}
+		now = I_GetTime();
+	}
+#else
 	do
 	{
+		sched_stats.wakeups++;
 		I_Yield();
-	} while (I_GetTime() < MIN(simulation_wake_time, display_wake_time));			
+		now = I_GetTime();
+	} while (now < wake_time);
+#endif
+
+	D_RecordLateness(now - wake_time);
+}
+
+//
+// D_PrintSchedulerStats
+//
+static void D_PrintSchedulerStats()
+{
+	size_t count = MIN(sched_stats.sleeps, (QWORD)SCHED_SAMPLES);
+	if (!count)
+	{
+		Printf(PRINT_HIGH, "No sleeps recorded yet\n");
+		return;
+	}
+
+	std::vector<dtime_t> late(sched_stats.late, sched_stats.late + count);
+	std::sort(late.begin(), late.end());
+
+	double sleeps = double(sched_stats.sleeps);
+	Printf(PRINT_HIGH, "%llu sleeps, %.2f wakeups each, %.2f of them for packets\n",
+		   (unsigned long long)sched_stats.sleeps, sched_stats.wakeups / sleeps,
+		   sched_stats.packet_wakeups / sleeps);
+	Printf(PRINT_HIGH, "woke late by %.3fms avg, %.3fms p50, %.3fms p99, %.3fms max\n",
+		   sched_stats.late_total / sleeps / 1e6,
+		   late[count / 2] / 1e6,
+		   late[count * 99 / 100] / 1e6,
+		   sched_stats.late_max / 1e6);
+}
+
+BEGIN_COMMAND (schedstats)
+{
+	if (argc > 1 && stricmp(argv[1], "reset") == 0)
+	{
+		sched_stats = scheduler_stats_t();
+		Printf(PRINT_HIGH, "Scheduler stats reset\n");
+		return;
+	}
+
+	D_PrintSchedulerStats();
 }
+END_COMMAND (schedstats)
 
 VERSION_CONTROL (d_main_cpp, "$Id$")
@@ -32,6 +32,7 @@ NetCommand::NetCommand()
 void NetCommand::clear()
 {
 	mFields = mTic = mWorldIndex = 0;
+	mLerpBehind = 0;
 	mButtons = mAngle = mPitch = mForwardMove = mSideMove = mUpMove = mImpulse = 0;
 	mDeltaYaw = mDeltaPitch = 0;
 }
@@ -88,7 +89,10 @@ void NetCommand::write(buf_t *buf)
 	// Let the recipient know which cmd fields are being sent
 	int serialized_fields = getSerializedFields();
 	buf->WriteByte(serialized_fields);
-	buf->WriteLong(mWorldIndex);
+
+	// Servers only look at the low byte of the world index, so the top one
+	// carries the lerp
+	buf->WriteLong((mWorldIndex & 0x00FFFFFF) | (mLerpBehind << 24));
 		
 	if (serialized_fields & CMD_BUTTONS)
 		buf->WriteByte(mButtons);
@@ -117,7 +121,10 @@ void NetCommand::read(buf_t *buf)
 {
 	clear();
 	mFields = buf->ReadByte();
-	mWorldIndex = buf->ReadLong();
+
+	int worldindex = buf->ReadLong();
+	mWorldIndex = worldindex & 0x00FFFFFF;
+	mLerpBehind = (worldindex >> 24) & 0xFF;
 	
 	if (hasButtons())
 		mButtons = buf->ReadByte();
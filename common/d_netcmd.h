@@ -59,6 +59,7 @@ public:
 	
 	int		getTic() const			{ return mTic; }
 	int		getWorldIndex() const	{ return mWorldIndex; }
+	byte	getLerpBehind() const	{ return mLerpBehind; }
 	byte	getButtons() const		{ return mButtons; }
 	fixed_t	getAngle() const 		{ return mAngle; }
 	fixed_t	getPitch() const		{ return mPitch; }
@@ -78,6 +79,13 @@ public:
 	{
 		mWorldIndex = val;
 	}
+
+	// how far short of the world index the client's screen was, in 1/256ths
+	// of a tic
+	void setLerpBehind(byte val)
+	{
+		mLerpBehind = val;
+	}
 	
 	void setButtons(byte val)
 	{
@@ -153,6 +161,7 @@ private:
 
 	int			mTic;
 	int			mWorldIndex;
+	byte		mLerpBehind;
 	int			mFields;
 	byte		mButtons;
 	fixed_t		mAngle;
@@ -268,15 +268,15 @@ public:
 		short		version;
 		short		majorversion;	// GhostlyDeath -- Major
 		short		minorversion;	// GhostlyDeath -- Minor
+		int			netcaps;		// optional protocol features, see net_capability_t
 
 		// for reliable protocol
 		buf_t       relpackets; // save reliable packets here
 		int         packetbegin[256]; // the beginning of a packet
 		int         packetsize[256]; // the size of a packet
-		int         packetseq[256];
+		int         packetseq[256];	// indexed by sequence & 0xff
 		int         sequence;
 		int         last_sequence;
-		byte        packetnum;
 
 		int         rate;
 		int         reliable_bps;	// bytes per second
@@ -292,14 +292,36 @@ public:
 
 		huffman_server	compressor;	// denis - adaptive huffman compression
 
+		// with NETCAP_LEVELSTATS, the monster counts the client was last sent
+		int			sent_total_monsters;
+		int			sent_killed_monsters;
+
 		class download_t
 		{
 		public:
 			std::string name;
 			unsigned int next_offset;
 
-			download_t() : name(""), next_offset(0) {}
-			download_t(const download_t& other) : name(other.name), next_offset(other.next_offset) {}
+			// with NETCAP_DOWNLOADACK, how much the client has acked and the
+			// gametic it last acked something new
+			bool windowed;
+			bool announce;			// svc_wadwindow needs sending
+			unsigned int acked_offset;
+			int acked_tic;
+
+			// the last clc_wantwad that rewound the download
+			unsigned int rewind_offset;
+			int rewind_tic;
+
+			int budget;				// bytes that can be sent now
+
+			download_t() : name(""), next_offset(0), windowed(false), announce(false),
+				acked_offset(0), acked_tic(0), rewind_offset(0), rewind_tic(0), budget(0) {}
+			download_t(const download_t& other) : name(other.name), next_offset(other.next_offset),
+				windowed(other.windowed), announce(other.announce),
+				acked_offset(other.acked_offset), acked_tic(other.acked_tic),
+				rewind_offset(other.rewind_offset), rewind_tic(other.rewind_tic),
+				budget(other.budget) {}
 		}download;
 
 		client_t()
@@ -309,6 +331,7 @@ public:
 			version = 0;
 			majorversion = 0;
 			minorversion = 0;
+			netcaps = 0;
 			for (size_t i = 0; i < 256; i++)
 			{
 				packetbegin[i] = 0;
@@ -317,7 +340,6 @@ public:
 			}
 			sequence = 0;
 			last_sequence = 0;
-			packetnum = 0;
 			rate = 0;
 			reliable_bps = 0;
 			unreliable_bps = 0;
@@ -333,6 +355,8 @@ public:
 			digest = "";
 			allow_rcon = false;
 			displaydisconnect = true;
+			sent_total_monsters = -1;
+			sent_killed_monsters = -1;
 		/*
 		huffman_server	compressor;	// denis - adaptive huffman compression*/
 		}
@@ -343,10 +367,10 @@ public:
 			version(other.version),
 			majorversion(other.majorversion),
 			minorversion(other.minorversion),
+			netcaps(other.netcaps),
 			relpackets(other.relpackets),
 			sequence(other.sequence),
 			last_sequence(other.last_sequence),
-			packetnum(other.packetnum),
 			rate(other.rate),
 			reliable_bps(other.reliable_bps),
 			unreliable_bps(other.unreliable_bps),
@@ -357,6 +381,8 @@ public:
 			allow_rcon(false),
 			displaydisconnect(true),
 			compressor(other.compressor),
+			sent_total_monsters(other.sent_total_monsters),
+			sent_killed_monsters(other.sent_killed_monsters),
 			download(other.download)
 		{
 				memcpy(packetbegin, other.packetbegin, sizeof(packetbegin));
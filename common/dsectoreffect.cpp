@@ -87,11 +87,13 @@ IMPLEMENT_SERIAL (DMover, DSectorEffect)
 
 DMover::DMover ()
 {
+	SetCategory(THINKER_MOVER);
 }
 
 DMover::DMover (sector_t *sector)
 	: DSectorEffect (sector)
 {
+	SetCategory(THINKER_MOVER);
 }
 
 void DMover::Serialize (FArchive &arc)
@@ -38,6 +38,9 @@ IMPLEMENT_SERIAL (DThinker, DObject)
 DThinker *DThinker::FirstThinker = NULL;
 DThinker *DThinker::LastThinker = NULL;
 
+DThinker *DThinker::FirstInCategory[NUMTHINKERCATEGORIES];
+DThinker *DThinker::LastInCategory[NUMTHINKERCATEGORIES];
+
 std::vector<DThinker *> LingerDestroy;
 
 void DThinker::Serialize (FArchive &arc)
@@ -111,6 +114,11 @@ DThinker::DThinker ()
 	LastThinker = this;
 	refCount = 0;
 	destroyed = false;
+
+	// and at the end of its category's list
+	m_CatNext = m_CatPrev = NULL;
+	m_Category = THINKER_OTHER;
+	SetCategory(THINKER_OTHER);
 }
 
 DThinker::~DThinker ()
@@ -124,9 +132,49 @@ void DThinker::Orphan()
 {
 	m_Next = NULL;
 	m_Prev = NULL;
+	m_CatNext = NULL;
+	m_CatPrev = NULL;
 	refCount = 0;
 }
 
+//
+// DThinker::UnlinkCategory
+//
+void DThinker::UnlinkCategory()
+{
+	if (FirstInCategory[m_Category] == this)
+		FirstInCategory[m_Category] = m_CatNext;
+	if (LastInCategory[m_Category] == this)
+		LastInCategory[m_Category] = m_CatPrev;
+	if (m_CatNext)
+		m_CatNext->m_CatPrev = m_CatPrev;
+	if (m_CatPrev)
+		m_CatPrev->m_CatNext = m_CatNext;
+
+	m_CatNext = m_CatPrev = NULL;
+}
+
+//
+// DThinker::SetCategory
+//
+// Moves the thinker to the end of another category's list.
+//
+void DThinker::SetCategory(thinker_category_t category)
+{
+	if (destroyed)
+		return;
+
+	UnlinkCategory();
+
+	m_Category = category;
+	m_CatPrev = LastInCategory[category];
+	if (LastInCategory[category])
+		LastInCategory[category]->m_CatNext = this;
+	if (!FirstInCategory[category])
+		FirstInCategory[category] = this;
+	LastInCategory[category] = this;
+}
+
 void DThinker::Destroy ()
 {
 	// denis - allow this function to be safely called multiple times
@@ -141,7 +189,9 @@ void DThinker::Destroy ()
 		m_Next->m_Prev = m_Prev;
 	if (m_Prev)
 		m_Prev->m_Next = m_Next;
-	
+
+	UnlinkCategory();
+
 	destroyed = true;
 		
 	if(refCount)
@@ -226,7 +276,9 @@ bool IndependentThinker(DThinker *thinker)
 	if (!multiplayer || demoplayback)
 		return false;
 
-	if (thinker->IsKindOf (RUNTIME_CLASS (AActor)))
+	switch (thinker->GetCategory())
+	{
+	case THINKER_PLAYER:
 	{
 		AActor *mobj = static_cast<AActor*>(thinker);
 		if (!mobj->player || mobj->player->spectator)
@@ -239,21 +291,17 @@ bool IndependentThinker(DThinker *thinker)
 		// Server ticks players as it processes their ticcmds
 		if (serverside)
 			return true;
+
+		return false;
 	}
-	
-	if (thinker->IsA(RUNTIME_CLASS (DPillar)) ||
-		thinker->IsA(RUNTIME_CLASS (DElevator)) ||
-		thinker->IsA(RUNTIME_CLASS (DFloor)) ||
-		thinker->IsA(RUNTIME_CLASS (DCeiling)) ||
-		thinker->IsA(RUNTIME_CLASS (DPlat)) ||
-		thinker->IsA(RUNTIME_CLASS (DDoor)))
-	{
+
+	case THINKER_MOVER:
 		// Client ticks movable sectors in prediction code
-		if (clientside)
-			return true;
-	}
+		return clientside;
 
-	return false;
+	default:
+		return false;
+	}
 }
 
 
@@ -261,7 +309,7 @@ void DThinker::RunThinkers ()
 {
 	DThinker *currentthinker;
 
-	BEGIN_STAT (ThinkCycles);
+	SCOPED_STAT (ThinkCycles);
 	currentthinker = FirstThinker;
 	while (currentthinker)
 	{
@@ -269,7 +317,6 @@ void DThinker::RunThinkers ()
 			currentthinker->RunThink();
 		currentthinker = currentthinker->m_Next;
 	}
-	END_STAT (ThinkCycles);
 }
 
 void *DThinker::operator new (size_t size)
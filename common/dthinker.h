@@ -52,6 +52,22 @@ typedef actionf_t  think_t;
 
 class FThinkerIterator;
 
+// Besides the list of every thinker, each thinker is on the list of its
+// category, so that code interested in one kind doesn't have to walk them
+// all.  An actor's category follows from its type, so it doesn't change
+// with its flags: an exploded missile stays on the missile list until it
+// is removed.
+enum thinker_category_t
+{
+	THINKER_OTHER,
+	THINKER_PLAYER,		// player actors, corpses included
+	THINKER_MONSTER,	// actors that count as kills, and lost souls
+	THINKER_MISSILE,
+	THINKER_MOVER,		// moving floors, ceilings, doors and the like
+
+	NUMTHINKERCATEGORIES
+};
+
 // Doubly linked list of thinkers
 class DThinker : public DObject
 {
@@ -70,6 +86,13 @@ public:
 	// Both the head and tail of the thinker list.
 	static DThinker *FirstThinker;
 	static DThinker *LastThinker;
+
+	// ... and of each category's list
+	static DThinker *FirstInCategory[NUMTHINKERCATEGORIES];
+	static DThinker *LastInCategory[NUMTHINKERCATEGORIES];
+
+	thinker_category_t GetCategory() const { return m_Category; }
+	void SetCategory(thinker_category_t category);
 	static void RunThinkers ();
 	static void DestroyAllThinkers ();
 	static void DestroyMostThinkers ();
@@ -81,8 +104,12 @@ public:
 
 private:
 	DThinker *m_Next, *m_Prev;
+	DThinker *m_CatNext, *m_CatPrev;
+	thinker_category_t m_Category;
 	bool destroyed;
 
+	void UnlinkCategory();
+
 	friend class FThinkerIterator;
 };
 
@@ -91,26 +118,38 @@ class FThinkerIterator
 private:
 	TypeInfo *m_ParentType;
 	DThinker *m_CurrThinker;
+	int m_Category;		// -1 to walk every thinker
+
+	DThinker *First () const
+	{
+		return m_Category < 0 ? DThinker::FirstThinker
+		                      : DThinker::FirstInCategory[m_Category];
+	}
 
 public:
 	FThinkerIterator (TypeInfo *type)
 	{
 		m_ParentType = type;
-		m_CurrThinker = DThinker::FirstThinker;
+		m_Category = -1;
+		m_CurrThinker = First ();
+	}
+	FThinkerIterator (TypeInfo *type, thinker_category_t category)
+	{
+		m_ParentType = type;
+		m_Category = category;
+		m_CurrThinker = First ();
 	}
 	DThinker *Next ()
 	{
 		while (m_CurrThinker)
 		{
-			if (m_CurrThinker->IsKindOf (m_ParentType))
-			{
-				DThinker *res = m_CurrThinker;
-				m_CurrThinker = m_CurrThinker->m_Next;
+			DThinker *res = m_CurrThinker;
+			m_CurrThinker = m_Category < 0 ? res->m_Next : res->m_CatNext;
+
+			if (res->IsKindOf (m_ParentType))
 				return res;
-			}
-			m_CurrThinker = m_CurrThinker->m_Next;
 		}
-		m_CurrThinker = DThinker::FirstThinker;
+		m_CurrThinker = First ();
 		return NULL;
 	}
 };
@@ -121,6 +160,9 @@ public:
 	TThinkerIterator () : FThinkerIterator (RUNTIME_CLASS(T))
 	{
 	}
+	TThinkerIterator (thinker_category_t category) : FThinkerIterator (RUNTIME_CLASS(T), category)
+	{
+	}
 	T *Next ()
 	{
 		return static_cast<T *>(FThinkerIterator::Next ());
@@ -26,6 +26,7 @@
 
 #include <cstddef>
 #include <cassert>
+#include <iterator>
 #include <utility>
 #include <string>
 
@@ -216,7 +217,7 @@ public:
 	typedef generic_iterator<const HashPairType, const HashTableType> const_iterator;
 
 	template <typename IVT, typename IHTT>
-	class generic_iterator : public std::iterator<std::forward_iterator_tag, OHashTable>
+	class generic_iterator
 	{
 	private:
 		// typedef for easier-to-read code
@@ -224,6 +225,13 @@ public:
 		typedef generic_iterator<const IVT, const IHTT> ConstThisClass;
 
 	public:
+		// what deriving from std::iterator gave, which C++17 deprecates
+		typedef std::forward_iterator_tag	iterator_category;
+		typedef IVT							value_type;
+		typedef std::ptrdiff_t				difference_type;
+		typedef IVT*						pointer;
+		typedef IVT&						reference;
+
 		generic_iterator() :
 			mBucketNum(IHTT::NOT_FOUND), mHashTable(NULL)
 		{ }
@@ -205,13 +205,14 @@ void huffman::_Huffman_Hist( unsigned char *in, huff_sym_t *sym, unsigned int si
 
   total_count += size;
 
-  // Tax all entries to prevent overflow
+  // Tax all entries to prevent overflow, but never down to zero: a symbol
+  // without a code could not be encoded any more
   while(total_count > 65000)
   {
 	  for(int i = 0; i < 256; i++)
 	  {
 		  total_count -= sym[i].Count;
-		  sym[i].Count /= 2;
+		  sym[i].Count = (sym[i].Count + 1) / 2;
 		  total_count += sym[i].Count;
 	  }
   }
@@ -551,6 +552,7 @@ bool huffman_server::packet_sent(unsigned int id, unsigned char *in_data, size_t
 	tmpcodec.extend(in_data, len);
 
 	awaiting_ack = true;
+	missed_acks = 0;
 
 	return true;
 }
@@ -583,38 +585,57 @@ void huffman_server::packet_acked(unsigned int id)
 // Huffman Client
 //
 
-void huffman_client::ack_sent(unsigned char *in_data, size_t len)
+//
+// The server marks the packet it extends its next codec with, this is
+// called for it once it has been decompressed.  If the server gave up
+// waiting for the ack of an earlier one, it started over from the codec
+// in use, and so does the client.
+//
+void huffman_client::ack_sent(unsigned int id, unsigned char *in_data, size_t len)
 {
-	// update the codec only one ack at a time
-	if(awaiting_ackack)
+	// arrived after a newer one
+	if(awaiting_ackack && (int)(id - recorded_id) <= 0)
 		return;
 	
 	tmpcodec = active_codec ? alpha : beta;
 	tmpcodec.extend(in_data, len);
 
+	recorded_id = id;
 	awaiting_ackack = true;
 }
 
-huffman &huffman_client::codec_for_received(unsigned char id)
+//
+// Returns the codec packet 'id' was compressed with, or NULL if it was
+// overwritten since (a packet delayed past two codec changes).
+//
+huffman *huffman_client::codec_for_received(unsigned int id, unsigned char codec)
 {
-	// if got a shiny new packet with a different codec
-	// and was expecting there to be one
-	if(awaiting_ackack && (id ? 1 : 0) != active_codec)
+	codec = codec ? 1 : 0;
+
+	// the server only switches codecs after the recorded packet was acked,
+	// a late packet from before it doesn't mean anything
+	if(awaiting_ackack && codec != active_codec && (int)(id - recorded_id) > 0)
 	{
 		// swap the codecs
 		active_codec = !active_codec;
 		huffman &update = active_codec ? alpha : beta;
 		update = tmpcodec;
+		codec_since[codec] = recorded_id + 1;
 		awaiting_ackack = false;
 	}
+
+	if((int)(id - codec_since[codec]) < 0)
+		return NULL;
 	
-	return id ? alpha : beta;
+	return codec ? &alpha : &beta;
 }
 
 void huffman_client::reset()
 {
 	active_codec = 0;
 	awaiting_ackack = false;
+	recorded_id = 0;
+	codec_since[0] = codec_since[1] = 0;
 	alpha.reset();
 	beta.reset();
 }
@@ -109,9 +109,22 @@ public:
 	{
 		memcpy(sym, other.sym, sizeof(sym));
 	} 
+
+	// ... and so does assigning, the tree would point into the other codec
+	huffman &operator =(const huffman &other)
+	{
+		if (this != &other)
+		{
+			total_count = other.total_count;
+			fresh_histogram = true;
+			memcpy(sym, other.sym, sizeof(sym));
+		}
+		return *this;
+	}
 };
 
-#define HUFFMAN_RENEGOTIATE_DELAY	256
+// acks of other packets after which the recorded one is given up on
+#define HUFFMAN_RENEGOTIATE_DELAY	64
 
 class huffman_server
 {
@@ -154,12 +167,15 @@ class huffman_client
 
 	bool awaiting_ackack;
 
+	unsigned int recorded_id;	// packet tmpcodec was extended with
+	unsigned int codec_since[2];	// first packet each codec was used for
+
 public:
 
 	void reset();
 
-	void ack_sent(unsigned char *in_data, size_t len);
-	huffman &codec_for_received(unsigned char id);
+	void ack_sent(unsigned int id, unsigned char *in_data, size_t len);
+	huffman *codec_for_received(unsigned int id, unsigned char codec);
 
 	huffman_client() { reset(); }
 	huffman_client(const huffman_client &other) :
@@ -167,8 +183,12 @@ public:
 		beta(other.beta),
 		tmpcodec(other.tmpcodec),
 		active_codec(other.active_codec),
-		awaiting_ackack(other.awaiting_ackack)
-	{}
+		awaiting_ackack(other.awaiting_ackack),
+		recorded_id(other.recorded_id)
+	{
+		codec_since[0] = other.codec_since[0];
+		codec_since[1] = other.codec_since[1];
+	}
 };
 
 #endif
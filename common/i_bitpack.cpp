@@ -0,0 +1,209 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Bit-level message writer and reader, see BitWriter in i_net.h.
+//
+//-----------------------------------------------------------------------------
+
+#include "doomtype.h"
+#include "i_net.h"
+#include "version.h"
+
+//
+// BitWriter::WriteBits
+//
+// Writes the low 'bits' bits of value (at most 32).
+//
+void BitWriter::WriteBits(DWORD value, int bits)
+{
+	while (bits > 0)
+	{
+		int n = bits < 8 - count ? bits : 8 - count;
+		DWORD chunk = (value >> (bits - n)) & ((1u << n) - 1);
+
+		current = (current << n) | chunk;
+		count += n;
+		bits -= n;
+
+		if (count == 8)
+		{
+			buf->WriteByte((byte)current);
+			current = 0;
+			count = 0;
+		}
+	}
+}
+
+//
+// BitWriter::WriteVarint
+//
+// Seven bits at a time, lowest first, each group followed by a bit that
+// says whether another one follows.
+//
+void BitWriter::WriteVarint(DWORD value)
+{
+	do
+	{
+		WriteBits(value & 0x7F, 7);
+		value >>= 7;
+		WriteBit(value != 0);
+	} while (value);
+}
+
+//
+// BitWriter::WriteSignedVarint
+//
+// Zig-zag encoded so small negative numbers stay small.
+//
+void BitWriter::WriteSignedVarint(int value)
+{
+	WriteVarint(((DWORD)value << 1) ^ (DWORD)(value >> 31));
+}
+
+//
+// QuantizeFixed
+//
+// Rounds a 16.16 fixed point value to 'fracbits' fractional bits.
+//
+static int QuantizeFixed(int value, int fracbits)
+{
+	int shift = 16 - fracbits;
+	if (shift <= 0)
+		return value;
+
+	// round to nearest without overflowing past the largest value
+	SQWORD rounded = (SQWORD)value + (1 << (shift - 1));
+	if (rounded > 0x7FFFFFFF)
+		return 0x7FFFFFFF >> shift;
+
+	return (int)(rounded >> shift);
+}
+
+//
+// BitWriter::WriteFixed
+//
+// A 16.16 fixed point value with 'fracbits' fractional bits kept, in
+// 16 + fracbits bits.  Suits map coordinates, which use the whole
+// integer range.
+//
+void BitWriter::WriteFixed(int value, int fracbits)
+{
+	WriteBits(QuantizeFixed(value, fracbits), 16 + fracbits);
+}
+
+//
+// BitWriter::WriteFixedVarint
+//
+// A 16.16 fixed point value with 'fracbits' fractional bits kept, as a
+// signed varint.  Suits momentum, which is usually small.
+//
+void BitWriter::WriteFixedVarint(int value, int fracbits)
+{
+	WriteSignedVarint(QuantizeFixed(value, fracbits));
+}
+
+//
+// BitWriter::Flush
+//
+void BitWriter::Flush()
+{
+	if (count)
+		WriteBits(0, 8 - count);
+}
+
+//
+// BitReader::ReadBits
+//
+DWORD BitReader::ReadBits(int bits)
+{
+	DWORD value = 0;
+
+	while (bits > 0)
+	{
+		if (!count)
+		{
+			int b = buf->ReadByte();
+			if (b < 0)
+				return 0;
+
+			current = b;
+			count = 8;
+		}
+
+		int n = bits < count ? bits : count;
+		DWORD chunk = (current >> (count - n)) & ((1u << n) - 1);
+
+		value = (value << n) | chunk;
+		count -= n;
+		bits -= n;
+	}
+
+	return value;
+}
+
+//
+// BitReader::ReadVarint
+//
+DWORD BitReader::ReadVarint()
+{
+	DWORD value = 0;
+
+	for (int shift = 0; shift < 32; shift += 7)
+	{
+		value |= ReadBits(7) << shift;
+		if (!ReadBit())
+			break;
+	}
+
+	return value;
+}
+
+//
+// BitReader::ReadSignedVarint
+//
+int BitReader::ReadSignedVarint()
+{
+	DWORD value = ReadVarint();
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+//
+// BitReader::ReadFixed
+//
+int BitReader::ReadFixed(int fracbits)
+{
+	int bits = 16 + fracbits;
+	DWORD value = ReadBits(bits);
+
+	// sign extend
+	if (bits < 32 && (value & (1u << (bits - 1))))
+		value |= ~0u << bits;
+
+	return fracbits < 16 ? (int)value << (16 - fracbits) : (int)value;
+}
+
+//
+// BitReader::ReadFixedVarint
+//
+int BitReader::ReadFixedVarint(int fracbits)
+{
+	int value = ReadSignedVarint();
+	return fracbits < 16 ? value << (16 - fracbits) : value;
+}
+
+VERSION_CONTROL (i_bitpack_cpp, "$Id$")
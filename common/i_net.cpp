@@ -51,8 +51,10 @@
 #	include <arpa/inet.h>
 #	include <netdb.h>
 #	include <sys/ioctl.h>
+#	include <poll.h>
 #endif // GEKKO
 #	include <sys/types.h>
+#	include <sys/uio.h>
 #	include <errno.h>
 #	include <unistd.h>
 #	include <sys/time.h>
@@ -102,6 +104,13 @@ typedef int SOCKET;
 
 #include "m_memio.h"	// for STACKARRAY_LENGTH
 
+// sendmmsg() and recvmmsg() let us move every datagram of a tic across the
+// kernel boundary with a single syscall.  They're only available on Linux.
+#if defined(__linux__) && !defined(GEKKO)
+#define ODA_HAVE_SENDMMSG
+#define ODA_HAVE_RECVMMSG
+#endif
+
 unsigned int	inet_socket;
 int         	localport;
 netadr_t    	net_from;   // address of who sent the packet
@@ -443,15 +452,161 @@ bool NET_CompareAdr (netadr_t a, netadr_t b)
 typedef int socklen_t;
 #endif
 
+//
+// Batched receiving
+//
+// NET_GetPacket can pull up to recv_batch_size datagrams out of the socket
+// with one recvmmsg call.  They are kept in a preallocated arena and handed
+// out one at a time by swapping the arena slot with net_message's buffer,
+// so the rest of the engine keeps parsing net_message/net_from as before.
+//
+#define NET_RECV_ARENA_SIZE	64
+
+static net_stats_t			net_stats;
+
+#ifdef ODA_HAVE_RECVMMSG
+struct received_packet_t
+{
+	struct sockaddr_in	from;
+	size_t				size;
+	byte				*data;	// MAX_UDP_PACKET bytes, allocated with new[]
+};
+
+static received_packet_t	*recv_arena = NULL;
+static size_t				recv_arena_count = 0;	// datagrams in the arena
+static size_t				recv_arena_next = 0;	// next one to hand out
+#endif
+
+static size_t				recv_batch_size = 0;
+
+//
+// NET_SetReceiveBatch
+//
+// Sets how many datagrams are read per syscall.  0 or 1 reads them one at
+// a time with recvfrom.
+//
+void NET_SetReceiveBatch(size_t count)
+{
+	if (count > NET_RECV_ARENA_SIZE)
+		count = NET_RECV_ARENA_SIZE;
+
+#ifdef ODA_HAVE_RECVMMSG
+	if (count > 1 && !recv_arena)
+	{
+		recv_arena = new received_packet_t[NET_RECV_ARENA_SIZE];
+		for (size_t i = 0; i < NET_RECV_ARENA_SIZE; i++)
+		{
+			recv_arena[i].size = 0;
+			recv_arena[i].data = new byte[MAX_UDP_PACKET];
+		}
+	}
+#endif
+
+	recv_batch_size = count;
+}
+
+#ifdef ODA_HAVE_RECVMMSG
+//
+// NET_FillReceiveArena
+//
+// Reads as many datagrams as are waiting, up to recv_batch_size.  Returns
+// false if nothing could be read.
+//
+static bool NET_FillReceiveArena()
+{
+	struct mmsghdr msgs[NET_RECV_ARENA_SIZE];
+	struct iovec iovs[NET_RECV_ARENA_SIZE];
+
+	for (size_t i = 0; i < recv_batch_size; i++)
+	{
+		iovs[i].iov_base = recv_arena[i].data;
+		iovs[i].iov_len = MAX_UDP_PACKET;
+
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &recv_arena[i].from;
+		msgs[i].msg_hdr.msg_namelen = sizeof(recv_arena[i].from);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int ret = recvmmsg(inet_socket, msgs, recv_batch_size, MSG_DONTWAIT, NULL);
+	net_stats.recv_syscalls++;
+
+	if (ret == -1)
+	{
+		if (errno != EWOULDBLOCK && errno != ECONNREFUSED && errno != EINTR)
+			Printf(PRINT_HIGH, "NET_GetPacket: %s\n", strerror(errno));
+		return false;
+	}
+
+	for (int i = 0; i < ret; i++)
+	{
+		// truncated datagrams are oversize, drop them like recvfrom would
+		if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			recv_arena[i].size = 0;
+		else
+			recv_arena[i].size = msgs[i].msg_len;
+	}
+
+	recv_arena_count = ret;
+	recv_arena_next = 0;
+	net_stats.recv_datagrams += ret;
+
+	return ret > 0;
+}
+
+//
+// NET_GetBatchedPacket
+//
+static int NET_GetBatchedPacket()
+{
+	while (true)
+	{
+		if (recv_arena_next >= recv_arena_count && !NET_FillReceiveArena())
+			return 0;
+
+		received_packet_t *pkt = &recv_arena[recv_arena_next++];
+
+		if (pkt->size == 0)
+			continue;
+
+		net_message.clear();
+
+		// swap buffers rather than copying the datagram
+		if (net_message.maxsize() == MAX_UDP_PACKET)
+		{
+			byte *tmp = net_message.data;
+			net_message.data = pkt->data;
+			pkt->data = tmp;
+		}
+		else
+		{
+			memcpy(net_message.ptr(), pkt->data, MIN(pkt->size, net_message.maxsize()));
+		}
+
+		net_message.setcursize(pkt->size);
+		SockadrToNetadr(&pkt->from, &net_from);
+
+		return pkt->size;
+	}
+}
+#endif
+
 int NET_GetPacket (void)
 {
     int                  ret;
     struct sockaddr_in   from;
     socklen_t            fromlen;
 
+#ifdef ODA_HAVE_RECVMMSG
+	if (recv_batch_size > 1 || recv_arena_next < recv_arena_count)
+		return NET_GetBatchedPacket();
+#endif
+
     fromlen = sizeof(from);
 	net_message.clear();
     ret = recvfrom (inet_socket, (char *)net_message.ptr(), net_message.maxsize(), 0, (struct sockaddr *)&from, &fromlen);
+	net_stats.recv_syscalls++;
 
     if (ret == -1)
     {
@@ -485,10 +640,161 @@ int NET_GetPacket (void)
     }
     net_message.setcursize(ret);
     SockadrToNetadr (&from, &net_from);
+	net_stats.recv_datagrams++;
 
     return ret;
 }
 
+//
+// Batched sending
+//
+// While a send batch is open, outgoing datagrams are copied into a ring of
+// preallocated slots instead of being handed to sendto() one at a time.
+// NET_EndSendBatch flushes the ring with as few syscalls as the platform
+// allows.
+//
+#define NET_SEND_RING_SIZE	64
+
+struct queued_packet_t
+{
+	struct sockaddr_in	addr;
+	size_t				size;
+	byte				data[MAX_UDP_PACKET];
+};
+
+static queued_packet_t	*send_ring = NULL;
+static size_t			send_ring_count = 0;
+static int				send_batch_depth = 0;
+
+static void NET_FlushSendRing()
+{
+	if (send_ring_count == 0)
+		return;
+
+	size_t sent = 0;
+
+#ifdef ODA_HAVE_SENDMMSG
+	struct mmsghdr msgs[NET_SEND_RING_SIZE];
+	struct iovec iovs[NET_SEND_RING_SIZE];
+
+	for (size_t i = 0; i < send_ring_count; i++)
+	{
+		iovs[i].iov_base = send_ring[i].data;
+		iovs[i].iov_len = send_ring[i].size;
+
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &send_ring[i].addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(send_ring[i].addr);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < send_ring_count)
+	{
+		int ret = sendmmsg(inet_socket, msgs + sent, send_ring_count - sent, 0);
+		net_stats.send_syscalls++;
+
+		if (ret == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			// wouldblock is silent, the rest of the batch is dropped just
+			// like it would be with individual sendto calls
+			if (errno == EWOULDBLOCK || errno == ECONNREFUSED)
+				break;
+
+			Printf(PRINT_HIGH, "NET_FlushSendRing: %s\n", strerror(errno));
+
+			// skip the offending datagram and try the remainder
+			sent++;
+			continue;
+		}
+
+		sent += ret;
+		net_stats.send_datagrams += ret;
+	}
+#else
+	for (; sent < send_ring_count; sent++)
+	{
+		queued_packet_t *pkt = &send_ring[sent];
+
+		int ret = sendto(inet_socket, (const char *)pkt->data, pkt->size, 0,
+						 (struct sockaddr *)&pkt->addr, sizeof(pkt->addr));
+		net_stats.send_syscalls++;
+
+		if (ret != -1)
+			net_stats.send_datagrams++;
+	}
+#endif
+
+	send_ring_count = 0;
+}
+
+//
+// NET_BeginSendBatch
+//
+// Start queueing outgoing datagrams.  Batches may be nested, only the
+// outermost NET_EndSendBatch flushes the queue.
+//
+void NET_BeginSendBatch()
+{
+	if (!send_ring)
+		send_ring = new queued_packet_t[NET_SEND_RING_SIZE];
+
+	send_batch_depth++;
+}
+
+//
+// NET_EndSendBatch
+//
+void NET_EndSendBatch()
+{
+	if (send_batch_depth <= 0)
+		return;
+
+	if (--send_batch_depth == 0)
+		NET_FlushSendRing();
+}
+
+//
+// NET_QueueSegments
+//
+// Gathers a datagram into the send ring, flushing first if the ring is
+// full.
+//
+static int NET_QueueSegments(const net_segment_t *segs, size_t count, netadr_t &to)
+{
+	if (send_ring_count >= NET_SEND_RING_SIZE)
+		NET_FlushSendRing();
+
+	queued_packet_t *pkt = &send_ring[send_ring_count++];
+	NetadrToSockadr(&to, &pkt->addr);
+
+	pkt->size = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t len = MIN(segs[i].size, MAX_UDP_PACKET - pkt->size);
+		memcpy(pkt->data + pkt->size, segs[i].data, len);
+		pkt->size += len;
+	}
+
+	net_stats.send_queued++;
+	net_stats.send_copied += pkt->size;
+
+	return pkt->size;
+}
+
+//
+// NET_GetStats
+//
+// Returns the running totals of datagrams and syscalls in both directions.
+//
+const net_stats_t &NET_GetStats()
+{
+	return net_stats;
+}
+
 int NET_SendPacket (buf_t &buf, netadr_t &to)
 {
     int                   ret;
@@ -502,10 +808,22 @@ int NET_SendPacket (buf_t &buf, netadr_t &to)
 		return 0;
 	}
 
+	if (send_batch_depth > 0)
+	{
+		net_segment_t seg = { buf.ptr(), buf.size() };
+		ret = NET_QueueSegments(&seg, 1, to);
+		buf.clear();
+		return ret;
+	}
+
     NetadrToSockadr (&to, &addr);
 
 	ret = sendto (inet_socket, (const char *)buf.ptr(), buf.size(), 0, (struct sockaddr *)&addr, sizeof(addr));
 
+	net_stats.send_syscalls++;
+	if (ret != -1)
+		net_stats.send_datagrams++;
+
 	buf.clear();
 
     if (ret == -1)
@@ -528,6 +846,81 @@ int NET_SendPacket (buf_t &buf, netadr_t &to)
 	return ret;
 }
 
+//
+// NET_SendSegments
+//
+// Sends one datagram made up of several non-contiguous pieces.  Where the
+// platform supports it the pieces go straight to the kernel with sendmsg,
+// otherwise they are gathered into a single buffer first.
+//
+int NET_SendSegments(const net_segment_t *segs, size_t count, netadr_t &to)
+{
+	int ret;
+	struct sockaddr_in addr;
+
+	if (simulated_connection)
+		return 0;
+
+	if (send_batch_depth > 0)
+		return NET_QueueSegments(segs, count, to);
+
+	NetadrToSockadr(&to, &addr);
+
+#if !defined(_WIN32) && !defined(GEKKO)
+	struct iovec iovs[NET_MAX_SEGMENTS];
+	struct msghdr msg;
+
+	if (count > NET_MAX_SEGMENTS)
+		count = NET_MAX_SEGMENTS;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		iovs[i].iov_base = (void *)segs[i].data;
+		iovs[i].iov_len = segs[i].size;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = iovs;
+	msg.msg_iovlen = count;
+
+	ret = sendmsg(inet_socket, &msg, 0);
+#else
+	static byte gather[MAX_UDP_PACKET];
+	size_t size = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t len = MIN(segs[i].size, MAX_UDP_PACKET - size);
+		memcpy(gather + size, segs[i].data, len);
+		size += len;
+	}
+
+	net_stats.send_copied += size;
+
+	ret = sendto(inet_socket, (const char *)gather, size, 0, (struct sockaddr *)&addr, sizeof(addr));
+#endif
+
+	net_stats.send_syscalls++;
+
+	if (ret == -1)
+	{
+#ifdef _WIN32
+		if (WSAGetLastError() == WSAEWOULDBLOCK)
+			return 0;
+#else
+		if (errno == EWOULDBLOCK || errno == ECONNREFUSED)
+			return 0;
+		Printf(PRINT_HIGH, "NET_SendSegments: %s\n", strerror(errno));
+#endif
+		return ret;
+	}
+
+	net_stats.send_datagrams++;
+	return ret;
+}
+
 
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX 256
@@ -589,12 +982,16 @@ void SZ_Write (buf_t *b, const byte *data, int startpos, int length)
 // [SL] 2011-07-17 - Moved back to i_net.cpp so that it can be used by
 // both client & server code.  Client has a stub function for SV_SendPackets.
 //
+// SV_UnsentSize leaves out what the bandwidth scheduler held back in a
+// client's netbuf, which won't go out any sooner for sending again.
+//
 void SV_SendPackets(void);
+size_t SV_UnsentSize(const buf_t *b);
 
 void MSG_WriteMarker (buf_t *b, svc_t c)
 {
     //[Spleen] final check to prevent huge packets from being sent to players
-    if (b->cursize > 600)
+    if (b->cursize > 600 && SV_UnsentSize(b) > 600)
         SV_SendPackets();
 
 	b->WriteByte((byte)c);
@@ -815,6 +1212,39 @@ bool MSG_CompressMinilzo (buf_t &buf, size_t start_offset, size_t write_gap)
 	return true;
 }
 
+//
+// MSG_CompressMinilzo
+//
+// Compresses a contiguous block into a caller-supplied buffer, which must be
+// at least MSG_CompressBound(inlen) bytes.  Returns false if compression
+// failed or wasn't worth the effort.  Without 'workmem' (at least
+// MSG_MinilzoWorkmemSize() bytes) a shared one is used.
+//
+bool MSG_CompressMinilzo (const byte *in, size_t inlen, byte *out, size_t &outlen,
+                          void *workmem)
+{
+	if (inlen < MINILZO_COMPRESS_MINPACKETSIZE)
+		return false;
+
+	lzo_uint len = OUT_LEN(inlen);
+
+	int r = lzo1x_1_compress (in, inlen, out, &len, workmem ? workmem : wrkmem);
+
+	if (r != LZO_E_OK || len >= inlen)
+		return false;
+
+	outlen = len;
+	return true;
+}
+
+//
+// MSG_MinilzoWorkmemSize
+//
+size_t MSG_MinilzoWorkmemSize()
+{
+	return LZO1X_1_MEM_COMPRESS;
+}
+
 //
 // MSG_DecompressAdaptive
 //
@@ -954,7 +1384,9 @@ void InitNetMessageFormats()
       MSG(clc_launcher_challenge, "x"),
       MSG(clc_challenge,          "x"),
       MSG(clc_spy,                "x"),
-      MSG(clc_privmsg,            "x")
+      MSG(clc_privmsg,            "x"),
+      MSG(clc_ackbits,            "NN"),
+      MSG(clc_wadack,             "N")
    };
 
    msg_info_t svc_messages[] = {
@@ -1018,6 +1450,13 @@ void InitNetMessageFormats()
 	MSG(svc_damagemobj,         "x"),
 	MSG(svc_wadinfo,            "x"),
 	MSG(svc_wadchunk,           "x"),
+	MSG(svc_mobjdelta,          "x"),
+	MSG(svc_packedmoveplayer,   "x"),
+	MSG(svc_packedmovemobj,     "x"),
+	MSG(svc_packedmobjspeedangle, "x"),
+	MSG(svc_reliable,           "x"),
+	MSG(svc_wadwindow,          "N"),
+	MSG(svc_levelstats,         "x"),
 	MSG(svc_compressed,         "x"),
 	MSG(svc_launcher_challenge, "x"),
 	MSG(svc_challenge,          "x"),
@@ -1104,6 +1543,97 @@ bool NetWaitOrTimeout(size_t ms)
 	return false;
 }
 
+//
+// NET_WaitFailed
+//
+// Reports poll or select failing at most once a second, with how many times
+// it failed since, and sleeps for the rest of the wait or a millisecond so a
+// persistent error doesn't spin the caller's loop.
+//
+static void NET_WaitFailed(const char *call, const char *error, dtime_t timeout)
+{
+	static dtime_t last_report = 0;
+	static int failures = 0;
+
+	dtime_t now = I_GetTime();
+	failures++;
+
+	if (last_report == 0 || now - last_report >= I_ConvertTimeFromMs(1000))
+	{
+		if (failures > 1)
+			Printf(PRINT_HIGH, "%s failed: %s (%d times since the last report)\n",
+				   call, error, failures);
+		else
+			Printf(PRINT_HIGH, "%s failed: %s\n", call, error);
+
+		last_report = now;
+		failures = 0;
+	}
+
+	I_Sleep(MIN(timeout, I_ConvertTimeFromMs(1)));
+}
+
+//
+// NET_WaitForPacket
+//
+// Blocks until a datagram arrives or 'timeout' nanoseconds pass, whichever
+// comes first.  Returns true if there's something for NET_GetPacket.
+//
+bool NET_WaitForPacket(dtime_t timeout)
+{
+#ifdef ODA_HAVE_RECVMMSG
+	if (recv_arena_next < recv_arena_count)
+		return true;
+#endif
+
+#if defined(UNIX) && !defined(GEKKO)
+	struct pollfd pfd;
+	pfd.fd = inet_socket;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+#ifdef __linux__
+	struct timespec ts;
+	ts.tv_sec = time_t(timeout / 1000000000LL);
+	ts.tv_nsec = long(timeout % 1000000000LL);
+	int ret = ppoll(&pfd, 1, &ts, NULL);
+#else
+	// round up so we don't wake a little early and spin on a zero timeout
+	int ms = int((timeout + 999999LL) / 1000000LL);
+	int ret = poll(&pfd, 1, ms);
+#endif
+
+	if (ret == -1 && errno != EINTR)
+		NET_WaitFailed("poll", strerror(errno), timeout);
+
+	return ret > 0 && (pfd.revents & POLLIN);
+#else
+	struct timeval tv;
+	tv.tv_sec = long(timeout / 1000000000LL);
+	tv.tv_usec = long((timeout % 1000000000LL + 999LL) / 1000LL);
+
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(inet_socket, &fds);
+
+	int ret = select(inet_socket + 1, &fds, NULL, NULL, &tv);
+
+	#ifdef _WIN32
+	if (ret == SOCKET_ERROR)
+	{
+		char error[16];
+		snprintf(error, sizeof(error), "%d", WSAGetLastError());
+		NET_WaitFailed("select", error, timeout);
+	}
+	#else
+	if (ret == -1 && errno != EINTR)
+		NET_WaitFailed("select", strerror(errno), timeout);
+	#endif
+
+	return ret > 0;
+#endif
+}
+
 void I_SetPort(netadr_t &addr, int port)
 {
    addr.port = htons(port);
@@ -134,6 +134,23 @@ enum svc_t
 	// for downloading
 	svc_wadinfo,			// denis - [ulong:filesize]
 	svc_wadchunk,			// denis - [ulong:offset], [ushort:len], [byte[]:data]
+
+	// for delta-compressed actor updates
+	svc_mobjdelta,			// [short:netid] [short:fields] [changed fields...]
+
+	// bit-packed versions of the busiest messages, see BitWriter
+	svc_packedmoveplayer,	// [byte:id] [varint:tic] [bits:position...]
+	svc_packedmovemobj,		// [bits:netid] [bits:rndindex] [bits:position]
+	svc_packedmobjspeedangle,	// [bits:netid] [bits:angle] [bits:momentum]
+
+	// for the selective-ack reliable stream
+	svc_reliable,			// [long:chunk] [ushort:len] [byte[]:messages]
+
+	// for downloading with NETCAP_DOWNLOADACK
+	svc_wadwindow,			// [ulong:window] - ack wad chunks with clc_wadack
+
+	// for NETCAP_LEVELSTATS
+	svc_levelstats,			// [short:total monsters] [short:killed monsters]
 		
 	// netdemos - NullPoint
 	svc_netdemocap = 100,
@@ -183,6 +200,8 @@ enum clc_t
 	clc_ready,				// [AM] Toggle ready state.
 	clc_spy,				// [SL] Tell server to send info about this player
 	clc_privmsg,			// [AM] Targeted chat to a specific player.
+	clc_ackbits,			// [long:sequence] [long:the 32 sequences before it]
+	clc_wadack,				// [ulong:bytes of the wad received in order]
 
 	// for when launcher packets go astray
 	clc_launcher_challenge = 212,
@@ -190,6 +209,55 @@ enum clc_t
 	clc_max = 255
 };
 
+// Optional protocol features.  The client sends the ones it understands
+// at the end of its connect packet, older servers simply ignore them.
+enum net_capability_t
+{
+	NETCAP_MOBJDELTA = 1 << 0,		// understands svc_mobjdelta
+	NETCAP_BITPACK = 1 << 1,		// understands the svc_packed* messages
+	NETCAP_RELIABLE = 1 << 2,		// understands svc_reliable, acks with clc_ackbits
+	NETCAP_HUFFMAN = 1 << 3,		// decodes adaptive huffman svc_compressed packets
+	NETCAP_RENDERLERP = 1 << 4,		// puts its render lerp in its ticcmds' world index
+	NETCAP_DOWNLOADACK = 1 << 5,	// acks wad chunks after svc_wadwindow
+	NETCAP_LEVELSTATS = 1 << 6		// counts monsters from svc_levelstats
+};
+
+#define NETCAP_SUPPORTED	(NETCAP_MOBJDELTA | NETCAP_BITPACK | NETCAP_RELIABLE | \
+							 NETCAP_HUFFMAN | NETCAP_RENDERLERP | NETCAP_DOWNLOADACK | \
+							 NETCAP_LEVELSTATS)
+
+// Fractional bits kept when packing positions and momentum
+#define NET_POSITION_FRACBITS	4
+#define NET_MOMENTUM_FRACBITS	8
+
+// Fields of svc_mobjdelta, in the order they are written
+enum mobjdelta_field_t
+{
+	MDF_X_BIT,			// long
+	MDF_Y_BIT,			// long
+	MDF_Z_BIT,			// long
+	MDF_ANGLE_BIT,		// long
+	MDF_MOMX_BIT,		// long
+	MDF_MOMY_BIT,		// long
+	MDF_MOMZ_BIT,		// long
+	MDF_RNDINDEX_BIT,	// byte
+	MDF_MOVEDIR_BIT,	// byte
+	MDF_MOVECOUNT_BIT,	// long
+	MDF_TARGET_BIT,		// short - netid
+	MDF_TRACER_BIT,		// short - netid
+
+	NUM_MOBJDELTA_FIELDS
+};
+
+#define MDF_POSITION	((1 << MDF_X_BIT) | (1 << MDF_Y_BIT) | (1 << MDF_Z_BIT))
+#define MDF_MOTION		((1 << MDF_ANGLE_BIT) | (1 << MDF_MOMX_BIT) | \
+						 (1 << MDF_MOMY_BIT) | (1 << MDF_MOMZ_BIT))
+#define MDF_RNDINDEX	(1 << MDF_RNDINDEX_BIT)
+#define MDF_MOVEDIR		(1 << MDF_MOVEDIR_BIT)
+#define MDF_MOVECOUNT	(1 << MDF_MOVECOUNT_BIT)
+#define MDF_TARGET		(1 << MDF_TARGET_BIT)
+#define MDF_TRACER		(1 << MDF_TRACER_BIT)
+
 extern msg_info_t clc_info[clc_max];
 extern msg_info_t svc_info[svc_max];
 
@@ -529,16 +597,99 @@ public:
 
 extern buf_t net_message;
 
+//
+// BitWriter
+//
+// Appends values to a buf_t at bit granularity, most significant bit
+// first.  Whole bytes go into the buffer as soon as they are complete;
+// Flush() pads the last one with zeros, after which the buffer can be
+// written to normally again.
+//
+class BitWriter
+{
+public:
+	BitWriter(buf_t *b) : buf(b), current(0), count(0) {}
+
+	void WriteBits(DWORD value, int bits);
+	void WriteBit(bool bit) { WriteBits(bit ? 1 : 0, 1); }
+	void WriteVarint(DWORD value);
+	void WriteSignedVarint(int value);
+	void WriteFixed(int value, int fracbits);
+	void WriteFixedVarint(int value, int fracbits);
+	void Flush();
+
+private:
+	buf_t	*buf;
+	DWORD	current;
+	int		count;
+};
+
+//
+// BitReader
+//
+// Reads what BitWriter wrote.  Running off the end of the buffer sets its
+// overflowed flag, just like the byte-level readers, and returns zeros.
+//
+class BitReader
+{
+public:
+	BitReader(buf_t *b) : buf(b), current(0), count(0) {}
+
+	DWORD ReadBits(int bits);
+	bool ReadBit() { return ReadBits(1) != 0; }
+	DWORD ReadVarint();
+	int ReadSignedVarint();
+	int ReadFixed(int fracbits);
+	int ReadFixedVarint(int fracbits);
+
+private:
+	buf_t	*buf;
+	DWORD	current;
+	int		count;
+};
+
 void CloseNetwork (void);
 void InitNetCommon(void);
 void I_SetPort(netadr_t &addr, int port);
 bool NetWaitOrTimeout(size_t ms);
+bool NET_WaitForPacket(dtime_t timeout);
 
 char *NET_AdrToString (netadr_t a);
 bool NET_StringToAdr (const char *s, netadr_t *a);
 bool NET_CompareAdr (netadr_t a, netadr_t b);
 int  NET_GetPacket (void);
 int NET_SendPacket (buf_t &buf, netadr_t &to);
+
+// a piece of a datagram, see NET_SendSegments
+struct net_segment_t
+{
+	const byte	*data;
+	size_t		size;
+};
+
+#define NET_MAX_SEGMENTS	8
+
+int NET_SendSegments(const net_segment_t *segs, size_t count, netadr_t &to);
+void NET_BeginSendBatch();
+void NET_EndSendBatch();
+
+void NET_SetReceiveBatch(size_t count);
+
+// running totals for the packet paths
+struct net_stats_t
+{
+	QWORD	send_datagrams;	// datagrams handed to the kernel
+	QWORD	send_syscalls;	// sendto/sendmmsg calls made
+	QWORD	send_queued;	// datagrams that went through the send ring
+	QWORD	send_copied;	// bytes copied while gathering datagrams
+	QWORD	recv_datagrams;	// datagrams read from the socket
+	QWORD	recv_syscalls;	// recvfrom/recvmmsg calls made
+
+	net_stats_t() : send_datagrams(0), send_syscalls(0), send_queued(0),
+		send_copied(0), recv_datagrams(0), recv_syscalls(0) {}
+};
+
+const net_stats_t &NET_GetStats();
 std::string NET_GetLocalAddress (void);
 
 void SZ_Clear (buf_t *buf);
@@ -571,6 +722,14 @@ size_t MSG_SetOffset (const size_t &offset, const buf_t::seek_loc_t &loc);
 
 bool MSG_DecompressMinilzo ();
 bool MSG_CompressMinilzo (buf_t &buf, size_t start_offset, size_t write_gap);
+bool MSG_CompressMinilzo (const byte *in, size_t inlen, byte *out, size_t &outlen,
+                          void *workmem = NULL);
+
+// scratch memory minilzo needs, for callers compressing on other threads
+size_t MSG_MinilzoWorkmemSize();
+
+// worst-case output size of MSG_CompressMinilzo
+#define MSG_CompressBound(a)	((a) + (a) / 16 + 64 + 3)
 
 bool MSG_DecompressAdaptive (huffman &huff);
 bool MSG_CompressAdaptive (huffman &huff, buf_t &buf, size_t start_offset, size_t write_gap);
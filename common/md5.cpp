@@ -402,8 +402,19 @@ std::string MD5SUM(const void *in, size_t size)
 
 	md5_append(&state, (const unsigned char *)in, size);
 
+	return MD5SUM(&state);
+}
+
+std::string MD5SUM(std::string in)
+{
+	return MD5SUM(in.c_str(), in.length());
+}
+
+// finishes a message that was appended a piece at a time
+std::string MD5SUM(md5_state_t *state)
+{
 	md5_byte_t digest[16];
-	md5_finish(&state, digest);
+	md5_finish(state, digest);
 
 	std::stringstream hash;
 
@@ -413,10 +424,5 @@ std::string MD5SUM(const void *in, size_t size)
 	return hash.str();
 }
 
-std::string MD5SUM(std::string in)
-{
-	return MD5SUM(in.c_str(), in.length());
-}
-
 VERSION_CONTROL (md5_cpp, "$Id$")
 
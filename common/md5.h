@@ -98,5 +98,6 @@ void md5_finish(md5_state_t *pms, md5_byte_t digest[16]);
 
 std::string MD5SUM(const void *in, size_t size);
 std::string MD5SUM(std::string in);
+std::string MD5SUM(md5_state_t *state);
 
 #endif /* md5_INCLUDED */
@@ -674,7 +674,7 @@ void A_KeenDie (AActor *actor)
 	// scan the remaining thinkers
 	// to see if all Keens are dead
 	AActor *other;
-	TThinkerIterator<AActor> iterator;
+	TThinkerIterator<AActor> iterator(actor->GetCategory());
 
 	while ( (other = iterator.Next ()) )
 	{
@@ -1710,7 +1710,7 @@ void A_PainShootSkull (AActor *actor, angle_t angle)
 	// count total number of skull currently on the level
 	count = 0;
 
-	TThinkerIterator<AActor> iterator;
+	TThinkerIterator<AActor> iterator(P_MobjCategory(MT_SKULL));
 
 	while ( (other = iterator.Next ()) )
 	{
@@ -1937,7 +1937,7 @@ void A_BossDeath (AActor *actor)
 		return; // no one left alive, so do not end game
 
 	// scan the remaining thinkers to see if all bosses are dead
-	TThinkerIterator<AActor> iterator;
+	TThinkerIterator<AActor> iterator(actor->GetCategory());
 	AActor *other;
 
 	while ( (other = iterator.Next ()) )
@@ -103,6 +103,8 @@ extern int				itemrespawntime[ITEMQUESIZE];
 extern int				iquehead;
 extern int				iquetail;
 
+thinker_category_t P_MobjCategory(mobjtype_t type);
+
 void 	P_ThrustMobj (AActor *mo, angle_t angle, fixed_t move);
 void	P_RespawnSpecials (void);
 
@@ -466,6 +468,7 @@ extern polyspawns_t *polyspawns;	// [RH] list of polyobject things to spawn
 
 BOOL PO_MovePolyobj (int num, int x, int y);
 BOOL PO_RotatePolyobj (int num, angle_t angle);
+void PO_SetPolyobjPosition (polyobj_t *po, fixed_t x, fixed_t y, angle_t angle);
 void PO_Init (void);
 BOOL PO_Busy (int polyobj);
 
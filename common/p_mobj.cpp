@@ -78,11 +78,119 @@ int             iquetail;
 NetIDHandler ServerNetID;
 
 // denis - fast netid lookup
-typedef std::map<size_t, AActor::AActorPtr> netid_map_t;
-netid_map_t actor_by_netid;
+// indexed by netid, the actor a slot points to may since have been given
+// another netid
+typedef std::vector<AActor::AActorPtr> netid_table_t;
+static netid_table_t actor_by_netid(MAX_NETID + 1);
+
+static const size_t NETID_WORDS = (MAX_NETID + 1) / 32;
+
+//
+// NetIDHandler::NetIDHandler
+//
+// Every netid from 1 to MAX_NETID - 1 starts off free.
+//
+NetIDHandler::NetIDHandler()
+	: free_bits(NETID_WORDS, 0xFFFFFFFF), generations(MAX_NETID + 1, 0),
+	  cursor(1), num_free(MAX_NETID - 1)
+{
+	free_bits[0] &= ~1u;
+	free_bits[MAX_NETID >> 5] &= ~(1u << (MAX_NETID & 31));
+}
+
+//
+// NetIDLowestBit
+//
+static inline int NetIDLowestBit(DWORD bits)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(bits);
+#else
+	int bit = 0;
+	while (!(bits & 1))
+	{
+		bits >>= 1;
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+//
+// NetIDHandler::ObtainNetID
+//
+// Hands out the first free netid at or after the cursor, wrapping around.
+//
+int NetIDHandler::ObtainNetID()
+{
+	if (!num_free)
+		I_Error("Exceeded maximum number of netids");
+
+	size_t word = cursor >> 5;
+
+	// ignore the ones before the cursor in its own word until wrapping
+	DWORD bits = free_bits[word] & (0xFFFFFFFF << (cursor & 31));
+
+	while (!bits)
+	{
+		word = (word + 1) % NETID_WORDS;
+		bits = free_bits[word];
+	}
+
+	int netid = (word << 5) + NetIDLowestBit(bits);
+
+	free_bits[word] &= ~(1u << (netid & 31));
+	num_free--;
+
+	cursor = netid + 1;
+	if (cursor >= MAX_NETID)
+		cursor = 1;
+
+	return netid;
+}
+
+//
+// NetIDHandler::ReleaseNetID
+//
+void NetIDHandler::ReleaseNetID(int NetID)
+{
+	if (NetID <= 0 || NetID >= MAX_NETID)
+		I_Error("Released a non-existant netid %d", NetID);
+
+	DWORD bit = 1u << (NetID & 31);
+
+	if (free_bits[NetID >> 5] & bit)
+	{
+		DPrintf("Released netid %d twice\n", NetID);
+		return;
+	}
+
+	free_bits[NetID >> 5] |= bit;
+	generations[NetID]++;
+	num_free++;
+}
 
 IMPLEMENT_SERIAL(AActor, DThinker)
 
+//
+// P_MobjCategory
+//
+// Which thinker list actors of a type go on.
+//
+thinker_category_t P_MobjCategory(mobjtype_t type)
+{
+	if (type == MT_PLAYER)
+		return THINKER_PLAYER;
+
+	if (mobjinfo[type].flags & MF_COUNTKILL || type == MT_SKULL)
+		return THINKER_MONSTER;
+
+	if (mobjinfo[type].flags & MF_MISSILE)
+		return THINKER_MISSILE;
+
+	return THINKER_OTHER;
+}
+
 AActor::~AActor ()
 {
     // Please avoid calling the destructor directly (or through delete)!
@@ -144,6 +252,7 @@ AActor::AActor (const AActor &other) :
 {
 	memcpy(args, other.args, sizeof(args));
 	self.init(this);
+	SetCategory(other.GetCategory());
 }
 
 AActor &AActor::operator= (const AActor &other)
@@ -241,6 +350,7 @@ AActor::AActor (fixed_t ix, fixed_t iy, fixed_t iz, mobjtype_t itype) :
 	self.init(this);
 	info = &mobjinfo[itype];
 	type = itype;
+	SetCategory(P_MobjCategory(type));
 	x = ix;
 	y = iy;
 	radius = info->radius;
@@ -252,7 +362,7 @@ AActor::AActor (fixed_t ix, fixed_t iy, fixed_t iz, mobjtype_t itype) :
 	rndindex = M_Random();
 
     if (multiplayer && serverside)
-        netid = ServerNetID.ObtainNetID();
+        P_SetThingId(this, ServerNetID.ObtainNetID());
 
 	if (sv_skill != sk_nightmare)
 		reactiontime = info->reactiontime;
@@ -329,7 +439,8 @@ void P_AnimationTick(AActor *mo)
 //
 void P_ClearAllNetIds()
 {
-	actor_by_netid.clear();
+	for (netid_table_t::iterator it = actor_by_netid.begin(); it != actor_by_netid.end(); ++it)
+		*it = AActor::AActorPtr();
 }
 
 //
@@ -338,12 +449,15 @@ void P_ClearAllNetIds()
 //
 AActor* P_FindThingById(size_t id)
 {
-	netid_map_t::iterator i = actor_by_netid.find(id);
+	if (id > MAX_NETID)
+		return NULL;
 
-	if(i == actor_by_netid.end())
-		return AActor::AActorPtr();
-	else
-		return i->second;
+	AActor *mo = actor_by_netid[id];
+
+	if (mo && (size_t)mo->netid != id)
+		return NULL;
+
+	return mo;
 }
 
 //
@@ -352,7 +466,9 @@ AActor* P_FindThingById(size_t id)
 void P_SetThingId(AActor *mo, size_t newnetid)
 {
 	mo->netid = newnetid;
-	actor_by_netid[newnetid] = mo->ptr();
+
+	if (newnetid <= MAX_NETID)
+		actor_by_netid[newnetid] = mo->ptr();
 }
 
 
@@ -877,6 +993,7 @@ void AActor::Serialize (FArchive &arc)
 		if(sprite >= NUMSPRITES)
 			I_Error("Unknown sprite in saved game");
 		info = &mobjinfo[type];
+		SetCategory(P_MobjCategory(type));
 		touching_sectorlist = NULL;
 
 		LinkToWorld ();
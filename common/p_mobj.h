@@ -29,29 +29,25 @@
 
 //-----------------------------------------------------------------------------
 //
-// denis - superior NetIDHandler
+// NetIDHandler
 //
-// Very simple, very fast.
-// Does not iterate when releasing a netid.
-// Does not iterate when obtaining a netid unless all pooled ids are taken.
-// (in which case does one allocation and does not iterate more than 
-//  MEMPOOLSIZE times)
-// Only downside is that it won't detect double-releasing, but shouldn't be 
-// a problem.
+// Hands out the netids that identify actors to clients.  The free netids are
+// a bitmap, one bit per netid, and are handed out next-fit from a cursor that
+// goes round all of them, so a released netid is only reused once every other
+// free one has been.  That keeps a recently freed netid from being given to a
+// different actor while clients may still get packets about the old one.
+// A netid released twice is only released once.
 //
-// Thanks to [Dash|RD] for noticing the efficiency problem, hard work on other 
-// versions of this class and giving me this great idea.
+// Each netid also has a generation that goes up when it is released, so
+// anything remembered about a netid can tell whether it still refers to the
+// same actor.
 //
 //-----------------------------------------------------------------------------
 
-// [SL] 2012-04-04 
-// Modified to use a std::queue, popping from the front of the queue to assign
-// new netids and pushing newly freed netids on the back of the queue.  This is
-// to avoid reassigning a recently freed netid to a different actor.  Otherwise
-// clients can get confused when packets are dropped.
+#include <vector>
 
+#include "doomtype.h"
 #include "i_system.h"
-#include <queue>
 
 #define MAX_NETID 0xFFFF
 
@@ -59,50 +55,31 @@ class NetIDHandler
 {
 	private:
 
-	size_t NumAllocated;
-	std::queue<int> free_ids;
-	const size_t ChunkSize;
+	std::vector<DWORD> free_bits;	// set for every netid that can be handed out
+	std::vector<byte> generations;
+	size_t cursor;					// where the search for the next one starts
+	size_t num_free;
 
 	public:
 
-	NetIDHandler(size_t chunk_size = 512)
-		: NumAllocated(0), ChunkSize(chunk_size)
-	{}
+	NetIDHandler();
 
-	~NetIDHandler()
-	{
-	}
+	int ObtainNetID();
+	void ReleaseNetID(int NetID);
 
-	int ObtainNetID()
+	bool IsAllocated(int NetID) const
 	{
-		if (free_ids.empty())
-		{
-			if(NumAllocated >= MAX_NETID - 1)
-				I_Error("Exceeded maximum number of netids");
-
-			int OldAllocated = NumAllocated;
-			NumAllocated += ChunkSize;
-
-			if(NumAllocated >= MAX_NETID - 1)
-				NumAllocated = MAX_NETID - 1;
-
-			for (size_t i = OldAllocated + 1; i <= NumAllocated; i++)
-				free_ids.push(i);
-		}
-
-		int netid = free_ids.front();
-		free_ids.pop();
-	
-		return netid;
+		return NetID > 0 && NetID < MAX_NETID &&
+			!(free_bits[NetID >> 5] & (1u << (NetID & 31)));
 	}
 
-	void ReleaseNetID(int NetID)
+	// goes up every time the netid is released
+	byte GetGeneration(int NetID) const
 	{
-		if (!NetID || NetID > (int)NumAllocated)
-			I_Error("Released a non-existant netid %d", NetID);
-
-		free_ids.push(NetID);
+		return generations[NetID & MAX_NETID];
 	}
+
+	size_t NumFree() const { return num_free; }
 };
 
 extern NetIDHandler ServerNetID;
@@ -645,7 +645,7 @@ void A_Punch(AActor* mo)
 
 	// [SL] 2011-07-12 - Move players and sectors back to their positions when
 	// this player hit the fire button clientside.
-	Unlag::getInstance().reconcile(player->id);
+	Unlag::getInstance().reconcile(player->id, angle, 0, MELEERANGE);
 
 	slope = P_AimLineAttack (player->mo, angle, MELEERANGE);
 	P_LineAttack (player->mo, angle, MELEERANGE, slope, damage);
@@ -679,7 +679,7 @@ void A_Saw(AActor* mo)
 
 	// [SL] 2011-07-12 - Move players and sectors back to their positions when
 	// this player hit the fire button clientside.
-	Unlag::getInstance().reconcile(player->id);
+	Unlag::getInstance().reconcile(player->id, angle, 0, MELEERANGE+1);
 
 	// use meleerange + 1 so the puff doesn't skip the flash
 	P_LineAttack (player->mo, angle, MELEERANGE+1,
@@ -798,7 +798,7 @@ void A_FireRailgun(AActor* mo)
 
 	// [SL] 2012-04-18 - Move players and sectors back to their positions when
 	// this player hit the fire button clientside.
-	Unlag::getInstance().reconcile(player->id);
+	Unlag::getInstance().reconcile(player->id, player->mo->angle, 0, 8192*FRACUNIT);
 
 	P_RailAttack (player->mo, damage, RailOffset);
 
@@ -877,6 +877,24 @@ typedef enum
 	SPREAD_SUPERSHOTGUN
 } spreadtype_t;
 
+//
+// P_HitscanSpread
+//
+// How far either side of where the player is facing a hitscan attack can
+// go: the widest of autoaim's search and the spread of the bullets.
+//
+
+static angle_t P_HitscanSpread(spreadtype_t spread)
+{
+	angle_t autoaim = 1 << 26;
+
+	if (spread == SPREAD_SUPERSHOTGUN)
+		return MAX(autoaim, angle_t(255 << 19));
+	if (spread == SPREAD_NORMAL)
+		return MAX(autoaim, angle_t(255 << 18));
+	return autoaim;
+}
+
 void P_FireHitscan (player_t *player, size_t quantity, spreadtype_t spread)
 {
 	if (!player || !player->mo)
@@ -900,7 +918,8 @@ void P_FireHitscan (player_t *player, size_t quantity, spreadtype_t spread)
 	// NOTE: Important to reconcile sectors and players BEFORE calculating
 	// bulletslope!
 	if (serverside)
-		Unlag::getInstance().reconcile(player->id);
+		Unlag::getInstance().reconcile(player->id, player->mo->angle,
+		                               P_HitscanSpread(spread), MISSILERANGE);
 
 	fixed_t bulletslope = P_BulletSlope(player->mo);
 
@@ -31,9 +31,17 @@
 //   prior position) and 'restoring' (moving players back to their proper
 //   positions).
 //
+//   Only players that could be in the way of the shot are moved: those whose
+//   bounding box, swept from their current to their reconciled position,
+//   touches the area the shot can reach.  Sectors and polyobjs are only moved
+//   if they were somewhere else back then.
+//
 //-----------------------------------------------------------------------------
 
 
+#include <algorithm>
+#include <cmath>
+
 #include "doomdef.h"
 #include "doomstat.h"
 #include "m_vectors.h"
@@ -50,32 +58,22 @@ void SV_SendDestroyActor(AActor *mo);
 EXTERN_CVAR(sv_unlag)
 EXTERN_CVAR(sv_maxunlagtime)
 
-Unlag::SectorHistoryRecord::SectorHistoryRecord()
-	:	sector(NULL), history_size(0),
-		history_ceilingheight(), history_floorheight(),
-		backup_ceilingheight(0), backup_floorheight(0)
-{
-}
+// how far a player's bounding box is grown before checking it against the
+// shot, to cover the railgun's offset and the angle table's rounding
+static const fixed_t TRACE_SLACK = 16 * FRACUNIT;
 
-Unlag::SectorHistoryRecord::SectorHistoryRecord(sector_t *sec)
-	: 	sector(sec), history_size(Unlag::MAX_HISTORY_TICS),
-		history_ceilingheight(), history_floorheight(),
-		backup_ceilingheight(0), backup_floorheight(0)
+Unlag::Unlag() : history_tics(0), reconciled(false)
 {
-	if (!sector)
-		return;
-
-	fixed_t ceilingheight = P_CeilingHeight(sector);
-	fixed_t floorheight = P_FloorHeight(sector);
-
-	for (size_t i = 0; i < history_size; i++)
+	for (size_t id = 0; id < MAX_PLAYER_IDS; id++)
 	{
-		history_ceilingheight[i] = ceilingheight;
-		history_floorheight[i] = floorheight;
+		history_player[id] = NULL;
+		history_size[id] = 0;
+		offset_x[id] = offset_y[id] = offset_z[id] = 0;
+		changed_flags[id] = false;
+		changed_box[id] = false;
+		current_lag[id] = 0;
+		current_lerp[id] = 0;
 	}
-
-	backup_ceilingheight = ceilingheight;
-	backup_floorheight = floorheight;
 }
 
 //
@@ -141,80 +139,158 @@ void Unlag::moveSector(sector_t *sector, fixed_t ceilingheight,
 
 
 //
-// Unlag::reconcilePlayerPositions
+// Unlag::boxInTrace
 //
-// Moves all of the players except 'shooter' to the position they were
-// at 'ticsago' tics before.  Players who were not alive at that time
-// have their MF_SHOOTABLE flag removed so they do not take damage.
+// Checks if any part of the box left-right, bottom-top is within 'range' of
+// x, y and no more than 'spread' either side of 'angle', as seen from there.
 //
-// If Unlag::reconcile is true, restore all player positions to their state
-// before reconciliation.  Restore the MF_SHOOTABLE flag if we changed it.
+
+bool Unlag::boxInTrace(fixed_t x, fixed_t y, fixed_t left, fixed_t right,
+					   fixed_t bottom, fixed_t top,
+					   angle_t angle, angle_t spread, fixed_t range)
+{
+	if (spread >= ANG180)
+		return true;
+
+	if (x >= left && x <= right && y >= bottom && y <= top)
+		return true;
+
+	// closest point of the box
+	double dx = x < left ? double(left - x) : x > right ? double(x - right) : 0.0;
+	double dy = y < bottom ? double(bottom - y) : y > top ? double(y - top) : 0.0;
+
+	if (dx * dx + dy * dy > double(range) * double(range))
+		return false;
+
+	// the box isn't around x, y, so its corners span less than 180 degrees
+	// and their angles relative to the first one are the box's extent
+	const fixed_t cx[4] = { left, left, right, right };
+	const fixed_t cy[4] = { bottom, top, bottom, top };
+
+	angle_t first = P_PointToAngle(x, y, cx[0], cy[0]) - angle;
+
+	int lo = 0, hi = 0;
+	for (int i = 1; i < 4; i++)
+	{
+		int rel = int(P_PointToAngle(x, y, cx[i], cy[i]) - angle - first);
+		lo = MIN(lo, rel);
+		hi = MAX(hi, rel);
+	}
+
+	// the box covers first..last going counterclockwise, relative to the shot
+	first += lo;
+	angle_t width = angle_t(hi - lo);
+	angle_t last = first + width;
+
+	// either an edge of the box is within the spread, or the spread is
+	// narrower than the box and one of its edges is inside it
+	if (angle_t(first + spread) <= 2 * spread || angle_t(last + spread) <= 2 * spread)
+		return true;
+
+	return angle_t(spread - first) <= width || angle_t(0 - spread - first) <= width;
+}
+
+
+//
+// Unlag::reconcilePlayerPositions
+//
+// Moves the players except 'shooter' that could be hit by a shot fired at
+// 'angle', 'spread' either side of it, out to 'range' to the position they
+// were at 'ticsago' tics before, plus 'frac' of a tic.  Players who were not
+// alive at that time have their MF_SHOOTABLE flag removed so they do not
+// take damage.
 //
-// NOTE: ticsago should be > 0 if we're reconciling and not restoring
+// NOTE: ticsago should be > 0
 //
 
-void Unlag::reconcilePlayerPositions(byte shooter_id, size_t ticsago)
+void Unlag::reconcilePlayerPositions(byte shooter_id, size_t ticsago, fixed_t frac,
+									 angle_t angle, angle_t spread, fixed_t range)
 {
-	for (size_t i=0; i<player_history.size(); i++)
+	AActor *shooter = history_player[shooter_id]->mo;
+	size_t cur = (gametic - ticsago) % history_tics;
+	size_t prev = (gametic - ticsago - 1) % history_tics;
+
+	for (size_t i = 0; i < registered_ids.size(); i++)
 	{
-		player_t *player = player_history[i].player;
+		byte id = registered_ids[i];
+		player_t *player = history_player[id];
 
 		// skip over the player shooting and any spectators
-		if (player->id == shooter_id || player->spectator || !player->mo)
+		if (id == shooter_id || player->spectator || !player->mo)
 			continue;
-	
-		fixed_t dest_x, dest_y, dest_z; // position to move player to
 
-		if (!reconciled)
+		AActor *mo = player->mo;
+
+		// position to move player to
+		fixed_t dest_x = mo->x, dest_y = mo->y, dest_z = mo->z;
+		fixed_t dest_radius = mo->radius, dest_height = mo->height;
+
+		// this player was not alive when the shot was fired
+		bool absent = history_size[id] < ticsago;
+
+		if (!absent)
 		{
-			// record the player's current position, which hasn't yet
-			// been saved to the history arrays
-			player_history[i].backup_x = player->mo->x;
-			player_history[i].backup_y = player->mo->y;
-			player_history[i].backup_z = player->mo->z;
-  
-  			size_t cur = (gametic - ticsago) % Unlag::MAX_HISTORY_TICS;
-
-			dest_x = player_history[i].history_x[cur];
-			dest_y = player_history[i].history_y[cur];
-			dest_z = player_history[i].history_z[cur];
-
-			player_history[i].offset_x = player_history[i].backup_x - dest_x;
-			player_history[i].offset_y = player_history[i].backup_y - dest_y;
-			player_history[i].offset_z = player_history[i].backup_z - dest_z;
-
-			if (player_history[i].history_size < ticsago)
-			{
-				// make the player temporarily unshootable since this player
-				// was not alive when the shot was fired.  Kind of a hack.
-				player_history[i].backup_flags = player->mo->flags;
-				player->mo->flags &= ~(MF_SHOOTABLE | MF_SOLID);
-				player_history[i].changed_flags = true;
-			}
+			size_t newer = id * history_tics + cur;
+			size_t older = id * history_tics + prev;
+
+			// no sample before the player spawned to interpolate with
+			if (history_size[id] <= ticsago)
+				older = newer;
+
+			dest_x = interpolate(history_x[newer], history_x[older], frac);
+			dest_y = interpolate(history_y[newer], history_y[older], frac);
+			dest_z = interpolate(history_z[newer], history_z[older], frac);
+			dest_radius = history_radius[newer];
+			dest_height = history_height[newer];
+		}
 
-			#ifdef _UNLAG_DEBUG_
-			// spawn a marker sprite at the reconciled position for debugging
-	        AActor *mo = new AActor(dest_x, dest_y, dest_z, MT_KEEN);
+		// leave the player alone if the shot can't reach them either where
+		// they are now or where they were then
+		fixed_t radius = MAX(mo->radius, dest_radius) + TRACE_SLACK;
+		if (!boxInTrace(shooter->x, shooter->y,
+						MIN(mo->x, dest_x) - radius, MAX(mo->x, dest_x) + radius,
+						MIN(mo->y, dest_y) - radius, MAX(mo->y, dest_y) + radius,
+						angle, spread, range))
+			continue;
+
+		// record the player's current position, which hasn't yet
+		// been saved to the history arrays
+		backup_x[id] = mo->x;
+		backup_y[id] = mo->y;
+		backup_z[id] = mo->z;
+
+		offset_x[id] = backup_x[id] - dest_x;
+		offset_y[id] = backup_y[id] - dest_y;
+		offset_z[id] = backup_z[id] - dest_z;
+
+		if (absent)
+		{
+			// make the player temporarily unshootable since this player
+			// was not alive when the shot was fired.  Kind of a hack.
+			backup_flags[id] = mo->flags;
 			mo->flags &= ~(MF_SHOOTABLE | MF_SOLID);
-			mo->health = -187;
-			SV_SpawnMobj(mo);
-			#endif // _UNLAG_DEBUG_
+			changed_flags[id] = true;
 		}
-		else
-		{   // we're moving the player back to proper position
-			dest_x = player_history[i].backup_x;
-			dest_y = player_history[i].backup_y;
-			dest_z = player_history[i].backup_z;
 
-			// restore a player's shootability if we removed it previously
-			if (player_history[i].changed_flags)
-			{
-				player->mo->flags = player_history[i].backup_flags;
-				player_history[i].changed_flags = false;
-			}
-		}   
+		if (dest_radius != mo->radius || dest_height != mo->height)
+		{
+			backup_radius[id] = mo->radius;
+			backup_height[id] = mo->height;
+			mo->radius = dest_radius;
+			mo->height = dest_height;
+			changed_box[id] = true;
+		}
+
+		#ifdef _UNLAG_DEBUG_
+		// spawn a marker sprite at the reconciled position for debugging
+		AActor *marker = new AActor(dest_x, dest_y, dest_z, MT_KEEN);
+		marker->flags &= ~(MF_SHOOTABLE | MF_SOLID);
+		marker->health = -187;
+		SV_SpawnMobj(marker);
+		#endif // _UNLAG_DEBUG_
 
-		movePlayer(player, dest_x, dest_y, dest_z); 
+		movePlayer(player, dest_x, dest_y, dest_z);
+		moved_players.push_back(id);
 	}
 }
 
@@ -224,61 +300,239 @@ void Unlag::reconcilePlayerPositions(byte shooter_id, size_t ticsago)
 // Unlag::reconcileSectorPositions
 //
 // Moves the ceiling and floor of any sectors considered moveable
-// to the positions they were 'ticsago' tics before.
+// to the positions they were 'ticsago' tics before, plus 'frac' of a tic.
+//
+
+void Unlag::reconcileSectorPositions(size_t ticsago, fixed_t frac)
+{
+	size_t cur = (gametic - ticsago) % history_tics;
+	size_t prev = (gametic - ticsago - 1) % history_tics;
+
+	for (size_t i = 0; i < sector_list.size(); i++)
+	{
+		sector_t *sector = sector_list[i];
+
+		size_t newer = i * history_tics + cur;
+		size_t older = i * history_tics + prev;
+		fixed_t dest_ceilingheight = interpolate(sector_ceilingheight[newer],
+												 sector_ceilingheight[older], frac);
+		fixed_t dest_floorheight = interpolate(sector_floorheight[newer],
+											   sector_floorheight[older], frac);
+
+		fixed_t ceilingheight = P_CeilingHeight(sector);
+		fixed_t floorheight = P_FloorHeight(sector);
+
+		if (dest_ceilingheight == ceilingheight && dest_floorheight == floorheight)
+			continue;
+
+		// record the sector's current position, which hasn't yet
+		// been saved to the history arrays
+		sector_backup_ceilingheight[i] = ceilingheight;
+		sector_backup_floorheight[i] = floorheight;
+
+		moveSector(sector, dest_ceilingheight, dest_floorheight);
+		moved_sectors.push_back(i);
+	}
+}
+
+
+//
+// Unlag::reconcilePolyobjPositions
+//
+// Moves any polyobjs that have moved since to where they were 'ticsago' tics
+// before, plus 'frac' of a tic.
+//
+
+void Unlag::reconcilePolyobjPositions(size_t ticsago, fixed_t frac)
+{
+	if (polyobj_x.size() != po_NumPolyobjs * history_tics)
+		return;
+
+	size_t cur = (gametic - ticsago) % history_tics;
+	size_t prev = (gametic - ticsago - 1) % history_tics;
+
+	for (int i = 0; i < po_NumPolyobjs; i++)
+	{
+		polyobj_t *po = &polyobjs[i];
+
+		size_t newer = i * history_tics + cur;
+		size_t older = i * history_tics + prev;
+
+		fixed_t x = interpolate(polyobj_x[newer], polyobj_x[older], frac);
+		fixed_t y = interpolate(polyobj_y[newer], polyobj_y[older], frac);
+
+		// turn the short way round
+		angle_t angle = polyobj_angle[newer] +
+			FixedMul(int(polyobj_angle[older] - polyobj_angle[newer]), frac);
+
+		if (x == po->startSpot[0] && y == po->startSpot[1] && angle == po->angle)
+			continue;
+
+		polyobj_backup_x[i] = po->startSpot[0];
+		polyobj_backup_y[i] = po->startSpot[1];
+		polyobj_backup_angle[i] = po->angle;
+
+		PO_SetPolyobjPosition(po, x, y, angle);
+		moved_polyobjs.push_back(i);
+	}
+}
+
+
+//
+// Unlag::restorePositions
 //
-// If 'reconciled' is true, restore the ceiling and floors to where they
-// were prior to reconciliation.
+// Moves everything reconciliation moved back to where it was.  Restore the
+// MF_SHOOTABLE flag if we changed it.
 //
 
-void Unlag::reconcileSectorPositions(size_t ticsago)
+void Unlag::restorePositions()
 {
-	for (size_t i=0; i<sector_history.size(); i++)
+	for (size_t i = 0; i < moved_players.size(); i++)
 	{
-		sector_t *sector = sector_history[i].sector;
+		byte id = moved_players[i];
+		player_t *player = history_player[id];
 
-		fixed_t dest_ceilingheight, dest_floorheight;
-		if (!reconciled)
+		offset_x[id] = offset_y[id] = offset_z[id] = 0;
+
+		if (!player || !player->mo)
 		{
-			// record the player's current position, which hasn't yet
-			// been saved to the history arrays
-			sector_history[i].backup_ceilingheight = P_CeilingHeight(sector);
-			sector_history[i].backup_floorheight = P_FloorHeight(sector);
-
-			size_t cur = (sector_history[i].history_size - 1 - ticsago) 
-						  % Unlag::MAX_HISTORY_TICS;
-			dest_ceilingheight = sector_history[i].history_ceilingheight[cur];
-			dest_floorheight = sector_history[i].history_floorheight[cur];
+			changed_flags[id] = changed_box[id] = false;
+			continue;
 		}
-		else	// restore to original positions 
+
+		// restore a player's shootability if we removed it previously
+		if (changed_flags[id])
 		{
-			dest_ceilingheight = sector_history[i].backup_ceilingheight;
-			dest_floorheight = sector_history[i].backup_floorheight;
+			player->mo->flags = backup_flags[id];
+			changed_flags[id] = false;
 		}
-		moveSector(sector, dest_ceilingheight, dest_floorheight);
-	}	
+
+		// a player killed by the shot keeps their corpse's size
+		if (changed_box[id])
+		{
+			if (player->mo->health > 0)
+			{
+				player->mo->radius = backup_radius[id];
+				player->mo->height = backup_height[id];
+			}
+			changed_box[id] = false;
+		}
+
+		movePlayer(player, backup_x[id], backup_y[id], backup_z[id]);
+	}
+
+	for (size_t i = 0; i < moved_sectors.size(); i++)
+	{
+		size_t index = moved_sectors[i];
+		moveSector(sector_list[index], sector_backup_ceilingheight[index],
+				   sector_backup_floorheight[index]);
+	}
+
+	for (size_t i = 0; i < moved_polyobjs.size(); i++)
+	{
+		size_t index = moved_polyobjs[i];
+		PO_SetPolyobjPosition(&polyobjs[index], polyobj_backup_x[index],
+							  polyobj_backup_y[index], polyobj_backup_angle[index]);
+	}
+
+	moved_players.clear();
+	moved_sectors.clear();
+	moved_polyobjs.clear();
 }
 
 
 //
 // Unlag::reset
 //
-// Erases the position history for players and sectors.  Unlinks
+// Erases the position history for players, sectors and polyobjs.  Unlinks
 // all player_t and sector_t objects from this Unlag object.
 // Should be called at the begining of each level.
 
 void Unlag::reset()
 {
-	player_history.clear();
-	sector_history.clear();
-	player_id_map.clear();
+	for (size_t i = 0; i < registered_ids.size(); i++)
+		history_player[registered_ids[i]] = NULL;
+	registered_ids.clear();
+
+	sector_list.clear();
+	sector_ceilingheight.clear();
+	sector_floorheight.clear();
+	sector_backup_ceilingheight.clear();
+	sector_backup_floorheight.clear();
+
+	polyobj_x.clear();
+	polyobj_y.clear();
+	polyobj_angle.clear();
+	polyobj_backup_x.clear();
+	polyobj_backup_y.clear();
+	polyobj_backup_angle.clear();
+
+	moved_players.clear();
+	moved_sectors.clear();
+	moved_polyobjs.clear();
+	reconciled = false;
+}
+
+
+//
+// Unlag::wantedHistoryTics
+//
+// How many tics of history sv_maxunlagtime calls for.  The sample before the
+// oldest one a player can be rewound to is needed for interpolating.
+//
+
+size_t Unlag::wantedHistoryTics()
+{
+	return size_t(ceil(TICRATE * sv_maxunlagtime)) + 2;
+}
+
+
+//
+// Unlag::resizeHistory
+//
+// Makes room for as much history as sv_maxunlagtime calls for.  Resizing
+// throws the player history away and fills the sector history with the
+// current heights; the polyobj history is refilled next time it's recorded.
+//
+
+void Unlag::resizeHistory()
+{
+	size_t tics = wantedHistoryTics();
+	if (tics == history_tics)
+		return;
+
+	history_tics = tics;
+
+	history_x.assign(MAX_PLAYER_IDS * history_tics, 0);
+	history_y.assign(MAX_PLAYER_IDS * history_tics, 0);
+	history_z.assign(MAX_PLAYER_IDS * history_tics, 0);
+	history_radius.assign(MAX_PLAYER_IDS * history_tics, 0);
+	history_height.assign(MAX_PLAYER_IDS * history_tics, 0);
+
+	for (size_t id = 0; id < MAX_PLAYER_IDS; id++)
+		history_size[id] = 0;
+
+	sector_ceilingheight.resize(sector_list.size() * history_tics);
+	sector_floorheight.resize(sector_list.size() * history_tics);
+
+	for (size_t index = 0; index < sector_ceilingheight.size(); index++)
+	{
+		sector_t *sector = sector_list[index / history_tics];
+		sector_ceilingheight[index] = P_CeilingHeight(sector);
+		sector_floorheight[index] = P_FloorHeight(sector);
+	}
+
+	polyobj_x.clear();
+	polyobj_y.clear();
+	polyobj_angle.clear();
 }
 
 
 //
 // Unlag::recordPlayerPositions
 //
-// Saves the current x, y, z position of all players.  History is
-// reset every time a player dies, spectates, etc.
+// Saves the current x, y, z position and bounding box of all players.
+// History is reset every time a player dies, spectates, etc.
 //
 
 void Unlag::recordPlayerPositions()
@@ -286,19 +540,26 @@ void Unlag::recordPlayerPositions()
 	if (!Unlag::enabled())
 		return;
 
-	for (size_t i=0; i<player_history.size(); i++)
+	resizeHistory();
+
+	size_t cur = gametic % history_tics;
+
+	for (size_t i = 0; i < registered_ids.size(); i++)
 	{
-		player_t *player = player_history[i].player;
+		byte id = registered_ids[i];
+		player_t *player = history_player[id];
 	
 		if (player->playerstate == PST_LIVE && 
 			!player->spectator && player->mo)
 		{
-			player_history[i].history_size++;
-			
-			size_t cur = gametic % Unlag::MAX_HISTORY_TICS;
-			player_history[i].history_x[cur] = player->mo->x;
-			player_history[i].history_y[cur] = player->mo->y;
-			player_history[i].history_z[cur] = player->mo->z;
+			history_size[id]++;
+
+			size_t index = id * history_tics + cur;
+			history_x[index] = player->mo->x;
+			history_y[index] = player->mo->y;
+			history_z[index] = player->mo->z;
+			history_radius[index] = player->mo->radius;
+			history_height[index] = player->mo->height;
 			
 			#ifdef _UNLAG_DEBUG_
 			DPrintf("Unlag (%03d): recording player %d position (%d, %d)\n",
@@ -310,7 +571,7 @@ void Unlag::recordPlayerPositions()
 		} 
 		else
 		{   // reset history for dead, spectating, etc players
-			player_history[i].history_size = 0;
+			history_size[id] = 0;
 		}
 	}
 }
@@ -327,14 +588,61 @@ void Unlag::recordSectorPositions()
 	if (!Unlag::enabled())
 		return;
 
-	for (size_t i=0; i<sector_history.size(); i++)
+	resizeHistory();
+
+	size_t cur = gametic % history_tics;
+
+	for (size_t i = 0; i < sector_list.size(); i++)
 	{
-		sector_t *sector = sector_history[i].sector;
+		size_t index = i * history_tics + cur;
+		sector_ceilingheight[index] = P_CeilingHeight(sector_list[i]);
+		sector_floorheight[index] = P_FloorHeight(sector_list[i]);
+	}
+}
+
+
+//
+// Unlag::recordPolyobjPositions()
+//
+// Saves the current position and angle of all polyobjs.  The history is
+// filled with where they are now the first time round on a level.
+//
+
+void Unlag::recordPolyobjPositions()
+{
+	if (!Unlag::enabled() || po_NumPolyobjs <= 0)
+		return;
+
+	resizeHistory();
+
+	size_t size = po_NumPolyobjs * history_tics;
+
+	if (polyobj_x.size() != size)
+	{
+		polyobj_x.resize(size);
+		polyobj_y.resize(size);
+		polyobj_angle.resize(size);
+		polyobj_backup_x.resize(po_NumPolyobjs);
+		polyobj_backup_y.resize(po_NumPolyobjs);
+		polyobj_backup_angle.resize(po_NumPolyobjs);
+
+		for (size_t index = 0; index < size; index++)
+		{
+			const polyobj_t *po = &polyobjs[index / history_tics];
+			polyobj_x[index] = po->startSpot[0];
+			polyobj_y[index] = po->startSpot[1];
+			polyobj_angle[index] = po->angle;
+		}
+	}
+
+	size_t cur = gametic % history_tics;
 
-		size_t cur = sector_history[i].history_size++ 
-					 % Unlag::MAX_HISTORY_TICS;
-		sector_history[i].history_ceilingheight[cur] = P_CeilingHeight(sector);
-		sector_history[i].history_floorheight[cur] = P_FloorHeight(sector);
+	for (int i = 0; i < po_NumPolyobjs; i++)
+	{
+		size_t index = i * history_tics + cur;
+		polyobj_x[index] = polyobjs[i].startSpot[0];
+		polyobj_y[index] = polyobjs[i].startSpot[1];
+		polyobj_angle[index] = polyobjs[i].angle;
 	}
 }
 
@@ -342,20 +650,15 @@ void Unlag::recordSectorPositions()
 //
 // Unlag::refreshRegisteredPlayers
 //
-// Updates the pointer to player_t in each player history record.
-// The address of a player's player_t can change when a player is added to or
-// removed from the global 'players' vector.  Also recreate the player_id_map.
+// Updates the pointer to player_t for each registered player id.
 // 
 
 void Unlag::refreshRegisteredPlayers()
 {
-	player_id_map.clear();
-	for (size_t i=0; i<player_history.size(); i++)
+	for (size_t i = 0; i < registered_ids.size(); i++)
 	{
-		byte id = player_history[i].player_id;
-
-		player_history[i].player = &idplayer(id);		
-		player_id_map[id] = i;
+		byte id = registered_ids[i];
+		history_player[id] = &idplayer(id);
 	}
 }
 
@@ -375,10 +678,15 @@ void Unlag::registerPlayer(byte player_id)
 	if (!validplayer(idplayer(player_id)))
 		return;
 
-	player_history.push_back(PlayerHistoryRecord());
-	player_history.back().player_id = player_id;
-	player_history.back().history_size = 0;
-	player_history.back().changed_flags = false;
+	if (!history_player[player_id])
+		registered_ids.push_back(player_id);
+
+	history_size[player_id] = 0;
+	offset_x[player_id] = offset_y[player_id] = offset_z[player_id] = 0;
+	changed_flags[player_id] = false;
+	changed_box[player_id] = false;
+	current_lag[player_id] = 0;
+	current_lerp[player_id] = 0;
 
 	refreshRegisteredPlayers();
 }
@@ -399,11 +707,12 @@ void Unlag::unregisterPlayer(byte player_id)
 	if (!Unlag::enabled())
 		return;
 
-	size_t history_index = player_id_map[player_id];
-	if (history_index >= player_history.size())
+	if (!history_player[player_id])
 		return;
 
-	player_history.erase(player_history.begin() + history_index);
+	history_player[player_id] = NULL;
+	registered_ids.erase(std::find(registered_ids.begin(), registered_ids.end(),
+								   player_id));
 	refreshRegisteredPlayers();
 }
 
@@ -418,18 +727,26 @@ void Unlag::unregisterPlayer(byte player_id)
 
 void Unlag::registerSector(sector_t *sector)
 {
-	if (!Unlag::enabled())
+	if (!Unlag::enabled() || !sector)
 		return;
 
-	// Check if this sector already is in sector_history
-	for (size_t i=0; i<sector_history.size(); i++)
+	// Check if this sector already is in sector_list
+	for (size_t i=0; i<sector_list.size(); i++)
 	{
 		// note: comparing the pointers to the sector_t objects
-		if (sector_history[i].sector == sector)
+		if (sector_list[i] == sector)
 			return;
 	}
 
-	sector_history.push_back(SectorHistoryRecord(sector));
+	resizeHistory();
+
+	sector_list.push_back(sector);
+	sector_ceilingheight.resize(sector_ceilingheight.size() + history_tics,
+								P_CeilingHeight(sector));
+	sector_floorheight.resize(sector_floorheight.size() + history_tics,
+							  P_FloorHeight(sector));
+	sector_backup_ceilingheight.push_back(0);
+	sector_backup_floorheight.push_back(0);
 }
 
 
@@ -445,12 +762,21 @@ void Unlag::unregisterSector(sector_t *sector)
 	if (!Unlag::enabled())
 		return;
 
-	for (size_t i=0; i<sector_history.size(); i++)
+	for (size_t i=0; i<sector_list.size(); i++)
 	{
 		// note: comparing the pointers to the sector_t objects
-		if (sector_history[i].sector == sector)  
+		if (sector_list[i] == sector)  
 		{
-			sector_history.erase(sector_history.begin() + i);
+			size_t begin = i * history_tics;
+			size_t end = begin + history_tics;
+
+			sector_list.erase(sector_list.begin() + i);
+			sector_ceilingheight.erase(sector_ceilingheight.begin() + begin,
+									   sector_ceilingheight.begin() + end);
+			sector_floorheight.erase(sector_floorheight.begin() + begin,
+									 sector_floorheight.begin() + end);
+			sector_backup_ceilingheight.erase(sector_backup_ceilingheight.begin() + i);
+			sector_backup_floorheight.erase(sector_backup_floorheight.begin() + i);
 			return;
 		}
 	}
@@ -467,17 +793,33 @@ void Unlag::unregisterSector(sector_t *sector)
 //
 
 void Unlag::reconcile(byte shooter_id)
+{
+	reconcile(shooter_id, 0, ANG180, MAXINT);
+}
+
+
+//
+// Unlag::reconcile
+//
+// As above, but only moves the players the shooter could hit with a shot
+// fired at 'angle' and up to 'spread' either side of it, out to 'range'.
+//
+
+void Unlag::reconcile(byte shooter_id, angle_t angle, angle_t spread, fixed_t range)
 {
 	if (!Unlag::enabled())
 		return;	
 
-	size_t player_index = player_id_map[shooter_id];
+	player_t *shooter = history_player[shooter_id];
+	if (!shooter || !shooter->mo)
+		return;
 
 	// Check if client disables unlagging for their weapons
-	if (!player_history[player_index].player->userinfo.unlag)
+	if (!shooter->userinfo.unlag)
 		return;
 
-	size_t lag = player_history[player_index].current_lag;
+	size_t lag = current_lag[shooter_id];
+	fixed_t frac = current_lerp[shooter_id];
 	
 	#ifdef _UNLAG_DEBUG_
 	DPrintf("Unlag (%03d): moving players to their positions at gametic %d (%d tics ago)\n",
@@ -486,7 +828,7 @@ void Unlag::reconcile(byte shooter_id)
 	// remove any other debugging player markers
 	AActor *mo;
 	std::list<AActor*> to_destroy;
-	TThinkerIterator<AActor> iterator;
+	TThinkerIterator<AActor> iterator(P_MobjCategory(MT_KEEN));
 	while ( (mo = iterator.Next() ) )
 	{
 		if (mo->type == MT_KEEN && mo->health == -187)
@@ -501,15 +843,16 @@ void Unlag::reconcile(byte shooter_id)
 			mo->Destroy();
 	}
 	
-	if (lag > Unlag::MAX_HISTORY_TICS)
+	if (lag + 1 >= history_tics)
 		DPrintf("Unlag (%03d): player %d has too great of lag (%d tics)\n",
 				gametic & 0xFF, shooter_id, lag);
 	#endif	// _UNLAG_DEBUG_
 
-	if (lag > 0 && lag < Unlag::MAX_HISTORY_TICS) 
+	if (lag > 0 && lag + 1 < history_tics) 
 	{
-		reconcileSectorPositions(lag);
-		reconcilePlayerPositions(shooter_id, lag);
+		reconcileSectorPositions(lag, frac);
+		reconcilePolyobjPositions(lag, frac);
+		reconcilePlayerPositions(shooter_id, lag, frac, angle, spread, range);
 		reconciled = true;
 	}
 }
@@ -529,8 +872,7 @@ void Unlag::restore(byte shooter_id)
 
 	if (reconciled)
 	{
-		reconcileSectorPositions(0);
-		reconcilePlayerPositions(shooter_id, 0);
+		restorePositions();
 		reconciled = false;	 // reset after restoring original positions
 	}
 	
@@ -549,21 +891,23 @@ void Unlag::restore(byte shooter_id)
 // care about this value at the time a player fires a weapon.  The parameter
 // svgametic is the server gametic send when the server sends a positional
 // update, which is returned to the server when the client sends a ticcmd
-// that has the attack button pressed.
+// that has the attack button pressed.  The parameter lerp is how far (0 to
+// FRACUNIT) short of that update the client was showing it when the ticcmd
+// was made, for clients that render between tics.
 
-void Unlag::setRoundtripDelay(byte player_id, byte svgametic)
+void Unlag::setRoundtripDelay(byte player_id, byte svgametic, fixed_t lerp)
 {
 	if (!Unlag::enabled())
 		return;
 
 	size_t maxdelay = TICRATE * sv_maxunlagtime;
-	if (maxdelay > Unlag::MAX_HISTORY_TICS)
-		maxdelay = Unlag::MAX_HISTORY_TICS;
+	if (history_tics >= 2 && maxdelay > history_tics - 2)
+		maxdelay = history_tics - 2;
 
 	size_t delay = ((gametic & 0xFF) + 256 - svgametic) & 0xFF;
 	
-	size_t player_index = player_id_map[player_id];
-	player_history[player_index].current_lag = MIN(delay, maxdelay);
+	current_lag[player_id] = MIN(delay, maxdelay);
+	current_lerp[player_id] = delay > maxdelay ? 0 : clamp(lerp, 0, FRACUNIT - 1);
 	
 	#ifdef _UNLAG_DEBUG_
 	DPrintf("Unlag (%03d): received gametic %d from player %d, lag = %d\n",
@@ -586,12 +930,10 @@ void Unlag::getReconciliationOffset(	byte target_id,
 	if (!reconciled)	// reconciled will only be true if sv_unlag is 1
 		return;
 
-	size_t target_index  = player_id_map[target_id];
-
 	// calculate how far the target was moved during reconciliation
-	x = player_history[target_index].offset_x;
-	y = player_history[target_index].offset_y;
-	z = player_history[target_index].offset_z;
+	x = offset_x[target_id];
+	y = offset_y[target_id];
+	z = offset_z[target_id];
 }
 
 
@@ -606,23 +948,23 @@ void Unlag::getCurrentPlayerPosition(	byte player_id,
 {
 	x = y = z = 0;
 
-	size_t cur = player_id_map[player_id];
-	player_t* player = player_history[cur].player;
+	player_t* player = history_player[player_id];
+	if (!player)
+		player = &idplayer(player_id);
 
-	if (!player || !player->mo || player->spectator)
+	if (!validplayer(*player) || !player->mo || player->spectator)
 		return;
 
+	x = player->mo->x;
+	y = player->mo->y;
+	z = player->mo->z;
+
+	// players that weren't moved have no offset
 	if (Unlag::enabled() && reconciled)
 	{
-		x = player_history[cur].backup_x;
-		y = player_history[cur].backup_y;
-		z = player_history[cur].backup_z;
-	}
-	else
-	{
-		x = player->mo->x;
-		y = player->mo->y;
-		z = player->mo->z;
+		x += offset_x[player_id];
+		y += offset_y[player_id];
+		z += offset_z[player_id];
 	}
 }
 
@@ -636,20 +978,21 @@ void Unlag::debugReconciliation(byte shooter_id)
 {
 	player_t *shooter = &(idplayer(shooter_id));
 	
-	for (size_t i = 0; i < player_history.size(); i++)
+	for (size_t i = 0; i < registered_ids.size(); i++)
 	{
-		if (player_history[i].player->id == shooter_id)
+		byte id = registered_ids[i];
+		if (id == shooter_id)
 			continue;	
 	
-		for (size_t n = 0; n < MAX_HISTORY_TICS; n++)
+		for (size_t n = 0; n < history_tics; n++)
 		{
-			if (n > player_history[i].history_size)
+			if (n > history_size[id])
 				break;
 				
-			size_t cur = (gametic - n) % Unlag::MAX_HISTORY_TICS;
+			size_t cur = id * history_tics + (gametic - n) % history_tics;
 		
-			fixed_t x = player_history[i].history_x[cur];
-			fixed_t y = player_history[i].history_y[cur];
+			fixed_t x = history_x[cur];
+			fixed_t y = history_y[cur];
 			
 			angle_t angle = P_PointToAngle(shooter->mo->x,	shooter->mo->y, x, y);
 			angle_t deltaangle = 	angle - shooter->mo->angle < ANG180 ?
@@ -659,7 +1002,7 @@ void Unlag::debugReconciliation(byte shooter_id)
 			if (deltaangle < 3 * FRACUNIT)
 			{
 				DPrintf("Unlag (%03d): would have hit player %d at gametic %d (%d tics ago)\n",
-						gametic & 0xFF, player_history[i].player->id, (gametic - n) & 0xFF, n);
+						gametic & 0xFF, id, (gametic - n) & 0xFF, n);
 			}
 		}
 	}
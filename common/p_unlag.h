@@ -29,8 +29,8 @@
 #define __PUNLAG_H__
 
 #include <vector>
-#include <map>
 #include "doomtype.h"
+#include "doomdef.h"
 #include "m_fixed.h"
 #include "actor.h"
 #include "d_player.h"
@@ -43,83 +43,113 @@ public:
 	static Unlag& getInstance();  // returns the instantiated Unlag object
 	void reset();	  // called when starting a level
 	void reconcile(byte player_id);
+	void reconcile(byte player_id, angle_t angle, angle_t spread, fixed_t range);
 	void restore(byte player_id);
 	void recordPlayerPositions();
 	void recordSectorPositions();
+	void recordPolyobjPositions();
 	void registerPlayer(byte player_id);
 	void unregisterPlayer(byte player_id);
 	void registerSector(sector_t *sector);
 	void unregisterSector(sector_t *sector);
-	void setRoundtripDelay(byte player_id, byte svgametic);
+	void setRoundtripDelay(byte player_id, byte svgametic, fixed_t lerp);
 	void getReconciliationOffset(	byte target_id,
 									fixed_t &x, fixed_t &y, fixed_t &z);
 	void getCurrentPlayerPosition(	byte player_id,
 									fixed_t &x, fixed_t &y, fixed_t &z);
 	static bool enabled();
-private:
-	static const size_t MAX_HISTORY_TICS = TICRATE;
-		
-	typedef struct {
-		byte		player_id;
-
-		// cached pointer to players[n].  Note: this needs to be updated
-		// EVERYTIME a player connects or disconnects.
-		player_t*	player;
-	
-		fixed_t		history_x[Unlag::MAX_HISTORY_TICS];
-		fixed_t		history_y[Unlag::MAX_HISTORY_TICS];
-		fixed_t		history_z[Unlag::MAX_HISTORY_TICS];
-		size_t		history_size;
-		
-		// current position. restore this position after reconciliation.
-		fixed_t		backup_x;
-		fixed_t		backup_y;
-		fixed_t		backup_z;
-
-		fixed_t		offset_x;
-		fixed_t		offset_y;
-		fixed_t		offset_z;
-		
-		// did we change player's MF_SHOOTABLE flag during reconciliation?
-		bool		changed_flags;
-		int			backup_flags; 
-
-		size_t		current_lag;
-	} PlayerHistoryRecord;
-   
-	class SectorHistoryRecord
+
+	// the value 'frac' (0 to FRACUNIT) of the way from the sample 'newer'
+	// back to the one before it, 'older'
+	static fixed_t interpolate(fixed_t newer, fixed_t older, fixed_t frac)
 	{
-	public:
-		SectorHistoryRecord();
-		SectorHistoryRecord(sector_t *sec);
-
-		sector_t*	sector;
-		size_t		history_size;
-		fixed_t		history_ceilingheight[Unlag::MAX_HISTORY_TICS];
-		fixed_t		history_floorheight[Unlag::MAX_HISTORY_TICS];
-
-		// current position. restore this position after reconciliation.
-		fixed_t		backup_ceilingheight;
-		fixed_t		backup_floorheight;
-	};
-
-	std::vector<PlayerHistoryRecord> player_history;
-	std::vector<SectorHistoryRecord> sector_history;
-	bool reconciled;	
-    
-    // stores an index into the player_history vector, keyed by player_id
-	std::map<byte, size_t> player_id_map;
-
-	Unlag() : reconciled(false) {}  // private contsructor (part of Singleton)
+		return newer + FixedMul(older - newer, frac);
+	}
+
+private:
+	static const size_t MAX_PLAYER_IDS = MAXPLAYERS + 1;
+
+	// how many tics of history are kept, enough for sv_maxunlagtime plus the
+	// sample before the oldest one for interpolating
+	size_t		history_tics;
+	static size_t wantedHistoryTics();
+
+	// The histories are ring buffers indexed by gametic, kept as one array
+	// per field so reconciling only touches the fields it looks at.  Player
+	// histories are indexed directly by player id, history_tics per player.
+	std::vector<fixed_t>	history_x;
+	std::vector<fixed_t>	history_y;
+	std::vector<fixed_t>	history_z;
+	std::vector<fixed_t>	history_radius;
+	std::vector<fixed_t>	history_height;
+	size_t		history_size[MAX_PLAYER_IDS];
+
+	// cached pointer to players[n], NULL if the id isn't registered
+	player_t*	history_player[MAX_PLAYER_IDS];
+	std::vector<byte> registered_ids;
+
+	// current position. restore this position after reconciliation.
+	fixed_t		backup_x[MAX_PLAYER_IDS];
+	fixed_t		backup_y[MAX_PLAYER_IDS];
+	fixed_t		backup_z[MAX_PLAYER_IDS];
+	fixed_t		backup_radius[MAX_PLAYER_IDS];
+	fixed_t		backup_height[MAX_PLAYER_IDS];
+
+	fixed_t		offset_x[MAX_PLAYER_IDS];
+	fixed_t		offset_y[MAX_PLAYER_IDS];
+	fixed_t		offset_z[MAX_PLAYER_IDS];
+
+	// did we change player's MF_SHOOTABLE flag during reconciliation?
+	bool		changed_flags[MAX_PLAYER_IDS];
+	int			backup_flags[MAX_PLAYER_IDS];
+
+	// did we change player's bounding box during reconciliation?
+	bool		changed_box[MAX_PLAYER_IDS];
+
+	// how many tics the player's view is behind, and the fraction of a tic
+	// further back their screen was showing when they fired
+	size_t		current_lag[MAX_PLAYER_IDS];
+	fixed_t		current_lerp[MAX_PLAYER_IDS];
+
+	// moving sectors, with history_tics heights per sector
+	std::vector<sector_t*>	sector_list;
+	std::vector<fixed_t>	sector_ceilingheight;
+	std::vector<fixed_t>	sector_floorheight;
+	std::vector<fixed_t>	sector_backup_ceilingheight;
+	std::vector<fixed_t>	sector_backup_floorheight;
+
+	// every polyobj on the level, with history_tics positions each
+	std::vector<fixed_t>	polyobj_x;
+	std::vector<fixed_t>	polyobj_y;
+	std::vector<angle_t>	polyobj_angle;
+	std::vector<fixed_t>	polyobj_backup_x;
+	std::vector<fixed_t>	polyobj_backup_y;
+	std::vector<angle_t>	polyobj_backup_angle;
+
+	// what the current reconciliation moved, so restore only touches those
+	std::vector<byte>		moved_players;
+	std::vector<size_t>		moved_sectors;
+	std::vector<size_t>		moved_polyobjs;
+
+	bool reconciled;
+
+	Unlag();						// private contsructor (part of Singleton)
 	Unlag(const Unlag &rhs);		// private copy constructor
 	Unlag& operator=(const Unlag &rhs);	//private assignment operator
 
 	void movePlayer(player_t *player, fixed_t x, fixed_t y, fixed_t z);
 	void moveSector(sector_t *sector, 
 					fixed_t ceilingheight, fixed_t floorheight);
-	void reconcilePlayerPositions(byte shooter_id, size_t ticsago);
-	void reconcileSectorPositions(size_t ticsago);
+	void reconcilePlayerPositions(byte shooter_id, size_t ticsago, fixed_t frac,
+								  angle_t angle, angle_t spread, fixed_t range);
+	void reconcileSectorPositions(size_t ticsago, fixed_t frac);
+	void reconcilePolyobjPositions(size_t ticsago, fixed_t frac);
+	void resizeHistory();
+	void restorePositions();
 	void refreshRegisteredPlayers();
+	static bool boxInTrace(fixed_t x, fixed_t y, fixed_t left, fixed_t right,
+						   fixed_t bottom, fixed_t top,
+						   angle_t angle, angle_t spread, fixed_t range);
 
 	void debugReconciliation(byte shooter_id);
 };
@@ -44,6 +44,7 @@
 
 BOOL PO_MovePolyobj (int num, int x, int y);
 BOOL PO_RotatePolyobj (int num, angle_t angle);
+void PO_SetPolyobjPosition (polyobj_t *po, fixed_t x, fixed_t y, angle_t angle);
 void PO_Init (void);
 
 // PRIVATE FUNCTION PROTOTYPES ---------------------------------------------
@@ -904,6 +905,56 @@ BOOL PO_RotatePolyobj (int num, angle_t angle)
 	return true;
 }
 
+//
+// PO_SetPolyobjPosition
+//
+// Puts a polyobj back where it was at some earlier point, given by its start
+// spot and angle.  Unlike PO_MovePolyobj and PO_RotatePolyobj, nothing can
+// block it and nothing gets pushed: used by the unlagging system, which
+// always moves it back again right away.
+//
+void PO_SetPolyobjPosition (polyobj_t *po, fixed_t x, fixed_t y, angle_t angle)
+{
+	int count;
+	seg_t **segList;
+	vertex_t *originalPts;
+	int an;
+
+	if (po->startSpot[0] == x && po->startSpot[1] == y && po->angle == angle)
+		return;
+
+	an = angle >> ANGLETOFINESHIFT;
+
+	UnLinkPolyobj(po);
+
+	segList = po->segs;
+	originalPts = po->originalPts;
+
+	for (count = po->numsegs; count; count--, segList++, originalPts++)
+	{
+		(*segList)->v1->x = originalPts->x;
+		(*segList)->v1->y = originalPts->y;
+		RotatePt (an, &(*segList)->v1->x, &(*segList)->v1->y, x, y);
+	}
+
+	segList = po->segs;
+	validcount++;
+	for (count = po->numsegs; count; count--, segList++)
+	{
+		if ((*segList)->linedef->validcount != validcount)
+		{
+			UpdateSegBBox(*segList);
+			(*segList)->linedef->validcount = validcount;
+		}
+		(*segList)->angle += angle - po->angle;
+	}
+
+	po->startSpot[0] = x;
+	po->startSpot[1] = y;
+	po->angle = angle;
+	LinkPolyobj(po);
+}
+
 //
 // UnLinkPolyobj
 //
@@ -24,6 +24,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <cassert>
+
+#include "win32inc.h"
+#ifdef _WIN32
+	#include <process.h>
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#ifdef __linux__
+	#include <sys/syscall.h>
+#endif
 
 #include "doomtype.h"
 #include "v_video.h"
@@ -34,9 +47,80 @@
 #include "i_system.h"
 
 std::vector<FStat*> FStat::stats;
+FStat *FStat::current = NULL;
+
+// every timing, oldest first once it wraps, for "profile dump"
+struct stat_event_t
+{
+	FStat		*stat;
+	dtime_t		start;
+	dtime_t		elapsed;
+};
+
+static const size_t STAT_TRACE_EVENTS = 65536;
+static stat_event_t stat_trace[STAT_TRACE_EVENTS];
+static size_t stat_trace_next = 0;
+
+//
+// The stats, their history and the trace aren't locked, so only the main
+// thread may clock them.  Stats clocked anywhere else are ignored, and
+// trip an assert in debug builds.
+//
+#ifdef _WIN32
+typedef DWORD stat_thread_t;
+
+static stat_thread_t StatThread()
+{
+	return GetCurrentThreadId();
+}
+
+static bool StatSameThread(stat_thread_t a, stat_thread_t b)
+{
+	return a == b;
+}
+#else
+typedef pthread_t stat_thread_t;
+
+static stat_thread_t StatThread()
+{
+	return pthread_self();
+}
+
+static bool StatSameThread(stat_thread_t a, stat_thread_t b)
+{
+	return pthread_equal(a, b) != 0;
+}
+#endif
+
+//
+// StatThreadId
+//
+// The id the OS shows for the calling thread, for the trace.
+//
+static unsigned long StatThreadId()
+{
+#if defined(_WIN32)
+	return GetCurrentThreadId();
+#elif defined(__linux__)
+	return (unsigned long)syscall(SYS_gettid);
+#else
+	return (unsigned long)getpid();
+#endif
+}
+
+// static initialization happens on the main thread
+static const stat_thread_t stat_main_thread = StatThread();
+static const unsigned long stat_main_thread_id = StatThreadId();
+
+static bool StatOnMainThread()
+{
+	bool main = StatSameThread(StatThread(), stat_main_thread);
+	assert(main);
+	return main;
+}
 
 FStat::FStat (const char *cname)
-: name(cname)
+: last_clock(0), last_elapsed(0), calls(0), parent(NULL), name(cname)
 {
 	stats.push_back(this);
 }
@@ -51,17 +135,38 @@ FStat::~FStat ()
 
 void FStat::clock()
 {
-	last_clock = I_MSTime();
+	if (!StatOnMainThread())
+		return;
+
+	parent = current;
+	current = this;
+
+	last_clock = I_GetTime();
 }
 
 void FStat::unclock()
 {
-	last_elapsed = I_MSTime() - last_clock;
+	if (!StatOnMainThread())
+		return;
+
+	last_elapsed = I_GetTime() - last_clock;
+
+	history[calls % STAT_HISTORY] = last_elapsed;
+	calls++;
+
+	current = parent;
+
+	stat_event_t &ev = stat_trace[stat_trace_next % STAT_TRACE_EVENTS];
+	ev.stat = this;
+	ev.start = last_clock;
+	ev.elapsed = last_elapsed;
+	stat_trace_next++;
 }
 
 void FStat::reset()
 {
 	last_elapsed = last_clock = 0;
+	calls = 0;
 }
 
 const char *FStat::getname()
@@ -69,6 +174,37 @@ const char *FStat::getname()
 	return name.c_str();
 }
 
+//
+// FStat::summarize
+//
+// Over the last STAT_HISTORY timings.
+//
+void FStat::summarize(dtime_t &min, dtime_t &avg, dtime_t &p99, dtime_t &max)
+{
+	size_t count = calls < STAT_HISTORY ? (size_t)calls : STAT_HISTORY;
+
+	min = avg = p99 = max = 0;
+	if (!count)
+		return;
+
+	std::vector<dtime_t> sorted(history, history + count);
+	std::vector<dtime_t>::iterator nth = sorted.begin() + (count * 99) / 100;
+	std::nth_element(sorted.begin(), nth, sorted.end());
+	p99 = *nth;
+
+	min = max = history[0];
+	dtime_t total = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		min = MIN(min, history[i]);
+		max = MAX(max, history[i]);
+		total += history[i];
+	}
+
+	avg = total / count;
+}
+
 void FStat::dumpstat()
 {
 	for(size_t i = 0; i < stats.size(); i++)
@@ -84,7 +220,97 @@ void FStat::dumpstat(std::string which)
 
 void FStat::dump()
 {
-	Printf(PRINT_HIGH, "%s: %dms\n", name.c_str(), last_elapsed);
+	dtime_t min, avg, p99, max;
+	summarize(min, avg, p99, max);
+
+	Printf(PRINT_HIGH, "%s: %.1fus, min %.1fus, avg %.1fus, p99 %.1fus, max %.1fus over %u calls\n",
+		name.c_str(), last_elapsed / 1000.0, min / 1000.0, avg / 1000.0,
+		p99 / 1000.0, max / 1000.0, (unsigned int)MIN(calls, (QWORD)STAT_HISTORY));
+}
+
+//
+// FStat::dumptree
+//
+// Every stat that has run, under the one it runs inside of.
+//
+void FStat::dumptree(int indent)
+{
+	dtime_t min, avg, p99, max;
+	summarize(min, avg, p99, max);
+
+	Printf(PRINT_HIGH, "%*s%-*s %9.1f %9.1f %9.1f %9.1f %9llu\n",
+		indent, "", 28 - indent, name.c_str(), min / 1000.0, avg / 1000.0,
+		p99 / 1000.0, max / 1000.0, (unsigned long long)calls);
+
+	for (size_t i = 0; i < stats.size(); i++)
+		if (stats[i]->parent == this && stats[i]->calls)
+			stats[i]->dumptree(indent + 2);
+}
+
+void FStat::dumptree()
+{
+	Printf(PRINT_HIGH, "%-28s %9s %9s %9s %9s %9s\n", "stat", "min us", "avg us", "p99 us", "max us", "calls");
+
+	for (size_t i = 0; i < stats.size(); i++)
+		if (!stats[i]->parent && stats[i]->calls)
+			stats[i]->dumptree(0);
+}
+
+void FStat::resetall()
+{
+	for (size_t i = 0; i < stats.size(); i++)
+		stats[i]->reset();
+
+	stat_trace_next = 0;
+}
+
+//
+// FStat::dumptrace
+//
+// Writes the recorded timings as Chrome trace events, which chrome://tracing
+// and Perfetto can show.
+//
+bool FStat::dumptrace(const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if (!f)
+		return false;
+
+	size_t count = MIN(stat_trace_next, STAT_TRACE_EVENTS);
+	size_t first = stat_trace_next - count;
+
+	// events are recorded as they finish, the outermost last
+	dtime_t base = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		const stat_event_t &ev = stat_trace[(first + i) % STAT_TRACE_EVENTS];
+		if (i == 0 || ev.start < base)
+			base = ev.start;
+	}
+
+#ifdef _WIN32
+	int pid = _getpid();
+#else
+	int pid = getpid();
+#endif
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const stat_event_t &ev = stat_trace[(first + i) % STAT_TRACE_EVENTS];
+
+		fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+			i ? "," : "", ev.stat->getname(), pid, stat_main_thread_id,
+			(ev.start - base) / 1000.0, ev.elapsed / 1000.0);
+	}
+
+	fprintf(f, "\n]}\n");
+
+	bool ok = !ferror(f);
+	fclose(f);
+
+	return ok;
 }
 
 BEGIN_COMMAND (stat)
@@ -101,6 +327,39 @@ BEGIN_COMMAND (stat)
 }
 END_COMMAND (stat)
 
+//
+// profile
+//
+//   profile           timings of everything that has run so far
+//   profile reset     starts over
+//   profile dump [f]  writes the last timings as a Chrome trace
+//
+BEGIN_COMMAND (profile)
+{
+	if (argc < 2)
+	{
+		FStat::dumptree ();
+	}
+	else if (stricmp (argv[1], "reset") == 0)
+	{
+		FStat::resetall ();
+	}
+	else if (stricmp (argv[1], "dump") == 0)
+	{
+		const char *filename = argc > 2 ? argv[2] : "profile.json";
+
+		if (FStat::dumptrace (filename))
+			Printf (PRINT_HIGH, "Wrote %s\n", filename);
+		else
+			Printf (PRINT_HIGH, "Could not write %s\n", filename);
+	}
+	else
+	{
+		Printf (PRINT_HIGH, "Usage: profile [reset | dump [filename]]\n");
+	}
+}
+END_COMMAND (profile)
+
 
 VERSION_CONTROL (stats_cpp, "$Id$")
 
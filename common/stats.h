@@ -29,6 +29,17 @@
 #include <string>
 #include <algorithm>
 
+#include "doomtype.h"
+
+//
+// FStat
+//
+// Times a piece of code with I_GetTime.  The last STAT_HISTORY timings are
+// kept for min/avg/p99/max, and every timing also goes into a trace that
+// "profile dump" writes out.  A stat that starts while another one is
+// running counts as part of it.  Only the main thread may clock stats; see
+// stats.cpp.
+//
 class FStat
 {
 public:
@@ -46,21 +57,53 @@ public:
 	static void dumpstat(std::string which);
 	void dump();
 
+	static void dumptree();
+	static void resetall();
+	static bool dumptrace(const char *filename);
+
 private:
 
-	QWORD last_clock, last_elapsed;
+	static const size_t STAT_HISTORY = 512;
+
+	dtime_t last_clock, last_elapsed;
+	dtime_t history[STAT_HISTORY];
+	QWORD calls;
+	FStat *parent;					// what was running when this started
 	std::string name;
+
 	static std::vector<FStat*> stats;
+	static FStat *current;
+
+	void summarize(dtime_t &min, dtime_t &avg, dtime_t &p99, dtime_t &max);
+	void dumptree(int indent);
+};
+
+//
+// FStatScope
+//
+// Clocks a stat for as long as it is in scope, so every return is covered.
+//
+class FStatScope
+{
+public:
+	FStatScope (FStat &s) : stat(s) { stat.clock(); }
+	~FStatScope () { stat.unclock(); }
+
+private:
+	FStat &stat;
 };
 
-#define BEGIN_STAT(n) \
+#define DECLARE_STAT(n) \
 	static class Stat_##n : public FStat { \
 		public: \
 			Stat_##n () : FStat (#n) {} \
-} Stat_var_##n; Stat_var_##n.clock();
+} Stat_var_##n;
+
+#define BEGIN_STAT(n) DECLARE_STAT(n) Stat_var_##n.clock();
 
 #define END_STAT(n) Stat_var_##n.unclock();
 
-#endif //__STATS_H__
+#define SCOPED_STAT(n) DECLARE_STAT(n) FStatScope Stat_scope_##n(Stat_var_##n);
 
+#endif //__STATS_H__
 
@@ -38,6 +38,7 @@
 #include <netdb.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/select.h>
 #endif
 
 #include "i_net.h"
@@ -246,6 +247,26 @@ void NET_SendPacket(int length, byte *data, netadr_t to)
     }
 }
 
+//
+// NET_WaitForPacket
+//
+// Sleep until a packet arrives or ms milliseconds have passed.  Returns true
+// if there's something to read.
+//
+bool NET_WaitForPacket(int ms)
+{
+	fd_set readfds;
+	struct timeval timeout;
+
+	FD_ZERO(&readfds);
+	FD_SET(net_socket, &readfds);
+
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
+
+	return select(net_socket + 1, &readfds, NULL, NULL, &timeout) > 0;
+}
+
 //
 // InitNetCommon
 //
@@ -260,6 +281,12 @@ void InitNetCommon(void)
 
    net_socket = UDPsocket();
    BindToLocalPort(net_socket, localport);
+
+   // room for bursts of launcher queries and server replies; the system
+   // may give us less
+   int rcvbuf = 1024 * 1024;
+   if (setsockopt(net_socket, SOL_SOCKET, SO_RCVBUF, (const char *)&rcvbuf, sizeof(rcvbuf)) == -1)
+       printf("UDPsocket: setsockopt SO_RCVBUF: %s\n", strerror(errno));
    if (ioctlsocket(net_socket, FIONBIO, &_true) == -1)
        printf("UDPsocket: ioctl FIONBIO: %s", strerror(errno));
 
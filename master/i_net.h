@@ -310,5 +310,6 @@ bool NET_StringToAdr(char *s, netadr_t *a);
 bool NET_CompareAdr(netadr_t a, netadr_t b);
 int  NET_GetPacket(void);
 void NET_SendPacket(int length, byte *data, netadr_t to);
+bool NET_WaitForPacket(int ms);
 
 #endif
@@ -36,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <stdint.h>
 
@@ -47,19 +48,29 @@
 
 #ifdef _WIN32
 #include <winsock.h>
-#include <time.h>
-#define usleep(n) Sleep(n/1000)
 #endif
 
 #include "i_net.h"
-
-using namespace std;
+#include "hashtable.h"
 
 #define MAX_SERVERS					1024
 #define MAX_SERVERS_PER_IP			64
+
+// ages are in tics of TIC_MS milliseconds
+#define TIC_MS						50
 #define MAX_SERVER_AGE				5000
 #define MAX_UNVERIFIED_SERVER_AGE	1000
 
+// Verified servers are asked for their details every PING_INTERVAL tics, and
+// an unverified one again when it makes contact, if it was last asked more
+// than PING_RETRY tics ago.  No more than PING_BATCH are asked in one tic.
+#define PING_INTERVAL				600
+#define PING_RETRY					100
+#define PING_BATCH					64
+
+// Has to be more than PING_INTERVAL
+#define PING_WHEEL_SIZE				1024
+
 #define LOGFILE "master_log.txt"
 
 buf_t message(MAX_UDP_PACKET);
@@ -67,58 +78,121 @@ buf_t message(MAX_UDP_PACKET);
 typedef struct server
 {
 	netadr_t addr;
-	int age;
+
+	// tics when we last heard from it, asked it for its details and will
+	// next check on it
+	unsigned int last_heard, last_pinged, next_check;
 
 	// from server itself
-	string hostname;
+	std::string hostname;
 	int players, maxplayers;
-	string map;
-	vector<string> pwads;
+	std::string map;
+	std::vector<std::string> pwads;
 	int gametype, skill, teamplay, ctfmode;
-	vector<string> playernames;
-	vector<int> playerfrags;
-	vector<int> playerpings;
-	vector<int> playerteams;
+	std::vector<std::string> playernames;
+	std::vector<int> playerfrags;
+	std::vector<int> playerpings;
+	std::vector<int> playerteams;
 
 	unsigned int key_sent;
 	bool pinged, verified;
 
-	server() : age(0), players(0), maxplayers(0), gametype(0), skill(0), teamplay(0), ctfmode(0), key_sent(0), pinged(0), verified(0) { memset(&addr, 0, sizeof(addr)); }
+	server() : last_heard(0), last_pinged(0), next_check(0), players(0), maxplayers(0), gametype(0), skill(0), teamplay(0), ctfmode(0), key_sent(0), pinged(0), verified(0) { memset(&addr, 0, sizeof(addr)); }
 
 } SServer;
 
-list<SServer> servers;
-list<SServer>::iterator ping_itr = servers.begin(); // this iterator must be updated when servers is changed
+typedef std::list<SServer> server_list_t;
+typedef unsigned long long server_key_t;
+
+// In the order they registered, with an index by address and port.  List
+// iterators stay put when other servers come and go.
+server_list_t servers;
+OHashTable<server_key_t, server_list_t::iterator> server_index(MAX_SERVERS * 2);
+
+// Verified servers, in all and for each address
+size_t verified_servers = 0;
+OHashTable<unsigned int, int> verified_per_ip;
+
+// What launchers are sent, rebuilt when a server is verified or goes away,
+// and whether the details in the file are out of date.
+buf_t server_list(4 + 2 + 6 * MAX_SERVERS + 1);
+bool server_list_changed = true;
+bool server_file_changed = true;
+
+// Servers due a check, by the tic they're due in.  A server that's been
+// rescheduled or removed can leave entries behind, they're ignored when
+// next_check doesn't match.
+unsigned int tic = 0;
+std::vector<server_key_t> ping_wheel[PING_WHEEL_SIZE];
+
+unsigned int ipKey(const netadr_t &addr)
+{
+	unsigned int key;
+	memcpy(&key, addr.ip, sizeof(key));
+	return key;
+}
+
+server_key_t serverKey(const netadr_t &addr)
+{
+	return ((server_key_t)ipKey(addr) << 16) | addr.port;
+}
 
 bool ipReachedLimit(netadr_t addr)
 {
-	list<SServer>::iterator itr;
-	int verifiedservers = 0;
+	OHashTable<unsigned int, int>::iterator it = verified_per_ip.find(ipKey(addr));
 
-	// count verified servers
-	for (itr = servers.begin(); itr != servers.end(); ++itr)
-		if ((*itr).verified && memcmp(&(*itr).addr.ip, &addr.ip, 4) == 0)
-			verifiedservers++;
+	return it != verified_per_ip.end() && it->second >= MAX_SERVERS_PER_IP;
+}
 
-	return verifiedservers >= MAX_SERVERS_PER_IP;
+void scheduleCheck(SServer &s, unsigned int delay)
+{
+	if (delay < 1)
+		delay = 1;
+	if (delay >= PING_WHEEL_SIZE)
+		delay = PING_WHEEL_SIZE - 1;
+
+	s.next_check = tic + delay;
+	ping_wheel[s.next_check % PING_WHEEL_SIZE].push_back(serverKey(s.addr));
+}
+
+void removeServer(server_list_t::iterator itr)
+{
+	SServer &s = *itr;
+
+	if (s.verified)
+	{
+		verified_servers--;
+
+		OHashTable<unsigned int, int>::iterator it = verified_per_ip.find(ipKey(s.addr));
+		if (it != verified_per_ip.end() && --it->second <= 0)
+			verified_per_ip.erase(it);
+
+		server_list_changed = true;
+		server_file_changed = true;
+	}
+
+	server_index.erase(serverKey(s.addr));
+	servers.erase(itr);
 }
 
 void addServer(netadr_t addr)
 {
-	list<SServer>::iterator itr;
-	SServer temp;
+	server_key_t key = serverKey(addr);
+	OHashTable<server_key_t, server_list_t::iterator>::iterator it = server_index.find(key);
 
-	for (itr = servers.begin(); itr != servers.end(); ++itr)
+	if (it != server_index.end())
 	{
-		if (memcmp(&(*itr).addr.ip, &addr.ip, 4) == 0)
+		SServer &s = *it->second;
+
+		s.last_heard = tic;
+
+		// it didn't answer last time, ask again
+		if (!s.verified && s.pinged && tic - s.last_pinged >= PING_RETRY)
 		{
-			if ((*itr).addr.port == addr.port)
-			{
-				(*itr).age = 0;
-				(*itr).pinged = false;
-				return;
-			}
+			s.pinged = false;
+			scheduleCheck(s, 1);
 		}
+		return;
 	}
 
 	if (servers.size() < MAX_SERVERS)
@@ -126,10 +200,15 @@ void addServer(netadr_t addr)
 		if(ipReachedLimit(addr))
 			return;
 
+		SServer temp;
 		memcpy(&temp.addr, &addr, sizeof(addr));
-		temp.age = 0;
+		temp.last_heard = tic;
 		servers.push_back(temp);
 
+		server_list_t::iterator itr = --servers.end();
+		server_index[key] = itr;
+		scheduleCheck(*itr, 1);
+
 		printf("Added new server: %s, %d total\n", NET_AdrToString(temp.addr), (int)servers.size());
 		FILE *fp = fopen(LOGFILE, "a");
 
@@ -148,113 +227,73 @@ void addServer(netadr_t addr)
 
 void addServerInfo(netadr_t addr)
 {
-	list<SServer>::iterator itr;
 	size_t i;
 
-	for (itr = servers.begin(); itr != servers.end(); ++itr)
-	{
-		if (memcmp(&(*itr).addr.ip, &addr.ip, 4) != 0)
-			continue;
+	OHashTable<server_key_t, server_list_t::iterator>::iterator it = server_index.find(serverKey(addr));
 
-		if ((*itr).addr.port != addr.port)
-			continue;
+	if (it == server_index.end())
+		return;
 
-		SServer &s = *itr;
+	SServer &s = *it->second;
 
-		if(!s.key_sent)
-			continue;
+	if(!s.key_sent)
+		return;
 
-		net_message.ReadLong();
+	net_message.ReadLong();
 
-		// check key against one we issued
-		if((unsigned)net_message.ReadLong() != s.key_sent)
-			continue;
+	// check key against one we issued
+	if((unsigned)net_message.ReadLong() != s.key_sent)
+		return;
 
-		// do not allow too many servers
-		if(ipReachedLimit((*itr).addr))
-			continue;
+	// do not allow too many servers
+	if(!s.verified && ipReachedLimit(s.addr))
+		return;
 
-		printf("Server info, IP = %s\n", NET_AdrToString(addr));
+	printf("Server info, IP = %s\n", NET_AdrToString(addr));
 
+	if (!s.verified)
+	{
 		s.verified = true;
-		s.age = 0;
-
-		s.hostname = net_message.ReadString();
-		s.players = net_message.ReadByte();
-		s.maxplayers = net_message.ReadByte();
-		s.map = net_message.ReadString();
-
-		int pwadcount = net_message.ReadByte();
-		if(pwadcount < 0)
-			pwadcount = 0;
-
-		s.pwads.resize(pwadcount);
+		verified_servers++;
+		verified_per_ip[ipKey(s.addr)]++;
+		server_list_changed = true;
+	}
 
-		for(i = 0; i < s.pwads.size(); i++)
-			s.pwads[i] = net_message.ReadString();
+	s.last_heard = tic;
+	server_file_changed = true;
 
-		s.gametype = net_message.ReadByte();
-		s.skill = net_message.ReadByte();
-		s.teamplay = net_message.ReadByte();
-		s.ctfmode = net_message.ReadByte();
+	s.hostname = net_message.ReadString();
+	s.players = net_message.ReadByte();
+	s.maxplayers = net_message.ReadByte();
+	s.map = net_message.ReadString();
 
-		byte playercount = net_message.ReadByte();
+	int pwadcount = net_message.ReadByte();
+	if(pwadcount < 0)
+		pwadcount = 0;
 
-		s.playernames.resize(playercount);
-		s.playerfrags.resize(playercount);
-		s.playerpings.resize(playercount);
-		s.playerteams.resize(playercount);
+	s.pwads.resize(pwadcount);
 
-		for(i = 0; i < playercount; i++)
-		{
-			s.playernames[i] = net_message.ReadString();
-			s.playerfrags[i] = net_message.ReadShort();
-			s.playerpings[i] = net_message.ReadLong();
-			s.playerteams[i] = net_message.ReadByte();
-		}
-
-		break;
-	}
+	for(i = 0; i < s.pwads.size(); i++)
+		s.pwads[i] = net_message.ReadString();
 
-	return;
-}
+	s.gametype = net_message.ReadByte();
+	s.skill = net_message.ReadByte();
+	s.teamplay = net_message.ReadByte();
+	s.ctfmode = net_message.ReadByte();
 
-void ageServers(void)
-{
-	list<SServer>::iterator itr;
+	size_t playercount = net_message.ReadByte();
 
-	itr = servers.begin();
+	s.playernames.resize(playercount);
+	s.playerfrags.resize(playercount);
+	s.playerpings.resize(playercount);
+	s.playerteams.resize(playercount);
 
-	while (itr != servers.end())
+	for(i = 0; i < playercount; i++)
 	{
-		(*itr).age++;
-
-		if((*itr).verified)
-		{
-			if ((*itr).age > MAX_SERVER_AGE)
-			{
-				printf("Remote server timed out: %s, ", NET_AdrToString((*itr).addr));
-				if(ping_itr == itr)
-					++ping_itr;
-				itr = servers.erase(itr);
-				printf("%d total\n", (int)servers.size());
-			}
-			else
-				++itr;
-		}
-		else
-		{
-			if ((*itr).age > MAX_UNVERIFIED_SERVER_AGE)
-			{
-				printf("Remote server timed out: %s, ", NET_AdrToString((*itr).addr));
-				if(ping_itr == itr)
-					++ping_itr;
-				itr = servers.erase(itr);
-				printf("%d total\n", (int)servers.size());
-			}
-			else
-				++itr;
-		}
+		s.playernames[i] = net_message.ReadString();
+		s.playerfrags[i] = net_message.ReadShort();
+		s.playerpings[i] = net_message.ReadLong();
+		s.playerteams[i] = net_message.ReadByte();
 	}
 }
 
@@ -272,8 +311,9 @@ void dumpServersToFile(const char *file = "./latest")
 	}
 
 	file_error = false;
+	server_file_changed = false;
 
-	list<SServer>::iterator itr;
+	server_list_t::iterator itr;
 
 	itr = servers.begin();
 
@@ -289,7 +329,7 @@ void dumpServersToFile(const char *file = "./latest")
 			continue;
 		}
 
-        string detectgametype = "ERROR";
+        std::string detectgametype = "ERROR";
 		if((*itr).gametype == 0)
 			detectgametype = "COOP";
 		else
@@ -299,7 +339,7 @@ void dumpServersToFile(const char *file = "./latest")
 		if((*itr).ctfmode == 1)
 			detectgametype = "CTF";
 
-		string str_wads;
+		std::string str_wads;
 		for(size_t j = 0; j < (*itr).pwads.size(); j++)
 		{
 			str_wads += (*itr).pwads[j];
@@ -319,15 +359,11 @@ void dumpServersToFile(const char *file = "./latest")
 
 void writeServerData(void)
 {
-	list<SServer>::iterator itr;
-	size_t num_verified = 0;
+	server_list_t::iterator itr;
 
-	// count verified servers
-	for (itr = servers.begin(); itr != servers.end(); ++itr)
-		if((*itr).verified)
-			num_verified++;
-
-	message.WriteShort(num_verified);
+	server_list.clear();
+	server_list.WriteLong(LAUNCHER_CHALLENGE);
+	server_list.WriteShort(verified_servers);
 
 	for (itr = servers.begin(); itr != servers.end(); ++itr)
 	{
@@ -335,9 +371,11 @@ void writeServerData(void)
 			continue;
 
 		for (int i = 0; i < 4; ++i)
-			message.WriteByte((*itr).addr.ip[i]);
-		message.WriteShort(htons((*itr).addr.port));
+			server_list.WriteByte((*itr).addr.ip[i]);
+		server_list.WriteShort(htons((*itr).addr.port));
 	}
+
+	server_list_changed = false;
 }
 
 void daemon_init(void)
@@ -361,11 +399,6 @@ void daemon_init(void)
 
 void pingServer(SServer &s)
 {
-	if(s.pinged && !s.verified)
-	{
-		return; // have already asked and got no answer
-	}
-
 #ifdef _WIN32
 	s.key_sent = rand() * (intptr_t)GetModuleHandle(0) * time(0);
 #else
@@ -379,82 +412,163 @@ void pingServer(SServer &s)
 	NET_SendPacket(message.cursize, message.data, s.addr);
 
 	s.pinged = true;
+	s.last_pinged = tic;
 }
 
-int main()
+//
+// checkServer
+//
+// Times the server out, or asks it for its details if it's time to, and
+// works out when to look at it next.
+//
+void checkServer(server_list_t::iterator itr, int &pings)
 {
-	int challenge;
-	localport = MASTERPORT;
-	InitNetCommon();
+	SServer &s = *itr;
+	unsigned int age = tic - s.last_heard;
+	unsigned int max_age = s.verified ? MAX_SERVER_AGE : MAX_UNVERIFIED_SERVER_AGE;
 
-	daemon_init();
-
-	printf("Odamex Master Started\n");
+	if (age > max_age)
+	{
+		printf("Remote server timed out: %s, ", NET_AdrToString(s.addr));
+		removeServer(itr);
+		printf("%d total\n", (int)servers.size());
+		return;
+	}
 
-	while (true)
+	// unless it's been asked already and not answered
+	if (s.verified || !s.pinged)
 	{
-		while (NET_GetPacket())
+		if (pings >= PING_BATCH)
 		{
-			challenge = net_message.ReadLong();
+			scheduleCheck(s, 1);
+			return;
+		}
+
+		pingServer(s);
+		pings++;
+	}
 
-			switch (challenge)
+	unsigned int delay = max_age + 1 - age;
+	if (s.verified && delay > PING_INTERVAL)
+		delay = PING_INTERVAL;
+
+	scheduleCheck(s, delay);
+}
+
+//
+// runTic
+//
+void runTic(void)
+{
+	tic++;
+
+	std::vector<server_key_t> &due = ping_wheel[tic % PING_WHEEL_SIZE];
+	int pings = 0;
+
+	// checkServer never schedules anything for this tic, so due won't change
+	for (size_t i = 0; i < due.size(); i++)
+	{
+		OHashTable<server_key_t, server_list_t::iterator>::iterator it = server_index.find(due[i]);
+
+		if (it == server_index.end() || it->second->next_check != tic)
+			continue;
+
+		checkServer(it->second, pings);
+	}
+
+	due.clear();
+
+	if (!(tic % 100) && server_file_changed)
+		dumpServersToFile();
+}
+
+//
+// msTime
+//
+unsigned int msTime(void)
+{
+#ifdef _WIN32
+	return GetTickCount();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+void handlePacket(void)
+{
+	int challenge = net_message.ReadLong();
+
+	switch (challenge)
+	{
+	case 0:
+	case SERVER_CHALLENGE:
+		if(net_message.BytesLeftToRead() > 2)
+		{
+			// full reply with deathmatch, wad, etc
+			addServerInfo(net_from);
+		}
+		else
+		{
+			// plain contact
+			if(net_message.BytesLeftToRead() == 2)
 			{
-			case 0:
-			case SERVER_CHALLENGE:
-				if(net_message.BytesLeftToRead() > 2)
-				{
-					// full reply with deathmatch, wad, etc
-					addServerInfo(net_from);
-				}
-				else
-				{
-					// plain contact
-					if(net_message.BytesLeftToRead() == 2)
-					{
-						unsigned short use_port = net_message.ReadShort();
-						net_from.port = htons(use_port);
-					}
-
-					addServer(net_from);
-				}
-			    break;
-			case LAUNCHER_CHALLENGE:
-				if(net_message.BytesLeftToRead() > 0)
-				{
-					printf("Master syncing server list (ignored), IP = %s\n", NET_AdrToString(net_from));
-				}
-				else
-				{
-					printf("Client request IP = %s\n", NET_AdrToString(net_from));
-					message.clear();
-					message.WriteLong(LAUNCHER_CHALLENGE);
-					writeServerData();
-					NET_SendPacket(message.cursize, message.data, net_from);
-				}
-			    break;
-			default:
-				break;
+				unsigned short use_port = net_message.ReadShort();
+				net_from.port = htons(use_port);
 			}
+
+			addServer(net_from);
+		}
+		break;
+	case LAUNCHER_CHALLENGE:
+		if(net_message.BytesLeftToRead() > 0)
+		{
+			printf("Master syncing server list (ignored), IP = %s\n", NET_AdrToString(net_from));
+		}
+		else
+		{
+			printf("Client request IP = %s\n", NET_AdrToString(net_from));
+
+			if (server_list_changed)
+				writeServerData();
+
+			NET_SendPacket(server_list.cursize, server_list.data, net_from);
 		}
+		break;
+	default:
+		break;
+	}
+}
 
-		static int counter = 0;
+int main()
+{
+	localport = MASTERPORT;
+	InitNetCommon();
 
-		usleep(50*1000); // every 50ms // denis - fixme - use proper timer, age of servers should increase even during packet sending
+	daemon_init();
 
-		ageServers();
+	printf("Odamex Master Started\n");
 
-		if(!(counter%100))
-		{
-			dumpServersToFile();
+	unsigned int last_tic = msTime();
 
-			if (ping_itr == servers.end())
-				ping_itr = servers.begin();
+	while (true)
+	{
+		int wait = TIC_MS - (int)(msTime() - last_tic);
 
-			if(ping_itr != servers.end())
-				pingServer(*(ping_itr++));
-		}
+		if (wait > 0)
+			NET_WaitForPacket(wait);
+
+		// answer everything that's come in, unless a tic is due
+		while ((int)(msTime() - last_tic) < TIC_MS && NET_GetPacket())
+			handlePacket();
 
-		counter++;
+		while ((int)(msTime() - last_tic) >= TIC_MS)
+		{
+			last_tic += TIC_MS;
+			runTic();
+		}
 	}
 
 	servers.clear();
@@ -88,6 +88,7 @@ void C_DoCommand (const char *cmd);
 
 #ifdef UNIX
 void daemon_init();
+void instances_init(int count);
 #endif
 
 void D_DoomLoop (void);
@@ -294,6 +295,14 @@ void D_DoomMain()
 	D_Init();
 	atterm(D_Shutdown);
 
+	#ifdef UNIX
+	// everything loaded so far is shared between the instances
+	const char *instances_arg = Args.CheckValue("-instances");
+	int instances = instances_arg ? atoi(instances_arg) : 1;
+	if (instances > 1)
+		instances_init(instances);
+	#endif
+
 	Printf(PRINT_HIGH, "SV_InitNetwork: Checking network game status.\n");
 	SV_InitNetwork();
 
@@ -360,7 +369,7 @@ void D_DoomMain()
 	Printf(PRINT_HIGH, "========== Odamex Server Initialized ==========\n");
 
 	#ifdef UNIX
-	if (Args.CheckParm("-fork"))
+	if (Args.CheckParm("-fork") && instances <= 1)
 		daemon_init();
 	#endif
 
@@ -603,7 +603,7 @@ void G_DoResetLevel(bool full_reset)
 		{
 			if (mo->netid && mo->type != MT_PLAYER)
 			{
-				mo->netid = ServerNetID.ObtainNetID();
+				P_SetThingId(mo, ServerNetID.ObtainNetID());
 			}
 		}
 	}
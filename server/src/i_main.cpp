@@ -25,6 +25,8 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "win32inc.h"
 #ifdef _WIN32
@@ -35,7 +37,10 @@
 #ifdef UNIX
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
 #endif
 
 #include <stdlib.h>
@@ -54,10 +59,12 @@
 #include "i_net.h"
 #include "sv_main.h"
 #include "m_ostring.h"
+#include "m_fileio.h"
 
 using namespace std;
 
 void AddCommandString(std::string cmd);
+void C_DoCommand(const char *cmd);
 
 DArgs Args;
 
@@ -230,6 +237,166 @@ void daemon_init(void)
     fclose(fpid);
 }
 
+//
+// instances_init
+//
+// Forks 'count' servers off after the WADs have been loaded, so they all
+// share the lump cache and level data copy-on-write, and stays behind to
+// restart any that crash.  Instances are numbered from 0: instance n listens
+// on the base port plus n, logs to <logfile>-n and runs instance<n>.cfg if
+// there is one.  The parent sleeps in waitpid() and never returns; each
+// child returns and carries on starting up.
+//
+
+static volatile sig_atomic_t instances_quit = 0;
+
+static void instances_handler(int s)
+{
+	instances_quit = 1;
+}
+
+static pid_t instance_spawn(int instance)
+{
+	pid_t pid = fork();
+
+	if (pid < 0)
+		Printf(PRINT_HIGH, "instances: could not fork instance %d: %s\n",
+			   instance, strerror(errno));
+
+	if (pid != 0)
+		return pid;
+
+	signal(SIGTERM, handler);
+	signal(SIGINT,  handler);
+
+	server_instance = instance;
+
+	// only the supervisor reads the terminal
+	int null = open("/dev/null", O_RDONLY);
+	if (null >= 0)
+	{
+		dup2(null, STDIN_FILENO);
+		close(null);
+	}
+
+	char num[16];
+	snprintf(num, sizeof(num), "%d", instance);
+
+	static std::string logname;
+	if (LOG_FILE)
+	{
+		logname = LOG_FILE;
+		size_t dot = logname.rfind('.');
+		std::string ext;
+		if (dot != std::string::npos && logname.find('/', dot) == std::string::npos)
+		{
+			ext = logname.substr(dot);
+			logname.erase(dot);
+		}
+		logname = logname + "-" + num + ext;
+
+		LOG.close();
+		LOG_FILE = logname.c_str();
+		LOG.open(LOG_FILE, std::ios::app);
+	}
+
+	Printf(PRINT_HIGH, "Instance %d started, pid %d\n", instance, (int)getpid());
+
+	std::string cfg = std::string("instance") + num + ".cfg";
+	if (M_FileExists(cfg))
+		C_DoCommand(("exec " + cfg).c_str());
+
+	return 0;
+}
+
+void instances_init(int count)
+{
+	if (Args.CheckParm("-fork"))
+		daemon_init();
+
+	Printf(PRINT_HIGH, "Starting %d server instances\n", count);
+
+	if (LOG.is_open())
+		LOG.flush();
+	fflush(stdout);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = instances_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+
+	std::vector<pid_t> pids(count, 0);
+	std::vector<time_t> started(count, 0);
+	int running = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		started[i] = time(NULL);
+		if ((pids[i] = instance_spawn(i)) == 0)
+			return;
+		if (pids[i] > 0)
+			running++;
+	}
+
+	while (running && !instances_quit)
+	{
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		int i = std::find(pids.begin(), pids.end(), pid) - pids.begin();
+		if (i == count)
+			continue;
+
+		pids[i] = 0;
+		running--;
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+		{
+			Printf(PRINT_HIGH, "Instance %d quit\n", i);
+			continue;
+		}
+
+		Printf(PRINT_HIGH, "Instance %d died (%s %d), restarting\n", i,
+			   WIFSIGNALED(status) ? "signal" : "status",
+			   WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+
+		// don't spin if it can't even get started
+		if (time(NULL) - started[i] < 10)
+			sleep(1);
+
+		if (instances_quit)
+			break;
+
+		started[i] = time(NULL);
+		if ((pids[i] = instance_spawn(i)) == 0)
+			return;
+		if (pids[i] > 0)
+			running++;
+	}
+
+	for (int i = 0; i < count; i++)
+		if (pids[i] > 0)
+			kill(pids[i], SIGTERM);
+
+	for (int i = 0; i < count; i++)
+		if (pids[i] > 0)
+			waitpid(pids[i], NULL, 0);
+
+	Printf(PRINT_HIGH, "All server instances stopped\n");
+
+	call_terms();
+	exit(EXIT_SUCCESS);
+}
+
 int main (int argc, char **argv)
 {
 	// [AM] Set crash callbacks, so we get something useful from crashes.
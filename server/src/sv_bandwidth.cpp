@@ -0,0 +1,520 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Per-client bandwidth scheduling of unreliable updates.
+//
+//	Updates about a player or an actor are written to the client's netbuf
+//	between SV_BeginUpdate and SV_EndUpdate, which remembers where each one
+//	is along with its priority.  When a packet is built, each client gets a
+//	token bucket worth of bytes (its rate, refilled every tic): the most
+//	important updates go first, the rest stay in netbuf for the next packet.
+//	A held back update is replaced by a newer one about the same thing and
+//	dropped once it is UPDATE_MAX_AGE tics old, or when netbuf needs the room.
+//
+//	Anything written to netbuf outside an update (sounds, pings, downloads)
+//	is always sent as long as it fits in the packet, and otherwise waits
+//	for the next one however long that takes.
+//
+//	Packets are built in the middle of a tic only while the client can take
+//	more (see SV_UpdatesDue), so a client over its rate is scheduled once
+//	per tic rather than once for every actor written after it ran out.
+//
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "doomstat.h"
+#include "i_net.h"
+#include "m_fixed.h"
+#include "p_local.h"
+#include "sv_main.h"
+#include "sv_bandwidth.h"
+
+// held back updates older than this are not worth sending
+static const int UPDATE_MAX_AGE = 4;
+
+// how many tics worth of rate a client can save up
+static const int UPDATE_BURST_TICS = 4;
+
+// nearby players and actors heading this way are sent first
+static const fixed_t UPDATE_NEAR_DIST = 1024 * FRACUNIT;
+
+// how much has to be written since the last packet to build another one
+// before the end of the tic
+static const size_t UPDATE_FLUSH_SIZE = 1024;
+
+struct pending_update_t
+{
+	size_t			begin;		// offset in netbuf
+	size_t			size;
+	int				key;
+	int				priority;
+	int				tic;		// when it was written
+	unsigned int	id;			// 0 for messages written outside an update
+	update_status_t	status;
+};
+
+typedef std::vector<pending_update_t> PendingUpdates;
+
+struct client_bandwidth_t
+{
+	PendingUpdates	updates;	// in netbuf order
+	bool			open;
+	size_t			open_begin;
+	int				open_key;
+	int				open_priority;
+	unsigned int	next_id;
+	int				tokens;		// bytes the client can still take
+	int				refill_tic;
+	size_t			held;		// netbuf bytes the last packet left behind
+
+	client_bandwidth_t() : open(false), open_begin(0), open_key(0),
+		open_priority(UPDATE_PRIORITY_NORMAL), next_id(1), tokens(0), refill_tic(0),
+		held(0) {}
+};
+
+static client_bandwidth_t client_bandwidth[MAXPLAYERS + 1];
+
+//
+// SV_BeginUpdate
+//
+void SV_BeginUpdate(player_t &player, int key, int priority)
+{
+	client_bandwidth_t &bw = client_bandwidth[player.id];
+
+	bw.open = true;
+	bw.open_begin = player.client.netbuf.cursize;
+	bw.open_key = key;
+	bw.open_priority = priority;
+}
+
+//
+// SV_EndUpdate
+//
+// Returns the update's id, which SV_UpdateStatus can be asked about once
+// the packet has been built.
+//
+unsigned int SV_EndUpdate(player_t &player)
+{
+	client_bandwidth_t &bw = client_bandwidth[player.id];
+	buf_t &netbuf = player.client.netbuf;
+
+	if (!bw.open)
+		return 0;
+
+	bw.open = false;
+
+	// an overflow wiped the buffer while the update was being written
+	if (netbuf.overflowed || netbuf.cursize <= bw.open_begin)
+		return 0;
+
+	pending_update_t update;
+	update.begin = bw.open_begin;
+	update.size = netbuf.cursize - bw.open_begin;
+	update.key = bw.open_key;
+	update.priority = bw.open_priority;
+	update.tic = gametic;
+	update.id = bw.next_id++;
+	update.status = UPDATE_PENDING;
+
+	if (!bw.next_id)
+		bw.next_id = 1;
+
+	bw.updates.push_back(update);
+
+	return update.id;
+}
+
+//
+// SV_UpdateStatus
+//
+// Valid between SV_ScheduleUpdates and SV_FinishUpdates.
+//
+update_status_t SV_UpdateStatus(player_t &player, unsigned int id)
+{
+	const PendingUpdates &updates = client_bandwidth[player.id].updates;
+
+	for (PendingUpdates::const_iterator it = updates.begin(); it != updates.end(); ++it)
+		if (it->id == id && id)
+			return it->status;
+
+	return UPDATE_DROPPED;
+}
+
+//
+// SV_UpdatePriority
+//
+// How urgently the player needs to hear about the actor.
+//
+int SV_UpdatePriority(player_t &player, AActor *mo)
+{
+	if (!player.mo || !mo)
+		return UPDATE_PRIORITY_NORMAL;
+
+	fixed_t dx = player.mo->x - mo->x;
+	fixed_t dy = player.mo->y - mo->y;
+	fixed_t dist = P_AproxDistance(dx, dy);
+
+	if (mo->player)
+		return dist < UPDATE_NEAR_DIST ? UPDATE_PRIORITY_HIGH : UPDATE_PRIORITY_NORMAL;
+
+	if (mo->flags & (MF_MISSILE | MF_SKULLFLY))
+	{
+		// moving towards the player?
+		double dot = (double)dx * mo->momx + (double)dy * mo->momy;
+		if (dot > 0 && dist < 2 * UPDATE_NEAR_DIST)
+			return UPDATE_PRIORITY_HIGH;
+
+		return UPDATE_PRIORITY_NORMAL;
+	}
+
+	return dist < UPDATE_NEAR_DIST ? UPDATE_PRIORITY_NORMAL : UPDATE_PRIORITY_LOW;
+}
+
+//
+// SV_RefillTokens
+//
+static void SV_RefillTokens(player_t &player, client_bandwidth_t &bw)
+{
+	if (bw.refill_tic == gametic)
+		return;
+
+	int pertic = player.client.rate * 1000 / TICRATE;
+	int burst = pertic * UPDATE_BURST_TICS;
+
+	int tics = gametic - bw.refill_tic;
+	if (tics < 0 || tics > UPDATE_BURST_TICS)
+		tics = UPDATE_BURST_TICS;
+
+	bw.tokens += pertic * tics;
+	if (bw.tokens > burst)
+		bw.tokens = burst;
+
+	bw.refill_tic = gametic;
+}
+
+//
+// CompareUpdatePriority
+//
+// Most important first, oldest first within the same priority.
+//
+struct CompareUpdatePriority
+{
+	const PendingUpdates &updates;
+
+	CompareUpdatePriority(const PendingUpdates &u) : updates(u) {}
+
+	bool operator()(size_t a, size_t b) const
+	{
+		if (updates[a].priority != updates[b].priority)
+			return updates[a].priority > updates[b].priority;
+
+		return a < b;
+	}
+};
+
+//
+// SV_ScheduleUpdates
+//
+// Picks what goes in the unreliable part of the next packet, given 'space'
+// bytes left in it.  Returns the size of the payload and points 'data' at
+// it, which is either netbuf or 'gather' (MAX_UDP_PACKET bytes) if only
+// some of the updates were picked.
+//
+size_t SV_ScheduleUpdates(player_t &player, size_t space, const byte *&data, byte *gather)
+{
+	client_bandwidth_t &bw = client_bandwidth[player.id];
+	buf_t &netbuf = player.client.netbuf;
+
+	SV_RefillTokens(player, bw);
+
+	// an update still being written stays where it is
+	size_t limit = bw.open ? bw.open_begin : netbuf.cursize;
+	if (limit > netbuf.cursize)
+	{
+		// netbuf was cleared behind our back
+		bw.updates.clear();
+		bw.open_begin = limit = 0;
+	}
+
+	// everything between the updates was written outside one
+	PendingUpdates all;
+	size_t pos = 0;
+
+	for (size_t i = 0; i <= bw.updates.size(); i++)
+	{
+		size_t next = i < bw.updates.size() ? bw.updates[i].begin : limit;
+
+		if (next > limit || next < pos)
+		{
+			all.clear();
+			pos = 0;
+			break;
+		}
+
+		if (next > pos)
+		{
+			pending_update_t loose;
+			loose.begin = pos;
+			loose.size = next - pos;
+			loose.key = 0;
+			loose.priority = UPDATE_PRIORITY_NORMAL;
+			loose.tic = gametic;
+			loose.id = 0;
+			loose.status = UPDATE_PENDING;
+			all.push_back(loose);
+		}
+
+		if (i == bw.updates.size())
+			break;
+
+		all.push_back(bw.updates[i]);
+		pos = next + bw.updates[i].size;
+	}
+
+	bw.updates.swap(all);
+
+	// only the newest update about something is worth sending
+	std::set<int> seen;
+	for (size_t i = bw.updates.size(); i-- > 0; )
+	{
+		pending_update_t &update = bw.updates[i];
+
+		// messages written outside an update never go stale
+		if (!update.id)
+			continue;
+
+		if (gametic - update.tic > UPDATE_MAX_AGE)
+			update.status = UPDATE_DROPPED;
+		else if (update.key && !seen.insert(update.key).second)
+			update.status = UPDATE_DROPPED;
+	}
+
+	int tokens = bw.tokens;
+	std::vector<size_t> order;
+
+	// loose messages go out whenever they fit
+	for (size_t i = 0; i < bw.updates.size(); i++)
+	{
+		pending_update_t &update = bw.updates[i];
+
+		if (update.status == UPDATE_DROPPED)
+			continue;
+
+		if (update.id)
+		{
+			order.push_back(i);
+			continue;
+		}
+
+		if (update.size <= space)
+		{
+			update.status = UPDATE_SENT;
+			space -= update.size;
+			tokens -= update.size;
+		}
+	}
+
+	// the rest in order of importance, as long as the client can take them
+	std::sort(order.begin(), order.end(), CompareUpdatePriority(bw.updates));
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		pending_update_t &update = bw.updates[order[i]];
+
+		if (update.size <= space && (int)update.size <= tokens)
+		{
+			update.status = UPDATE_SENT;
+			space -= update.size;
+			tokens -= update.size;
+		}
+	}
+
+	// whatever is held back has to leave room in netbuf for the next tic,
+	// so the least important updates go first
+	size_t held = 0;
+	for (size_t i = 0; i < order.size(); i++)
+		if (bw.updates[order[i]].status == UPDATE_PENDING)
+			held += bw.updates[order[i]].size;
+
+	for (size_t i = order.size(); i-- > 0 && held > netbuf.maxsize() / 2; )
+	{
+		pending_update_t &update = bw.updates[order[i]];
+
+		if (update.status == UPDATE_PENDING)
+		{
+			update.status = UPDATE_DROPPED;
+			held -= update.size;
+		}
+	}
+
+	// if everything goes, it can go straight from netbuf
+	size_t size = 0;
+	bool everything = !bw.open;
+
+	for (size_t i = 0; i < bw.updates.size(); i++)
+	{
+		if (bw.updates[i].status == UPDATE_SENT)
+			size += bw.updates[i].size;
+		else
+			everything = false;
+	}
+
+	if (everything)
+	{
+		data = netbuf.data;
+		return size;
+	}
+
+	byte *dest = gather;
+	for (size_t i = 0; i < bw.updates.size(); i++)
+	{
+		const pending_update_t &update = bw.updates[i];
+
+		if (update.status == UPDATE_SENT)
+		{
+			memcpy(dest, netbuf.data + update.begin, update.size);
+			dest += update.size;
+		}
+	}
+
+	data = gather;
+	return size;
+}
+
+//
+// SV_FinishUpdates
+//
+// Charges the client for the packet and moves whatever was held back to
+// the start of netbuf.
+//
+void SV_FinishUpdates(player_t &player, size_t packetsize)
+{
+	client_bandwidth_t &bw = client_bandwidth[player.id];
+	buf_t &netbuf = player.client.netbuf;
+
+	int burst = player.client.rate * 1000 / TICRATE * UPDATE_BURST_TICS;
+
+	bw.tokens -= packetsize;
+	if (bw.tokens < -burst)
+		bw.tokens = -burst;
+
+	size_t dest = 0;
+	PendingUpdates kept;
+
+	for (size_t i = 0; i < bw.updates.size(); i++)
+	{
+		pending_update_t update = bw.updates[i];
+
+		if (update.status != UPDATE_PENDING)
+			continue;
+
+		memmove(netbuf.data + dest, netbuf.data + update.begin, update.size);
+		update.begin = dest;
+		dest += update.size;
+
+		kept.push_back(update);
+	}
+
+	bw.held = dest;
+
+	if (bw.open && bw.open_begin <= netbuf.cursize)
+	{
+		size_t opensize = netbuf.cursize - bw.open_begin;
+
+		memmove(netbuf.data + dest, netbuf.data + bw.open_begin, opensize);
+		bw.open_begin = dest;
+		dest += opensize;
+	}
+
+	bw.updates.swap(kept);
+	netbuf.cursize = dest;
+}
+
+//
+// SV_DropUpdates
+//
+// Throws away everything held back, for when netbuf had to be cleared.
+//
+void SV_DropUpdates(player_t &player)
+{
+	client_bandwidth_t &bw = client_bandwidth[player.id];
+
+	bw.updates.clear();
+	bw.open_begin = 0;
+	bw.held = 0;
+}
+
+//
+// SV_UnsentSize
+//
+// How much of a buffer hasn't been offered to a packet yet; for a client's
+// netbuf, what the last packet held back doesn't count.
+//
+size_t SV_UnsentSize(const buf_t *b)
+{
+	for (Players::const_iterator it = players.begin(); it != players.end(); ++it)
+	{
+		if (&it->client.netbuf != b)
+			continue;
+
+		size_t held = client_bandwidth[it->id].held;
+		return b->cursize > held ? b->cursize - held : 0;
+	}
+
+	return b->cursize;
+}
+
+//
+// SV_UpdatesDue
+//
+// Whether enough has been written to netbuf since the last packet for
+// another one to be built before the end of the tic.  Once the client has
+// used up its rate for this tic, scheduling again would only hold the same
+// updates back, so that waits for the end of the tic unless netbuf is
+// filling up.
+//
+bool SV_UpdatesDue(player_t &player)
+{
+	client_bandwidth_t &bw = client_bandwidth[player.id];
+	const buf_t &netbuf = player.client.netbuf;
+
+	// netbuf was cleared behind our back
+	if (bw.held > netbuf.cursize)
+		bw.held = 0;
+
+	if (netbuf.cursize < bw.held + UPDATE_FLUSH_SIZE)
+		return false;
+
+	bool limited = bw.refill_tic == gametic && bw.tokens <= 0;
+
+	return !limited || netbuf.cursize >= netbuf.maxsize() * 3 / 4;
+}
+
+//
+// SV_BandwidthReset
+//
+void SV_BandwidthReset(player_t &player)
+{
+	client_bandwidth[player.id] = client_bandwidth_t();
+	client_bandwidth[player.id].refill_tic = gametic;
+}
+
+VERSION_CONTROL (sv_bandwidth_cpp, "$Id$")
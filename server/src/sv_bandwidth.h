@@ -0,0 +1,65 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Per-client bandwidth scheduling of unreliable updates.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __SV_BANDWIDTH_H__
+#define __SV_BANDWIDTH_H__
+
+#include "actor.h"
+#include "d_player.h"
+
+enum update_priority_t
+{
+	UPDATE_PRIORITY_LOW,		// far away monsters
+	UPDATE_PRIORITY_NORMAL,
+	UPDATE_PRIORITY_HIGH		// nearby players, missiles heading for the player
+};
+
+enum update_status_t
+{
+	UPDATE_SENT,
+	UPDATE_PENDING,				// held back, may still go out
+	UPDATE_DROPPED				// superseded or too old
+};
+
+// what an update is about; a newer update with the same key replaces an
+// older one that hasn't gone out yet
+enum update_keytype_t
+{
+	UPDATE_KEY_PLAYER = 1,
+	UPDATE_KEY_MOBJ
+};
+
+#define UPDATE_KEY(type, id)	(((type) << 16) | ((id) & 0xFFFF))
+
+void SV_BeginUpdate(player_t &player, int key, int priority);
+unsigned int SV_EndUpdate(player_t &player);
+update_status_t SV_UpdateStatus(player_t &player, unsigned int id);
+int SV_UpdatePriority(player_t &player, AActor *mo);
+
+size_t SV_ScheduleUpdates(player_t &player, size_t space, const byte *&data, byte *gather);
+void SV_FinishUpdates(player_t &player, size_t packetsize);
+void SV_DropUpdates(player_t &player);
+bool SV_UpdatesDue(player_t &player);
+size_t SV_UnsentSize(const buf_t *b);
+void SV_BandwidthReset(player_t &player);
+
+#endif
@@ -21,6 +21,7 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 
@@ -178,6 +179,118 @@ std::string IPRange::string()
 	return buffer.str();
 }
 
+//// IPRangeIndex ////
+
+const size_t IPRangeIndex::npos;
+
+// Constructor
+IPRangeIndex::IPRangeIndex()
+{
+	this->clear();
+}
+
+// Empty the index, leaving just the root.
+void IPRangeIndex::clear()
+{
+	this->nodes.clear();
+	this->nodes.push_back(Node());
+}
+
+// Add a range to the index.  Ranges have to be inserted in the order of
+// their indexes for find to return the first match.
+void IPRangeIndex::insert(const IPRange &range, size_t index)
+{
+	size_t node = 0;
+
+	for (byte i = 0; i < 4; i++)
+	{
+		size_t next;
+
+		if (range.mask[i])
+		{
+			next = this->nodes[node].wildcard;
+			if (next == 0)
+			{
+				next = this->nodes.size();
+				this->nodes.push_back(Node());
+				this->nodes[node].wildcard = next;
+			}
+		}
+		else
+		{
+			std::vector<std::pair<byte, size_t> > &children = this->nodes[node].children;
+			std::pair<byte, size_t> key(range.ip[i], 0);
+			std::vector<std::pair<byte, size_t> >::iterator it =
+				std::lower_bound(children.begin(), children.end(), key);
+
+			if (it != children.end() && it->first == range.ip[i])
+			{
+				next = it->second;
+			}
+			else
+			{
+				next = this->nodes.size();
+				children.insert(it, std::pair<byte, size_t>(range.ip[i], next));
+				// children may have moved, but it's done with
+				this->nodes.push_back(Node());
+			}
+		}
+
+		node = next;
+	}
+
+	this->nodes[node].ranges.push_back(index);
+}
+
+// Return the lowest index of a range the address falls in, leaving out any
+// whose entry in skip is set, or npos if there isn't one.
+size_t IPRangeIndex::find(const netadr_t &address,
+                          const std::vector<bool> *skip) const
+{
+	return this->find(0, 0, address, skip, npos);
+}
+
+size_t IPRangeIndex::find(size_t node, byte depth, const netadr_t &address,
+                          const std::vector<bool> *skip, size_t best) const
+{
+	const Node &n = this->nodes[node];
+
+	if (depth == 4)
+	{
+		for (std::vector<size_t>::const_iterator it = n.ranges.begin();
+		        it != n.ranges.end() && *it < best; ++it)
+		{
+			if (skip == NULL || !(*skip)[*it])
+			{
+				return *it;
+			}
+		}
+		return best;
+	}
+
+	std::pair<byte, size_t> key(address.ip[depth], 0);
+	std::vector<std::pair<byte, size_t> >::const_iterator it =
+		std::lower_bound(n.children.begin(), n.children.end(), key);
+
+	if (it != n.children.end() && it->first == address.ip[depth])
+	{
+		best = this->find(it->second, depth + 1, address, skip, best);
+	}
+
+	if (n.wildcard != 0)
+	{
+		best = this->find(n.wildcard, depth + 1, address, skip, best);
+	}
+
+	return best;
+}
+
+// Number of nodes in the trie.
+size_t IPRangeIndex::size() const
+{
+	return this->nodes.size();
+}
+
 //// Banlist ////
 
 size_t Banlist::size()
@@ -185,6 +298,47 @@ size_t Banlist::size()
 	return this->banlist.size();
 }
 
+// Add the ban at the end of the banlist to the index and expiry queue.
+void Banlist::index_ban(size_t index)
+{
+	const Ban &ban = this->banlist[index];
+
+	this->banindex.insert(ban.range, index);
+	this->expired.push_back(false);
+
+	if (ban.expire != 0)
+	{
+		this->expiry.push(expiry_t(ban.expire, index));
+	}
+}
+
+// Rebuild the ban index after the banlist has been changed other than by
+// adding to the end of it.
+void Banlist::reindex_bans()
+{
+	this->banindex.clear();
+	this->expiry = std::priority_queue<expiry_t, std::vector<expiry_t>,
+	                                   std::greater<expiry_t> >();
+	this->expired.clear();
+	this->expired.reserve(this->banlist.size());
+
+	for (size_t i = 0; i < this->banlist.size(); i++)
+	{
+		this->index_ban(i);
+	}
+}
+
+// Rebuild the exception index.
+void Banlist::reindex_exceptions()
+{
+	this->exceptionindex.clear();
+
+	for (size_t i = 0; i < this->exceptionlist.size(); i++)
+	{
+		this->exceptionindex.insert(this->exceptionlist[i].range, i);
+	}
+}
+
 bool Banlist::add(const std::string &address, const time_t expire,
                   const std::string &name, const std::string &reason)
 {
@@ -203,6 +357,7 @@ bool Banlist::add(const std::string &address, const time_t expire,
 
 	// Add the ban to the banlist
 	this->banlist.push_back(ban);
+	this->index_ban(this->banlist.size() - 1);
 
 	return true;
 }
@@ -226,6 +381,7 @@ bool Banlist::add(player_t &player, const time_t expire,
 
 	// Add the ban to the banlist
 	this->banlist.push_back(ban);
+	this->index_ban(this->banlist.size() - 1);
 
 	return true;
 }
@@ -244,6 +400,7 @@ bool Banlist::add_exception(const std::string &address, const std::string &name)
 	// Add the exception to the banlist.
 	exception.name = name;
 	this->exceptionlist.push_back(exception);
+	this->exceptionindex.insert(exception.range, this->exceptionlist.size() - 1);
 
 	return true;
 }
@@ -264,6 +421,7 @@ bool Banlist::add_exception(player_t &player)
 
 	// Add the exception to the banlist.
 	this->exceptionlist.push_back(exception);
+	this->exceptionindex.insert(exception.range, this->exceptionlist.size() - 1);
 
 	return true;
 }
@@ -274,25 +432,25 @@ bool Banlist::add_exception(player_t &player)
 bool Banlist::check(const netadr_t &address, Ban &baninfo)
 {
 	// Check against exception list.
-	for (std::vector<Exception>::iterator it = this->exceptionlist.begin();
-	        it != this->exceptionlist.end(); ++it)
+	if (this->exceptionindex.find(address) != IPRangeIndex::npos)
 	{
-		if (it->range.check(address))
-		{
-			return false;
-		}
+		return false;
+	}
+
+	// Mark any bans that have run out since the last check.
+	time_t now = time(NULL);
+	while (!this->expiry.empty() && this->expiry.top().first <= now)
+	{
+		this->expired[this->expiry.top().second] = true;
+		this->expiry.pop();
 	}
 
 	// Check against banlist.
-	for (std::vector<Ban>::iterator it = this->banlist.begin();
-	        it != this->banlist.end(); ++it)
+	size_t index = this->banindex.find(address, &this->expired);
+	if (index != IPRangeIndex::npos)
 	{
-		if (it->range.check(address) && (it->expire == 0 ||
-		                                 it->expire > time(NULL)))
-		{
-			baninfo = *it;
-			return true;
-		}
+		baninfo = this->banlist[index];
+		return true;
 	}
 
 	return false;
@@ -411,6 +569,7 @@ bool Banlist::remove(size_t index)
 	}
 
 	this->banlist.erase(this->banlist.begin() + index);
+	this->reindex_bans();
 	return true;
 }
 
@@ -430,6 +589,7 @@ bool Banlist::remove_exception(size_t index)
 	}
 
 	this->exceptionlist.erase(this->exceptionlist.begin() + index);
+	this->reindex_exceptions();
 	return true;
 }
 
@@ -437,12 +597,14 @@ bool Banlist::remove_exception(size_t index)
 void Banlist::clear()
 {
 	this->banlist.clear();
+	this->reindex_bans();
 }
 
 // Clear the exceptionlist.
 void Banlist::clear_exceptions()
 {
 	this->exceptionlist.clear();
+	this->reindex_exceptions();
 }
 
 // Fills a JSON array with bans.
@@ -525,6 +687,7 @@ bool Banlist::json_replace(const Json::Value &json_bans)
 		this->banlist.push_back(ban);
 	}
 
+	this->reindex_bans();
 	return true;
 }
 
@@ -24,6 +24,8 @@
 #ifndef __SV_BANLIST__
 #define __SV_BANLIST__
 
+#include <functional>
+#include <queue>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -45,6 +47,42 @@ public:
 	void set(const netadr_t &address);
 	bool set(const std::string &input);
 	std::string string(void);
+
+	friend class IPRangeIndex;
+};
+
+// Finds the first of a list of ranges that an address falls in without
+// checking every one of them.  It's a trie with a level for each octet,
+// where a masked octet goes down the wildcard branch.  An address follows
+// its own octet and the wildcard at each level, so no more than 16 leaves
+// are looked at however long the list is.
+class IPRangeIndex
+{
+public:
+	static const size_t npos = (size_t)-1;
+
+	IPRangeIndex(void);
+	void clear(void);
+	void insert(const IPRange &range, size_t index);
+	size_t find(const netadr_t &address,
+	            const std::vector<bool> *skip = NULL) const;
+	size_t size(void) const;
+private:
+	struct Node
+	{
+		Node() : wildcard(0) { };
+		// Sorted by octet.  The root can't be anyone's child, so 0 is
+		// used for no child.
+		std::vector<std::pair<byte, size_t> > children;
+		size_t wildcard;
+		// Indexes of the ranges that end here, lowest first.
+		std::vector<size_t> ranges;
+	};
+
+	std::vector<Node> nodes;
+
+	size_t find(size_t node, byte depth, const netadr_t &address,
+	            const std::vector<bool> *skip, size_t best) const;
 };
 
 struct Ban
@@ -93,8 +131,25 @@ public:
 	bool json_replace(const Json::Value &json_bans);
 	void json_exceptions();
 private:
+	typedef std::pair<time_t, size_t> expiry_t;
+
 	std::vector<Ban> banlist;
 	std::vector<Exception> exceptionlist;
+
+	// Rebuilt whenever a ban or exception is removed or the list is
+	// replaced, added to as they're added.
+	IPRangeIndex banindex;
+	IPRangeIndex exceptionindex;
+
+	// Bans with an expire time, soonest first, and which of them have
+	// expired.  Expired bans stay on the list until someone removes them.
+	std::priority_queue<expiry_t, std::vector<expiry_t>,
+	                    std::greater<expiry_t> > expiry;
+	std::vector<bool> expired;
+
+	void index_ban(size_t index);
+	void reindex_bans();
+	void reindex_exceptions();
 };
 
 void SV_InitBanlist();
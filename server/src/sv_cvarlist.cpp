@@ -108,12 +108,43 @@ CVAR_RANGE(		sv_natport,	"0", "NAT firewall workaround, this is a port number",
 CVAR_RANGE(		sv_flooddelay, "1.5", "Chat flood protection time (in seconds)",
 				CVARTYPE_FLOAT, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 0.0f, 10.0f)
 
+CVAR_RANGE(		sv_qryrate, "2", "Launcher queries answered per second for each address, after a " \
+				"short burst (0 answers them all)",
+				CVARTYPE_FLOAT, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 0.0f, 100.0f)
+
 CVAR_RANGE_FUNC_DECL(sv_maxrate, "200", "Forces clients to be on or below this rate",
 				CVARTYPE_INT, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 7.0f, 100000.0f)
 
+CVAR(			sv_deltasnapshots, "1", "Only send monster and missile fields that changed since the " \
+				"client's last acknowledged update (clients that support it)",
+				CVARTYPE_BOOL, CVAR_SERVERARCHIVE)
+
+CVAR_FUNC_DECL(	sv_interestmanagement, "1", "Only send monsters and missiles to clients that could " \
+				"plausibly see or hear them",
+				CVARTYPE_BOOL, CVAR_SERVERARCHIVE)
+
+CVAR_RANGE(		sv_interestradius, "4096", "Distance (in map units) within which visible monsters and " \
+				"missiles are sent to clients when sv_interestmanagement is on",
+				CVARTYPE_INT, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 1200.0f, 32768.0f)
+
+CVAR(			sv_batchsend, "1", "Queue outgoing packets and send them in batches at the end of each tic",
+				CVARTYPE_BOOL, CVAR_SERVERARCHIVE)
+
+CVAR_RANGE_FUNC_DECL(sv_batchrecv, "32", "Maximum number of packets read from the network per syscall " \
+				"(0 reads them one at a time)",
+				CVARTYPE_BYTE, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 0.0f, 64.0f)
+
+CVAR_RANGE_FUNC_DECL(sv_sendthreads, "0", "Number of extra threads that build and compress " \
+				"client packets at the end of each tic (0 builds them all on the main thread)",
+				CVARTYPE_BYTE, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 0.0f, 32.0f)
+
 CVAR_RANGE_FUNC_DECL(sv_waddownloadcap, "200", "Cap wad file downloading to a specific rate",
 				CVARTYPE_INT, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 7.0f, 100000.0f)
 
+CVAR_RANGE(		sv_waddownloadwindow, "64", "KiB of a wad sent to a client that acknowledges " \
+				"wad chunks before it has to acknowledge them",
+				CVARTYPE_INT, CVAR_SERVERARCHIVE | CVAR_NOENABLEDISABLE, 4.0f, 4096.0f)
+
 #ifdef ODA_HAVE_MINIUPNP
 CVAR(			sv_upnp, "1", "Enable UPnP support",
 				CVARTYPE_BOOL, CVAR_SERVERARCHIVE)
@@ -0,0 +1,360 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Delta-compressed actor updates against the state each client has
+//	acknowledged.
+//
+//	For every actor a client knows about, the server remembers the value
+//	of each field it last sent and whether a packet carrying it has been
+//	acknowledged.  A field is only written again when it changed, or when
+//	its value is unconfirmed and no packet carrying it is still waiting for
+//	an ack, so a lost packet never leaves the client with stale data.  An
+//	ack for any packet carrying the current value confirms it, so a client
+//	whose round trip is longer than the update interval still gets there.
+//	Every MOBJDELTA_KEYFRAME_TICS the full state is sent regardless, which
+//	also corrects any client-side drift.
+//
+//-----------------------------------------------------------------------------
+
+#include <map>
+#include <vector>
+
+#include "doomstat.h"
+#include "c_cvars.h"
+#include "i_net.h"
+#include "sv_main.h"
+#include "sv_delta.h"
+#include "sv_bandwidth.h"
+#include "p_mobj.h"
+
+EXTERN_CVAR(sv_deltasnapshots)
+
+// how often the full state of an actor is resent
+static const int MOBJDELTA_KEYFRAME_TICS = 2 * TICRATE;
+
+// how many sent packets are remembered while waiting for their ack
+static const int MOBJDELTA_HISTORY = 64;
+
+// how long an unconfirmed field waits for an ack before it's written again
+static const int MOBJDELTA_ACK_TICS = TICRATE;
+
+struct mobj_baseline_t
+{
+	int				value[NUM_MOBJDELTA_FIELDS];		// last value sent
+	int				first_seq[NUM_MOBJDELTA_FIELDS];	// first packet that carried
+														// it, -1 until one has
+	int				written_tic[NUM_MOBJDELTA_FIELDS];	// last time it was written
+	unsigned int	confirmed;							// fields the client acked
+	int				keyframe_tic;
+	byte			generation;							// of the netid, see NetIDHandler
+};
+
+struct delta_record_t
+{
+	int				netid;
+	byte			generation;
+	unsigned int	mask;
+	unsigned int	update;		// see SV_EndUpdate
+	int				value[NUM_MOBJDELTA_FIELDS];
+};
+
+typedef std::map<int, mobj_baseline_t> Baselines;
+typedef std::vector<delta_record_t> DeltaRecords;
+
+struct client_delta_t
+{
+	Baselines		baselines;
+	DeltaRecords	unsent;		// written to netbuf or held back, not sent yet
+	DeltaRecords	inflight[MOBJDELTA_HISTORY];
+	int				inflight_seq[MOBJDELTA_HISTORY];
+
+	client_delta_t()
+	{
+		for (int i = 0; i < MOBJDELTA_HISTORY; i++)
+			inflight_seq[i] = -1;
+	}
+};
+
+static client_delta_t client_deltas[MAXPLAYERS + 1];
+
+//
+// SV_MobjDeltaValue
+//
+static int SV_MobjDeltaValue(AActor *mo, int field)
+{
+	switch (field)
+	{
+	case MDF_X_BIT:			return mo->x;
+	case MDF_Y_BIT:			return mo->y;
+	case MDF_Z_BIT:			return mo->z;
+	case MDF_ANGLE_BIT:		return mo->angle;
+	case MDF_MOMX_BIT:		return mo->momx;
+	case MDF_MOMY_BIT:		return mo->momy;
+	case MDF_MOMZ_BIT:		return mo->momz;
+	case MDF_RNDINDEX_BIT:	return mo->rndindex;
+	case MDF_MOVEDIR_BIT:	return mo->movedir;
+	case MDF_MOVECOUNT_BIT:	return mo->movecount;
+	case MDF_TARGET_BIT:	return mo->target ? mo->target->netid : 0;
+	case MDF_TRACER_BIT:	return mo->tracer ? mo->tracer->netid : 0;
+	}
+
+	return 0;
+}
+
+//
+// SV_ClientWantsDeltas
+//
+// Older clients don't understand svc_mobjdelta and get the full
+// svc_movemobj/svc_mobjspeedangle messages instead.
+//
+bool SV_ClientWantsDeltas(player_t &player)
+{
+	return sv_deltasnapshots && (player.client.netcaps & NETCAP_MOBJDELTA);
+}
+
+//
+// SV_WriteMobjDelta
+//
+// Writes the requested fields of an actor that differ from what the client
+// is known to have or is about to get.  Returns false if nothing needed
+// writing.
+//
+bool SV_WriteMobjDelta(player_t &player, AActor *mo, unsigned int fields, int priority)
+{
+	client_delta_t &cd = client_deltas[player.id];
+
+	byte generation = ServerNetID.GetGeneration(mo->netid);
+
+	// a baseline from an earlier generation is about an actor that's gone,
+	// whose netid was released without the client being told
+	Baselines::iterator bit = cd.baselines.find(mo->netid);
+	if (bit == cd.baselines.end() || bit->second.generation != generation)
+	{
+		mobj_baseline_t fresh;
+		memset(&fresh, 0, sizeof(fresh));
+		for (int i = 0; i < NUM_MOBJDELTA_FIELDS; i++)
+			fresh.first_seq[i] = -1;
+		fresh.keyframe_tic = gametic - MOBJDELTA_KEYFRAME_TICS;
+		fresh.generation = generation;
+
+		if (bit == cd.baselines.end())
+			bit = cd.baselines.insert(std::make_pair(mo->netid, fresh)).first;
+		else
+			bit->second = fresh;
+	}
+
+	mobj_baseline_t &base = bit->second;
+
+	bool keyframe = gametic - base.keyframe_tic >= MOBJDELTA_KEYFRAME_TICS;
+	if (keyframe)
+		base.keyframe_tic = gametic;
+
+	int values[NUM_MOBJDELTA_FIELDS] = { 0 };
+	unsigned int mask = 0;
+
+	for (int i = 0; i < NUM_MOBJDELTA_FIELDS; i++)
+	{
+		unsigned int fbit = 1 << i;
+		if (!(fields & fbit))
+			continue;
+
+		values[i] = SV_MobjDeltaValue(mo, i);
+
+		bool changed = values[i] != base.value[i];
+
+		// an unchanged value that's on its way is left to its ack, unless
+		// that's taking long enough that the packet was probably lost
+		bool waiting = base.first_seq[i] != -1 &&
+			gametic - base.written_tic[i] < MOBJDELTA_ACK_TICS;
+
+		if (keyframe || changed || (!(base.confirmed & fbit) && !waiting))
+		{
+			mask |= fbit;
+			base.written_tic[i] = gametic;
+
+			if (changed)
+			{
+				base.value[i] = values[i];
+				base.first_seq[i] = -1;
+				base.confirmed &= ~fbit;
+			}
+		}
+	}
+
+	if (!mask)
+		return false;
+
+	buf_t *buf = &player.client.netbuf;
+
+	SV_BeginUpdate(player, UPDATE_KEY(UPDATE_KEY_MOBJ, mo->netid), priority);
+
+	MSG_WriteMarker(buf, svc_mobjdelta);
+	MSG_WriteShort(buf, mo->netid);
+	MSG_WriteShort(buf, mask);
+
+	for (int i = 0; i < NUM_MOBJDELTA_FIELDS; i++)
+	{
+		if (!(mask & (1 << i)))
+			continue;
+
+		switch (i)
+		{
+		case MDF_RNDINDEX_BIT:
+		case MDF_MOVEDIR_BIT:
+			MSG_WriteByte(buf, values[i]);
+			break;
+		case MDF_TARGET_BIT:
+		case MDF_TRACER_BIT:
+			MSG_WriteShort(buf, values[i]);
+			break;
+		default:
+			MSG_WriteLong(buf, values[i]);
+			break;
+		}
+	}
+
+	delta_record_t rec = { mo->netid, generation, mask, SV_EndUpdate(player) };
+	memcpy(rec.value, values, sizeof(rec.value));
+	cd.unsent.push_back(rec);
+
+	return true;
+}
+
+//
+// SV_DeltaPacketSent
+//
+// Called by SV_SendPacket once the bandwidth scheduler has picked what goes
+// in the packet.  Deltas held back wait for the next packet; the fields of
+// dropped ones have no packet carrying them and are written again on the
+// next update.
+//
+void SV_DeltaPacketSent(player_t &player, int sequence)
+{
+	client_delta_t &cd = client_deltas[player.id];
+
+	if (cd.unsent.empty())
+		return;
+
+	int slot = sequence % MOBJDELTA_HISTORY;
+	DeltaRecords held;
+
+	if (cd.inflight_seq[slot] != sequence)
+	{
+		cd.inflight[slot].clear();
+		cd.inflight_seq[slot] = sequence;
+	}
+
+	for (DeltaRecords::iterator it = cd.unsent.begin(); it != cd.unsent.end(); ++it)
+	{
+		update_status_t status = SV_UpdateStatus(player, it->update);
+
+		if (status == UPDATE_PENDING)
+			held.push_back(*it);
+
+		if (status != UPDATE_SENT)
+			continue;
+
+		Baselines::iterator bit = cd.baselines.find(it->netid);
+		if (bit == cd.baselines.end() || bit->second.generation != it->generation)
+			continue;
+
+		mobj_baseline_t &base = bit->second;
+
+		// a value that has changed since this was written isn't current
+		for (int i = 0; i < NUM_MOBJDELTA_FIELDS; i++)
+			if (it->mask & (1 << i) && it->value[i] == base.value[i] && base.first_seq[i] == -1)
+				base.first_seq[i] = sequence;
+
+		cd.inflight[slot].push_back(*it);
+	}
+
+	cd.unsent.swap(held);
+}
+
+//
+// SV_DeltaPacketAcked
+//
+void SV_DeltaPacketAcked(player_t &player, int sequence)
+{
+	client_delta_t &cd = client_deltas[player.id];
+
+	if (sequence < 0)
+		return;
+
+	int slot = sequence % MOBJDELTA_HISTORY;
+	if (cd.inflight_seq[slot] != sequence)
+		return;
+
+	DeltaRecords &recs = cd.inflight[slot];
+	for (DeltaRecords::iterator it = recs.begin(); it != recs.end(); ++it)
+	{
+		Baselines::iterator bit = cd.baselines.find(it->netid);
+		if (bit == cd.baselines.end() || bit->second.generation != it->generation)
+			continue;
+
+		mobj_baseline_t &base = bit->second;
+
+		// any packet since the first one carrying the current value that had
+		// the field carried that value too, so an ack for any of them
+		// confirms it
+		for (int i = 0; i < NUM_MOBJDELTA_FIELDS; i++)
+			if (it->mask & (1 << i) && base.first_seq[i] != -1 &&
+				sequence >= base.first_seq[i] && it->value[i] == base.value[i])
+				base.confirmed |= (1 << i);
+	}
+
+	recs.clear();
+	cd.inflight_seq[slot] = -1;
+}
+
+//
+// SV_DeltaForgetMobj
+//
+// The client no longer has this actor, the next update starts from scratch.
+//
+void SV_DeltaForgetMobj(player_t &player, int netid)
+{
+	client_deltas[player.id].baselines.erase(netid);
+}
+
+void SV_DeltaForgetMobj(int netid)
+{
+	for (Players::iterator it = players.begin(); it != players.end(); ++it)
+		SV_DeltaForgetMobj(*it, netid);
+}
+
+//
+// SV_DeltaReset
+//
+// Forget everything about a client, used on connect and map change.
+//
+void SV_DeltaReset(player_t &player)
+{
+	client_delta_t &cd = client_deltas[player.id];
+
+	cd.baselines.clear();
+	cd.unsent.clear();
+
+	for (int i = 0; i < MOBJDELTA_HISTORY; i++)
+	{
+		cd.inflight[i].clear();
+		cd.inflight_seq[i] = -1;
+	}
+}
+
+VERSION_CONTROL (sv_delta_cpp, "$Id$")
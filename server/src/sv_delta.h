@@ -0,0 +1,46 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Delta-compressed actor updates against the state each client has
+//	acknowledged.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __SV_DELTA_H__
+#define __SV_DELTA_H__
+
+#include "actor.h"
+#include "d_player.h"
+
+// fields sent for monsters and missiles
+#define MOBJDELTA_MONSTER_FIELDS	(MDF_POSITION | MDF_MOTION | MDF_RNDINDEX | \
+									 MDF_MOVEDIR | MDF_MOVECOUNT | MDF_TARGET)
+#define MOBJDELTA_MISSILE_FIELDS	(MDF_POSITION | MDF_MOTION | MDF_RNDINDEX | \
+									 MDF_TRACER)
+
+bool SV_ClientWantsDeltas(player_t &player);
+bool SV_WriteMobjDelta(player_t &player, AActor *mo, unsigned int fields, int priority);
+
+void SV_DeltaPacketSent(player_t &player, int sequence);
+void SV_DeltaPacketAcked(player_t &player, int sequence);
+
+void SV_DeltaForgetMobj(player_t &player, int netid);
+void SV_DeltaForgetMobj(int netid);
+void SV_DeltaReset(player_t &player);
+
+#endif
@@ -0,0 +1,393 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Serving wads to clients that don't have them.
+//
+//	A wad is mapped into memory (read into it where there's no mmap) the
+//	first time someone asks for it and shared by everyone downloading it,
+//	until nobody is.  Chunks are as big as fits in a packet under the MTU
+//	and paced by a token bucket of the client's download rate.
+//
+//	Clients with NETCAP_DOWNLOADACK are sent svc_wadwindow, ack what they
+//	have got in order with clc_wadack and are sent no more than
+//	sv_waddownloadwindow KiB past their last ack.  If their acks stop coming
+//	the download goes back to the last one.  Older clients get a steady
+//	stream and ask for it to be rewound with clc_wantwad when they miss a
+//	chunk.
+//
+//-----------------------------------------------------------------------------
+
+#include <map>
+#include <string>
+
+#ifdef UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "c_dispatch.h"
+#include "doomstat.h"
+#include "i_net.h"
+#include "i_system.h"
+#include "m_fileio.h"
+#include "sv_download.h"
+#include "sv_main.h"
+
+EXTERN_CVAR(sv_waddownloadcap)
+EXTERN_CVAR(sv_waddownloadwindow)
+
+// Room for the sequence number, a compression header, svc_wadwindow and the
+// svc_wadchunk header in a packet of 1400 bytes
+#define DOWNLOAD_CHUNK_SIZE		1360
+
+// Go back to the last ack when nothing new has been acked for this many tics
+#define DOWNLOAD_ACK_TIMEOUT	TICRATE
+
+// A clc_wantwad for where the download was last rewound to, this soon after,
+// is about a chunk that was already on its way and is ignored
+#define DOWNLOAD_REWIND_DELAY	(TICRATE / 2)
+
+struct download_file_t
+{
+	const byte	*data;
+	size_t		size;
+	bool		mapped;
+	bool		used;		// by someone this tic
+};
+
+typedef std::map<std::string, download_file_t> DownloadFiles;
+static DownloadFiles download_files;
+
+static struct
+{
+	QWORD		sent;		// bytes of wads
+	QWORD		rewound;	// bytes that had to be sent again
+	QWORD		chunks;
+	QWORD		started;	// downloads, not counting resumes
+	dtime_t		since;
+
+	QWORD		second;		// bytes sent this second and the one before
+	QWORD		lastsecond;
+	dtime_t		secondstart;
+} DownloadStats;
+
+//
+// SV_OpenDownloadFile
+//
+// Returns the wad, mapping it if nobody has it open, or NULL if it can't be
+// read.
+//
+static download_file_t *SV_OpenDownloadFile(const std::string &filename)
+{
+	DownloadFiles::iterator it = download_files.find(filename);
+	if (it != download_files.end())
+		return &it->second;
+
+	download_file_t file;
+	file.data = NULL;
+	file.size = 0;
+	file.mapped = false;
+	file.used = false;
+
+#ifdef UNIX
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			file.data = (const byte *)p;
+			file.size = st.st_size;
+			file.mapped = true;
+		}
+	}
+
+	// the mapping keeps the file
+	close(fd);
+#endif
+
+	if (!file.mapped)
+	{
+		FILE *fp = fopen(filename.c_str(), "rb");
+		if (!fp)
+			return NULL;
+
+		SDWORD len = M_FileLength(fp);
+		if (len <= 0)
+		{
+			fclose(fp);
+			return NULL;
+		}
+
+		byte *data = new byte[len];
+		if (fread(data, 1, len, fp) != (size_t)len)
+		{
+			delete[] data;
+			fclose(fp);
+			return NULL;
+		}
+		fclose(fp);
+
+		file.data = data;
+		file.size = len;
+	}
+
+	return &(download_files[filename] = file);
+}
+
+//
+// SV_CloseDownloadFile
+//
+static void SV_CloseDownloadFile(download_file_t &file)
+{
+#ifdef UNIX
+	if (file.mapped)
+		munmap((void *)file.data, file.size);
+	else
+#endif
+		delete[] file.data;
+
+	file.data = NULL;
+	file.size = 0;
+}
+
+//
+// SV_DownloadStart
+//
+// Called for every clc_wantwad, which starts a download, resumes it after a
+// reconnect or rewinds it to where the client is missing a chunk.
+//
+void SV_DownloadStart(player_t &player, const std::string &filename, unsigned int offset)
+{
+	client_t::download_t &dl = player.client.download;
+	bool resume = player.playerstate == PST_DOWNLOAD && dl.name == filename;
+
+	if (resume)
+	{
+		// a chunk sent before the last rewind went missing too
+		if (offset == dl.rewind_offset && offset < dl.next_offset &&
+			gametic - dl.rewind_tic < DOWNLOAD_REWIND_DELAY)
+			return;
+
+		if (offset < dl.next_offset)
+			DownloadStats.rewound += dl.next_offset - offset;
+	}
+	else
+	{
+		DownloadStats.started++;
+		dl.budget = 0;
+	}
+
+	dl.name = filename;
+	dl.next_offset = offset;
+	dl.windowed = (player.client.netcaps & NETCAP_DOWNLOADACK) != 0;
+	dl.announce = dl.windowed;
+	dl.acked_offset = offset;
+	dl.acked_tic = gametic;
+	dl.rewind_offset = offset;
+	dl.rewind_tic = gametic;
+
+	player.playerstate = PST_DOWNLOAD;
+}
+
+//
+// SV_DownloadAck
+//
+// clc_wadack: how much of the wad the client has, from the start.
+//
+void SV_DownloadAck(player_t &player)
+{
+	unsigned int offset = MSG_ReadLong();
+	client_t::download_t &dl = player.client.download;
+
+	if (player.playerstate != PST_DOWNLOAD || !dl.windowed)
+		return;
+
+	// it knows about the window now
+	dl.announce = false;
+
+	if (offset > dl.acked_offset)
+	{
+		dl.acked_offset = offset;
+		dl.acked_tic = gametic;
+
+		// acks were lost and the download went back further than it needed to
+		if (offset > dl.next_offset)
+			dl.next_offset = offset;
+	}
+}
+
+//
+// SV_SendDownload
+//
+static void SV_SendDownload(player_t &player, const download_file_t &file)
+{
+	client_t *cl = &player.client;
+	client_t::download_t &dl = cl->download;
+
+	// maximum rate client can download at (in bytes per second)
+	int download_rate = (sv_waddownloadcap > cl->rate) ? cl->rate*1000 : sv_waddownloadcap*1000;
+	int per_tic = download_rate / TICRATE;
+
+	// Smaller chunks for slower clients
+	unsigned int chunk_size = MIN(DOWNLOAD_CHUNK_SIZE, per_tic);
+
+	// what wasn't used last tic can be, but no more than a chunk of it
+	dl.budget = MIN(dl.budget + per_tic, per_tic + (int)chunk_size);
+
+	unsigned int window = sv_waddownloadwindow.asInt() * 1024;
+
+	if (dl.windowed && dl.next_offset > dl.acked_offset &&
+		gametic - dl.acked_tic > DOWNLOAD_ACK_TIMEOUT)
+	{
+		DownloadStats.rewound += dl.next_offset - dl.acked_offset;
+		dl.next_offset = dl.acked_offset;
+		dl.acked_tic = gametic;
+	}
+
+	while (dl.budget > 0 && dl.next_offset < file.size)
+	{
+		if (dl.windowed && dl.next_offset - dl.acked_offset >= window)
+			break;
+
+		unsigned int len = MIN((size_t)chunk_size, file.size - dl.next_offset);
+
+		// [SL] 2011-08-09 - Always send the data in netbuf and reliablebuf prior
+		// to writing a wadchunk to netbuf to keep packet sizes below the MTU.
+		// This prevents packets from getting dropped due to size on some networks.
+		if (cl->netbuf.size() + cl->reliablebuf.size())
+			SV_SendPacket(player);
+
+		// until the client acks something, in case it got lost
+		if (dl.announce)
+		{
+			MSG_WriteMarker(&cl->netbuf, svc_wadwindow);
+			MSG_WriteLong(&cl->netbuf, window);
+		}
+
+		if (!dl.next_offset)
+		{
+			MSG_WriteMarker(&cl->netbuf, svc_wadinfo);
+			MSG_WriteLong(&cl->netbuf, file.size);
+		}
+
+		MSG_WriteMarker(&cl->netbuf, svc_wadchunk);
+		MSG_WriteLong(&cl->netbuf, dl.next_offset);
+		MSG_WriteShort(&cl->netbuf, len);
+		MSG_WriteChunk(&cl->netbuf, file.data + dl.next_offset, len);
+
+		// Make double-sure the wadchunk is sent in its own packet
+		SV_SendPacket(player);
+
+		dl.next_offset += len;
+		dl.budget -= len;
+
+		DownloadStats.sent += len;
+		DownloadStats.second += len;
+		DownloadStats.chunks++;
+	}
+}
+
+//
+// SV_WadDownloads
+//
+void SV_WadDownloads(void)
+{
+	if (!DownloadStats.since)
+		DownloadStats.since = DownloadStats.secondstart = I_GetTime();
+
+	for (DownloadFiles::iterator it = download_files.begin(); it != download_files.end(); ++it)
+		it->second.used = false;
+
+	for (Players::iterator it = players.begin(); it != players.end(); ++it)
+	{
+		if (it->playerstate != PST_DOWNLOAD)
+			continue;
+
+		client_t *cl = &(it->client);
+
+		if (cl->download.name.empty())
+			continue;
+
+		download_file_t *file = SV_OpenDownloadFile(cl->download.name);
+		if (!file)
+			continue;
+
+		file->used = true;
+		SV_SendDownload(*it, *file);
+	}
+
+	// let go of the ones nobody is downloading
+	DownloadFiles::iterator it = download_files.begin();
+	while (it != download_files.end())
+	{
+		if (it->second.used)
+		{
+			++it;
+			continue;
+		}
+
+		SV_CloseDownloadFile(it->second);
+		download_files.erase(it++);
+	}
+
+	dtime_t now = I_GetTime();
+	if (now - DownloadStats.secondstart >= I_ConvertTimeFromMs(1000))
+	{
+		DownloadStats.lastsecond = DownloadStats.second;
+		DownloadStats.second = 0;
+		DownloadStats.secondstart = now;
+	}
+}
+
+BEGIN_COMMAND(downloadstats)
+{
+	if (argc > 1 && stricmp(argv[1], "reset") == 0)
+	{
+		memset(&DownloadStats, 0, sizeof(DownloadStats));
+		DownloadStats.since = DownloadStats.secondstart = I_GetTime();
+		Printf(PRINT_HIGH, "Download stats reset\n");
+		return;
+	}
+
+	int downloading = 0;
+	for (Players::iterator it = players.begin(); it != players.end(); ++it)
+		if (it->playerstate == PST_DOWNLOAD)
+			downloading++;
+
+	double seconds = (double)I_ConvertTimeToMs(I_GetTime() - DownloadStats.since) / 1000.0;
+
+	Printf(PRINT_HIGH, "Downloads: %d clients, %u wads open, %.1f KiB/s in the last second\n",
+	       downloading, (unsigned)download_files.size(), DownloadStats.lastsecond / 1024.0);
+	Printf(PRINT_HIGH, "In %.0f seconds: %llu started, %llu bytes in %llu chunks (%.1f KiB/s), "
+	       "%llu bytes sent again\n", seconds,
+	       (unsigned long long)DownloadStats.started, (unsigned long long)DownloadStats.sent,
+	       (unsigned long long)DownloadStats.chunks,
+	       seconds > 0.0 ? DownloadStats.sent / 1024.0 / seconds : 0.0,
+	       (unsigned long long)DownloadStats.rewound);
+}
+END_COMMAND(downloadstats)
+
+VERSION_CONTROL(sv_download_cpp, "$Id$")
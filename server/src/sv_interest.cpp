@@ -0,0 +1,283 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Interest management: which monsters and missiles each client is told
+//	about.
+//
+//	A monster or missile is relevant to a client when it is close enough to
+//	be heard, or within sv_interestradius and in a sector the reject table
+//	says is visible from the client's (or the spied player's) sector.  Each
+//	client keeps the set of such actors it currently knows about; every few
+//	tics the set is checked for actors that dropped out of range and the
+//	blockmap around the client is searched for ones that came into it.
+//	Everything else (players, items, decorations) is always sent.
+//
+//-----------------------------------------------------------------------------
+
+#include "doomstat.h"
+#include "c_cvars.h"
+#include "m_fixed.h"
+#include "p_local.h"
+#include "sv_main.h"
+#include "sv_interest.h"
+
+EXTERN_CVAR(sv_interestmanagement)
+EXTERN_CVAR(sv_interestradius)
+
+bool SV_AwarenessUpdate(player_t &player, AActor *mo);
+void SV_QueueAllMobjs(player_t &player);
+
+// anything this close can be heard, walls or not (S_CLIPPING_DIST)
+static const fixed_t INTEREST_HEARING_DIST = 1200 * FRACUNIT;
+
+// actors already known are kept until they are this much further away,
+// so one wandering along the edge doesn't flicker in and out
+static const fixed_t INTEREST_MARGIN = 256 * FRACUNIT;
+
+// how often each client's set is refreshed
+static const int INTEREST_SCAN_TICS = 4;
+
+static InterestSet interest_sets[MAXPLAYERS + 1];
+
+CVAR_FUNC_IMPL(sv_interestmanagement)
+{
+	// catch everyone up on what was held back
+	if (!var)
+	{
+		for (Players::iterator it = players.begin(); it != players.end(); ++it)
+			SV_QueueAllMobjs(*it);
+	}
+}
+
+//
+// SV_IsMonsterOrMissile
+//
+static bool SV_IsMonsterOrMissile(AActor *mo)
+{
+	if (!mo || mo->player)
+		return false;
+
+	return (mo->flags & (MF_MISSILE | MF_SKULLFLY | MF_COUNTKILL)) ||
+		   mo->type == MT_SKULL;
+}
+
+//
+// SV_IsInterestManaged
+//
+// Only live monsters and missiles are held back; they are the ones that
+// get periodic updates.  Corpses are always sent, the client counts kills
+// when it is told about them.
+//
+bool SV_IsInterestManaged(AActor *mo)
+{
+	return SV_IsMonsterOrMissile(mo) && !(mo->flags & MF_CORPSE);
+}
+
+//
+// SV_RejectAllowsSight
+//
+static bool SV_RejectAllowsSight(AActor *a, AActor *b)
+{
+	if (rejectempty || !a->subsector || !b->subsector)
+		return true;
+
+	int pnum = (a->subsector->sector - sectors) * numsectors +
+			   (b->subsector->sector - sectors);
+
+	return !(rejectmatrix[pnum >> 3] & (1 << (pnum & 7)));
+}
+
+//
+// SV_CanPerceive
+//
+static bool SV_CanPerceive(AActor *viewer, AActor *mo, fixed_t radius)
+{
+	fixed_t dist = P_AproxDistance(mo->x - viewer->x, mo->y - viewer->y);
+
+	if (dist <= INTEREST_HEARING_DIST)
+		return true;
+
+	if (dist > radius)
+		return false;
+
+	return SV_RejectAllowsSight(viewer, mo);
+}
+
+//
+// SV_SpiedActor
+//
+// The actor a spectator is following, if any.
+//
+static AActor *SV_SpiedActor(player_t &player)
+{
+	if (player.spying == player.id)
+		return NULL;
+
+	player_t &other = idplayer(player.spying);
+	if (!validplayer(other) || !P_CanSpy(player, other))
+		return NULL;
+
+	return other.mo;
+}
+
+//
+// SV_IsRelevant
+//
+// Should this client know about the actor?
+//
+bool SV_IsRelevant(player_t &player, AActor *mo)
+{
+	if (!sv_interestmanagement || !SV_IsInterestManaged(mo))
+		return true;
+
+	// without an actor there is nowhere to measure from
+	if (!player.mo)
+		return true;
+
+	fixed_t radius = sv_interestradius.asInt() * FRACUNIT;
+	if (mo->players_aware.get(player.id))
+		radius += INTEREST_MARGIN;
+
+	if (SV_CanPerceive(player.mo, mo, radius))
+		return true;
+
+	AActor *spied = SV_SpiedActor(player);
+	return spied && SV_CanPerceive(spied, mo, radius);
+}
+
+//
+// SV_InterestTrack
+//
+// Called when the client is told about an actor.  Corpses are tracked too
+// in case they are raised.
+//
+void SV_InterestTrack(player_t &player, AActor *mo)
+{
+	if (!SV_IsMonsterOrMissile(mo) || mo->players_interested.get(player.id))
+		return;
+
+	mo->players_interested.set(player.id);
+	interest_sets[player.id].push_back(mo->ptr());
+}
+
+//
+// SV_ScanBlockmap
+//
+// Tells the client about managed actors around the viewer that it doesn't
+// know about yet.
+//
+static int SV_ScanBlockmap(player_t &player, AActor *viewer, int budget)
+{
+	int updated = 0;
+
+	fixed_t radius = sv_interestradius.asInt() * FRACUNIT;
+	int left   = (viewer->x - radius - bmaporgx) >> MAPBLOCKSHIFT;
+	int right  = (viewer->x + radius - bmaporgx) >> MAPBLOCKSHIFT;
+	int bottom = (viewer->y - radius - bmaporgy) >> MAPBLOCKSHIFT;
+	int top    = (viewer->y + radius - bmaporgy) >> MAPBLOCKSHIFT;
+
+	if (left < 0) left = 0;
+	if (bottom < 0) bottom = 0;
+	if (right >= bmapwidth) right = bmapwidth - 1;
+	if (top >= bmapheight) top = bmapheight - 1;
+
+	for (int by = bottom; by <= top; by++)
+	{
+		for (int bx = left; bx <= right; bx++)
+		{
+			AActor *mo = blocklinks[by * bmapwidth + bx];
+			for (; mo; mo = mo->bmapnode.Next(bx, by))
+			{
+				if (!SV_IsInterestManaged(mo) || mo->players_aware.get(player.id))
+					continue;
+
+				updated += SV_AwarenessUpdate(player, mo);
+				if (updated >= budget)
+					return updated;
+			}
+		}
+	}
+
+	return updated;
+}
+
+//
+// SV_UpdateInterest
+//
+// Refreshes the client's set every INTEREST_SCAN_TICS, staggered between
+// clients.  Actors that went out of range are removed from the client;
+// at most 'budget' new ones are sent.
+//
+int SV_UpdateInterest(player_t &player, int budget)
+{
+	if (!player.mo || (gametic + player.id) % INTEREST_SCAN_TICS)
+		return 0;
+
+	InterestSet &set = interest_sets[player.id];
+	int updated = 0;
+
+	for (size_t i = 0; i < set.size(); )
+	{
+		AActor *mo = set[i];
+
+		if (mo && mo->players_aware.get(player.id) && SV_IsRelevant(player, mo))
+		{
+			i++;
+			continue;
+		}
+
+		// SV_AwarenessUpdate sends the removal
+		if (mo && mo->players_aware.get(player.id))
+			SV_AwarenessUpdate(player, mo);
+
+		if (mo)
+			mo->players_interested.unset(player.id);
+
+		set[i] = set.back();
+		set.pop_back();
+	}
+
+	if (!sv_interestmanagement || budget <= 0)
+		return updated;
+
+	updated += SV_ScanBlockmap(player, player.mo, budget);
+
+	AActor *spied = SV_SpiedActor(player);
+	if (spied && updated < budget)
+		updated += SV_ScanBlockmap(player, spied, budget - updated);
+
+	return updated;
+}
+
+//
+// SV_InterestReset
+//
+void SV_InterestReset(player_t &player)
+{
+	InterestSet &set = interest_sets[player.id];
+
+	for (size_t i = 0; i < set.size(); i++)
+	{
+		if (set[i])
+			set[i]->players_interested.unset(player.id);
+	}
+
+	set.clear();
+}
+
+VERSION_CONTROL (sv_interest_cpp, "$Id$")
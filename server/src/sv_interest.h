@@ -0,0 +1,41 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Interest management: which monsters and missiles each client is told
+//	about.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __SV_INTEREST_H__
+#define __SV_INTEREST_H__
+
+#include <vector>
+
+#include "actor.h"
+#include "d_player.h"
+
+typedef std::vector<AActor::AActorPtr> InterestSet;
+
+bool SV_IsInterestManaged(AActor *mo);
+bool SV_IsRelevant(player_t &player, AActor *mo);
+
+void SV_InterestTrack(player_t &player, AActor *mo);
+int SV_UpdateInterest(player_t &player, int budget);
+void SV_InterestReset(player_t &player);
+
+#endif
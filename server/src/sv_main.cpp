@@ -64,7 +64,14 @@
 #include "sv_maplist.h"
 #include "g_warmup.h"
 #include "sv_banlist.h"
+#include "sv_download.h"
 #include "d_main.h"
+#include "m_memio.h"
+#include "sv_delta.h"
+#include "sv_interest.h"
+#include "sv_bandwidth.h"
+#include "sv_mobjupdate.h"
+#include "stats.h"
 
 #include <algorithm>
 #include <sstream>
@@ -91,6 +98,8 @@ extern int mapchange;
 
 bool step_mode = false;
 
+int server_instance = 0;
+
 std::queue<byte> free_player_ids;
 
 // General server settings
@@ -108,6 +117,8 @@ EXTERN_CVAR(sv_allowtargetnames)
 EXTERN_CVAR(sv_flooddelay)
 EXTERN_CVAR(sv_ticbuffer)
 EXTERN_CVAR(sv_warmup)
+EXTERN_CVAR(sv_batchsend)
+EXTERN_CVAR(sv_batchrecv)
 
 void SexMessage (const char *from, char *to, int gender,
 	const char *victim, const char *killer);
@@ -268,6 +279,11 @@ CVAR_FUNC_IMPL(sv_maxrate)
 	}
 }
 
+CVAR_FUNC_IMPL (sv_batchrecv)
+{
+	NET_SetReceiveBatch(var.asInt());
+}
+
 CVAR_FUNC_IMPL (sv_waddownloadcap)
 {
 	// sv_waddownloadcap can not be larger than sv_maxrate
@@ -458,8 +474,16 @@ void SV_InitNetwork (void)
 	else
 	   localport = SERVERPORT;
 
+	// -instances gives each forked server the next port up
+	if (server_instance)
+	{
+		localport += server_instance;
+		Printf (PRINT_HIGH, "instance %i using port %i\n", server_instance, localport);
+	}
+
 	// set up a socket and net_message buffer
 	InitNetCommon();
+	NET_SetReceiveBatch(sv_batchrecv.asInt());
 
 	// determine my name & address
 	// NET_GetLocalAddress ();
@@ -495,6 +519,7 @@ Players::iterator SV_GetFreeClient(void)
 	}
 
 	players.push_back(player_t());
+	SV_QryInvalidate();
 
 	// generate player id
 	players.back().id = free_player_ids.front();
@@ -570,12 +595,18 @@ Players::iterator SV_RemoveDisconnectedPlayer(Players::iterator it)
 		it->mo = AActor::AActorPtr();
 	}
 
+	SV_DeltaReset(*it);
+	SV_InterestReset(*it);
+	SV_BandwidthReset(*it);
+	SV_ReliableReset(*it);
+
 	// remove this player from the global players vector
 	Players::iterator next;
 	next = players.erase(it);
 	free_player_ids.push(player_id);
 
 	Unlag::getInstance().unregisterPlayer(player_id);
+	SV_QryInvalidate();
 
 	// update tracking cvar
 	sv_clientcount.ForceSet(players.size());
@@ -813,6 +844,8 @@ void SV_Sound (fixed_t x, fixed_t y, byte channel, const char *name, byte attenu
 //
 void SV_UpdateFrags(player_t &player)
 {
+	SV_QryInvalidate();
+
 	for (Players::iterator it = players.begin();it != players.end();++it)
 	{
 		client_t *cl = &(it->client);
@@ -865,6 +898,8 @@ void SV_BroadcastUserInfo(player_t &player)
  */
 bool SV_SetupUserInfo(player_t &player)
 {
+	SV_QryInvalidate();
+
 	// read in userinfo from packet
 	std::string old_netname(player.userinfo.netname);
 	std::string new_netname(MSG_ReadString());
@@ -1195,7 +1230,7 @@ bool SV_AwarenessUpdate(player_t &player, AActor *mo)
 	if(player.mo == mo)
 		ok = true;
 	else if(!mo->player)
-		ok = true;
+		ok = SV_IsRelevant(player, mo);
 	else if (mo->flags & MF_SPECTATOR)      // GhostlyDeath -- Spectating things
 		ok = false;
 	else if(player.mo && mo->player && mo->player->spectator)
@@ -1212,6 +1247,7 @@ bool SV_AwarenessUpdate(player_t &player, AActor *mo)
 	if(!ok && previously_ok)
 	{
 		mo->players_aware.unset(player.id);
+		SV_DeltaForgetMobj(player, mo->netid);
 
 		MSG_WriteMarker (&cl->reliablebuf, svc_removemobj);
 		MSG_WriteShort (&cl->reliablebuf, mo->netid);
@@ -1221,6 +1257,7 @@ bool SV_AwarenessUpdate(player_t &player, AActor *mo)
 	else if(!previously_ok && ok)
 	{
 		mo->players_aware.set(player.id);
+		SV_InterestTrack(player, mo);
 
 		if(!mo->player || mo->player->playerstate != PST_LIVE)
 		{
@@ -1279,44 +1316,98 @@ bool SV_IsPlayerAllowedToSee(player_t &p, AActor *mo)
 #define HARDWARE_CAPABILITY 1000
 
 //
-// SV_UpdateHiddenMobj
+// SV_QueueAllMobjs
+//
+// Queues every actor for an awareness check, for a client that has to be
+// caught up on the whole level.
 //
-void SV_UpdateHiddenMobj (void)
+void SV_QueueAllMobjs(player_t &pl)
 {
-	// denis - todo - throttle this
 	AActor *mo;
 	TThinkerIterator<AActor> iterator;
 
+	while ( (mo = iterator.Next() ) )
+		pl.to_spawn.push(mo->ptr());
+}
+
+//
+// SV_PlayerAwarenessChanged
+//
+// Whether a player is sent another player only depends on their actors
+// and who is spectating, so everyone is only checked against everyone
+// on tics where one of those changed.
+//
+static bool SV_PlayerAwarenessChanged()
+{
+	static int checked_tic = -1;
+	static bool changed = false;
+	static int last_netid[MAXPLAYERS + 1];
+	static bool last_spectator[MAXPLAYERS + 1];
+
+	if (checked_tic == gametic)
+		return changed;
+
+	checked_tic = gametic;
+	changed = false;
+
 	for (Players::iterator it = players.begin();it != players.end();++it)
 	{
-		player_t &pl = *it;
+		int netid = it->mo ? it->mo->netid : 0;
+		bool spectator = it->spectator || (it->mo && (it->mo->flags & MF_SPECTATOR));
 
-		if(!pl.mo)
-			continue;
+		if (last_netid[it->id] != netid || last_spectator[it->id] != spectator)
+		{
+			last_netid[it->id] = netid;
+			last_spectator[it->id] = spectator;
+			changed = true;
+		}
+	}
 
-		int updated = 0;
+	return changed;
+}
 
-		while(!pl.to_spawn.empty())
-		{
-			mo = pl.to_spawn.front();
+//
+// SV_UpdateHiddenMobj
+//
+// Sends the player actors it has not been told about yet and removes ones
+// it should no longer see, a few at a time.
+//
+void SV_UpdateHiddenMobj (player_t &pl)
+{
+	SCOPED_STAT(SV_UpdateHiddenMobj);
 
-			pl.to_spawn.pop();
+	AActor *mo;
 
-			if(mo && !mo->WasDestroyed())
-				updated += SV_AwarenessUpdate(pl, mo);
+	if(!pl.mo)
+		return;
 
-			if(updated > 16)
-				break;
-		}
+	int updated = 0;
 
-		while ( (mo = iterator.Next() ) )
-		{
+	while(!pl.to_spawn.empty())
+	{
+		mo = pl.to_spawn.front();
+
+		pl.to_spawn.pop();
+
+		if(mo && !mo->WasDestroyed())
 			updated += SV_AwarenessUpdate(pl, mo);
 
-			if(updated > 16)
-				break;
+		if(updated > 16)
+			break;
+	}
+
+	// players come and go from view as they spectate
+	if (SV_PlayerAwarenessChanged())
+	{
+		for (Players::iterator it = players.begin();it != players.end();++it)
+		{
+			if (it->mo)
+				updated += SV_AwarenessUpdate(pl, it->mo);
 		}
 	}
+
+	// monsters and missiles follow the player around
+	SV_UpdateInterest(pl, 16 - updated);
 }
 
 void SV_UpdateSector(client_t* cl, int sectornum)
@@ -1575,6 +1666,9 @@ void SV_ClientFullUpdate(player_t &pl)
 {
 	client_t *cl = &pl.client;
 
+	// the client starts from scratch, so do its delta baselines
+	SV_DeltaReset(pl);
+
 	// send player's info to the client
 	for (Players::iterator it = players.begin();it != players.end();++it)
 	{
@@ -1620,7 +1714,8 @@ void SV_ClientFullUpdate(player_t &pl)
 			MSG_WriteShort(&cl->reliablebuf, TEAMpoints[i]);
 	}
 
-	SV_UpdateHiddenMobj();
+	SV_QueueAllMobjs(pl);
+	SV_UpdateHiddenMobj(pl);
 
 	// update flags
 	if (sv_gametype == GM_CTF)
@@ -1694,6 +1789,9 @@ void SV_SendServerSettings (player_t &pl)
 //
 void SV_ServerSettingChange (void)
 {
+	// launchers are told about server info cvars and the map too
+	SV_QryInvalidate();
+
 	if (gamestate != GS_LEVEL)
 		return;
 
@@ -1908,6 +2006,7 @@ void SV_ConnectClient()
 	cl->lastclientcmdtic = 0;
 	cl->allow_rcon = false;
 	cl->displaydisconnect = false;
+	cl->netcaps = 0;
 
 	// generate a random string
 	std::stringstream ss;
@@ -1920,14 +2019,16 @@ void SV_ConnectClient()
 	SZ_Clear(&cl->netbuf);
 	SZ_Clear(&cl->reliablebuf);
 	SZ_Clear(&cl->relpackets);
+	SV_BandwidthReset(*player);
 
 	memset(cl->packetseq, -1, sizeof(cl->packetseq));
 	memset(cl->packetbegin, 0, sizeof(cl->packetbegin));
 	memset(cl->packetsize, 0, sizeof(cl->packetsize));
 
 	cl->sequence = 0;
+	cl->compressor = huffman_server();
 	cl->last_sequence = -1;
-	cl->packetnum =  0;
+	SV_ReliableReset(*player);
 
 	cl->version = MSG_ReadShort();
 	byte connection_type = MSG_ReadByte();
@@ -1964,6 +2065,10 @@ void SV_ConnectClient()
 	}
 
 	std::string passhash = MSG_ReadString();
+
+	// optional protocol features the client supports
+	if (MSG_BytesLeft() >= 4)
+		cl->netcaps = MSG_ReadLong() & NETCAP_SUPPORTED;
 	if (strlen(join_password.cstring()) && MD5SUM(join_password.cstring()) != passhash)
 	{
 		Printf(PRINT_HIGH, "%s disconnected (password failed).\n", NET_AdrToString(net_from));
@@ -2150,7 +2255,7 @@ void SV_DropClient(player_t &who)
 
 	MSG_WriteMarker(&cl->reliablebuf, svc_disconnect);
 
-	SV_SendPacket(who);
+	SV_SendPacket(who, true);
 
 	SV_DisconnectClient(who);
 }
@@ -2165,7 +2270,7 @@ void SV_SendDisconnectSignal()
 		client_t *cl = &(it->client);
 
 		MSG_WriteMarker(&cl->reliablebuf, svc_disconnect);
-		SV_SendPacket(*it);
+		SV_SendPacket(*it, true);
 
 		if (it->mo)
 			it->mo->Destroy();
@@ -2184,7 +2289,7 @@ void SV_SendReconnectSignal()
 	for (Players::iterator it = players.begin();it != players.end();++it)
 	{
 		MSG_WriteMarker(&(it->client.reliablebuf), svc_reconnect);
-		SV_SendPacket(*it);
+		SV_SendPacket(*it, true);
 
 		if (it->mo)
 			it->mo->Destroy();
@@ -2236,6 +2341,10 @@ void SV_SendLoadMap(const std::vector<std::string> &wadnames,
 	}
 
 	MSG_WriteString(buf, mapname.c_str());
+
+	// the client starts counting from zero again
+	player->client.sent_total_monsters = -1;
+	player->client.sent_killed_monsters = -1;
 }
 
 
@@ -2875,59 +2984,177 @@ bool SV_PrivMsg(player_t &player)
 }
 
 //
-// SV_UpdateMissiles
-// Updates missiles position sometimes.
+// SV_WriteMoveMobj
 //
-void SV_UpdateMissiles(player_t &pl)
+// Writes svc_movemobj, or its packed form if the client understands it.
+// The packed form is lossy and only good for updates the next one corrects,
+// so nothing sent reliably is packed.
+//
+static void SV_WriteMoveMobj(buf_t *buf, client_t *cl, AActor *mo,
+							 fixed_t x, fixed_t y, fixed_t z)
+{
+	bool packed = (cl->netcaps & NETCAP_BITPACK) && buf != &cl->reliablebuf;
+	SV_WriteMoveMobj(buf, packed, mo->netid, mo->rndindex, x, y, z);
+}
+
+//
+// SV_WriteMobjSpeedAngle
+//
+// Writes svc_mobjspeedangle, or its packed form if the client understands
+// it and the message isn't reliable.
+//
+static void SV_WriteMobjSpeedAngle(buf_t *buf, client_t *cl, AActor *mo)
 {
-    AActor *mo;
+	bool packed = (cl->netcaps & NETCAP_BITPACK) && buf != &cl->reliablebuf;
+	SV_WriteMobjSpeedAngle(buf, packed, mo->netid, mo->angle, mo->momx, mo->momy, mo->momz);
+}
 
-    TThinkerIterator<AActor> iterator;
-    while ( (mo = iterator.Next() ) )
-    {
-        if (!(mo->flags & MF_MISSILE || mo->flags & MF_SKULLFLY))
+//
+// Per-tic monster and missile updates, see sv_mobjupdate.cpp
+//
+static MobjUpdates missile_updates;
+static MobjUpdates monster_updates;
+static buf_t mobj_frame(MAX_UDP_PACKET * 4);
+
+//
+// SV_CopyMobjUpdate
+//
+static void SV_CopyMobjUpdate(mobj_update_t &u, AActor *mo, bool missile)
+{
+	u.mo = mo;
+	u.aware = &mo->players_aware;
+	u.netid = mo->netid;
+	u.rndindex = mo->rndindex;
+	u.missile = missile;
+	u.x = mo->x;
+	u.y = mo->y;
+	u.z = mo->z;
+	u.angle = mo->angle;
+	u.momx = mo->momx;
+	u.momy = mo->momy;
+	u.momz = mo->momz;
+	u.target = mo->target ? mo->target->netid : 0;
+	u.tracer = mo->tracer ? mo->tracer->netid : 0;
+	u.movedir = mo->movedir;
+	u.movecount = mo->movecount;
+
+	if (missile)
+	{
+		u.deltafields = MOBJDELTA_MISSILE_FIELDS;
+		if (!mo->tracer)
+			u.deltafields &= ~MDF_TRACER;
+	}
+	else
+		u.deltafields = MOBJDELTA_MONSTER_FIELDS;
+}
+
+//
+// SV_BuildMobjUpdates
+//
+// Picks the monsters and missiles due for an update this tic.
+//
+static void SV_BuildMobjUpdates()
+{
+	missile_updates.clear();
+	monster_updates.clear();
+
+	AActor *mo;
+	mobj_update_t u;
+
+	TThinkerIterator<AActor> missiles(THINKER_MISSILE);
+	while ((mo = missiles.Next()))
+	{
+		if (!(mo->flags & MF_MISSILE) || mo->flags & MF_SPECTATOR)
+			continue;
+
+		if (mo->type == MT_PLASMA || !SV_MissileUpdateDue(mo->netid, mo->type, gametic))
+			continue;
+
+		SV_CopyMobjUpdate(u, mo, true);
+		missile_updates.push_back(u);
+	}
+
+	TThinkerIterator<AActor> monsters(THINKER_MONSTER);
+	while ((mo = monsters.Next()))
+	{
+		if (mo->flags & MF_SPECTATOR)
 			continue;
 
-		if (mo->type == MT_PLASMA)
+		// charging lost souls are updated like missiles
+		if (mo->flags & (MF_MISSILE | MF_SKULLFLY) &&
+			SV_MissileUpdateDue(mo->netid, mo->type, gametic))
+		{
+			SV_CopyMobjUpdate(u, mo, true);
+			missile_updates.push_back(u);
+		}
+
+		// Ignore corpses.
+		if (mo->flags & MF_CORPSE || !mo->target)
 			continue;
 
-		// update missile position every 30 tics
-		if (((gametic+mo->netid) % 30) && (mo->type != MT_TRACER) && (mo->type != MT_FATSHOT))
+		if (!SV_MonsterUpdateDue(mo->netid, gametic))
 			continue;
-		// Revenant tracers and Mancubus fireballs need to be  updated more often
-		else if (((gametic+mo->netid) % 5) && (mo->type == MT_TRACER || mo->type == MT_FATSHOT))
+
+		SV_CopyMobjUpdate(u, mo, false);
+		monster_updates.push_back(u);
+	}
+
+	SV_SerializeMobjFrame(mobj_frame, missile_updates, monster_updates);
+}
+
+//
+// SV_WriteMobjUpdates
+//
+// Copies the updates about actors the client knows of into its packet.
+// Returns false if the client was dropped.
+//
+static bool SV_WriteMobjUpdates(player_t &pl, const MobjUpdates &updates)
+{
+	client_t *cl = &pl.client;
+
+	bool deltas = SV_ClientWantsDeltas(pl);
+	bool packed = (cl->netcaps & NETCAP_BITPACK) != 0;
+
+	for (size_t i = 0; i < updates.size(); i++)
+	{
+		const mobj_update_t &u = updates[i];
+
+		if (!u.aware->get(pl.id))
 			continue;
 
-		if(SV_IsPlayerAllowedToSee(pl, mo))
+		int priority = SV_UpdatePriority(pl, u.mo);
+
+		if (deltas)
 		{
-			client_t *cl = &pl.client;
+			SV_WriteMobjDelta(pl, u.mo, u.deltafields, priority);
+		}
+		else
+		{
+			SV_BeginUpdate(pl, UPDATE_KEY(UPDATE_KEY_MOBJ, u.netid), priority);
 
-			MSG_WriteMarker (&cl->netbuf, svc_movemobj);
-			MSG_WriteShort (&cl->netbuf, mo->netid);
-			MSG_WriteByte (&cl->netbuf, mo->rndindex);
-			MSG_WriteLong (&cl->netbuf, mo->x);
-			MSG_WriteLong (&cl->netbuf, mo->y);
-			MSG_WriteLong (&cl->netbuf, mo->z);
-
-			MSG_WriteMarker (&cl->netbuf, svc_mobjspeedangle);
-			MSG_WriteShort(&cl->netbuf, mo->netid);
-			MSG_WriteLong (&cl->netbuf, mo->angle);
-			MSG_WriteLong (&cl->netbuf, mo->momx);
-			MSG_WriteLong (&cl->netbuf, mo->momy);
-			MSG_WriteLong (&cl->netbuf, mo->momz);
-
-			if (mo->tracer)
-			{
-				MSG_WriteMarker (&cl->netbuf, svc_actor_tracer);
-				MSG_WriteShort(&cl->netbuf, mo->netid);
-				MSG_WriteShort (&cl->netbuf, mo->tracer->netid);
-			}
+			if (packed)
+				MSG_WriteChunk(&cl->netbuf, mobj_frame.ptr() + u.packed_offset, u.packed_size);
+			else
+				MSG_WriteChunk(&cl->netbuf, mobj_frame.ptr() + u.plain_offset, u.plain_size);
 
-            if (cl->netbuf.cursize >= 1024)
-                if(!SV_SendPacket(pl))
-                    return;
+			SV_EndUpdate(pl);
 		}
-    }
+
+		if (SV_UpdatesDue(pl))
+			if (!SV_SendPacket(pl))
+				return false;
+	}
+
+	return true;
+}
+
+//
+// SV_UpdateMissiles
+// Updates missiles position sometimes.
+//
+void SV_UpdateMissiles(player_t &pl)
+{
+	SV_WriteMobjUpdates(pl, missile_updates);
 }
 
 // Update the given actors state immediately.
@@ -2953,57 +3180,7 @@ void SV_UpdateMobjState(AActor *mo)
 // Keep tabs on monster positions and angles.
 void SV_UpdateMonsters(player_t &pl)
 {
-	AActor *mo;
-
-	TThinkerIterator<AActor> iterator;
-	while ((mo = iterator.Next()))
-	{
-		// Ignore corpses.
-		if (mo->flags & MF_CORPSE)
-			continue;
-
-		// We don't handle updating non-monsters here.
-		if (!(mo->flags & MF_COUNTKILL || mo->type == MT_SKULL))
-			continue;
-
-		// update monster position every 7 tics
-		if ((gametic+mo->netid) % 7)
-			continue;
-
-		if (SV_IsPlayerAllowedToSee(pl, mo) && mo->target)
-		{
-			client_t *cl = &pl.client;
-
-			MSG_WriteMarker(&cl->netbuf, svc_movemobj);
-			MSG_WriteShort(&cl->netbuf, mo->netid);
-			MSG_WriteByte(&cl->netbuf, mo->rndindex);
-			MSG_WriteLong(&cl->netbuf, mo->x);
-			MSG_WriteLong(&cl->netbuf, mo->y);
-			MSG_WriteLong(&cl->netbuf, mo->z);
-
-			MSG_WriteMarker(&cl->netbuf, svc_mobjspeedangle);
-			MSG_WriteShort(&cl->netbuf, mo->netid);
-			MSG_WriteLong(&cl->netbuf, mo->angle);
-			MSG_WriteLong(&cl->netbuf, mo->momx);
-			MSG_WriteLong(&cl->netbuf, mo->momy);
-			MSG_WriteLong(&cl->netbuf, mo->momz);
-
-			MSG_WriteMarker(&cl->netbuf, svc_actor_movedir);
-			MSG_WriteShort(&cl->netbuf, mo->netid);
-			MSG_WriteByte(&cl->netbuf, mo->movedir);
-			MSG_WriteLong(&cl->netbuf, mo->movecount);
-
-			MSG_WriteMarker(&cl->netbuf, svc_actor_target);
-			MSG_WriteShort(&cl->netbuf, mo->netid);
-			MSG_WriteShort(&cl->netbuf, mo->target->netid);
-
-			if (cl->netbuf.cursize >= 1024)
-			{
-				if (!SV_SendPacket(pl))
-					return;
-			}
-		}
-	}
+	SV_WriteMobjUpdates(pl, monster_updates);
 }
 
 //
@@ -3062,7 +3239,7 @@ void SV_RemoveCorpses (void)
 		return;
 	else
 	{
-		TThinkerIterator<AActor> iterator;
+		TThinkerIterator<AActor> iterator(THINKER_PLAYER);
 		while ( (mo = iterator.Next() ) )
 		{
 			if (mo->type == MT_PLAYER && (!mo->player || mo->health <=0) )
@@ -3070,7 +3247,7 @@ void SV_RemoveCorpses (void)
 		}
 	}
 
-	TThinkerIterator<AActor> iterator;
+	TThinkerIterator<AActor> iterator(THINKER_PLAYER);
 	while (corpses > sv_maxcorpses && (mo = iterator.Next() ) )
 	{
 		if (mo->type == MT_PLAYER && !mo->player)
@@ -3129,6 +3306,31 @@ void SV_UpdatePing(client_t* cl)
 }
 
 
+//
+// SV_UpdateLevelStats
+//
+// Monsters come and go from a client's view, so it can't count them
+// itself; clients with NETCAP_LEVELSTATS are told the counts when they
+// change.
+//
+static void SV_UpdateLevelStats(client_t *cl)
+{
+	if (!(cl->netcaps & NETCAP_LEVELSTATS))
+		return;
+
+	if (cl->sent_total_monsters == level.total_monsters &&
+		cl->sent_killed_monsters == level.killed_monsters)
+		return;
+
+	MSG_WriteMarker(&cl->reliablebuf, svc_levelstats);
+	MSG_WriteShort(&cl->reliablebuf, level.total_monsters);
+	MSG_WriteShort(&cl->reliablebuf, level.killed_monsters);
+
+	cl->sent_total_monsters = level.total_monsters;
+	cl->sent_killed_monsters = level.killed_monsters;
+}
+
+
 //
 // SV_UpdateDeadPlayers
 // Update player's frame while he's dying.
@@ -3181,9 +3383,15 @@ void SV_ClearClientsBPS(void)
 //
 void SV_SendPackets()
 {
+	SCOPED_STAT(SV_SendPackets);
+
 	if (players.empty())
 		return;
 
+	// Hand every client's datagram to the kernel at once
+	if (sv_batchsend)
+		NET_BeginSendBatch();
+
 	static size_t fair_send = 0;
 	size_t num_players = players.size();
 
@@ -3197,10 +3405,13 @@ void SV_SendPackets()
 		++begin;
 
 	// Loop through all players in a staggered fashion.
+	static std::vector<player_t*> order;
+	order.clear();
+
 	Players::iterator it = begin;
 	do
 	{
-		SV_SendPacket(*it);
+		order.push_back(&*it);
 
 		++it;
 		if (it == players.end())
@@ -3208,10 +3419,106 @@ void SV_SendPackets()
 	}
 	while (it != begin);
 
+	SV_SendPacketsTo(order);
+
 	// Advance the send index.
 	fair_send++;
+
+	if (sv_batchsend)
+		NET_EndSendBatch();
 }
 
+//
+// Network packet statistics
+//
+// Sampled once per tic so the netstats command can report how many
+// datagrams and syscalls each tic costs.
+//
+static const int NETSTATS_WINDOW = TICRATE;
+
+struct netstats_sample_t
+{
+	QWORD send_datagrams;
+	QWORD send_syscalls;
+	QWORD recv_datagrams;
+	QWORD recv_syscalls;
+};
+
+static netstats_sample_t netstats_window[NETSTATS_WINDOW];
+static net_stats_t netstats_last;
+static int netstats_pos = 0;
+
+static void SV_SampleNetStats()
+{
+	const net_stats_t &now = NET_GetStats();
+
+	netstats_sample_t &sample = netstats_window[netstats_pos];
+	sample.send_datagrams = now.send_datagrams - netstats_last.send_datagrams;
+	sample.send_syscalls = now.send_syscalls - netstats_last.send_syscalls;
+	sample.recv_datagrams = now.recv_datagrams - netstats_last.recv_datagrams;
+	sample.recv_syscalls = now.recv_syscalls - netstats_last.recv_syscalls;
+
+	netstats_last = now;
+	netstats_pos = (netstats_pos + 1) % NETSTATS_WINDOW;
+}
+
+BEGIN_COMMAND (netstats)
+{
+	const netstats_sample_t &last =
+		netstats_window[(netstats_pos + NETSTATS_WINDOW - 1) % NETSTATS_WINDOW];
+
+	netstats_sample_t sum;
+	memset(&sum, 0, sizeof(sum));
+
+	for (int i = 0; i < NETSTATS_WINDOW; i++)
+	{
+		sum.send_datagrams += netstats_window[i].send_datagrams;
+		sum.send_syscalls += netstats_window[i].send_syscalls;
+		sum.recv_datagrams += netstats_window[i].recv_datagrams;
+		sum.recv_syscalls += netstats_window[i].recv_syscalls;
+	}
+
+	const net_stats_t &total = NET_GetStats();
+
+	Printf(PRINT_HIGH, "Batched sending: %s, batched receiving: %d per syscall\n",
+		sv_batchsend ? "on" : "off", sv_batchrecv.asInt());
+	Printf(PRINT_HIGH, "Last tic: sent %llu datagrams in %llu syscalls, "
+		"received %llu datagrams in %llu syscalls\n",
+		(unsigned long long)last.send_datagrams, (unsigned long long)last.send_syscalls,
+		(unsigned long long)last.recv_datagrams, (unsigned long long)last.recv_syscalls);
+	Printf(PRINT_HIGH, "Average over %d tics: sent %.2f datagrams in %.2f syscalls, "
+		"received %.2f datagrams in %.2f syscalls\n", NETSTATS_WINDOW,
+		(double)sum.send_datagrams / NETSTATS_WINDOW,
+		(double)sum.send_syscalls / NETSTATS_WINDOW,
+		(double)sum.recv_datagrams / NETSTATS_WINDOW,
+		(double)sum.recv_syscalls / NETSTATS_WINDOW);
+	Printf(PRINT_HIGH, "Total: sent %llu datagrams (%llu batched) in %llu syscalls, "
+		"received %llu datagrams in %llu syscalls\n",
+		(unsigned long long)total.send_datagrams, (unsigned long long)total.send_queued,
+		(unsigned long long)total.send_syscalls,
+		(unsigned long long)total.recv_datagrams, (unsigned long long)total.recv_syscalls);
+
+	const packet_copy_stats_t &copies = SV_GetPacketCopyStats();
+	if (copies.packets)
+	{
+		Printf(PRINT_HIGH, "Game packets: %llu sent, %.1f bytes each, %.1f bytes copied per packet\n",
+			(unsigned long long)copies.packets,
+			(double)copies.sent / copies.packets,
+			(double)copies.copied / copies.packets);
+	}
+
+	const packet_compression_stats_t &comp = SV_GetPacketCompressionStats();
+	if (comp.payload)
+	{
+		Printf(PRINT_HIGH, "Compression: %.1f%% of payload bytes saved; huffman %llu, "
+			"minilzo %llu, uncompressed %llu packets (%llu recorded for the adaptive codec)\n",
+			100.0 * (1.0 - (double)comp.compressed / comp.payload),
+			(unsigned long long)comp.huffman, (unsigned long long)comp.minilzo,
+			(unsigned long long)comp.uncompressed, (unsigned long long)comp.recorded);
+	}
+}
+END_COMMAND (netstats)
+
 void SV_SendPlayerStateUpdate(client_t *client, player_t *player)
 {
 	if (!client || !player || !player->mo)
@@ -3252,15 +3559,151 @@ void SV_SpyPlayer(player_t &viewer)
 	SV_SendPlayerStateUpdate(&viewer.client, &other);
 }
 
+//
+// Per-tic world frame
+//
+// Everything in svc_moveplayer except the recipient's own ticcmd number is
+// the same for every client, so each player's record is serialized once per
+// tic into world_frame and copied as-is into each client's packet.
+//
+static buf_t world_frame(MAX_UDP_PACKET * 2);
+
+struct world_record_t
+{
+	bool	valid;
+	size_t	offset;
+	size_t	size;
+};
+
+static world_record_t moveplayer_records[MAXPLAYERS + 1];
+static world_record_t packedmoveplayer_records[MAXPLAYERS + 1];
+
+//
+// SV_WritePackedPlayerMove
+//
+// The svc_packedmoveplayer form of a player's record: positions and
+// momentum are quantized and momentum is left out entirely when the
+// player is standing still.
+//
+static void SV_WritePackedPlayerMove(buf_t *buf, player_t &player)
+{
+	AActor *mo = player.mo;
+	BitWriter bits(buf);
+
+	bits.WriteFixed(mo->x, NET_POSITION_FRACBITS);
+	bits.WriteFixed(mo->y, NET_POSITION_FRACBITS);
+	bits.WriteFixed(mo->z, NET_POSITION_FRACBITS);
+
+	bits.WriteBits(mo->angle >> FRACBITS, 16);
+	bits.WriteBits(mo->pitch >> FRACBITS, 16);
+
+	if (mo->frame == 32773)
+		bits.WriteBits(PLAYER_FULLBRIGHTFRAME, 8);
+	else
+		bits.WriteBits(mo->frame, 8);
+
+	bool moving = mo->momx || mo->momy || mo->momz;
+	bits.WriteBit(moving);
+	if (moving)
+	{
+		bits.WriteFixedVarint(mo->momx, NET_MOMENTUM_FRACBITS);
+		bits.WriteFixedVarint(mo->momy, NET_MOMENTUM_FRACBITS);
+		bits.WriteFixedVarint(mo->momz, NET_MOMENTUM_FRACBITS);
+	}
+
+	bool invisible = player.powers[pw_invisibility] != 0;
+	bits.WriteBit(invisible);
+	if (invisible)
+		bits.WriteBits(player.powers[pw_invisibility], 8);
+
+	bits.Flush();
+}
+
+static void SV_BuildWorldFrame()
+{
+	world_frame.clear();
+
+	for (size_t i = 0; i < STACKARRAY_LENGTH(moveplayer_records); i++)
+	{
+		moveplayer_records[i].valid = false;
+		packedmoveplayer_records[i].valid = false;
+	}
+
+	for (Players::iterator it = players.begin(); it != players.end(); ++it)
+	{
+		if (!(it->ingame()) || !(it->mo) || it->spectator)
+			continue;
+
+		AActor *mo = it->mo;
+		world_record_t &rec = moveplayer_records[it->id];
+		rec.offset = world_frame.size();
+
+		world_frame.WriteLong(mo->x);
+		world_frame.WriteLong(mo->y);
+		world_frame.WriteLong(mo->z);
+
+		if (GAMEVER > 60)
+		{
+			world_frame.WriteShort(mo->angle >> FRACBITS);
+			world_frame.WriteShort(mo->pitch >> FRACBITS);
+		}
+		else
+		{
+			world_frame.WriteLong(mo->angle);
+		}
+
+		if (mo->frame == 32773)
+			world_frame.WriteByte(PLAYER_FULLBRIGHTFRAME);
+		else
+			world_frame.WriteByte(mo->frame);
+
+		// write velocity
+		world_frame.WriteLong(mo->momx);
+		world_frame.WriteLong(mo->momy);
+		world_frame.WriteLong(mo->momz);
+
+		// [Russell] - hack, tell the client about the partial
+		// invisibility power of another player.. (cheaters can disable
+		// this but its all we have for now)
+		if (GAMEVER > 60)
+			world_frame.WriteByte(it->powers[pw_invisibility]);
+		else
+			world_frame.WriteLong(it->powers[pw_invisibility]);
+
+		if (world_frame.overflowed)
+			break;
+
+		rec.size = world_frame.size() - rec.offset;
+		rec.valid = true;
+
+		world_record_t &packed = packedmoveplayer_records[it->id];
+		packed.offset = world_frame.size();
+
+		SV_WritePackedPlayerMove(&world_frame, *it);
+
+		if (world_frame.overflowed)
+			break;
+
+		packed.size = world_frame.size() - packed.offset;
+		packed.valid = true;
+	}
+}
+
 //
 // SV_WriteCommands
 //
 void SV_WriteCommands(void)
 {
+	SCOPED_STAT(SV_WriteCommands);
+
 	// [SL] 2011-05-11 - Save player positions and moving sector heights so
-	// they can be reconciled later for unlagging
+	// they can be reconciled later for unlagging, along with polyobjs
 	Unlag::getInstance().recordPlayerPositions();
 	Unlag::getInstance().recordSectorPositions();
+	Unlag::getInstance().recordPolyobjPositions();
+
+	bool world_frame_built = false;
+	bool mobj_updates_built = false;
 
 	for (Players::iterator it = players.begin(); it != players.end(); ++it)
 	{
@@ -3279,60 +3722,54 @@ void SV_WriteCommands(void)
 			if (it->ingame())
 				SV_SendGametic(cl);
 
-			for (Players::iterator pit = players.begin();pit != players.end();++pit)
+			if (!world_frame_built)
 			{
-				if (!(pit->ingame()) || !(pit->mo))
-					continue;
+				SV_BuildWorldFrame();
+				world_frame_built = true;
+			}
 
+			for (Players::iterator pit = players.begin();pit != players.end();++pit)
+			{
 				// a player is updated about their own position elsewhere
 				if (&*it == &*pit)
 					continue;
 
-				// GhostlyDeath -- Screw spectators
-				if (pit->spectator)
+				// not in game, no actor or a spectator
+				const world_record_t &rec = moveplayer_records[pit->id];
+				if (!rec.valid)
 					continue;
 
 				if(!SV_IsPlayerAllowedToSee(*it, pit->mo))
 					continue;
 
-				MSG_WriteMarker(&cl->netbuf, svc_moveplayer);
-				MSG_WriteByte(&cl->netbuf, pit->id); // player number
+				SV_BeginUpdate(*it, UPDATE_KEY(UPDATE_KEY_PLAYER, pit->id),
+				               SV_UpdatePriority(*it, pit->mo));
 
-				// [SL] 2011-09-14 - the most recently processed ticcmd from the
-				// client we're sending this message to.
-				MSG_WriteLong(&cl->netbuf, it->tic);
+				const world_record_t &packed = packedmoveplayer_records[pit->id];
+				if ((cl->netcaps & NETCAP_BITPACK) && packed.valid)
+				{
+					MSG_WriteMarker(&cl->netbuf, svc_packedmoveplayer);
+					MSG_WriteByte(&cl->netbuf, pit->id);
 
-				MSG_WriteLong(&cl->netbuf, pit->mo->x);
-				MSG_WriteLong(&cl->netbuf, pit->mo->y);
-				MSG_WriteLong(&cl->netbuf, pit->mo->z);
+					BitWriter bits(&cl->netbuf);
+					bits.WriteVarint(it->tic);
+					bits.Flush();
 
-				if (GAMEVER > 60)
-				{
-					MSG_WriteShort(&cl->netbuf, pit->mo->angle >> FRACBITS);
-					MSG_WriteShort(&cl->netbuf, pit->mo->pitch >> FRACBITS);
+					MSG_WriteChunk(&cl->netbuf, world_frame.ptr() + packed.offset, packed.size);
 				}
 				else
 				{
-					MSG_WriteLong(&cl->netbuf, pit->mo->angle);
+					MSG_WriteMarker(&cl->netbuf, svc_moveplayer);
+					MSG_WriteByte(&cl->netbuf, pit->id); // player number
+
+					// [SL] 2011-09-14 - the most recently processed ticcmd from the
+					// client we're sending this message to.
+					MSG_WriteLong(&cl->netbuf, it->tic);
+
+					MSG_WriteChunk(&cl->netbuf, world_frame.ptr() + rec.offset, rec.size);
 				}
 
-				if (pit->mo->frame == 32773)
-					MSG_WriteByte(&cl->netbuf, PLAYER_FULLBRIGHTFRAME);
-				else
-					MSG_WriteByte(&cl->netbuf, pit->mo->frame);
-
-				// write velocity
-				MSG_WriteLong(&cl->netbuf, pit->mo->momx);
-				MSG_WriteLong(&cl->netbuf, pit->mo->momy);
-				MSG_WriteLong(&cl->netbuf, pit->mo->momz);
-
-				// [Russell] - hack, tell the client about the partial
-				// invisibility power of another player.. (cheaters can disable
-				// this but its all we have for now)
-				if (GAMEVER > 60)
-					MSG_WriteByte(&cl->netbuf, pit->powers[pw_invisibility]);
-				else
-					MSG_WriteLong(&cl->netbuf, pit->powers[pw_invisibility]);
+				SV_EndUpdate(*it);
 			}
 		}
 
@@ -3341,10 +3778,16 @@ void SV_WriteCommands(void)
 		if (validplayer(*target) && &(*it) != target && P_CanSpy(*it, *target))
 			SV_SendPlayerStateUpdate(&(it->client), target);
 
-		SV_UpdateHiddenMobj();
+		SV_UpdateHiddenMobj(*it);
 
 		SV_UpdateConsolePlayer(*it);
 
+		if (!mobj_updates_built)
+		{
+			SV_BuildMobjUpdates();
+			mobj_updates_built = true;
+		}
+
 		SV_UpdateMissiles(*it);
 
 		SV_UpdateMonsters(*it);
@@ -3352,6 +3795,8 @@ void SV_WriteCommands(void)
 		SV_SendPingRequest(cl);     // request ping reply
 
 		SV_UpdatePing(cl);          // send the ping value of all cients to this client
+
+		SV_UpdateLevelStats(cl);
 	}
 
 	SV_UpdateDeadPlayers(); // Update dying players.
@@ -3446,7 +3891,10 @@ void SV_ProcessPlayerCmd(player_t &player)
 
 		player.tic = netcmd->getTic();
 		// Set the latency amount for Unlagging
-		Unlag::getInstance().setRoundtripDelay(player.id, netcmd->getWorldIndex() & 0xFF);
+		fixed_t lerp = 0;
+		if (player.client.netcaps & NETCAP_RENDERLERP)
+			lerp = netcmd->getLerpBehind() << (FRACBITS - 8);
+		Unlag::getInstance().setRoundtripDelay(player.id, netcmd->getWorldIndex() & 0xFF, lerp);
 
 		if ((netcmd->hasForwardMove() && abs(netcmd->getForwardMove()) > maxcmdmove) ||
 			(netcmd->hasSideMove() && abs(netcmd->getSideMove()) > maxcmdmove))
@@ -3615,6 +4063,8 @@ void SV_SetPlayerSpec(player_t &player, bool setting, bool silent)
 	if (player.ingame() == false)
 		return;
 
+	SV_QryInvalidate();
+
 	if (!setting && player.spectator)
 	{
 		// We want to unspectate the player.
@@ -4086,9 +4536,7 @@ void SV_WantWad(player_t &player)
 	if (player.playerstate != PST_DOWNLOAD || cl->download.name != wadfiles[i])
 		Printf(PRINT_HIGH, "> client %d is downloading %s\n", player.id, filename.c_str());
 
-	cl->download.name = wadfiles[i];
-	cl->download.next_offset = next_offset;
-	player.playerstate = PST_DOWNLOAD;
+	SV_DownloadStart(player, wadfiles[i], next_offset);
 }
 
 //
@@ -4151,6 +4599,10 @@ void SV_ParseCommands(player_t &player)
 			SV_AcknowledgePacket(player);
 			break;
 
+		case clc_ackbits:
+			SV_AcknowledgePackets(player);
+			break;
+
 		case clc_rcon:
 			{
 				std::string str(MSG_ReadString());
@@ -4218,6 +4670,10 @@ void SV_ParseCommands(player_t &player)
 			SV_WantWad(player);
 			break;
 
+		case clc_wadack:
+			SV_DownloadAck(player);
+			break;
+
 		case clc_cheat:
 			SV_Cheat(player);
 			break;
@@ -4282,75 +4738,6 @@ void SV_WinCheck (void)
 	}
 }
 
-EXTERN_CVAR (sv_waddownloadcap)
-
-//
-// SV_WadDownloads
-//
-void SV_WadDownloads (void)
-{
-	// nobody around?
-	if(players.empty())
-		return;
-
-	// wad downloading
-	for (Players::iterator it = players.begin();it != players.end();++it)
-	{
-		if (it->playerstate != PST_DOWNLOAD)
-			continue;
-
-		client_t *cl = &(it->client);
-
-		if(!cl->download.name.length())
-			continue;
-
-		static char buff[1024];
-		// Smaller buffer for slower clients
-		int chunk_size = (sizeof(buff) > (unsigned)cl->rate*1000/TICRATE) ? cl->rate*1000/TICRATE : sizeof(buff);
-
-		// maximum rate client can download at (in bytes per second)
-		int download_rate = (sv_waddownloadcap > cl->rate) ? cl->rate*1000 : sv_waddownloadcap*1000;
-
-		do
-		{
-			// read next bit of wad
-			unsigned int read;
-			unsigned int filelen = 0;
-			read = W_ReadChunk(cl->download.name.c_str(), cl->download.next_offset, chunk_size, buff, filelen);
-
-			if (!read)
-				break;
-
-			// [SL] 2011-08-09 - Always send the data in netbuf and reliablebuf prior
-			// to writing a wadchunk to netbuf to keep packet sizes below the MTU.
-			// This prevents packets from getting dropped due to size on some networks.
-			if (cl->netbuf.size() + cl->reliablebuf.size())
-				SV_SendPacket(*it);
-
-			if(!cl->download.next_offset)
-			{
-				MSG_WriteMarker (&cl->netbuf, svc_wadinfo);
-				MSG_WriteLong (&cl->netbuf, filelen);
-			}
-
-			MSG_WriteMarker (&cl->netbuf, svc_wadchunk);
-			MSG_WriteLong (&cl->netbuf, cl->download.next_offset);
-			MSG_WriteShort (&cl->netbuf, read);
-			MSG_WriteChunk (&cl->netbuf, buff, read);
-
-			// Make double-sure the wadchunk is sent in its own packet
-			if (cl->netbuf.size() + cl->reliablebuf.size())
-				SV_SendPacket(*it);
-
-			cl->download.next_offset += read;
-		} while (
-			(double)(cl->reliable_bps + cl->unreliable_bps) * TICRATE
-				/ (double)(gametic % TICRATE)	// bps already used
-				+ (double)chunk_size / TICRATE 	// bps this chunk will use
-			< (double)download_rate);
-	}
-}
-
 //
 //	SV_WinningTeam					[Toke - teams]
 //
@@ -4528,6 +4915,8 @@ bool SV_Frozen()
 //
 void SV_StepTics(QWORD count)
 {
+	SCOPED_STAT(SV_StepTics);
+
 	DObject::BeginFrame();
 
 	// run the newtime tics
@@ -4539,6 +4928,7 @@ void SV_StepTics(QWORD count)
 
 		SV_WriteCommands();
 		SV_SendPackets();
+		SV_SampleNetStats();
 		SV_ClearClientsBPS();
 		SV_CheckTimeouts();
 
@@ -4578,7 +4968,13 @@ void SV_DisplayTics()
 //
 void SV_RunTics()
 {
-	SV_GetPackets();
+	SCOPED_STAT(SV_RunTics);
+
+	{
+		// D_RunTics has its own stat for the packets read between tics
+		SCOPED_STAT(SV_GetPackets);
+		SV_GetPackets();
+	}
 
 	std::string cmd = I_ConsoleInput();
 	if (cmd.length())
@@ -4985,19 +5381,8 @@ void SV_SendDamageMobj(AActor *target, int pain)
 		MSG_WriteShort(&cl->reliablebuf, target->health);
 		MSG_WriteByte(&cl->reliablebuf, pain);
 
-		MSG_WriteMarker (&cl->netbuf, svc_movemobj);
-		MSG_WriteShort (&cl->netbuf, target->netid);
-		MSG_WriteByte (&cl->netbuf, target->rndindex);
-		MSG_WriteLong (&cl->netbuf, target->x);
-		MSG_WriteLong (&cl->netbuf, target->y);
-		MSG_WriteLong (&cl->netbuf, target->z);
-
-		MSG_WriteMarker (&cl->netbuf, svc_mobjspeedangle);
-		MSG_WriteShort(&cl->netbuf, target->netid);
-		MSG_WriteLong (&cl->netbuf, target->angle);
-		MSG_WriteLong (&cl->netbuf, target->momx);
-		MSG_WriteLong (&cl->netbuf, target->momy);
-		MSG_WriteLong (&cl->netbuf, target->momz);
+		SV_WriteMoveMobj(&cl->netbuf, cl, target, target->x, target->y, target->z);
+		SV_WriteMobjSpeedAngle(&cl->netbuf, cl, target);
 	}
 }
 
@@ -5012,12 +5397,12 @@ void SV_SendKillMobj(AActor *source, AActor *target, AActor *inflictor,
 		client_t *cl = &(it->client);
 
 		if (!SV_IsPlayerAllowedToSee(*it, target))
+		{
+			// out of the player's interest, but the corpse is always sent
+			if (!target->player)
+				it->to_spawn.push(target->ptr());
 			continue;
-
-		// send death location first
-		MSG_WriteMarker(&cl->reliablebuf, svc_movemobj);
-		MSG_WriteShort(&cl->reliablebuf, target->netid);
-		MSG_WriteByte(&cl->reliablebuf, target->rndindex);
+		}
 
 		// [SL] 2012-12-26 - Get real position since this actor is at
 		// a reconciled position with sv_unlag 1
@@ -5028,16 +5413,10 @@ void SV_SendKillMobj(AActor *source, AActor *target, AActor *inflictor,
 					target->player->id, xoffs, yoffs, zoffs);
 		}
 
-		MSG_WriteLong(&cl->reliablebuf, target->x + xoffs);
-		MSG_WriteLong(&cl->reliablebuf, target->y + yoffs);
-		MSG_WriteLong(&cl->reliablebuf, target->z + zoffs);
-
-		MSG_WriteMarker (&cl->reliablebuf, svc_mobjspeedangle);
-		MSG_WriteShort(&cl->reliablebuf, target->netid);
-		MSG_WriteLong (&cl->reliablebuf, target->angle);
-		MSG_WriteLong (&cl->reliablebuf, target->momx);
-		MSG_WriteLong (&cl->reliablebuf, target->momy);
-		MSG_WriteLong (&cl->reliablebuf, target->momz);
+		// send death location first
+		SV_WriteMoveMobj(&cl->reliablebuf, cl, target,
+						 target->x + xoffs, target->y + yoffs, target->z + zoffs);
+		SV_WriteMobjSpeedAngle(&cl->reliablebuf, cl, target);
 
 		MSG_WriteMarker(&cl->reliablebuf, svc_killmobj);
 		if (source)
@@ -5075,7 +5454,10 @@ void SV_SendDestroyActor(AActor *mo)
 
 	// AActor no longer active. NetID released.
 	if (mo->netid)
+	{
+		SV_DeltaForgetMobj(mo->netid);
 		ServerNetID.ReleaseNetID( mo->netid );
+	}
 }
 
 // Missile exploded so tell clients about it
@@ -5088,12 +5470,7 @@ void SV_ExplodeMissile(AActor *mo)
 		if (!SV_IsPlayerAllowedToSee(*it, mo))
 			continue;
 
-		MSG_WriteMarker (&cl->reliablebuf, svc_movemobj);
-		MSG_WriteShort (&cl->reliablebuf, mo->netid);
-		MSG_WriteByte (&cl->reliablebuf, mo->rndindex);
-		MSG_WriteLong (&cl->reliablebuf, mo->x);
-		MSG_WriteLong (&cl->reliablebuf, mo->y);
-		MSG_WriteLong (&cl->reliablebuf, mo->z);
+		SV_WriteMoveMobj(&cl->reliablebuf, cl, mo, mo->x, mo->y, mo->z);
 
 		MSG_WriteMarker(&cl->reliablebuf, svc_explodemissile);
 		MSG_WriteShort(&cl->reliablebuf, mo->netid);
@@ -39,6 +39,9 @@
 
 extern int shotclock;
 
+// which of the -instances servers this process is, 0 for the first or only one
+extern int server_instance;
+
 class client_c
 {
 public:
@@ -66,8 +69,40 @@ void SV_CheckTimeouts (void);
 void SV_ConnectClient(void);
 void SV_WriteCommands(void);
 void SV_ClearClientsBPS(void);
-bool SV_SendPacket(player_t &pl);
+bool SV_SendPacket(player_t &pl, bool flush = false);
+void SV_SendPacketsTo(std::vector<player_t*> &list);
+
+// bytes copied while assembling outgoing game packets
+struct packet_copy_stats_t
+{
+	QWORD	packets;
+	QWORD	sent;	// bytes put on the wire
+	QWORD	copied;	// bytes memcpy'd on the way there
+
+	packet_copy_stats_t() : packets(0), sent(0), copied(0) {}
+};
+
+const packet_copy_stats_t &SV_GetPacketCopyStats();
+
+// what the compressors made of outgoing game packets
+struct packet_compression_stats_t
+{
+	QWORD	huffman;		// packets each method won
+	QWORD	minilzo;
+	QWORD	uncompressed;
+	QWORD	recorded;		// packets the adaptive codec learns from
+	QWORD	payload;		// bytes after the sequence number, before
+	QWORD	compressed;		// and after
+
+	packet_compression_stats_t() : huffman(0), minilzo(0), uncompressed(0),
+		recorded(0), payload(0), compressed(0) {}
+};
+
+const packet_compression_stats_t &SV_GetPacketCompressionStats();
+
 void SV_AcknowledgePacket(player_t &player);
+void SV_AcknowledgePackets(player_t &player);
+void SV_ReliableReset(player_t &player);
 void SV_DisplayTics();
 void SV_RunTics();
 void SV_ParseCommands(player_t &player);
@@ -0,0 +1,209 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Per-tic monster and missile updates.
+//
+//	Which monsters and missiles are due for a periodic update depends only
+//	on the gametic, so they are picked once per tic and their messages are
+//	serialized into a frame, in both forms.  Each client then only checks
+//	which of them it knows about and copies those messages.
+//
+//	Nothing here touches the level, so tools/mobjupdates can time it on
+//	its own.
+//
+//-----------------------------------------------------------------------------
+
+#include "version.h"
+#include "sv_mobjupdate.h"
+
+// what one update can take, in either form
+static const size_t MOBJ_UPDATE_MAX = 128;
+
+//
+// SV_MissileUpdateDue
+//
+bool SV_MissileUpdateDue(int netid, mobjtype_t type, int tic)
+{
+	// Revenant tracers and Mancubus fireballs need to be updated more often
+	if (type == MT_TRACER || type == MT_FATSHOT)
+		return (tic + netid) % 5 == 0;
+
+	// update missile position every 30 tics
+	return (tic + netid) % 30 == 0;
+}
+
+//
+// SV_MonsterUpdateDue
+//
+bool SV_MonsterUpdateDue(int netid, int tic)
+{
+	// update monster position every 7 tics
+	return (tic + netid) % 7 == 0;
+}
+
+//
+// SV_WriteMoveMobj
+//
+// Writes svc_movemobj, or its packed form.
+//
+void SV_WriteMoveMobj(buf_t *buf, bool packed, int netid, byte rndindex,
+					  fixed_t x, fixed_t y, fixed_t z)
+{
+	if (packed)
+	{
+		MSG_WriteMarker(buf, svc_packedmovemobj);
+
+		BitWriter bits(buf);
+		bits.WriteBits(netid, 16);
+		bits.WriteBits(rndindex, 8);
+		bits.WriteFixed(x, NET_POSITION_FRACBITS);
+		bits.WriteFixed(y, NET_POSITION_FRACBITS);
+		bits.WriteFixed(z, NET_POSITION_FRACBITS);
+		bits.Flush();
+		return;
+	}
+
+	MSG_WriteMarker(buf, svc_movemobj);
+	MSG_WriteShort(buf, netid);
+	MSG_WriteByte(buf, rndindex);
+	MSG_WriteLong(buf, x);
+	MSG_WriteLong(buf, y);
+	MSG_WriteLong(buf, z);
+}
+
+//
+// SV_WriteMobjSpeedAngle
+//
+// Writes svc_mobjspeedangle, or its packed form.
+//
+void SV_WriteMobjSpeedAngle(buf_t *buf, bool packed, int netid, angle_t angle,
+							fixed_t momx, fixed_t momy, fixed_t momz)
+{
+	if (packed)
+	{
+		MSG_WriteMarker(buf, svc_packedmobjspeedangle);
+
+		BitWriter bits(buf);
+		bits.WriteBits(netid, 16);
+		bits.WriteBits(angle >> FRACBITS, 16);
+
+		bool moving = momx || momy || momz;
+		bits.WriteBit(moving);
+		if (moving)
+		{
+			bits.WriteFixedVarint(momx, NET_MOMENTUM_FRACBITS);
+			bits.WriteFixedVarint(momy, NET_MOMENTUM_FRACBITS);
+			bits.WriteFixedVarint(momz, NET_MOMENTUM_FRACBITS);
+		}
+		bits.Flush();
+		return;
+	}
+
+	MSG_WriteMarker(buf, svc_mobjspeedangle);
+	MSG_WriteShort(buf, netid);
+	MSG_WriteLong(buf, angle);
+	MSG_WriteLong(buf, momx);
+	MSG_WriteLong(buf, momy);
+	MSG_WriteLong(buf, momz);
+}
+
+//
+// SV_SerializeMobjUpdate
+//
+void SV_SerializeMobjUpdate(buf_t *buf, const mobj_update_t &u, bool packed)
+{
+	SV_WriteMoveMobj(buf, packed, u.netid, u.rndindex, u.x, u.y, u.z);
+	SV_WriteMobjSpeedAngle(buf, packed, u.netid, u.angle, u.momx, u.momy, u.momz);
+
+	if (u.missile)
+	{
+		if (u.tracer)
+		{
+			MSG_WriteMarker(buf, svc_actor_tracer);
+			MSG_WriteShort(buf, u.netid);
+			MSG_WriteShort(buf, u.tracer);
+		}
+		return;
+	}
+
+	MSG_WriteMarker(buf, svc_actor_movedir);
+	MSG_WriteShort(buf, u.netid);
+	MSG_WriteByte(buf, u.movedir);
+	MSG_WriteLong(buf, u.movecount);
+
+	MSG_WriteMarker(buf, svc_actor_target);
+	MSG_WriteShort(buf, u.netid);
+	MSG_WriteShort(buf, u.target);
+}
+
+//
+// SV_SerializeMobjUpdates
+//
+// Each update is written to a small buffer first: the frame isn't a packet,
+// and MSG_WriteMarker sends everybody's packets once the buffer it writes to
+// is past 600 bytes.  Returns false if the frame is too small.
+//
+static bool SV_SerializeMobjUpdates(buf_t &frame, MobjUpdates &updates)
+{
+	static buf_t one(MOBJ_UPDATE_MAX);
+
+	for (size_t i = 0; i < updates.size(); i++)
+	{
+		mobj_update_t &u = updates[i];
+
+		one.clear();
+		SV_SerializeMobjUpdate(&one, u, false);
+
+		u.plain_offset = frame.size();
+		u.plain_size = one.size();
+		SZ_Write(&frame, one.ptr(), one.size());
+
+		one.clear();
+		SV_SerializeMobjUpdate(&one, u, true);
+
+		u.packed_offset = frame.size();
+		u.packed_size = one.size();
+		SZ_Write(&frame, one.ptr(), one.size());
+
+		if (frame.overflowed)
+			return false;
+	}
+
+	return true;
+}
+
+//
+// SV_SerializeMobjFrame
+//
+// Writes both forms of every update to 'frame', growing it as needed.
+//
+void SV_SerializeMobjFrame(buf_t &frame, MobjUpdates &missiles, MobjUpdates &monsters)
+{
+	for (;;)
+	{
+		frame.clear();
+
+		if (SV_SerializeMobjUpdates(frame, missiles) &&
+			SV_SerializeMobjUpdates(frame, monsters))
+			return;
+
+		frame.resize(frame.maxsize() * 2);
+	}
+}
+
+VERSION_CONTROL (sv_mobjupdate_cpp, "$Id$")
@@ -0,0 +1,65 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Per-tic monster and missile updates, serialized once for all clients.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __SV_MOBJUPDATE_H__
+#define __SV_MOBJUPDATE_H__
+
+#include <vector>
+
+#include "actor.h"
+#include "i_net.h"
+
+struct mobj_update_t
+{
+	AActor					*mo;		// NULL in tools/mobjupdates
+	const PlayerBitField	*aware;		// clients that know about it
+
+	int				netid;
+	byte			rndindex;
+	bool			missile;
+	fixed_t			x, y, z;
+	angle_t			angle;
+	fixed_t			momx, momy, momz;
+	int				target;				// netids, 0 for none
+	int				tracer;
+	byte			movedir;
+	int				movecount;
+	unsigned int	deltafields;		// for clients that take deltas
+
+	size_t			plain_offset, plain_size;	// in the frame
+	size_t			packed_offset, packed_size;
+};
+
+typedef std::vector<mobj_update_t> MobjUpdates;
+
+bool SV_MissileUpdateDue(int netid, mobjtype_t type, int tic);
+bool SV_MonsterUpdateDue(int netid, int tic);
+
+void SV_WriteMoveMobj(buf_t *buf, bool packed, int netid, byte rndindex,
+					  fixed_t x, fixed_t y, fixed_t z);
+void SV_WriteMobjSpeedAngle(buf_t *buf, bool packed, int netid, angle_t angle,
+							fixed_t momx, fixed_t momy, fixed_t momz);
+
+void SV_SerializeMobjUpdate(buf_t *buf, const mobj_update_t &u, bool packed);
+void SV_SerializeMobjFrame(buf_t &frame, MobjUpdates &missiles, MobjUpdates &monsters);
+
+#endif
@@ -24,6 +24,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#ifdef UNIX
+#define ODA_HAVE_SEND_THREADS
+#include <pthread.h>
+#endif
 
 #include "doomtype.h"
 #include "doomstat.h"
@@ -31,73 +39,685 @@
 #include "sv_main.h"
 #include "huffman.h"
 #include "i_net.h"
-
-QWORD I_MSTime (void);
+#include "sv_delta.h"
+#include "sv_bandwidth.h"
+#include "i_system.h"
 
 EXTERN_CVAR (log_packetdebug)
+EXTERN_CVAR (sv_sendthreads)
+
+// What a packet is built in between SV_ScheduleUpdates and the network
+// layer: the updates the bandwidth scheduler picked, the reliable chunks,
+// a contiguous copy of the payload for the compressors and their output.
+// The main thread has one that is reused for every client, and each
+// sv_sendthreads worker has its own.  A reliable chunk that fills a packet
+// on its own can take it slightly over MAX_UDP_PACKET.
+struct packet_scratch_t
+{
+	byte		header[2];
+	byte		gathered[MAX_UDP_PACKET];
+	byte		payload[MAX_UDP_PACKET * 2];
+	byte		compressed[MSG_CompressBound(MAX_UDP_PACKET * 2)];
+	byte		huffman[MAX_UDP_PACKET * 2];
+	byte		*lzo_workmem;
+	buf_t		reliable;	// the chunks going out in the packet
+
+	packet_copy_stats_t			copy_stats;
+	packet_compression_stats_t	compression_stats;
+
+	packet_scratch_t() :
+		lzo_workmem(new byte[MSG_MinilzoWorkmemSize()]), reliable(MAX_UDP_PACKET * 2)
+	{
+	}
+
+	~packet_scratch_t()
+	{
+		delete [] lzo_workmem;
+	}
+
+private:
+	packet_scratch_t(const packet_scratch_t &);
+	packet_scratch_t &operator=(const packet_scratch_t &);
+};
+
+static packet_scratch_t main_scratch;
+
+// Selective-ack reliable stream, for clients with NETCAP_RELIABLE.
+//
+// Every time reliablebuf is flushed its contents become a chunk with its
+// own number.  Chunks go out as svc_reliable messages and are kept until a
+// packet carrying them is acked.  The client acks the newest packet it got
+// along with a bitfield of the 32 before it, so a lost ack costs nothing,
+// and puts the chunks back in order itself.
+//
+// A packet is given up on once RELIABLE_REORDER newer ones were acked or
+// its retransmit timeout (derived from the measured round trip) ran out;
+// the chunks it carried are then sent again.  How many bytes of chunks can
+// be in flight at once is limited by a congestion window that grows as
+// acks come in and is halved when packets are lost.  Chunks that arrive
+// ahead of a missing one are held by the client, which only has room for
+// so many, so nothing more than RELIABLE_MAX_SPAN chunks past the oldest
+// unacked one is sent.
+
+// packets remembered while waiting for their ack
+static const int RELIABLE_WINDOW = 256;
+
+// acks of newer packets after which a packet counts as lost
+static const int RELIABLE_REORDER = 3;
+
+// retransmit timeout bounds, in ms
+static const int RELIABLE_MIN_RTO = 50;
+static const int RELIABLE_MAX_RTO = 2000;
+static const int RELIABLE_INITIAL_RTO = 500;
+
+// congestion window, in bytes of chunks
+static const size_t RELIABLE_MIN_CWND = 2048;
+static const size_t RELIABLE_INITIAL_CWND = 16384;
+static const size_t RELIABLE_MAX_CWND = 131072;
+
+// a client that lets this much pile up is dropped
+static const size_t RELIABLE_MAX_BACKLOG = 1048576;
+
+// chunks past the oldest unacked one that can be sent, less than the
+// client holds while waiting for a missing one (MAX_RELIABLE_HELD)
+static const int RELIABLE_MAX_SPAN = 512;
+
+// svc_reliable, chunk number and length
+static const size_t RELIABLE_CHUNK_HEADER = 7;
+
+struct reliable_chunk_t
+{
+	std::vector<byte>	data;
+	int					sent_in;	// packet it is in flight in, -1 if it has to be sent
+};
 
-buf_t plain(MAX_UDP_PACKET); // denis - todo - call_terms destroys these statics on quit
-buf_t sendd(MAX_UDP_PACKET);
+struct reliable_packet_t
+{
+	int					sequence;	// -1 if the slot is unused
+	QWORD				sent;		// I_MSTime
+	size_t				bytes;		// chunk bytes it carried
+	std::vector<int>	chunks;		// which ones
+	bool				acked;
+	bool				lost;
+};
+
+struct reliable_channel_t
+{
+	std::map<int, reliable_chunk_t>	chunks;		// not acked yet
+	size_t				backlog;	// bytes in chunks
+	int					next_chunk;
+
+	reliable_packet_t	packets[RELIABLE_WINDOW];	// indexed by sequence
+	std::deque<int>		inflight;	// packets carrying chunks, oldest first
+	size_t				inflight_bytes;
+
+	size_t				cwnd;
+	size_t				ssthresh;
+	int					recovery;	// losses up to this packet don't shrink cwnd again
+	int					latest_acked;
+
+	int					srtt;		// smoothed round trip, -1 until measured
+	int					rttvar;
+	int					rto;
+
+	reliable_channel_t()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		chunks.clear();
+		backlog = 0;
+		next_chunk = 0;
+
+		for (int i = 0; i < RELIABLE_WINDOW; i++)
+		{
+			packets[i].sequence = -1;
+			packets[i].chunks.clear();
+		}
+
+		inflight.clear();
+		inflight_bytes = 0;
+
+		cwnd = RELIABLE_INITIAL_CWND;
+		ssthresh = RELIABLE_MAX_CWND;
+		recovery = -1;
+		latest_acked = -1;
+
+		srtt = -1;
+		rttvar = 0;
+		rto = RELIABLE_INITIAL_RTO;
+	}
+};
+
+static reliable_channel_t reliable_channels[MAXPLAYERS + 1];
+
+//
+// SV_GetPacketCopyStats
+//
+// Workers' counts are added to the main thread's after every tic.
+//
+const packet_copy_stats_t &SV_GetPacketCopyStats()
+{
+	return main_scratch.copy_stats;
+}
+
+//
+// SV_GetPacketCompressionStats
+//
+const packet_compression_stats_t &SV_GetPacketCompressionStats()
+{
+	return main_scratch.compression_stats;
+}
 
 //
 // SV_CompressPacket
 //
+// Compresses the payload segments of a packet (everything after the
+// sequence number) and, if that pays off, replaces them with the
+// svc_compressed header and the compressed data.
+//
+// Clients with NETCAP_HUFFMAN also get the adaptive huffman codec, whose
+// statistics come from earlier packets the client acked (see huffman.h).
+// It does well on the small packets minilzo doesn't bother with; on larger
+// ones both are tried and the smaller result is sent.
+//
 // [Russell] - reason this was failing is because of huffman routines, so just
-// use minilzo for now (cuts a packet size down by roughly 45%), huffman is the
-// if 0'd sections
-void SV_CompressPacket(buf_t &send, unsigned int reserved, client_t *cl)
+// use minilzo for now (cuts a packet size down by roughly 45%)
+//
+static bool SV_CompressPacket(net_segment_t *segs, size_t &count, client_t *cl, int sequence,
+                              packet_scratch_t &scratch)
 {
-	if(plain.maxsize() < send.maxsize())
-		plain.resize(send.maxsize());
-	
-	plain.setcursize(send.size());
-	
-	memcpy(plain.ptr(), send.ptr(), send.size());
+	byte *header = scratch.header;
+	byte *packet_payload = scratch.payload;
+	byte *packet_compressed = scratch.compressed;
+	byte *packet_huffman = scratch.huffman;
+	packet_copy_stats_t &copy_stats = scratch.copy_stats;
+	packet_compression_stats_t &compression_stats = scratch.compression_stats;
+
+	bool adaptive = (cl->netcaps & NETCAP_HUFFMAN) != 0;
+
+	size_t payload_size = 0;
+	for (size_t i = 1; i < count; i++)
+		payload_size += segs[i].size;
 
-	byte method = 0;
+	if (!adaptive && payload_size < 0xFF)
+		return false;
 
-	int need_gap = 2; // for svc_compressed and method, below
-#if 0
-	if(MSG_CompressAdaptive(cl->compressor.get_codec(), send, reserved, need_gap))
+	// the compressors need their input in one piece
+	byte *dest = packet_payload;
+	for (size_t i = 1; i < count; i++)
 	{
-		reserved += need_gap;
-		need_gap = 0;
+		memcpy(dest, segs[i].data, segs[i].size);
+		dest += segs[i].size;
+	}
+	copy_stats.copied += payload_size;
+
+	header[0] = svc_compressed;
+	header[1] = 0;
 
-		method |= adaptive_mask;
+	const byte *out = NULL;
+	size_t outlen = payload_size;
 
-		if(cl->compressor.get_codec_id())
-			method |= adaptive_select_mask;
+	if (adaptive)
+	{
+		if (cl->compressor.get_codec_id())
+			header[1] |= adaptive_select_mask;
+
+		size_t len = sizeof(scratch.huffman);
+		if (cl->compressor.get_codec().compress(packet_payload, payload_size, packet_huffman, len) &&
+			len < outlen)
+		{
+			out = packet_huffman;
+			outlen = len;
+		}
 	}
-#endif
-	DPrintf("SV_CompressPacket stage 2: %x %d\n", (int)method, (int)send.size());
 
-	if(MSG_CompressMinilzo(send, reserved, need_gap))
-		method |= minilzo_mask;
+	size_t lzolen = 0;
+	if (MSG_CompressMinilzo(packet_payload, payload_size, packet_compressed, lzolen,
+	                        scratch.lzo_workmem) &&
+		lzolen < outlen)
+	{
+		out = packet_compressed;
+		outlen = lzolen;
+	}
+
+	// worth the effort?
+	if (out && outlen + sizeof(scratch.header) >= payload_size)
+		out = NULL;
+
+	if (out == packet_huffman)
+		header[1] |= adaptive_mask;
+	else if (out == packet_compressed)
+		header[1] |= minilzo_mask;
 
-	if((method & adaptive_mask) || (method & minilzo_mask))
+	// once the client acks this packet, both ends extend the codec with it;
+	// it has to be marked even if it goes out uncompressed
+	bool record = adaptive && cl->compressor.packet_sent(sequence, packet_payload, payload_size);
+
+	compression_stats.payload += payload_size;
+
+	if (record)
 	{
-#if 0
-		if(cl->compressor.packet_sent(cl->sequence - 1, plain.ptr() + sizeof(int), plain.size() - sizeof(int)))
-			method |= adaptive_record_mask;
-#endif
-		send.ptr()[sizeof(int)] = svc_compressed;
-		send.ptr()[sizeof(int) + 1] = method;
+		header[1] |= adaptive_record_mask;
+		compression_stats.recorded++;
 	}
-	DPrintf("SV_CompressPacket %x %d\n", (int)method, (int)send.size());
 
+	if (!out)
+	{
+		compression_stats.uncompressed++;
+		compression_stats.compressed += payload_size;
+
+		if (!record)
+			return false;
+
+		out = packet_payload;
+	}
+	else
+	{
+		if (out == packet_huffman)
+			compression_stats.huffman++;
+		else
+			compression_stats.minilzo++;
+
+		compression_stats.compressed += outlen + sizeof(scratch.header);
+	}
+
+	segs[1].data = header;
+	segs[1].size = sizeof(scratch.header);
+	segs[2].data = out;
+	segs[2].size = outlen;
+	count = 3;
+
+	return true;
 }
 
 //
-// SV_SendPacket
+// SV_ReliableReset
+//
+void SV_ReliableReset(player_t &player)
+{
+	reliable_channels[player.id].reset();
+}
+
+//
+// SV_ReliableLost
+//
+// Queues the chunks a lost packet carried to be sent again.
+//
+static void SV_ReliableLost(player_t &player, reliable_packet_t &pkt)
+{
+	reliable_channel_t &rc = reliable_channels[player.id];
+
+	if (pkt.acked || pkt.lost)
+		return;
+
+	pkt.lost = true;
+	rc.inflight_bytes -= pkt.bytes;
+
+	for (size_t i = 0; i < pkt.chunks.size(); i++)
+	{
+		std::map<int, reliable_chunk_t>::iterator it = rc.chunks.find(pkt.chunks[i]);
+
+		// it may have been resent in a newer packet already
+		if (it != rc.chunks.end() && it->second.sent_in == pkt.sequence)
+			it->second.sent_in = -1;
+	}
+
+	// one cut per round trip, however many packets were lost in it
+	if (pkt.sequence > rc.recovery)
+	{
+		rc.ssthresh = MAX(rc.cwnd / 2, RELIABLE_MIN_CWND);
+		rc.cwnd = rc.ssthresh;
+		rc.recovery = player.client.sequence - 1;
+	}
+}
+
+//
+// SV_ReliableCheckLosses
+//
+// Gives up on the packets overtaken by newer acked ones, and on those that
+// went unacked for longer than the retransmit timeout.
+//
+static void SV_ReliableCheckLosses(player_t &player)
+{
+	reliable_channel_t &rc = reliable_channels[player.id];
+	QWORD now = I_MSTime();
+
+	while (!rc.inflight.empty())
+	{
+		int sequence = rc.inflight.front();
+		reliable_packet_t &pkt = rc.packets[sequence % RELIABLE_WINDOW];
+
+		if (pkt.sequence != sequence || pkt.acked || pkt.lost)
+		{
+			rc.inflight.pop_front();
+			continue;
+		}
+
+		if (sequence <= rc.latest_acked - RELIABLE_REORDER)
+		{
+			SV_ReliableLost(player, pkt);
+		}
+		else if (now - pkt.sent > (QWORD)rc.rto)
+		{
+			SV_ReliableLost(player, pkt);
+
+			// back off until an ack comes in
+			rc.rto = MIN(rc.rto * 2, RELIABLE_MAX_RTO);
+		}
+		else
+			break;
+
+		rc.inflight.pop_front();
+	}
+}
+
+//
+// SV_ReliableAcked
+//
+static void SV_ReliableAcked(player_t &player, int sequence, QWORD now)
+{
+	reliable_channel_t &rc = reliable_channels[player.id];
+	reliable_packet_t &pkt = rc.packets[sequence % RELIABLE_WINDOW];
+
+	if (pkt.sequence != sequence || pkt.acked)
+		return;
+
+	player.client.compressor.packet_acked(sequence);
+	SV_DeltaPacketAcked(player, sequence);
+
+	if (!pkt.lost)
+	{
+		rc.inflight_bytes -= pkt.bytes;
+
+		// slow start, then about one chunk per round trip
+		if (rc.cwnd < rc.ssthresh)
+			rc.cwnd += pkt.bytes;
+		else if (pkt.bytes)
+			rc.cwnd += MAX((size_t)1, 1024 * pkt.bytes / rc.cwnd);
+
+		rc.cwnd = MIN(rc.cwnd, RELIABLE_MAX_CWND);
+	}
+
+	pkt.acked = true;
+
+	for (size_t i = 0; i < pkt.chunks.size(); i++)
+	{
+		std::map<int, reliable_chunk_t>::iterator it = rc.chunks.find(pkt.chunks[i]);
+		if (it == rc.chunks.end())
+			continue;
+
+		rc.backlog -= it->second.data.size();
+		rc.chunks.erase(it);
+	}
+
+	// the newest packet is the only one whose ack wasn't held up by others
+	if (sequence < rc.latest_acked)
+		return;
+
+	int sample = (int)(now - pkt.sent);
+
+	if (rc.srtt < 0)
+	{
+		rc.srtt = sample;
+		rc.rttvar = sample / 2;
+	}
+	else
+	{
+		rc.rttvar = (3 * rc.rttvar + abs(rc.srtt - sample)) / 4;
+		rc.srtt = (7 * rc.srtt + sample) / 8;
+	}
+
+	rc.rto = clamp(rc.srtt + 4 * rc.rttvar, RELIABLE_MIN_RTO, RELIABLE_MAX_RTO);
+}
+
+//
+// SV_ReliableAck
+//
+// 'bits' has bit n set if packet 'sequence' - n - 1 arrived as well.
+//
+static void SV_ReliableAck(player_t &player, int sequence, DWORD bits)
+{
+	reliable_channel_t &rc = reliable_channels[player.id];
+
+	// can't ack what wasn't sent yet
+	if (sequence < 0 || sequence >= player.client.sequence)
+		return;
+
+	if (sequence > rc.latest_acked)
+		rc.latest_acked = sequence;
+
+	QWORD now = I_MSTime();
+
+	for (int n = 31; n >= 0; n--)
+		if (bits & (1u << n) && sequence - n - 1 >= 0)
+			SV_ReliableAcked(player, sequence - n - 1, now);
+
+	SV_ReliableAcked(player, sequence, now);
+
+	SV_ReliableCheckLosses(player);
+}
+
+//
+// SV_ReliableQueue
+//
+// Turns what was written to reliablebuf into a chunk.  Returns false if the
+// client stopped taking them.
+//
+static bool SV_ReliableQueue(player_t &player)
+{
+	reliable_channel_t &rc = reliable_channels[player.id];
+	buf_t &reliablebuf = player.client.reliablebuf;
+
+	if (!reliablebuf.cursize)
+		return true;
+
+	reliable_chunk_t &chunk = rc.chunks[rc.next_chunk++];
+	chunk.data.assign(reliablebuf.data, reliablebuf.data + reliablebuf.cursize);
+	chunk.sent_in = -1;
+
+	rc.backlog += reliablebuf.cursize;
+	SZ_Clear(&reliablebuf);
+
+	return rc.backlog <= RELIABLE_MAX_BACKLOG;
+}
+
+//
+// SV_ReliableWrite
+//
+// Writes the chunks that go in packet 'sequence' to 'payload': the oldest
+// ones first, as many as fit in 'space' and in the congestion window (or
+// as fit in 'space', when flushing).
+//
+static size_t SV_ReliableWrite(player_t &player, int sequence, size_t space, bool flush,
+                               buf_t &reliable_payload)
+{
+	reliable_channel_t &rc = reliable_channels[player.id];
+	reliable_packet_t &pkt = rc.packets[sequence % RELIABLE_WINDOW];
+
+	// nobody is going to ack a packet that old
+	if (pkt.sequence != sequence && pkt.sequence >= 0)
+		SV_ReliableLost(player, pkt);
+
+	pkt.sequence = sequence;
+	pkt.sent = I_MSTime();
+	pkt.bytes = 0;
+	pkt.chunks.clear();
+	pkt.acked = false;
+	pkt.lost = false;
+
+	SZ_Clear(&reliable_payload);
+
+	if (rc.chunks.empty())
+		return 0;
+
+	int span_end = rc.chunks.begin()->first + RELIABLE_MAX_SPAN;
+
+	for (std::map<int, reliable_chunk_t>::iterator it = rc.chunks.begin(); it != rc.chunks.end(); ++it)
+	{
+		reliable_chunk_t &chunk = it->second;
+
+		if (chunk.sent_in != -1)
+			continue;
+
+		// the client couldn't hold it until the oldest one gets there
+		if (it->first >= span_end)
+			break;
+
+		size_t size = chunk.data.size() + RELIABLE_CHUNK_HEADER;
+
+		// one that doesn't fit with anything else goes alone
+		if (pkt.bytes && pkt.bytes + size > space)
+			break;
+
+		// something always goes when nothing is in flight
+		if (!flush && rc.inflight_bytes + pkt.bytes + size > rc.cwnd &&
+			(rc.inflight_bytes || pkt.bytes))
+			break;
+
+		MSG_WriteByte(&reliable_payload, svc_reliable);
+		MSG_WriteLong(&reliable_payload, it->first);
+		MSG_WriteShort(&reliable_payload, chunk.data.size());
+		SZ_Write(&reliable_payload, &chunk.data[0], chunk.data.size());
+
+		chunk.sent_in = sequence;
+		pkt.chunks.push_back(it->first);
+		pkt.bytes += size;
+	}
+
+	if (pkt.bytes)
+	{
+		rc.inflight.push_back(sequence);
+		rc.inflight_bytes += pkt.bytes;
+	}
+
+	return pkt.bytes;
+}
+
+//
+// SV_ReliableUnsent
 //
-bool SV_SendPacket(player_t &pl)
+static bool SV_ReliableUnsent(player_t &player)
 {
-	int				bps = 0; // bytes per second, not bits per second
+	reliable_channel_t &rc = reliable_channels[player.id];
 
+	for (std::map<int, reliable_chunk_t>::const_iterator it = rc.chunks.begin(); it != rc.chunks.end(); ++it)
+		if (it->second.sent_in == -1)
+			return true;
+
+	return false;
+}
+
+//
+// Packet building threads
+//
+// With sv_sendthreads set, SV_SendPackets hands the clients to a fixed pool
+// of workers once the tic has been simulated and every update written.
+// Building a packet only touches the client's own state and the worker's
+// scratch, so the only thing they share is the socket (and the console, for
+// log_packetdebug), which send_lock serializes.
+//
+// The pool is started on the first send after sv_sendthreads changes rather
+// than when the cvar is set, since the config is run before -fork and
+// -instances fork and threads don't survive that.
+//
+// Who may touch what:
+//
+//   send_workers      main thread only.  A worker only sees its own
+//                     send_worker_t, through the thread argument.
+//   send_pool_ready   main thread only.
+//   pool_lock         guards send_generation, send_busy and send_quit.
+//                     Taking it to bump send_generation also publishes
+//                     the batch below to the workers.
+//   send_jobs,        written by the main thread between batches, read only
+//   send_num_jobs,    while one is out.
+//   send_threaded
+//   send_next_job     reset by the main thread between batches, claimed
+//                     with an atomic add while one is out.
+//   scratch           the worker's own while a batch is out.  The main
+//                     thread folds its counts in after send_busy drops to
+//                     0, under pool_lock.
+//   send_lock         held around the socket and the console while
+//                     send_threaded is set.
+//
+// Each job is claimed by exactly one thread, so the client's player_t,
+// client_t and reliable channel are only touched by that thread.  Anything
+// that can drop a client stays on the main thread; see SV_CheckPacket.
+//
+#ifdef ODA_HAVE_SEND_THREADS
+struct send_worker_t
+{
+	pthread_t			thread;
+	unsigned int		generation;		// the last batch it has seen
+	packet_scratch_t	scratch;
+};
+
+static std::vector<send_worker_t*> send_workers;
+static bool send_pool_ready = false;
+
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// a batch of clients is handed out by bumping send_generation
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static unsigned int send_generation = 0;
+static size_t send_busy = 0;		// workers not done with the batch
+static bool send_quit = false;
+
+static player_t **send_jobs = NULL;
+static size_t send_num_jobs = 0;
+static size_t send_next_job = 0;	// claimed with an atomic add
+
+static bool send_threaded = false;	// while the workers are at it
+#endif
+
+static void SV_LockSend()
+{
+#ifdef ODA_HAVE_SEND_THREADS
+	if (send_threaded)
+		pthread_mutex_lock(&send_lock);
+#endif
+}
+
+static void SV_UnlockSend()
+{
+#ifdef ODA_HAVE_SEND_THREADS
+	if (send_threaded)
+		pthread_mutex_unlock(&send_lock);
+#endif
+}
+
+//
+// SV_CheckPacket
+//
+// The part of sending a packet that can drop the client.  Dropping someone
+// tells everybody else, so this always runs on the main thread.  Returns
+// false if the client was dropped.
+//
+static bool SV_CheckPacket(player_t &pl)
+{
 	client_t *cl = &pl.client;
+	bool stream = (cl->netcaps & NETCAP_RELIABLE) != 0;
+
+	// queueing clears reliablebuf, so an overflow has to be caught first
+	bool overflowed = cl->reliablebuf.overflowed;
 
-	if (cl->reliablebuf.overflowed)
+	if (stream && !overflowed && !SV_ReliableQueue(pl))
+	{
+		Printf(PRINT_HIGH, "%s is not acknowledging reliable messages.\n",
+		       NET_AdrToString(cl->address));
+
+		overflowed = true;
+	}
+
+	if (overflowed)
 	{ 
+		if (stream)
+			SV_ReliableReset(pl);
+
 		SZ_Clear(&cl->netbuf);
 		SZ_Clear(&cl->reliablebuf);
 	    SV_DropClient(pl);
@@ -105,74 +725,392 @@ bool SV_SendPacket(player_t &pl)
 	}
 	else
 		if (cl->netbuf.overflowed)
+		{
 			SZ_Clear(&cl->netbuf);
+			SV_DropUpdates(pl);
+			SV_DeltaPacketSent(pl, cl->sequence);
+		}
+
+	return true;
+}
+
+//
+// SV_BuildPacket
+//
+// The packet is never assembled in an intermediate buffer.  The sequence
+// number, the reliable payload (already saved in the client's history) and
+// the unreliable payload are passed to the network layer as separate
+// segments; only the compressor gets a contiguous copy.
+//
+// Returns true if a packet went out.
+//
+static bool SV_BuildPacket(player_t &pl, bool flush, packet_scratch_t &scratch)
+{
+	client_t *cl = &pl.client;
+	bool stream = (cl->netcaps & NETCAP_RELIABLE) != 0;
+	packet_copy_stats_t &copy_stats = scratch.copy_stats;
+
+	byte seq[4];
+
+	const byte *reliable = cl->reliablebuf.data;
+	size_t reliable_size = cl->reliablebuf.cursize;
+
+	if (stream)
+	{
+		SV_ReliableCheckLosses(pl);
+
+		reliable_size = SV_ReliableWrite(pl, cl->sequence,
+			MAX_UDP_PACKET - sizeof(seq) - 1, flush, scratch.reliable);
+		reliable = scratch.reliable.data;
+	}
 
 	// [SL] 2012-05-04 - Don't send empty packets - they still have overhead
-	if (cl->reliablebuf.cursize + cl->netbuf.cursize == 0)
-		return true;
+	if (reliable_size + cl->netbuf.cursize == 0)
+		return false;
+
+	// pick the unreliable updates that fit and that the client's rate allows
+	const byte *unreliable = NULL;
+	size_t unreliable_size = 0;
 
-	sendd.clear();
+	if (reliable_size < MAX_UDP_PACKET - sizeof(seq) - 1)
+		unreliable_size = SV_ScheduleUpdates(pl,
+			MAX_UDP_PACKET - sizeof(seq) - reliable_size - 1, unreliable, scratch.gathered);
+
+	if (reliable_size + unreliable_size == 0)
+	{
+		// everything was held back
+		SV_DeltaPacketSent(pl, cl->sequence);
+		SV_FinishUpdates(pl, 0);
+		return false;
+	}
 
 	// save the reliable message 
 	// it will be retransmited, if it's missed
+	size_t relbegin = 0;
+
+	if (!stream)
+	{
+		// the end of the buffer is reached
+		if (cl->relpackets.cursize + reliable_size >= cl->relpackets.maxsize())
+			cl->relpackets.cursize = 0;
+
+		// copy the beginning and the size of a packet to the buffer
+		int slot = cl->sequence & 0xff;
+		relbegin = cl->relpackets.cursize;
+		cl->packetbegin[slot] = relbegin;
+		cl->packetsize[slot] = reliable_size;
+		cl->packetseq[slot] = cl->sequence;
+
+		if (reliable_size)
+		{
+			SZ_Write (&cl->relpackets, reliable, reliable_size);
+			copy_stats.copied += reliable_size;
+		}
+
+		reliable = cl->relpackets.data + relbegin;
+	}
+
+	net_segment_t segs[3];
+	size_t count = 0;
+
+	// sequence
+	int sequence = cl->sequence++;
+	seq[0] = sequence & 0xff;
+	seq[1] = (sequence >> 8) & 0xff;
+	seq[2] = (sequence >> 16) & 0xff;
+	seq[3] = sequence >> 24;
+
+	segs[count].data = seq;
+	segs[count].size = sizeof(seq);
+	count++;
+
+	// the reliable message goes first, straight from the history buffer
+	if (reliable_size)
+	{
+		segs[count].data = reliable;
+		segs[count].size = reliable_size;
+		count++;
+
+		cl->reliable_bps += reliable_size;
+	}
+
+	// then the unreliable part
+	if (unreliable_size)
+	{
+		segs[count].data = unreliable;
+		segs[count].size = unreliable_size;
+		count++;
+
+		cl->unreliable_bps += unreliable_size;
+	}
+
+	SV_DeltaPacketSent(pl, sequence);
+
+	size_t size = 0;
+	for (size_t i = 0; i < count; i++)
+		size += segs[i].size;
 
-	// the end of the buffer is reached
-	if (cl->relpackets.cursize + cl->reliablebuf.cursize >= cl->relpackets.maxsize())
-		cl->relpackets.cursize = 0;
-
-	// copy the beginning and the size of a packet to the buffer
-	cl->packetbegin[cl->packetnum] = cl->relpackets.cursize;
-	cl->packetsize[cl->packetnum] = cl->reliablebuf.cursize;
-	cl->packetseq[cl->packetnum] = cl->sequence;
-
-	if (cl->reliablebuf.cursize)
-		SZ_Write (&cl->relpackets, cl->reliablebuf.data, cl->reliablebuf.cursize);
-
-
-	cl->packetnum++; // packetnum will never be more than 255
-	                 // because sizeof(packetnum) == 1. Don't need
-	                 // to use &0xff. Cool, eh? ;-)
-	// copy sequence
-	MSG_WriteLong(&sendd, cl->sequence++);
-    
-	// copy the reliable message to the packet first
-    if (cl->reliablebuf.cursize)
-    {
-		SZ_Write (&sendd, cl->reliablebuf.data, cl->reliablebuf.cursize);
-		cl->reliable_bps += cl->reliablebuf.cursize;
-    }
-
-	// add the unreliable part if space is available and rate value
-	// allows it
-	if (gametic % 35)
-	    bps = (int)((double)( (cl->unreliable_bps + cl->reliable_bps) * TICRATE)/(double)(gametic%35));
-
-    if (bps < cl->rate*1000)
-
-	  if (cl->netbuf.cursize && (sendd.maxsize() - sendd.cursize > cl->netbuf.cursize) )
-	  {
-         SZ_Write (&sendd, cl->netbuf.data, cl->netbuf.cursize);
-	     cl->unreliable_bps += cl->netbuf.cursize;
-	  }
-    
-	SZ_Clear(&cl->netbuf);
-	SZ_Clear(&cl->reliablebuf);
-	
 	// compress the packet, but not the sequence id
-	if (sendd.size() > sizeof(int))
-		SV_CompressPacket(sendd, sizeof(int), cl);
+	bool compressed = count > 1 && SV_CompressPacket(segs, count, cl, sequence, scratch);
+	if (compressed)
+	{
+		size = 0;
+		for (size_t i = 0; i < count; i++)
+			size += segs[i].size;
+	}
+
+	SV_LockSend();
+
+	if (compressed)
+		DPrintf("SV_CompressPacket %x %d\n", (int)scratch.header[1], (int)(size - sizeof(seq)));
 
 	if (log_packetdebug)
 	{
 		Printf(PRINT_HIGH, "ply %03u, pkt %06u, size %04u, tic %07u, time %011u\n",
-			   pl.id, cl->sequence - 1, sendd.cursize, gametic, I_MSTime());
+			   pl.id, sequence, size, gametic, I_MSTime());
 	}
 
-	NET_SendPacket(sendd, cl->address);
+	// count the copy made when the datagram is gathered for sending
+	QWORD gathered = NET_GetStats().send_copied;
+
+	NET_SendSegments(segs, count, cl->address);
+
+	copy_stats.copied += NET_GetStats().send_copied - gathered;
+
+	SV_UnlockSend();
+
+	copy_stats.packets++;
+	copy_stats.sent += size;
+
+	// keeps what was held back for the next packet
+	SV_FinishUpdates(pl, sizeof(seq) + size);
+
+	// anything written to a stream client's reliablebuf since it was queued
+	// goes in the next chunk
+	if (!stream)
+		SZ_Clear(&cl->reliablebuf);
+
+	return true;
+}
+
+//
+// SV_SendPacket
+//
+// The reliable message always goes out, or with NETCAP_RELIABLE, as much of
+// the reliable stream as the congestion window allows; 'flush' ignores the
+// window, for the last things a client is told.  What fits of the
+// unreliable message is up to the bandwidth scheduler, see sv_bandwidth.cpp.
+//
+bool SV_SendPacket(player_t &pl, bool flush)
+{
+	if (!SV_CheckPacket(pl))
+		return false;
+
+	bool sent = SV_BuildPacket(pl, flush, main_scratch);
+
+	// the rest of the stream, if it didn't fit in one packet
+	if (sent && flush && (pl.client.netcaps & NETCAP_RELIABLE) && SV_ReliableUnsent(pl))
+		return SV_SendPacket(pl, true);
 
 	return true;
 }
 
+#ifdef ODA_HAVE_SEND_THREADS
+
+//
+// SV_BuildPackets
+//
+// Builds packets for clients from the current batch until none are left.
+//
+static void SV_BuildPackets(packet_scratch_t &scratch)
+{
+	for (;;)
+	{
+		size_t job = __sync_fetch_and_add(&send_next_job, 1);
+		if (job >= send_num_jobs)
+			break;
+
+		SV_BuildPacket(*send_jobs[job], false, scratch);
+	}
+}
+
+//
+// SV_SendWorker
+//
+static void *SV_SendWorker(void *arg)
+{
+	send_worker_t *worker = (send_worker_t *)arg;
+
+	pthread_mutex_lock(&pool_lock);
+
+	for (;;)
+	{
+		while (send_generation == worker->generation && !send_quit)
+			pthread_cond_wait(&pool_work, &pool_lock);
+
+		if (send_quit)
+			break;
+
+		worker->generation = send_generation;
+		pthread_mutex_unlock(&pool_lock);
+
+		SV_BuildPackets(worker->scratch);
+
+		pthread_mutex_lock(&pool_lock);
+		if (--send_busy == 0)
+			pthread_cond_signal(&pool_done);
+	}
+
+	pthread_mutex_unlock(&pool_lock);
+	return NULL;
+}
+
+//
+// SV_StopSendWorkers
+//
+static void STACK_ARGS SV_StopSendWorkers()
+{
+	pthread_mutex_lock(&pool_lock);
+	send_quit = true;
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+
+	for (size_t i = 0; i < send_workers.size(); i++)
+	{
+		pthread_join(send_workers[i]->thread, NULL);
+		delete send_workers[i];
+	}
+
+	send_workers.clear();
+	send_quit = false;
+}
+
+//
+// SV_StartSendWorkers
+//
+static void SV_StartSendWorkers(size_t count)
+{
+	static bool registered = false;
+	if (!registered)
+	{
+		atterm(SV_StopSendWorkers);
+		registered = true;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		send_worker_t *worker = new send_worker_t;
+
+		// no batch is out, so the worker waits for the next one; reading
+		// send_generation itself could miss one handed out before it runs
+		worker->generation = send_generation;
+
+		if (pthread_create(&worker->thread, NULL, SV_SendWorker, worker) != 0)
+		{
+			Printf(PRINT_HIGH, "Could not start packet building thread %d\n", (int)i + 1);
+			delete worker;
+			break;
+		}
+
+		send_workers.push_back(worker);
+	}
+}
+
+#endif
+
+CVAR_FUNC_IMPL (sv_sendthreads)
+{
+#ifdef ODA_HAVE_SEND_THREADS
+	if (send_pool_ready && send_workers.size() == (size_t)var.asInt())
+		return;
+
+	// SV_SendPacketsTo starts the new pool
+	if (!send_workers.empty())
+		SV_StopSendWorkers();
+
+	send_pool_ready = false;
+#endif
+}
+
+//
+// SV_SendPacketsTo
+//
+// Sends every client in 'list' their packet for this tic, in that order
+// unless sv_sendthreads is set.
+//
+void SV_SendPacketsTo(std::vector<player_t*> &list)
+{
+	// drop who needs dropping first, on this thread
+	size_t count = 0;
+	for (size_t i = 0; i < list.size(); i++)
+		if (SV_CheckPacket(*list[i]))
+			list[count++] = list[i];
+
+	list.resize(count);
+
+#ifdef ODA_HAVE_SEND_THREADS
+	if (!send_pool_ready)
+	{
+		SV_StartSendWorkers(sv_sendthreads.asInt());
+		send_pool_ready = true;
+	}
+
+	if (!send_workers.empty() && list.size() > 1)
+	{
+		send_jobs = &list[0];
+		send_num_jobs = list.size();
+		send_next_job = 0;
+		send_threaded = true;
+
+		pthread_mutex_lock(&pool_lock);
+		send_busy = send_workers.size();
+		send_generation++;
+		pthread_cond_broadcast(&pool_work);
+		pthread_mutex_unlock(&pool_lock);
+
+		// this thread lends a hand too
+		SV_BuildPackets(main_scratch);
+
+		pthread_mutex_lock(&pool_lock);
+		while (send_busy)
+			pthread_cond_wait(&pool_done, &pool_lock);
+		pthread_mutex_unlock(&pool_lock);
+
+		send_threaded = false;
+		send_jobs = NULL;
+		send_num_jobs = 0;
+
+		// fold the workers' counts into the totals
+		packet_copy_stats_t &copy = main_scratch.copy_stats;
+		packet_compression_stats_t &comp = main_scratch.compression_stats;
+
+		for (size_t i = 0; i < send_workers.size(); i++)
+		{
+			packet_scratch_t &scratch = send_workers[i]->scratch;
+
+			copy.packets += scratch.copy_stats.packets;
+			copy.sent += scratch.copy_stats.sent;
+			copy.copied += scratch.copy_stats.copied;
+
+			comp.huffman += scratch.compression_stats.huffman;
+			comp.minilzo += scratch.compression_stats.minilzo;
+			comp.uncompressed += scratch.compression_stats.uncompressed;
+			comp.recorded += scratch.compression_stats.recorded;
+			comp.payload += scratch.compression_stats.payload;
+			comp.compressed += scratch.compression_stats.compressed;
+
+			scratch.copy_stats = packet_copy_stats_t();
+			scratch.compression_stats = packet_compression_stats_t();
+		}
+
+		return;
+	}
+#endif
+
+	for (size_t i = 0; i < list.size(); i++)
+		SV_BuildPacket(*list[i], false, main_scratch);
+}
+
 //
 // SV_AcknowledgePacket
 //
@@ -182,7 +1120,15 @@ void SV_AcknowledgePacket(player_t &player)
 
 	int sequence = MSG_ReadLong();
 
+	// until it hears from the reliable stream the client acks this way
+	if (cl->netcaps & NETCAP_RELIABLE)
+	{
+		SV_ReliableAck(player, sequence, 0);
+		return;
+	}
+
 	cl->compressor.packet_acked(sequence);
+	SV_DeltaPacketAcked(player, sequence);
 
 	// packet is missed
 	if (sequence - cl->last_sequence > 1)
@@ -190,17 +1136,10 @@ void SV_AcknowledgePacket(player_t &player)
 		// resend
 		for (int seq = cl->last_sequence+1; seq < sequence; seq++)
 		{
-			int  n;
-			bool needfullupdate = true;
+			// the history is indexed by sequence
+			int n = seq & 0xff;
 
-			for (n=0; n<256; n++)
-				if (cl->packetseq[n] == seq)
-				{
-					needfullupdate = false;
-					break;
-				}
-
-			if  (needfullupdate)
+			if (cl->packetseq[n] != seq)
 			{
 				// do full update
 				DPrintf("need full update\n");
@@ -232,5 +1171,20 @@ void SV_AcknowledgePacket(player_t &player)
 	cl->last_sequence = sequence;
 }
 
+//
+// SV_AcknowledgePackets
+//
+// clc_ackbits: the newest packet the client got and which of the 32 before
+// it it got as well.
+//
+void SV_AcknowledgePackets(player_t &player)
+{
+	int sequence = MSG_ReadLong();
+	DWORD bits = MSG_ReadLong();
+
+	if (player.client.netcaps & NETCAP_RELIABLE)
+		SV_ReliableAck(player, sequence, bits);
+}
+
 VERSION_CONTROL (sv_rproto_cpp, "$Id$")
 
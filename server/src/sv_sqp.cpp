@@ -20,6 +20,7 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -43,6 +44,7 @@ static buf_t ml_message(MAX_UDP_PACKET);
 
 EXTERN_CVAR(join_password)
 EXTERN_CVAR(sv_timelimit)
+EXTERN_CVAR(sv_qryrate)
 
 struct CvarField_t
 {
@@ -74,18 +76,120 @@ struct CvarField_t
 #define QRYRANGEINFO(INTRODUCED,REMOVED) \
     if (EqProtocolVersion >= INTRODUCED && EqProtocolVersion < REMOVED)
 
+// Replies are built once and reused until something in them changes (see
+// SV_QryInvalidate) or they get older than this, for pings and times
+#define QRY_CACHE_MAXAGE 1000
+
+// Enquiries a single address can burst before sv_qryrate kicks in
+#define QRY_RATE_BURST 10
+
+// Addresses tracked for rate limiting before idle ones are forgotten
+#define QRY_RATE_MAXADDRESSES 4096
+
+struct QryCache_t
+{
+	std::vector<byte> Data;		// everything after the enquirer's time
+	unsigned int Generation;
+	dtime_t Built;				// I_MSTime
+	bool Valid;
+
+	QryCache_t() : Generation(0), Built(0), Valid(false) {}
+};
+
+// One per protocol version we can be asked for
+static QryCache_t QryCache[PROTOCOL_VERSION + 1];
+static unsigned int QryGeneration = 0;
+
+struct QryRate_t
+{
+	float Tokens;
+	dtime_t Last;				// I_MSTime
+};
+
+static std::map<DWORD, QryRate_t> QryRates;
+
+struct QryStats_t
+{
+	QWORD Enquiries;
+	QWORD CacheHits;
+	QWORD Rebuilds;
+	QWORD Limited;				// dropped by sv_qryrate
+} QryStats;
+
+//
+// SV_QryInvalidate()
+//
+// Called when something launchers are shown changes: server info cvars,
+// the map, players joining, leaving or scoring
+void SV_QryInvalidate()
+{
+	QryGeneration++;
+}
+
+//
+// IntQryAllowed()
+//
+// Token bucket per source address, so a single scraper can't make us spend
+// all our time and upstream answering it
+static bool IntQryAllowed(const netadr_t &From)
+{
+	if (sv_qryrate <= 0.0f)
+		return true;
+
+	DWORD Ip = (From.ip[0] << 24) | (From.ip[1] << 16) | (From.ip[2] << 8) | From.ip[3];
+	dtime_t Now = I_MSTime();
+
+	std::map<DWORD, QryRate_t>::iterator it = QryRates.find(Ip);
+
+	if (it == QryRates.end())
+	{
+		// Forget the ones that have been quiet long enough to be back to a
+		// full bucket, and everyone if that doesn't help
+		if (QryRates.size() >= QRY_RATE_MAXADDRESSES)
+		{
+			dtime_t Idle = (dtime_t)(1000.0f * QRY_RATE_BURST / sv_qryrate);
+
+			for (std::map<DWORD, QryRate_t>::iterator i = QryRates.begin(); i != QryRates.end(); )
+			{
+				if (Now - i->second.Last >= Idle)
+					QryRates.erase(i++);
+				else
+					++i;
+			}
+
+			if (QryRates.size() >= QRY_RATE_MAXADDRESSES)
+				QryRates.clear();
+		}
+
+		QryRate_t Rate;
+		Rate.Tokens = QRY_RATE_BURST;
+		Rate.Last = Now;
+		it = QryRates.insert(std::make_pair(Ip, Rate)).first;
+	}
+
+	QryRate_t &Rate = it->second;
+
+	Rate.Tokens += (Now - Rate.Last) * sv_qryrate / 1000.0f;
+	Rate.Last = Now;
+
+	if (Rate.Tokens > QRY_RATE_BURST)
+		Rate.Tokens = QRY_RATE_BURST;
+
+	if (Rate.Tokens < 1.0f)
+		return false;
+
+	Rate.Tokens -= 1.0f;
+	return true;
+}
+
 //
 // IntQryBuildInformation()
 //
 // Protocol building routine, the passed parameter is the enquirer version
-static void IntQryBuildInformation(const DWORD& EqProtocolVersion,
-                                   const DWORD& EqTime)
+static void IntQryBuildInformation(const DWORD& EqProtocolVersion)
 {
 	std::vector<CvarField_t> Cvars;
 
-	// bond - time
-	MSG_WriteLong(&ml_message, EqTime);
-
 	// The servers real protocol version
 	// bond - real protocol
 	MSG_WriteLong(&ml_message, PROTOCOL_VERSION);
@@ -275,6 +379,42 @@ next:
 	}
 }
 
+//
+// IntQryWriteInformation()
+//
+// Appends the information for the enquirer's version to ml_message, from
+// the cache if it is still good
+static void IntQryWriteInformation(const DWORD& EqProtocolVersion,
+                                   const DWORD& EqTime)
+{
+	QryCache_t &Cache = QryCache[EqProtocolVersion];
+	dtime_t Now = I_MSTime();
+
+	// bond - time
+	MSG_WriteLong(&ml_message, EqTime);
+
+	if (Cache.Valid && Cache.Generation == QryGeneration &&
+	    Now - Cache.Built < QRY_CACHE_MAXAGE)
+	{
+		if (!Cache.Data.empty())
+			MSG_WriteChunk(&ml_message, &Cache.Data[0], Cache.Data.size());
+
+		QryStats.CacheHits++;
+		return;
+	}
+
+	size_t Start = ml_message.cursize;
+
+	IntQryBuildInformation(EqProtocolVersion);
+
+	Cache.Data.assign(ml_message.data + Start, ml_message.data + ml_message.cursize);
+	Cache.Generation = QryGeneration;
+	Cache.Built = Now;
+	Cache.Valid = !ml_message.overflowed;
+
+	QryStats.Rebuilds++;
+}
+
 //
 // IntQrySendResponse()
 //
@@ -406,7 +546,7 @@ static DWORD IntQrySendResponse(const WORD& TagId,
 	else
 		MSG_WriteLong(&ml_message, EqProtocolVersion);
 
-	IntQryBuildInformation(EqProtocolVersion, EqTime);
+	IntQryWriteInformation(EqProtocolVersion, EqTime);
 
 	NET_SendPacket(ml_message, net_from);
 
@@ -434,7 +574,33 @@ DWORD SV_QryParseEnquiry(const DWORD& Tag)
 		return 1;
 	}
 
+	QryStats.Enquiries++;
+
+	// Ours, but this address has asked too often
+	if (!IntQryAllowed(net_from))
+	{
+		QryStats.Limited++;
+		return 0;
+	}
+
 	return IntQrySendResponse(TagId, TagApplication, TagQRId, TagPacketType);
 }
 
+BEGIN_COMMAND(qrystats)
+{
+	if (argc > 1 && stricmp(argv[1], "reset") == 0)
+	{
+		memset(&QryStats, 0, sizeof(QryStats));
+		Printf(PRINT_HIGH, "Launcher query stats reset\n");
+		return;
+	}
+
+	Printf(PRINT_HIGH, "Launcher enquiries: %llu, %llu answered from the cache, "
+	       "%llu rebuilt, %llu rate limited\n",
+	       (unsigned long long)QryStats.Enquiries, (unsigned long long)QryStats.CacheHits,
+	       (unsigned long long)QryStats.Rebuilds, (unsigned long long)QryStats.Limited);
+	Printf(PRINT_HIGH, "Addresses tracked for rate limiting: %u\n", (unsigned)QryRates.size());
+}
+END_COMMAND(qrystats)
+
 VERSION_CONTROL(sv_sqp_cpp, "$Id$")
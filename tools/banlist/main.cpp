@@ -0,0 +1,348 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Fills a banlist with made up bans, a few of them ranges and some expired
+//	or expiring, a handful of exceptions and bans on connected players.
+//	Then throws a flood of connection attempts at it, some from banned
+//	addresses and ranges and the rest from anywhere, and times checking
+//	them by going through the whole list and with the index:
+//
+//	  banlist [-bans n] [-connects n] [-players n]
+//
+//	Both have to agree on every attempt and on which ban they found, before
+//	and after half of the player bans are removed again; it exits with 1 if
+//	they don't.  It is linked with the server's own objects (see the
+//	Makefile), so this is the Banlist odasrv uses.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "actor.h"
+#include "cmdlib.h"
+#include "d_player.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "sv_banlist.h"
+
+// i_main.cpp isn't linked, this is what the rest of the server needs of it
+DArgs Args;
+
+void addterm(void (STACK_ARGS *func)(), const char *name) {}
+void STACK_ARGS call_terms() {}
+int PrintString(int printlevel, char const *str) { return 0; }
+void daemon_init() {}
+void instances_init(int count) {}
+
+static DWORD seed = 0x9e3779b9;
+
+static DWORD Random()
+{
+	seed = seed * 1664525 + 1013904223;
+	return seed;
+}
+
+//
+// LinearBanCheck
+//
+// What Banlist::check did before it had an index.
+//
+static bool LinearBanCheck(const exceptionlist_results_t &exceptions,
+                           const banlist_results_t &bans,
+                           const netadr_t &address, Ban &baninfo)
+{
+	for (exceptionlist_results_t::const_iterator it = exceptions.begin();
+	        it != exceptions.end(); ++it)
+	{
+		if (it->second->range.check(address))
+		{
+			return false;
+		}
+	}
+
+	for (banlist_results_t::const_iterator it = bans.begin();
+	        it != bans.end(); ++it)
+	{
+		if (it->second->range.check(address) && (it->second->expire == 0 ||
+		                                         it->second->expire > time(NULL)))
+		{
+			baninfo = *it->second;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+//
+// CheckAll
+//
+// Checks every connection attempt both ways and counts how many are banned.
+// Returns how many times the two disagree, on the verdict or on the ban.
+//
+static int CheckAll(Banlist &banlist, const std::vector<netadr_t> &connects,
+                    int &oldbanned, int &newbanned, dtime_t &oldtime, dtime_t &newtime)
+{
+	banlist_results_t bans;
+	exceptionlist_results_t exceptions;
+	banlist.query(bans);
+	banlist.query_exception(exceptions);
+
+	std::vector<bool> oldresult(connects.size());
+	std::vector<Ban> oldban(connects.size());
+	int differ = 0;
+
+	oldbanned = newbanned = 0;
+
+	dtime_t start = I_GetTime();
+	for (size_t i = 0; i < connects.size(); i++)
+	{
+		oldresult[i] = LinearBanCheck(exceptions, bans, connects[i], oldban[i]);
+		oldbanned += oldresult[i];
+	}
+	oldtime = I_GetTime() - start;
+
+	std::vector<bool> newresult(connects.size());
+	std::vector<Ban> newban(connects.size());
+
+	start = I_GetTime();
+	for (size_t i = 0; i < connects.size(); i++)
+	{
+		newresult[i] = banlist.check(connects[i], newban[i]);
+		newbanned += newresult[i];
+	}
+	newtime = I_GetTime() - start;
+
+	for (size_t i = 0; i < connects.size(); i++)
+	{
+		if (oldresult[i] != newresult[i])
+			differ++;
+		else if (oldresult[i] && (oldban[i].name != newban[i].name ||
+		                          oldban[i].range.string() != newban[i].range.string() ||
+		                          oldban[i].expire != newban[i].expire))
+			differ++;
+	}
+
+	return differ;
+}
+
+//
+// MakeAddress
+//
+static netadr_t MakeAddress(DWORD ip)
+{
+	netadr_t adr;
+	memset(&adr, 0, sizeof(adr));
+
+	for (byte j = 0; j < 4; j++)
+		adr.ip[j] = (byte)(ip >> (24 - j * 8));
+
+	return adr;
+}
+
+int main(int argc, char **argv)
+{
+	int numbans = 100000;
+	int numconnects = 2000;
+	int numplayers = 64;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-bans") && i + 1 < argc)
+			numbans = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-connects") && i + 1 < argc)
+			numconnects = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-players") && i + 1 < argc)
+			numplayers = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-bans n] [-connects n] [-players n]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (numbans <= 0 || numconnects <= 0 || numplayers < 0 || numplayers > 255)
+	{
+		fprintf(stderr, "-bans and -connects need to be at least 1, -players 0-255\n");
+		return 1;
+	}
+
+	time_t now = time(NULL);
+	Banlist banlist;
+
+	dtime_t start = I_GetTime();
+
+	for (int i = 0; i < numbans; i++)
+	{
+		DWORD r = Random();
+
+		char address[16];
+		if ((r >> 8) % 100 == 0)
+			snprintf(address, sizeof(address), "%u.%u.*.*", r >> 24, (r >> 16) & 0xff);
+		else if ((r >> 8) % 100 < 5)
+			snprintf(address, sizeof(address), "%u.%u.%u.*", r >> 24, (r >> 16) & 0xff,
+			         (r >> 8) & 0xff);
+		else
+			snprintf(address, sizeof(address), "%u.%u.%u.%u", r >> 24, (r >> 16) & 0xff,
+			         (r >> 8) & 0xff, Random() >> 24);
+
+		// a tenth ran out a while ago, a tenth run out some time in the
+		// next day and the rest are for good
+		time_t expire = 0;
+		r = Random();
+		if ((r >> 8) % 10 == 0)
+			expire = now - 3600;
+		else if ((r >> 8) % 10 == 1)
+			expire = now + 3600 + (r >> 16) % 86400;
+
+		banlist.add(address, expire);
+	}
+
+	for (int i = 0; i < 16; i++)
+	{
+		DWORD r = Random();
+
+		char address[16];
+		snprintf(address, sizeof(address), "%u.%u.%u.*", r >> 24, (r >> 16) & 0xff,
+		         (r >> 8) & 0xff);
+		banlist.add_exception(address);
+	}
+
+	dtime_t addtime = I_GetTime() - start;
+
+	// kicking and banning players, as the ban command does
+	for (int i = 0; i < numplayers; i++)
+	{
+		players.push_back(player_t());
+
+		player_t &player = players.back();
+		player.id = i + 1;
+		player.client.address = MakeAddress(Random());
+
+		char name[MAXPLAYERNAME + 1];
+		snprintf(name, sizeof(name), "player%d", i + 1);
+		player.userinfo.netname = name;
+	}
+
+	start = I_GetTime();
+
+	int n = 0;
+	for (Players::iterator it = players.begin(); it != players.end(); ++it, ++n)
+	{
+		size_t before = banlist.size();
+
+		// every fourth one has expired already, and another runs out later
+		time_t expire = n % 4 == 3 ? now - 60 : n % 4 == 2 ? now + 3600 : 0;
+
+		if (!banlist.add(*it, expire, "testing") || banlist.size() != before + 1)
+		{
+			fprintf(stderr, "banning %s didn't add one ban\n", it->userinfo.netname.c_str());
+			return 1;
+		}
+	}
+
+	dtime_t playertime = I_GetTime() - start;
+
+	// what reloading the banfile costs, less reading it
+	Json::Value json_bans(Json::arrayValue);
+	banlist.json(json_bans);
+
+	start = I_GetTime();
+	banlist.json_replace(json_bans);
+	dtime_t replacetime = I_GetTime() - start;
+
+	// half of them come from somewhere on the list, and every player tries
+	// to come back
+	banlist_results_t bans;
+	banlist.query(bans);
+
+	std::vector<netadr_t> connects(numconnects);
+	for (int i = 0; i < numconnects; i++)
+	{
+		netadr_t &adr = connects[i];
+		DWORD r = Random();
+
+		if (!((r >> 16) & 1))
+		{
+			adr = MakeAddress(r);
+			continue;
+		}
+
+		memset(&adr, 0, sizeof(adr));
+		StringTokens tokens = TokenizeString(
+			bans[(Random() >> 8) % bans.size()].second->range.string(), ".");
+
+		// fill the wildcards in with something
+		for (byte j = 0; j < 4; j++)
+		{
+			r = Random();
+			if (tokens[j] == "*")
+				adr.ip[j] = (byte)(r >> 24);
+			else
+				adr.ip[j] = (byte)atoi(tokens[j].c_str());
+		}
+	}
+
+	for (Players::iterator it = players.begin(); it != players.end(); ++it)
+		connects.push_back(it->client.address);
+
+	int oldbanned, newbanned;
+	dtime_t oldtime, newtime;
+	int differ = CheckAll(banlist, connects, oldbanned, newbanned, oldtime, newtime);
+
+	printf("%d bans, %d player bans, %d connection attempts:\n",
+	       numbans, numplayers, (int)connects.size());
+	printf("  adding:     %.1f ms, players: %.3f ms, replacing: %.1f ms\n",
+	       (double)addtime / 1000000.0, (double)playertime / 1000000.0,
+	       (double)replacetime / 1000000.0);
+	printf("  whole list: %.1f us per check, %d banned\n",
+	       (double)oldtime / 1000.0 / connects.size(), oldbanned);
+	printf("  index:      %.3f us per check, %d banned\n",
+	       (double)newtime / 1000.0 / connects.size(), newbanned);
+
+	// unban every other player, which has the index rebuilt
+	banlist.query(bans);
+	for (size_t i = bans.size(); i-- > 0;)
+	{
+		if (bans[i].second->reason == "testing" && i % 2)
+			banlist.remove(bans[i].first);
+	}
+
+	differ += CheckAll(banlist, connects, oldbanned, newbanned, oldtime, newtime);
+
+	printf("  after unbanning half of the players: %d banned, %d with the index\n",
+	       oldbanned, newbanned);
+
+	players.clear();
+
+	// what i_main has run at exit, so Args goes without the object list
+	DObject::StaticShutdown();
+
+	if (differ)
+	{
+		printf("  %d checks differ!\n", differ);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,364 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Round-trip checks for BitWriter and BitReader:
+//
+//	  bitpack [-seed n] [-rounds n]
+//
+//	Writes edge values and then random runs of every kind of field, reads
+//	them back and compares.  Fixed point fields are compared with the
+//	value rounded to the kept fractional bits, worked out here separately
+//	from QuantizeFixed.  Exits with 1 on the first mismatch.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "doomtype.h"
+#include "i_net.h"
+#include "version.h"
+
+// i_bitpack.cpp registers itself with the version command
+file_version::file_version(const char *uid, const char *id, const char *p, int l,
+						   const char *t, const char *d) {}
+
+// buf_t reports overflows through the console
+int STACK_ARGS Printf(int printlevel, const char *format, ...) { return 0; }
+
+enum field_type_t
+{
+	FIELD_BITS,
+	FIELD_VARINT,
+	FIELD_SIGNEDVARINT,
+	FIELD_FIXED,
+	FIELD_FIXEDVARINT,
+	FIELD_BYTE,			// flushed, then a byte-level write in between
+	NUMFIELDS
+};
+
+struct field_t
+{
+	field_type_t	type;
+	int				width;		// bits, or fractional bits for fixed point
+	DWORD			value;
+};
+
+static unsigned int seed = 1;
+
+static DWORD Random()
+{
+	// xorshift32
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+//
+// Quantized
+//
+// What a fixed point field is expected to read back as.
+//
+static int Quantized(int value, int fracbits)
+{
+	int shift = 16 - fracbits;
+	if (shift <= 0)
+		return value;
+
+	SQWORD step = (SQWORD)1 << shift;
+	SQWORD q = ((SQWORD)value + step / 2);
+	q = (q >= 0 ? q / step : -((-q + step - 1) / step)) * step;
+
+	// rounding up past the largest value stays at the largest step
+	if (q > 0x7FFFFFFF)
+		q = ((SQWORD)0x7FFFFFFF / step) * step;
+
+	return (int)q;
+}
+
+static DWORD Expected(const field_t &f)
+{
+	switch (f.type)
+	{
+	case FIELD_BITS:
+		return f.width < 32 ? f.value & ((1u << f.width) - 1) : f.value;
+	case FIELD_FIXED:
+	case FIELD_FIXEDVARINT:
+		return (DWORD)Quantized((int)f.value, f.width);
+	case FIELD_BYTE:
+		return f.value & 0xFF;
+	default:
+		return f.value;
+	}
+}
+
+static const char *field_names[NUMFIELDS] = {
+	"bits", "varint", "signed varint", "fixed", "fixed varint", "byte"
+};
+
+static void Write(buf_t &buf, BitWriter &bits, const field_t &f)
+{
+	switch (f.type)
+	{
+	case FIELD_BITS:			bits.WriteBits(f.value, f.width); break;
+	case FIELD_VARINT:			bits.WriteVarint(f.value); break;
+	case FIELD_SIGNEDVARINT:	bits.WriteSignedVarint((int)f.value); break;
+	case FIELD_FIXED:			bits.WriteFixed((int)f.value, f.width); break;
+	case FIELD_FIXEDVARINT:		bits.WriteFixedVarint((int)f.value, f.width); break;
+	case FIELD_BYTE:
+		bits.Flush();
+		buf.WriteByte((byte)f.value);
+		break;
+	default:
+		break;
+	}
+}
+
+static DWORD Read(buf_t &buf, BitReader &bits, const field_t &f)
+{
+	switch (f.type)
+	{
+	case FIELD_BITS:			return bits.ReadBits(f.width);
+	case FIELD_VARINT:			return bits.ReadVarint();
+	case FIELD_SIGNEDVARINT:	return (DWORD)bits.ReadSignedVarint();
+	case FIELD_FIXED:			return (DWORD)bits.ReadFixed(f.width);
+	case FIELD_FIXEDVARINT:		return (DWORD)bits.ReadFixedVarint(f.width);
+	case FIELD_BYTE:
+		// the writer padded to a byte, the reader starts afresh after one
+		bits = BitReader(&buf);
+		return (DWORD)buf.ReadByte();
+	default:
+		return 0;
+	}
+}
+
+//
+// RoundTrip
+//
+// Writes the fields, reads them back and reports the first one that
+// doesn't come back as expected.
+//
+static bool RoundTrip(const std::vector<field_t> &fields, const char *what)
+{
+	buf_t buf(fields.size() * 8 + 16);
+
+	BitWriter writer(&buf);
+	for (size_t i = 0; i < fields.size(); i++)
+		Write(buf, writer, fields[i]);
+	writer.Flush();
+
+	if (buf.overflowed)
+	{
+		printf("%s: buffer overflowed writing %u fields\n", what, (unsigned)fields.size());
+		return false;
+	}
+
+	BitReader reader(&buf);
+	for (size_t i = 0; i < fields.size(); i++)
+	{
+		const field_t &f = fields[i];
+		DWORD got = Read(buf, reader, f);
+		DWORD expected = Expected(f);
+
+		if (got != expected || buf.overflowed)
+		{
+			printf("%s: field %u (%s, %d) wrote %08x, read %08x, expected %08x%s\n",
+				   what, (unsigned)i, field_names[f.type], f.width, f.value, got, expected,
+				   buf.overflowed ? " (overflowed)" : "");
+			return false;
+		}
+	}
+
+	// one byte of padding at most
+	if (buf.cursize - buf.readpos > 0)
+	{
+		printf("%s: %u bytes left over\n", what, (unsigned)(buf.cursize - buf.readpos));
+		return false;
+	}
+
+	return true;
+}
+
+static field_t Field(field_type_t type, int width, DWORD value)
+{
+	field_t f;
+	f.type = type;
+	f.width = width;
+	f.value = value;
+	return f;
+}
+
+//
+// EdgeValues
+//
+static bool EdgeValues()
+{
+	static const DWORD values[] = {
+		0, 1, 2, 0x7F, 0x80, 0xFF, 0x100, 0x3FFF, 0x4000, 0x7FFF, 0x8000, 0xFFFF,
+		0x10000, 0x7FFFFFFF, 0x80000000, 0x80000001, 0xFFFFFFFF, 0xFFFFFFFE,
+		0xFFFF8000, 0x7FFFF800, 0x7FFFF7FF, 0x12345678
+	};
+	static const size_t numvalues = sizeof(values) / sizeof(values[0]);
+
+	std::vector<field_t> fields;
+
+	for (size_t i = 0; i < numvalues; i++)
+	{
+		for (int width = 1; width <= 32; width++)
+			fields.push_back(Field(FIELD_BITS, width, values[i]));
+
+		fields.push_back(Field(FIELD_VARINT, 0, values[i]));
+		fields.push_back(Field(FIELD_SIGNEDVARINT, 0, values[i]));
+
+		for (int fracbits = 0; fracbits <= 16; fracbits++)
+		{
+			fields.push_back(Field(FIELD_FIXED, fracbits, values[i]));
+			fields.push_back(Field(FIELD_FIXEDVARINT, fracbits, values[i]));
+		}
+	}
+
+	if (!RoundTrip(fields, "edge values"))
+		return false;
+
+	// what the packed movement messages use
+	fields.clear();
+	for (size_t i = 0; i < numvalues; i++)
+	{
+		fields.push_back(Field(FIELD_BITS, 16, values[i]));
+		fields.push_back(Field(FIELD_FIXED, NET_POSITION_FRACBITS, values[i]));
+		fields.push_back(Field(FIELD_FIXEDVARINT, NET_MOMENTUM_FRACBITS, values[i]));
+	}
+
+	return RoundTrip(fields, "packed movement");
+}
+
+//
+// RandomValue
+//
+// Mostly small numbers of either sign, as the packed messages send.
+//
+static DWORD RandomValue()
+{
+	DWORD value = Random();
+
+	switch (Random() % 4)
+	{
+	case 0:
+		return value;
+	case 1:
+		return value & 0xFF;
+	case 2:
+		return (DWORD)((int)(value & 0xFFFFF) - 0x80000);
+	default:
+		return (DWORD)((int)value >> (Random() % 32));
+	}
+}
+
+//
+// RandomFields
+//
+static bool RandomFields(int rounds)
+{
+	for (int round = 0; round < rounds; round++)
+	{
+		std::vector<field_t> fields;
+		size_t count = 1 + Random() % 64;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			field_type_t type = (field_type_t)(Random() % NUMFIELDS);
+			int width = 0;
+
+			if (type == FIELD_BITS)
+				width = 1 + Random() % 32;
+			else if (type == FIELD_FIXED || type == FIELD_FIXEDVARINT)
+				width = Random() % 17;
+
+			fields.push_back(Field(type, width, RandomValue()));
+		}
+
+		char what[32];
+		snprintf(what, sizeof(what), "round %d", round);
+
+		if (!RoundTrip(fields, what))
+			return false;
+	}
+
+	return true;
+}
+
+//
+// Overrun
+//
+// Reading past what was written sets overflowed and returns zeros.
+//
+static bool Overrun()
+{
+	buf_t buf(16);
+	BitWriter writer(&buf);
+	writer.WriteBits(0x5, 3);
+	writer.Flush();
+
+	BitReader reader(&buf);
+	if (reader.ReadBits(3) != 0x5 || buf.overflowed)
+	{
+		printf("overrun: the written bits didn't come back\n");
+		return false;
+	}
+
+	// the rest of the padding byte is there, the next one isn't
+	reader.ReadBits(5);
+	DWORD got = reader.ReadBits(8);
+	if (got != 0 || !buf.overflowed)
+	{
+		printf("overrun: read %08x past the end, overflowed %d\n", got, (int)buf.overflowed);
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = 100000;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+			seed = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-rounds") && i + 1 < argc)
+			rounds = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-seed n] [-rounds n]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (!seed)
+		seed = 1;
+
+	if (!EdgeValues() || !RandomFields(rounds) || !Overrun())
+		return 1;
+
+	printf("bitpack: edge values, %d random rounds and overrun passed\n", rounds);
+	return 0;
+}
@@ -0,0 +1,274 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Replays the server messages of a netdemo through the packet
+//	compressors and reports how well each one does:
+//
+//	  compressratio [-rtt tics] demo.odd
+//
+//	Netdemos store what the client received during each tic, decompressed,
+//	so a message stands in for a packet.  The adaptive huffman codec is
+//	extended with one message per round trip, like the server does.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#ifdef UNIX
+#include <sys/time.h>
+#endif
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include "huffman.h"
+#include "minilzo.h"
+#include "version.h"
+
+// huffman.cpp registers itself with the version command
+file_version::file_version(const char *uid, const char *id, const char *p, int l,
+						   const char *t, const char *d) {}
+
+// netdemo layout, see cl_demo.h
+static const size_t NETDEMO_HEADER_SIZE = 64;
+static const size_t NETDEMO_MESSAGE_HEADER_SIZE = 9;
+static const unsigned char NETDEMO_MSG_PACKET = 0xAA;
+
+// what the server bothers running minilzo on
+static const size_t MINILZO_MIN = 0xFF;
+
+// svc_compressed and the method byte
+static const size_t COMPRESSED_HEADER = 2;
+
+#define OUT_LEN(a)	((a) + (a) / 16 + 64 + 3)
+
+struct method_stats_t
+{
+	const char		*name;
+	unsigned long	packets;	// won or compressed at all
+	double			bytes;		// output, headers included
+	double			usecs;
+};
+
+static double Now()
+{
+#ifdef WIN32
+	return GetTickCount() * 1000.0;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+#endif
+}
+
+static unsigned int ReadLE32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+//
+// ReadMessages
+//
+// Returns the payload of every packet message in the demo, along with the
+// tic it was received on.
+//
+static bool ReadMessages(const char *filename, std::vector<std::vector<unsigned char> > &messages,
+						 std::vector<unsigned int> &tics)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (!fp)
+	{
+		fprintf(stderr, "Can't open %s\n", filename);
+		return false;
+	}
+
+	unsigned char header[NETDEMO_HEADER_SIZE];
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header) || memcmp(header, "ODAD", 4))
+	{
+		fprintf(stderr, "%s is not a netdemo\n", filename);
+		fclose(fp);
+		return false;
+	}
+
+	// the indices are written after the messages
+	long end = 0;
+	unsigned int offsets[2] = { ReadLE32(header + 8), ReadLE32(header + 14) };
+
+	for (int i = 0; i < 2; i++)
+		if (offsets[i] > NETDEMO_HEADER_SIZE && (!end || (long)offsets[i] < end))
+			end = offsets[i];
+
+	while (!end || ftell(fp) < end)
+	{
+		unsigned char msgheader[NETDEMO_MESSAGE_HEADER_SIZE];
+		if (fread(msgheader, 1, sizeof(msgheader), fp) != sizeof(msgheader))
+			break;
+
+		unsigned int len = ReadLE32(msgheader + 1);
+		unsigned int tic = ReadLE32(msgheader + 5);
+
+		std::vector<unsigned char> data(len);
+		if (len && fread(&data[0], 1, len, fp) != len)
+			break;
+
+		// snapshots are client state, not what came over the wire
+		if (msgheader[0] != NETDEMO_MSG_PACKET || !len)
+			continue;
+
+		messages.push_back(data);
+		tics.push_back(tic);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int rtt = 4;
+	const char *filename = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-rtt") && i + 1 < argc)
+			rtt = atoi(argv[++i]);
+		else
+			filename = argv[i];
+	}
+
+	if (!filename)
+	{
+		fprintf(stderr, "usage: compressratio [-rtt tics] demo.odd\n");
+		return 1;
+	}
+
+	std::vector<std::vector<unsigned char> > messages;
+	std::vector<unsigned int> tics;
+
+	if (!ReadMessages(filename, messages, tics))
+		return 1;
+
+	if (messages.empty())
+	{
+		fprintf(stderr, "%s has no messages\n", filename);
+		return 1;
+	}
+
+	if (lzo_init() != LZO_E_OK)
+	{
+		fprintf(stderr, "lzo_init failed\n");
+		return 1;
+	}
+
+	static lzo_byte wrkmem[LZO1X_1_MEM_COMPRESS];
+
+	method_stats_t minilzo = { "minilzo", 0, 0, 0 };
+	method_stats_t adaptive = { "huffman", 0, 0, 0 };
+	method_stats_t best = { "best of", 0, 0, 0 };
+
+	huffman_server server;
+	unsigned int recorded = 0, recorded_tic = 0;
+	bool awaiting = false;
+
+	double raw = 0;
+
+	for (size_t i = 0; i < messages.size(); i++)
+	{
+		std::vector<unsigned char> &in = messages[i];
+		size_t len = in.size();
+
+		std::vector<unsigned char> out(OUT_LEN(len) + 32);
+
+		raw += len;
+
+		// the client acks the recorded message a round trip later
+		if (awaiting && tics[i] >= recorded_tic + rtt)
+		{
+			server.packet_acked(recorded);
+			awaiting = false;
+		}
+
+		size_t lzolen = len;
+		double start = Now();
+
+		if (len >= MINILZO_MIN)
+		{
+			lzo_uint outlen = out.size();
+			if (lzo1x_1_compress(&in[0], len, &out[0], &outlen, wrkmem) == LZO_E_OK)
+				lzolen = outlen + COMPRESSED_HEADER;
+		}
+
+		minilzo.usecs += Now() - start;
+
+		size_t hufflen = out.size();
+		start = Now();
+
+		if (!server.get_codec().compress(&in[0], len, &out[0], hufflen))
+			hufflen = len;
+		else
+			hufflen += COMPRESSED_HEADER;
+
+		if (!awaiting && server.packet_sent(i, &in[0], len))
+		{
+			recorded = i;
+			recorded_tic = tics[i];
+			awaiting = true;
+		}
+
+		adaptive.usecs += Now() - start;
+
+		if (lzolen < len)
+			minilzo.packets++;
+		if (hufflen < len)
+			adaptive.packets++;
+
+		minilzo.bytes += lzolen < len ? lzolen : len;
+		adaptive.bytes += hufflen < len ? hufflen : len;
+
+		size_t smallest = len;
+		if (lzolen < smallest)
+			smallest = lzolen;
+		if (hufflen < smallest)
+			smallest = hufflen;
+
+		if (smallest < len)
+			best.packets++;
+
+		best.bytes += smallest;
+	}
+
+	best.usecs = minilzo.usecs + adaptive.usecs;
+
+	printf("%lu messages, %.0f bytes, %.1f bytes on average, round trip %u tics\n",
+		   (unsigned long)messages.size(), raw, raw / messages.size(), rtt);
+
+	method_stats_t *methods[] = { &minilzo, &adaptive, &best };
+
+	for (size_t i = 0; i < sizeof(methods) / sizeof(*methods); i++)
+	{
+		printf("%-8s %6.1f%% of the original size, %lu messages smaller, %.2f us/KB\n",
+			   methods[i]->name, 100.0 * methods[i]->bytes / raw, methods[i]->packets,
+			   methods[i]->usecs * 1024.0 / raw);
+	}
+
+	return 0;
+}
@@ -0,0 +1,884 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Connects a number of made up clients to a server and has them play,
+//	then reports what the server sent them:
+//
+//	  loadtest [-clients n] [-time secs] [-connectrate n] [-updaterate tics]
+//	           [-rate kbps] [-netcaps n] [-nofire] [-seed n]
+//	           [-ticcmds file] [host[:port]]
+//
+//	Every client has its own UDP socket, goes through the same handshake
+//	as the real one, joins the game and sends a clc_move with its last ten
+//	ticcmds every tic.  The ticcmds come from the file, in the format
+//	tools/unlagreplay reads plus an optional fourth column that is 1 while
+//	fire is held down, each client starting at a different line.  Without
+//	one they are made up: running around, turning and shooting.
+//
+//	The clients don't decode anything the server sends.  They read the
+//	sequence number in front of every packet and acknowledge it, with
+//	clc_ackbits if they claim NETCAP_RELIABLE and clc_ack if not, which is
+//	all the server needs to keep them going.  Claiming the other netcaps
+//	makes the server build the same packets it would for real clients.
+//	Since the clients don't know the server's gametic, the world index in
+//	their ticcmds is only a counter, so unlag rewinds them by however much
+//	it works out to, up to sv_maxunlagtime.
+//
+//	Reported are the bandwidth and packet loss of each client and the time
+//	between the bursts of packets the server sends every tic, which is its
+//	tic time as the clients see it; "profile" on the server breaks it down.
+//
+//-----------------------------------------------------------------------------
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifdef UNIX
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define closesocket close
+#endif
+
+#ifdef WIN32
+#include <winsock.h>
+#include <windows.h>
+#define usleep(n) Sleep(n/1000)
+typedef int socklen_t;
+#endif
+
+#include "i_net.h"
+#include "version.h"
+#include "doomdef.h"
+#include "d_event.h"
+#include "m_fixed.h"
+#include "d_netinf.h"
+
+// give up on a client that hears nothing for this long
+static const double CLIENT_TIMEOUT = 5.0;
+
+// how often the handshake is retried; the challenge is repeated for long
+// enough to get through a server that is still starting up, and a connect
+// request that goes unanswered starts the handshake over with a new token
+static const double CONNECT_RETRY = 1.0;
+static const int CHALLENGE_TRIES = 30;
+static const int CONNECT_TRIES = 5;
+
+// the client asks to join the game this often after connecting, in case
+// the first request went out before it was spawned
+static const double JOIN_RETRY = 1.0;
+static const int JOIN_TRIES = 5;
+
+// packets closer together than this count as sent in the same tic, which
+// also lumps together the tics a server runs back to back to catch up
+static const double SAME_TIC = 0.5 / TICRATE;
+
+// same as in NetCommand
+static const int CMD_BUTTONS = 0x0001;
+static const int CMD_ANGLE = 0x0002;
+static const int CMD_FORWARD = 0x0008;
+static const int CMD_SIDE = 0x0010;
+
+struct ticcmd_line_t
+{
+	int		forwardmove;
+	int		sidemove;
+	double	angle;		// degrees
+	bool	attack;
+};
+
+enum client_state_t
+{
+	CS_WAITING,			// not started yet
+	CS_CHALLENGING,		// asked for a connect token
+	CS_CONNECTING,		// sent the connect request
+	CS_CONNECTED,
+	CS_FAILED
+};
+
+struct client_t
+{
+	SOCKET					sock;
+	client_state_t			state;
+	const char				*failure;
+
+	double					start;			// when the handshake began
+	double					connected;		// when the first game packet came
+	double					last_sent;		// handshake packets
+	double					last_received;
+	int						challenges;
+	int						tries;			// connect requests for this token
+	int						joins;
+	DWORD					token;
+
+	int						tic;
+	size_t					cmd_offset;
+	std::vector<ticcmd_line_t>	recent;		// the last ten ticcmds
+
+	std::vector<byte>		acks;			// written with the next clc_move
+	int						ack_sequence;
+	DWORD					ack_bits;
+
+	int						first_sequence;
+	int						last_sequence;
+	int						received;		// different sequences
+	int						duplicates;
+	std::vector<bool>		seen;
+
+	double					bytes_in;
+	double					bytes_out;
+	double					last_packet;
+	double					tic_start;		// first packet of the tic
+	std::vector<float>		gaps;			// milliseconds between tics
+};
+
+static unsigned int rng;
+
+static unsigned int Random()
+{
+	rng = rng * 1103515245 + 12345;
+	return (rng >> 16) & 0x7FFF;
+}
+
+static double Now()
+{
+#ifdef WIN32
+	return GetTickCount() / 1000.0;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+static void WriteByte(std::vector<byte> &buf, int b)
+{
+	buf.push_back(b & 0xFF);
+}
+
+static void WriteShort(std::vector<byte> &buf, int s)
+{
+	buf.push_back(s & 0xFF);
+	buf.push_back((s >> 8) & 0xFF);
+}
+
+static void WriteLong(std::vector<byte> &buf, int l)
+{
+	buf.push_back(l & 0xFF);
+	buf.push_back((l >> 8) & 0xFF);
+	buf.push_back((l >> 16) & 0xFF);
+	buf.push_back((l >> 24) & 0xFF);
+}
+
+static void WriteString(std::vector<byte> &buf, const char *s)
+{
+	buf.insert(buf.end(), s, s + strlen(s) + 1);
+}
+
+static int ReadLong(const byte *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+}
+
+//
+// ReadTiccmds
+//
+static bool ReadTiccmds(const char *filename, std::vector<ticcmd_line_t> &cmds)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+	{
+		fprintf(stderr, "can't open %s\n", filename);
+		return false;
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+
+		ticcmd_line_t cmd;
+		int attack = 0;
+		if (sscanf(line, "%d %d %lf %d", &cmd.forwardmove, &cmd.sidemove, &cmd.angle, &attack) < 3)
+		{
+			fprintf(stderr, "%s: bad line: %s", filename, line);
+			fclose(f);
+			return false;
+		}
+
+		cmd.attack = attack != 0;
+		cmds.push_back(cmd);
+	}
+
+	fclose(f);
+
+	if (cmds.empty())
+	{
+		fprintf(stderr, "%s has no ticcmds\n", filename);
+		return false;
+	}
+
+	return true;
+}
+
+//
+// MakeTiccmds
+//
+// Running about at full speed, changing direction every so often, turning
+// and holding down fire now and then.
+//
+static void MakeTiccmds(std::vector<ticcmd_line_t> &cmds, int tics, bool fire)
+{
+	int forward = 0x32 << 8, side = 0x28 << 8;
+	double angle = 0.0, turn = 0.0;
+	int left = 0, firing = 0;
+
+	for (int i = 0; i < tics; i++)
+	{
+		if (left-- <= 0)
+		{
+			forward = (int(Random() % 3) - 1) * (0x32 << 8);
+			side = (int(Random() % 3) - 1) * (0x28 << 8);
+			turn = (int(Random() % 11) - 5) * 1.5;
+			left = 8 + Random() % 48;
+		}
+
+		if (fire && firing-- <= 0 && Random() % 64 == 0)
+			firing = 10 + Random() % 60;
+
+		angle = fmod(angle + turn + 360.0, 360.0);
+
+		ticcmd_line_t cmd;
+		cmd.forwardmove = forward;
+		cmd.sidemove = side;
+		cmd.angle = angle;
+		cmd.attack = firing > 0;
+		cmds.push_back(cmd);
+	}
+}
+
+//
+// SendPacket
+//
+static void SendPacket(client_t &cl, const std::vector<byte> &buf, const sockaddr_in &to)
+{
+	int sent = sendto(cl.sock, (const char *)&buf[0], buf.size(), 0,
+					  (const sockaddr *)&to, sizeof(to));
+
+	if (sent > 0)
+		cl.bytes_out += sent;
+}
+
+//
+// SendChallenge
+//
+// What a launcher asks for, the answer has the token to connect with.
+//
+static void SendChallenge(client_t &cl, const sockaddr_in &server, double now)
+{
+	std::vector<byte> buf;
+	WriteLong(buf, LAUNCHER_CHALLENGE);
+	SendPacket(cl, buf, server);
+
+	cl.last_sent = now;
+}
+
+//
+// SendConnect
+//
+// Same as CL_TryToConnect and CL_SendUserInfo.
+//
+static void SendConnect(client_t &cl, int id, const sockaddr_in &server, double now,
+						int updaterate, int rate, int netcaps)
+{
+	std::vector<byte> buf;
+	char name[MAXPLAYERNAME + 1];
+
+	snprintf(name, sizeof(name), "loadtest%d", id);
+
+	WriteLong(buf, CHALLENGE);
+	WriteLong(buf, cl.token);
+	WriteShort(buf, VERSION);
+	WriteByte(buf, 0);						// play, not download
+	WriteLong(buf, GAMEVER);
+
+	WriteByte(buf, clc_userinfo);
+	WriteString(buf, name);
+	WriteByte(buf, TEAM_NONE);
+	WriteLong(buf, GENDER_MALE);
+	for (int i = 3; i >= 0; i--)
+		WriteByte(buf, i ? (id * 40 * i) & 0xFF : 0);
+	WriteString(buf, "");					// skin
+	WriteLong(buf, 0);						// aimdist
+	WriteByte(buf, 1);						// unlag
+	WriteByte(buf, 1);						// predict weapons
+	WriteByte(buf, updaterate);
+	WriteByte(buf, WPSW_ALWAYS);
+	for (int i = 0; i < NUMWEAPONS; i++)
+		WriteByte(buf, i);
+
+	WriteLong(buf, rate);
+	WriteString(buf, "");					// password hash
+	WriteLong(buf, netcaps);
+
+	SendPacket(cl, buf, server);
+
+	cl.last_sent = now;
+}
+
+//
+// ReceivedSequence
+//
+// Same as CL_ReadPacketHeader.
+//
+static void ReceivedSequence(client_t &cl, int sequence, int netcaps)
+{
+	if (cl.first_sequence < 0)
+		cl.first_sequence = sequence;
+
+	int index = sequence - cl.first_sequence;
+	if (index >= 0)
+	{
+		if ((size_t)index >= cl.seen.size())
+			cl.seen.resize(index + 1024);
+
+		if (cl.seen[index])
+			cl.duplicates++;
+		else
+			cl.received++;
+
+		cl.seen[index] = true;
+	}
+
+	cl.last_sequence = std::max(cl.last_sequence, sequence);
+
+	int delta = sequence - cl.ack_sequence;
+
+	if (cl.ack_sequence < 0)
+	{
+		cl.ack_sequence = sequence;
+		cl.ack_bits = 0;
+	}
+	else if (delta > 0)
+	{
+		cl.ack_bits = delta < 32 ? cl.ack_bits << delta : 0;
+		if (delta <= 32)
+			cl.ack_bits |= 1u << (delta - 1);
+
+		cl.ack_sequence = sequence;
+	}
+	else if (delta < 0 && delta >= -32)
+	{
+		cl.ack_bits |= 1u << (-delta - 1);
+	}
+
+	if (!(netcaps & NETCAP_RELIABLE))
+	{
+		WriteByte(cl.acks, clc_ack);
+		WriteLong(cl.acks, sequence);
+	}
+}
+
+//
+// ReadPackets
+//
+static void ReadPackets(client_t &cl, const sockaddr_in &server, double now,
+						int updaterate, int rate, int netcaps, int id)
+{
+	byte data[MAX_UDP_PACKET * 4];
+	sockaddr_in from;
+
+	while (true)
+	{
+		socklen_t fromlen = sizeof(from);
+		int len = recvfrom(cl.sock, (char *)data, sizeof(data), 0, (sockaddr *)&from, &fromlen);
+
+		if (len <= 0)
+			return;
+
+		if (from.sin_addr.s_addr != server.sin_addr.s_addr || from.sin_port != server.sin_port)
+			continue;
+
+		if (len < 4 || cl.state == CS_FAILED)
+			continue;
+
+		cl.last_received = now;
+
+		int sequence = ReadLong(data);
+
+		if (cl.state == CS_CHALLENGING)
+		{
+			// the launcher answer, CL_PrepareConnect
+			if (sequence != CHALLENGE || len < 8)
+				continue;
+
+			cl.token = ReadLong(data + 4);
+			cl.state = CS_CONNECTING;
+			cl.tries = 1;
+
+			SendConnect(cl, id, server, now, updaterate, rate, netcaps);
+			continue;
+		}
+
+		if (cl.state == CS_CONNECTING)
+		{
+			// a late answer to a repeated challenge
+			if (sequence == CHALLENGE)
+				continue;
+
+			if (sequence == 0 && len > 4 && data[4] == svc_full)
+			{
+				cl.state = CS_FAILED;
+				cl.failure = "server full";
+				continue;
+			}
+
+			cl.state = CS_CONNECTED;
+			cl.connected = now;
+			cl.tic_start = now;
+			cl.joins = 0;
+			cl.last_sent = 0.0;
+
+			// same as CL_Connect
+			WriteByte(cl.acks, clc_ack);
+			WriteLong(cl.acks, 0);
+		}
+		else if (now - cl.last_packet >= SAME_TIC)
+		{
+			cl.gaps.push_back(float((now - cl.tic_start) * 1000.0));
+			cl.tic_start = now;
+		}
+
+		cl.last_packet = now;
+		cl.bytes_in += len;
+
+		ReceivedSequence(cl, sequence, netcaps);
+	}
+}
+
+//
+// SendMove
+//
+// Same as CL_SendCmd, with the acks and a request to join the game in
+// front while it's needed.
+//
+static void SendMove(client_t &cl, const sockaddr_in &server, double now,
+					 const std::vector<ticcmd_line_t> &cmds, int netcaps)
+{
+	cl.recent.erase(cl.recent.begin());
+	cl.recent.push_back(cmds[(cl.cmd_offset + cl.tic) % cmds.size()]);
+	cl.tic++;
+
+	std::vector<byte> buf(cl.acks);
+	cl.acks.clear();
+
+	if (netcaps & NETCAP_RELIABLE && cl.ack_sequence >= 0)
+	{
+		WriteByte(buf, clc_ackbits);
+		WriteLong(buf, cl.ack_sequence);
+		WriteLong(buf, cl.ack_bits);
+	}
+
+	if (cl.joins < JOIN_TRIES && now - cl.last_sent >= JOIN_RETRY)
+	{
+		WriteByte(buf, clc_spectate);
+		WriteByte(buf, 0);
+
+		cl.joins++;
+		cl.last_sent = now;
+	}
+
+	WriteByte(buf, clc_move);
+	WriteLong(buf, cl.tic);
+
+	for (int i = 0; i < 10; i++)
+	{
+		const ticcmd_line_t &cmd = cl.recent[i];
+
+		int fields = CMD_ANGLE | CMD_FORWARD | CMD_SIDE;
+		if (cmd.attack)
+			fields |= CMD_BUTTONS;
+
+		WriteByte(buf, fields);
+		WriteLong(buf, cl.tic - 9 + i);		// world index
+		if (cmd.attack)
+			WriteByte(buf, BT_ATTACK);
+		WriteShort(buf, int(cmd.angle * 65536.0 / 360.0));
+		WriteShort(buf, cmd.forwardmove);
+		WriteShort(buf, cmd.sidemove);
+	}
+
+	SendPacket(cl, buf, server);
+}
+
+//
+// SendDisconnect
+//
+static void SendDisconnect(client_t &cl, const sockaddr_in &server)
+{
+	std::vector<byte> buf;
+	WriteByte(buf, clc_disconnect);
+	SendPacket(cl, buf, server);
+}
+
+//
+// Percentile
+//
+static double Percentile(std::vector<float> &values, double pct)
+{
+	if (values.empty())
+		return 0.0;
+
+	std::vector<float>::iterator nth = values.begin() + size_t((values.size() - 1) * pct);
+	std::nth_element(values.begin(), nth, values.end());
+	return *nth;
+}
+
+//
+// OpenSocket
+//
+static SOCKET OpenSocket()
+{
+	SOCKET s = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s == INVALID_SOCKET)
+		return s;
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = INADDR_ANY;
+	address.sin_port = 0;
+
+	if (bind(s, (sockaddr *)&address, sizeof(address)) != 0)
+	{
+		closesocket(s);
+		return INVALID_SOCKET;
+	}
+
+	// big enough for a few tics of packets while the others are served
+	int size = 256 * 1024;
+	setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+
+#ifdef WIN32
+	u_long nonblocking = 1;
+	ioctlsocket(s, FIONBIO, &nonblocking);
+#else
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	return s;
+}
+
+//
+// ResolveServer
+//
+static bool ResolveServer(const char *name, sockaddr_in &server)
+{
+	std::string host(name);
+	int port = 10666;
+
+	size_t colon = host.find(':');
+	if (colon != std::string::npos)
+	{
+		port = atoi(host.c_str() + colon + 1);
+		host.erase(colon);
+	}
+
+	hostent *h = gethostbyname(host.c_str());
+	if (!h)
+		return false;
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	memcpy(&server.sin_addr, h->h_addr_list[0], sizeof(server.sin_addr));
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int numclients = 16;
+	double duration = 60.0;
+	double connectrate = 10.0;		// clients per second
+	int updaterate = 1;
+	int rate = 200;
+	int netcaps = NETCAP_SUPPORTED;
+	bool fire = true;
+	const char *ticcmdfile = NULL;
+	const char *servername = "127.0.0.1:10666";
+
+	rng = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-clients") && i + 1 < argc)
+			numclients = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-time") && i + 1 < argc)
+			duration = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-connectrate") && i + 1 < argc)
+			connectrate = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-updaterate") && i + 1 < argc)
+			updaterate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-rate") && i + 1 < argc)
+			rate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-netcaps") && i + 1 < argc)
+			netcaps = strtol(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "-nofire"))
+			fire = false;
+		else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+			rng = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-ticcmds") && i + 1 < argc)
+			ticcmdfile = argv[++i];
+		else if (argv[i][0] != '-')
+			servername = argv[i];
+		else
+		{
+			fprintf(stderr, "usage: %s [-clients n] [-time secs] [-connectrate n] "
+					"[-updaterate tics] [-rate kbps] [-netcaps n] [-nofire] [-seed n] "
+					"[-ticcmds file] [host[:port]]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (numclients < 1 || numclients > MAXPLAYERS || duration <= 0.0 || connectrate <= 0.0 ||
+		updaterate < 1 || updaterate > 3)
+	{
+		fprintf(stderr, "-clients has to be 1-%d, -updaterate 1-3, -time and -connectrate "
+				"above 0\n", MAXPLAYERS);
+		return 1;
+	}
+
+#ifdef WIN32
+	WSADATA wsad;
+	WSAStartup(MAKEWORD(1, 1), &wsad);
+#endif
+
+	sockaddr_in server;
+	if (!ResolveServer(servername, server))
+	{
+		fprintf(stderr, "can't resolve %s\n", servername);
+		return 1;
+	}
+
+	std::vector<ticcmd_line_t> cmds;
+	if (ticcmdfile)
+	{
+		if (!ReadTiccmds(ticcmdfile, cmds))
+			return 1;
+	}
+	else
+		MakeTiccmds(cmds, 60 * TICRATE, fire);
+
+	std::vector<client_t> clients(numclients);
+
+	for (int i = 0; i < numclients; i++)
+	{
+		client_t &cl = clients[i];
+
+		cl.sock = OpenSocket();
+		if (cl.sock == INVALID_SOCKET)
+		{
+			fprintf(stderr, "can't open a socket for client %d\n", i + 1);
+			return 1;
+		}
+
+		cl.state = CS_WAITING;
+		cl.failure = NULL;
+		cl.start = cl.connected = cl.last_sent = cl.last_received = 0.0;
+		cl.challenges = cl.tries = cl.joins = 0;
+		cl.token = 0;
+		cl.tic = 100;
+		cl.cmd_offset = Random() * 7919 % cmds.size();
+		cl.recent.resize(10, cmds[cl.cmd_offset]);
+		cl.ack_sequence = -1;
+		cl.ack_bits = 0;
+		cl.first_sequence = cl.last_sequence = -1;
+		cl.received = cl.duplicates = 0;
+		cl.bytes_in = cl.bytes_out = 0.0;
+		cl.last_packet = cl.tic_start = 0.0;
+	}
+
+	printf("%d clients to %s for %.0f seconds\n", numclients, servername, duration);
+
+	double begin = Now();
+	double next_tic = begin;
+	double next_report = begin + 10.0;
+	double end = begin + numclients / connectrate + duration;
+
+	while (true)
+	{
+		double now = Now();
+		if (now >= end)
+			break;
+
+		for (int i = 0; i < numclients; i++)
+		{
+			client_t &cl = clients[i];
+
+			if (cl.state == CS_WAITING && now - begin >= i / connectrate)
+			{
+				cl.state = CS_CHALLENGING;
+				cl.start = now;
+				cl.last_received = now;
+				cl.challenges = 1;
+				SendChallenge(cl, server, now);
+			}
+
+			ReadPackets(cl, server, now, updaterate, rate, netcaps, i + 1);
+
+			if ((cl.state == CS_CHALLENGING || cl.state == CS_CONNECTING) &&
+				now - cl.last_sent >= CONNECT_RETRY)
+			{
+				// like the client, ask for a new token
+				if (cl.state == CS_CONNECTING && cl.tries >= CONNECT_TRIES)
+					cl.state = CS_CHALLENGING;
+
+				if (cl.state == CS_CONNECTING)
+				{
+					cl.tries++;
+					SendConnect(cl, i + 1, server, now, updaterate, rate, netcaps);
+				}
+				else if (cl.challenges++ < CHALLENGE_TRIES)
+					SendChallenge(cl, server, now);
+				else
+				{
+					cl.failure = cl.tries ? "not let in" : "no answer";
+					cl.state = CS_FAILED;
+				}
+			}
+
+			if (cl.state == CS_CONNECTED && now - cl.last_received >= CLIENT_TIMEOUT)
+			{
+				cl.state = CS_FAILED;
+				cl.failure = "timed out";
+			}
+		}
+
+		if (now >= next_tic)
+		{
+			for (int i = 0; i < numclients; i++)
+				if (clients[i].state == CS_CONNECTED)
+					SendMove(clients[i], server, now, cmds, netcaps);
+
+			next_tic += 1.0 / TICRATE;
+			if (next_tic < now)
+				next_tic = now;
+		}
+
+		if (now >= next_report)
+		{
+			int connected = 0;
+			double in = 0.0;
+			for (int i = 0; i < numclients; i++)
+			{
+				connected += clients[i].state == CS_CONNECTED;
+				in += clients[i].bytes_in;
+			}
+
+			printf("%5.0fs: %d connected, %.1f KB/s in\n", now - begin, connected,
+				   in / 1024.0 / (now - begin));
+			fflush(stdout);
+
+			next_report += 10.0;
+		}
+
+		usleep(500);
+	}
+
+	double finish = Now();
+
+	for (int i = 0; i < numclients; i++)
+	{
+		if (clients[i].state == CS_CONNECTED)
+			SendDisconnect(clients[i], server);
+		closesocket(clients[i].sock);
+	}
+
+	// per client
+	printf("\nclient  state      connect    KB/s in  KB/s out  pkts/s    loss\n");
+
+	std::vector<float> gaps;
+	int connected = 0;
+	double total_in = 0.0, total_out = 0.0, total_lost = 0.0, total_expected = 0.0;
+
+	for (int i = 0; i < numclients; i++)
+	{
+		client_t &cl = clients[i];
+
+		if (!cl.connected)
+		{
+			// still going through the handshake when time ran out
+			const char *why = cl.failure;
+			if (!why)
+				why = cl.state == CS_WAITING ? "never started" :
+					  cl.state == CS_CHALLENGING ? "no answer yet" : "not let in yet";
+
+			printf("%6d  %s\n", i + 1, why);
+			continue;
+		}
+
+		connected++;
+
+		double secs = std::max(finish - cl.connected, 0.001);
+		int expected = cl.last_sequence - cl.first_sequence + 1;
+		double loss = expected > 0 ? 100.0 * (expected - cl.received) / expected : 0.0;
+
+		printf("%6d  %-9s %6.0fms  %8.2f  %8.2f  %6.1f  %5.2f%%\n", i + 1,
+			   cl.state == CS_CONNECTED ? "playing" : cl.failure,
+			   (cl.connected - cl.start) * 1000.0, cl.bytes_in / 1024.0 / secs,
+			   cl.bytes_out / 1024.0 / secs, cl.received / secs, loss);
+
+		total_in += cl.bytes_in / secs;
+		total_out += cl.bytes_out / secs;
+		total_lost += expected - cl.received;
+		total_expected += expected;
+		gaps.insert(gaps.end(), cl.gaps.begin(), cl.gaps.end());
+	}
+
+	printf("\n%d of %d clients connected\n", connected, numclients);
+
+	if (!connected)
+		return 1;
+
+	double avg = 0.0;
+	for (size_t i = 0; i < gaps.size(); i++)
+		avg += gaps[i];
+	avg = gaps.empty() ? 0.0 : avg / gaps.size();
+
+	printf("per client:  %.2f KB/s in, %.2f KB/s out on average\n",
+		   total_in / 1024.0 / connected, total_out / 1024.0 / connected);
+	printf("all clients: %.2f KB/s in, %.2f KB/s out\n", total_in / 1024.0, total_out / 1024.0);
+	printf("packet loss: %.2f%%\n", total_expected ? 100.0 * total_lost / total_expected : 0.0);
+	printf("between tics: %.2fms avg, %.2fms p99, %.2fms max (%.2fms at full speed)\n",
+		   avg, Percentile(gaps, 0.99), Percentile(gaps, 1.0), 1000.0 / TICRATE);
+
+	return 0;
+}
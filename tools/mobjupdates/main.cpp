@@ -0,0 +1,213 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Times writing the periodic monster updates for a synthetic level:
+//
+//	  mobjupdates [-monsters n] [-clients n] [-tics n]
+//
+//	Both the way it used to be done (picked and serialized separately for
+//	every client) and from the shared per-tic frame, with the server's own
+//	sv_mobjupdate.cpp.  Each client knows about half of the monsters; half
+//	of the clients take the packed messages.  Only the serialization is
+//	timed, not the bandwidth scheduler.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#ifdef UNIX
+#include <sys/time.h>
+#endif
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#include "sv_mobjupdate.h"
+#include "version.h"
+
+// sv_mobjupdate.cpp and i_bitpack.cpp register themselves with the version
+// command
+file_version::file_version(const char *uid, const char *id, const char *p, int l,
+						   const char *t, const char *d) {}
+
+// buf_t reports overflows through the console
+int STACK_ARGS Printf(int printlevel, const char *format, ...) { return 0; }
+
+// the message writers from i_net.cpp, without the rest of the network code
+void MSG_WriteMarker(buf_t *b, svc_t c) { b->WriteByte((byte)c); }
+void MSG_WriteByte(buf_t *b, byte c) { b->WriteByte(c); }
+void MSG_WriteShort(buf_t *b, short c) { b->WriteShort(c); }
+void MSG_WriteLong(buf_t *b, int c) { b->WriteLong(c); }
+void MSG_WriteChunk(buf_t *b, const void *p, unsigned l) { b->WriteChunk((const char *)p, l); }
+void SZ_Write(buf_t *b, const void *data, int length) { b->WriteChunk((const char *)data, length); }
+
+static double Now()
+{
+#ifdef WIN32
+	return GetTickCount() * 1000.0;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000.0 + tv.tv_usec;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	int nummonsters = 1000;
+	int numclients = 32;
+	int numtics = 35 * 10;
+	bool usage = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-monsters") && i + 1 < argc)
+			nummonsters = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-clients") && i + 1 < argc)
+			numclients = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-tics") && i + 1 < argc)
+			numtics = atoi(argv[++i]);
+		else
+			usage = true;
+	}
+
+	if (usage || nummonsters <= 0 || numtics <= 0 || numclients <= 0 || numclients > MAXPLAYERS)
+	{
+		fprintf(stderr, "usage: %s [-monsters n] [-clients (1-%d)] [-tics n]\n",
+				argv[0], MAXPLAYERS);
+		return 2;
+	}
+
+	DWORD seed = 0x1d872b41;
+
+	MobjUpdates monsters(nummonsters);
+	std::vector<PlayerBitField> aware(nummonsters);
+
+	for (int i = 0; i < nummonsters; i++)
+	{
+		mobj_update_t &u = monsters[i];
+		memset(&u, 0, sizeof(u));
+
+		u.aware = &aware[i];
+		u.netid = i + 1;
+
+		seed = seed * 1664525 + 1013904223;
+		u.rndindex = seed >> 24;
+		u.x = (fixed_t)(seed & 0x0fffffff) - 0x08000000;
+		seed = seed * 1664525 + 1013904223;
+		u.y = (fixed_t)(seed & 0x0fffffff) - 0x08000000;
+		u.angle = seed << 8;
+		seed = seed * 1664525 + 1013904223;
+		u.momx = (fixed_t)(seed & 0x7ffff) - 0x40000;
+		u.momy = (fixed_t)((seed >> 12) & 0x7ffff) - 0x40000;
+		u.target = (seed >> 20) % nummonsters + 1;
+		u.movedir = seed % 8;
+		u.movecount = seed % 16;
+
+		for (int c = 0; c < numclients; c++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			if (seed & 0x80000000)
+				aware[i].set(c + 1);
+		}
+	}
+
+	buf_t scratch(MAX_UDP_PACKET * 8);
+	unsigned long long oldbytes = 0, newbytes = 0;
+
+	// every client picks and serializes its own
+	double start = Now();
+
+	for (int tic = 0; tic < numtics; tic++)
+	{
+		for (int c = 1; c <= numclients; c++)
+		{
+			scratch.clear();
+
+			for (int i = 0; i < nummonsters; i++)
+			{
+				const mobj_update_t &u = monsters[i];
+
+				if (!SV_MonsterUpdateDue(u.netid, tic) || !u.aware->get(c))
+					continue;
+
+				SV_SerializeMobjUpdate(&scratch, u, c & 1);
+			}
+
+			oldbytes += scratch.size();
+		}
+	}
+
+	double oldtime = Now() - start;
+
+	// picked and serialized once, copied for every client
+	MobjUpdates missile_updates, monster_updates;
+	buf_t frame(MAX_UDP_PACKET * 4);
+
+	start = Now();
+
+	for (int tic = 0; tic < numtics; tic++)
+	{
+		monster_updates.clear();
+
+		for (int i = 0; i < nummonsters; i++)
+			if (SV_MonsterUpdateDue(monsters[i].netid, tic))
+				monster_updates.push_back(monsters[i]);
+
+		SV_SerializeMobjFrame(frame, missile_updates, monster_updates);
+
+		for (int c = 1; c <= numclients; c++)
+		{
+			scratch.clear();
+
+			for (size_t i = 0; i < monster_updates.size(); i++)
+			{
+				const mobj_update_t &u = monster_updates[i];
+
+				if (!u.aware->get(c))
+					continue;
+
+				if (c & 1)
+					MSG_WriteChunk(&scratch, frame.ptr() + u.packed_offset, u.packed_size);
+				else
+					MSG_WriteChunk(&scratch, frame.ptr() + u.plain_offset, u.plain_size);
+			}
+
+			newbytes += scratch.size();
+		}
+	}
+
+	double newtime = Now() - start;
+
+	printf("%d monsters, %d clients, %d tics:\n", nummonsters, numclients, numtics);
+	printf("  per client: %.1f us per tic, %llu bytes\n", oldtime / numtics, oldbytes);
+	printf("  shared:     %.1f us per tic, %llu bytes\n", newtime / numtics, newbytes);
+
+	// the same messages either way
+	if (oldbytes != newbytes)
+	{
+		printf("mobjupdates: shared frame wrote a different number of bytes\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Times handing out and releasing netids with the old queue and the
+//	server's NetIDHandler, and looking actors up by netid in a std::map and
+//	in a table like the one P_FindThingById uses.  Also shows how soon a
+//	released netid comes back:
+//
+//	  netids [-live n] [-ops n]
+//
+//	It is linked with the server's own objects (see the Makefile), so the
+//	bitmap is the one odasrv uses.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <queue>
+#include <vector>
+
+#include "actor.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "p_mobj.h"
+
+// i_main.cpp isn't linked, this is what the rest of the server needs of it
+DArgs Args;
+
+void addterm(void (STACK_ARGS *func)(), const char *name) {}
+void STACK_ARGS call_terms() {}
+int PrintString(int printlevel, char const *str) { return 0; }
+void daemon_init() {}
+void instances_init(int count) {}
+
+//
+// OldNetIDHandler
+//
+// The std::queue allocator NetIDHandler replaced.
+//
+class OldNetIDHandler
+{
+	size_t NumAllocated;
+	std::queue<int> free_ids;
+
+public:
+	OldNetIDHandler() : NumAllocated(0) {}
+
+	int ObtainNetID()
+	{
+		if (free_ids.empty())
+		{
+			size_t OldAllocated = NumAllocated;
+			NumAllocated = MIN(NumAllocated + 512, (size_t)MAX_NETID - 1);
+
+			for (size_t i = OldAllocated + 1; i <= NumAllocated; i++)
+				free_ids.push(i);
+		}
+
+		int netid = free_ids.front();
+		free_ids.pop();
+		return netid;
+	}
+
+	void ReleaseNetID(int NetID)
+	{
+		free_ids.push(NetID);
+	}
+};
+
+//
+// BenchChurn
+//
+// Keeps 'live' netids allocated and replaces a random one 'ops' times.
+// Returns the time taken and the fewest allocations seen between a netid
+// being released and handed out again.
+//
+template <class Handler>
+static dtime_t BenchChurn(Handler &handler, int live, int ops, int &mindistance)
+{
+	std::vector<int> ids(live);
+	std::vector<int> released_at(MAX_NETID + 1, -1);
+
+	DWORD seed = 0x5bd1e995;
+	mindistance = MAX_NETID;
+
+	dtime_t start = I_GetTime();
+
+	for (int i = 0; i < live; i++)
+		ids[i] = handler.ObtainNetID();
+
+	for (int i = 0; i < ops; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		int &slot = ids[(seed >> 8) % live];
+
+		handler.ReleaseNetID(slot);
+		released_at[slot] = i;
+
+		slot = handler.ObtainNetID();
+		if (released_at[slot] >= 0)
+			mindistance = MIN(mindistance, i - released_at[slot]);
+	}
+
+	return I_GetTime() - start;
+}
+
+int main(int argc, char **argv)
+{
+	int live = 4000;
+	int ops = 1000000;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-live") && i + 1 < argc)
+			live = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-ops") && i + 1 < argc)
+			ops = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-live n] [-ops n]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (live <= 0 || live >= MAX_NETID - 1 || ops <= 0)
+	{
+		fprintf(stderr, "-live needs to be 1-%d and -ops at least 1\n", MAX_NETID - 2);
+		return 1;
+	}
+
+	OldNetIDHandler oldhandler;
+	NetIDHandler newhandler;
+	int olddistance, newdistance;
+
+	dtime_t oldtime = BenchChurn(oldhandler, live, ops, olddistance);
+	dtime_t newtime = BenchChurn(newhandler, live, ops, newdistance);
+
+	// lookups of live netids, what the client does for every actor message
+	std::map<size_t, int> bymap;
+	std::vector<int> bytable(MAX_NETID + 1, 0);
+
+	for (int i = 1; i <= live; i++)
+	{
+		bymap[i] = i;
+		bytable[i] = i;
+	}
+
+	DWORD seed = 0x2545f491;
+	QWORD found = 0;
+
+	dtime_t start = I_GetTime();
+	for (int i = 0; i < ops; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		std::map<size_t, int>::iterator it = bymap.find((seed >> 8) % live + 1);
+		if (it != bymap.end())
+			found += it->second;
+	}
+	dtime_t maptime = I_GetTime() - start;
+
+	start = I_GetTime();
+	for (int i = 0; i < ops; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		size_t id = (seed >> 8) % live + 1;
+		if (id <= MAX_NETID)
+			found += bytable[id];
+	}
+	dtime_t tabletime = I_GetTime() - start;
+
+	printf("%d live netids, %d operations:\n", live, ops);
+	printf("  queue:  %.1f ns per release and obtain, reused after %d\n",
+		   (double)oldtime / ops, olddistance);
+	printf("  bitmap: %.1f ns per release and obtain, reused after %d\n",
+		   (double)newtime / ops, newdistance);
+	printf("  lookup: %.1f ns with a map, %.1f ns with the table (%llu)\n",
+		   (double)maptime / ops, (double)tabletime / ops, (unsigned long long)found);
+
+	// what i_main has run at exit, so Args goes without the object list
+	DObject::StaticShutdown();
+
+	return 0;
+}
@@ -0,0 +1,334 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Counts the bytes copied while assembling game packets, on the way
+//	SV_SendPacket used to build them (reliablebuf to relpackets, both
+//	messages into one send buffer, a copy of that for the compressor and
+//	the compressed result copied back) and on the segment path odasrv
+//	uses now, for the same reliable and unreliable messages:
+//
+//	  packetcopy [-packets n] [-updates n] [-seed n]
+//
+//	'-updates' is the number of svc_movemobj messages in each packet.
+//	The segment path is the server's own SV_SendPacket, linked from its
+//	objects (see the Makefile), read back through SV_GetPacketCopyStats.
+//	Packets aren't actually sent; neither path copies on the way to the
+//	socket on this platform, and with the segments gathered for sendto on
+//	others it would be one more copy of what is sent.
+//
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "actor.h"
+#include "d_player.h"
+#include "doomstat.h"
+#include "i_net.h"
+#include "m_argv.h"
+#include "minilzo.h"
+#include "sv_main.h"
+
+// i_main.cpp isn't linked, this is what the rest of the server needs of it
+DArgs Args;
+
+void addterm(void (STACK_ARGS *func)(), const char *name) {}
+void STACK_ARGS call_terms() {}
+int PrintString(int printlevel, char const *str) { return 0; }
+void daemon_init() {}
+void instances_init(int count) {}
+
+extern bool simulated_connection;
+
+typedef std::vector<byte> Message;
+
+struct packet_t
+{
+	Message reliable;
+	Message unreliable;
+};
+
+struct copy_count_t
+{
+	QWORD packets;
+	QWORD sent;
+	QWORD copied;
+
+	copy_count_t() : packets(0), sent(0), copied(0) {}
+};
+
+// what the old MSG_CompressMinilzo bothered with, sequence included
+static const size_t MINILZO_COMPRESS_MINPACKETSIZE = 0xFF;
+
+#define OUT_LEN(a)	((a) + (a) / 16 + 64 + 3)
+
+static void WriteLong(Message &msg, int value)
+{
+	for (int i = 0; i < 4; i++)
+		msg.push_back((value >> (i * 8)) & 0xff);
+}
+
+//
+// MakePackets
+//
+// Every packet gets 'updates' svc_movemobj messages for actors drifting
+// about a level; every fourth or so also a reliable svc_print.
+//
+static void MakePackets(std::vector<packet_t> &packets, int count, int updates)
+{
+	std::vector<int> x(updates), y(updates), z(updates);
+
+	for (int i = 0; i < updates; i++)
+	{
+		x[i] = (rand() % 4096 - 2048) << 16;
+		y[i] = (rand() % 4096 - 2048) << 16;
+		z[i] = (rand() % 64) << 16;
+	}
+
+	packets.resize(count);
+
+	for (int p = 0; p < count; p++)
+	{
+		packet_t &packet = packets[p];
+
+		if (rand() % 4 == 0)
+		{
+			char text[64];
+			int len = snprintf(text, sizeof(text), "Player %d got the shotgun!\n", rand() % 16);
+
+			packet.reliable.push_back(svc_print);
+			packet.reliable.push_back(PRINT_HIGH);
+			packet.reliable.insert(packet.reliable.end(), text, text + len + 1);
+		}
+
+		for (int i = 0; i < updates; i++)
+		{
+			x[i] += (rand() % 33 - 16) << 16;
+			y[i] += (rand() % 33 - 16) << 16;
+
+			packet.unreliable.push_back(svc_movemobj);
+			packet.unreliable.push_back((i + 1) & 0xff);
+			packet.unreliable.push_back((i + 1) >> 8);
+			packet.unreliable.push_back(rand() % 4);
+			WriteLong(packet.unreliable, x[i]);
+			WriteLong(packet.unreliable, y[i]);
+			WriteLong(packet.unreliable, z[i]);
+		}
+	}
+}
+
+//
+// CopyOldPath
+//
+// SV_SendPacket and SV_CompressPacket as they were before the segment path,
+// with every copy of packet data counted.  The rate check never held the
+// unreliable message back for these clients.
+//
+static void CopyOldPath(const std::vector<packet_t> &packets, copy_count_t &count)
+{
+	static lzo_byte wrkmem[LZO1X_1_MEM_COMPRESS];
+
+	buf_t relpackets(MAX_UDP_PACKET * 50);
+	buf_t sendd(MAX_UDP_PACKET);
+	buf_t plain(MAX_UDP_PACKET);
+	buf_t compressed(OUT_LEN(MAX_UDP_PACKET) + sizeof(int) + 2);
+
+	int sequence = 0;
+
+	for (size_t p = 0; p < packets.size(); p++)
+	{
+		const Message &reliable = packets[p].reliable;
+		const Message &unreliable = packets[p].unreliable;
+
+		// [SL] 2012-05-04 - Don't send empty packets - they still have overhead
+		if (reliable.empty() && unreliable.empty())
+			continue;
+
+		sendd.clear();
+
+		// save the reliable message
+		if (relpackets.cursize + reliable.size() >= relpackets.maxsize())
+			relpackets.cursize = 0;
+
+		if (!reliable.empty())
+		{
+			SZ_Write(&relpackets, &reliable[0], reliable.size());
+			count.copied += reliable.size();
+		}
+
+		MSG_WriteLong(&sendd, sequence++);
+
+		if (!reliable.empty())
+		{
+			SZ_Write(&sendd, &reliable[0], reliable.size());
+			count.copied += reliable.size();
+		}
+
+		if (!unreliable.empty() && sendd.maxsize() - sendd.cursize > unreliable.size())
+		{
+			SZ_Write(&sendd, &unreliable[0], unreliable.size());
+			count.copied += unreliable.size();
+		}
+
+		if (sendd.size() > sizeof(int))
+		{
+			// the copy kept for the adaptive codec
+			plain.setcursize(sendd.size());
+			memcpy(plain.ptr(), sendd.ptr(), sendd.size());
+			count.copied += sendd.size();
+
+			// MSG_CompressMinilzo, with the svc_compressed gap
+			const size_t start = sizeof(int), gap = 2;
+
+			if (sendd.size() >= MINILZO_COMPRESS_MINPACKETSIZE)
+			{
+				lzo_uint outlen = OUT_LEN(sendd.maxsize() - start - gap);
+
+				int r = lzo1x_1_compress(sendd.ptr() + start, sendd.size() - start,
+				                         compressed.ptr() + start + gap, &outlen, wrkmem);
+
+				if (r == LZO_E_OK && outlen < sendd.size() - start - gap)
+				{
+					memcpy(compressed.ptr(), sendd.ptr(), start);
+					count.copied += start;
+
+					SZ_Clear(&sendd);
+					MSG_WriteChunk(&sendd, compressed.ptr(), outlen + start + gap);
+					count.copied += outlen + start + gap;
+
+					sendd.ptr()[start] = svc_compressed;
+					sendd.ptr()[start + 1] = minilzo_mask;
+				}
+			}
+		}
+
+		count.packets++;
+		count.sent += sendd.size();
+	}
+}
+
+//
+// CopySegmentPath
+//
+// Hands the same messages to the server's SV_SendPacket, one packet a tic.
+//
+static void CopySegmentPath(const std::vector<packet_t> &packets, copy_count_t &count)
+{
+	players.push_back(player_t());
+
+	player_t &player = players.back();
+	player.id = 1;
+	player.client.rate = 100000;	// nothing gets held back
+
+	const packet_copy_stats_t before = SV_GetPacketCopyStats();
+
+	// NET_SendSegments drops the packets, like it does for netdemos
+	simulated_connection = true;
+
+	for (size_t p = 0; p < packets.size(); p++)
+	{
+		const Message &reliable = packets[p].reliable;
+		const Message &unreliable = packets[p].unreliable;
+
+		gametic++;
+
+		if (!reliable.empty())
+			SZ_Write(&player.client.reliablebuf, &reliable[0], reliable.size());
+		if (!unreliable.empty())
+			SZ_Write(&player.client.netbuf, &unreliable[0], unreliable.size());
+
+		SV_SendPacket(player);
+	}
+
+	simulated_connection = false;
+
+	const packet_copy_stats_t &after = SV_GetPacketCopyStats();
+
+	count.packets = after.packets - before.packets;
+	count.sent = after.sent - before.sent;
+	count.copied = after.copied - before.copied;
+
+	players.clear();
+}
+
+//
+// PrintCount
+//
+static void PrintCount(const char *name, const copy_count_t &count)
+{
+	double packets = count.packets ? (double)count.packets : 1.0;
+
+	printf("%-10s %8llu packets, %7.1f bytes sent, %7.1f bytes copied per packet (%.2f per byte sent)\n",
+	       name, (unsigned long long)count.packets, count.sent / packets, count.copied / packets,
+	       count.sent ? (double)count.copied / count.sent : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	int numpackets = 100000;
+	int updates = 40;
+	unsigned int seed = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-packets") && i + 1 < argc)
+			numpackets = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-updates") && i + 1 < argc)
+			updates = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+			seed = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr, "usage: %s [-packets n] [-updates n] [-seed n]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// 15 bytes each, and the whole packet has to fit in netbuf
+	if (numpackets <= 0 || updates < 0 || updates > 500)
+	{
+		fprintf(stderr, "-packets needs to be at least 1 and -updates 0-500\n");
+		return 1;
+	}
+
+	if (lzo_init() != LZO_E_OK)
+	{
+		fprintf(stderr, "lzo_init failed\n");
+		return 1;
+	}
+
+	srand(seed);
+
+	std::vector<packet_t> packets;
+	MakePackets(packets, numpackets, updates);
+
+	copy_count_t oldcount, newcount;
+	CopyOldPath(packets, oldcount);
+	CopySegmentPath(packets, newcount);
+
+	PrintCount("old path", oldcount);
+	PrintCount("segments", newcount);
+
+	// what i_main has run at exit, so no DObject is left for the static
+	// destructors, Args among them
+	DObject::StaticShutdown();
+
+	return 0;
+}
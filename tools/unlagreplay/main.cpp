@@ -0,0 +1,481 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (C) 2006-2015 by The Odamex Team.
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// DESCRIPTION:
+//	Replays a target's ticcmds and checks how many shots fired at it by
+//	a lagged client register, rewinding the target to whole tics and to
+//	the client's render lerp:
+//
+//	  unlagreplay [-ping ms] [-fps n] [-firerate tics] [-maxunlagtime secs]
+//	              [-seed n] [-v] [ticcmds.txt]
+//
+//	The ticcmd file has one tic per line, "forwardmove sidemove angle" with
+//	the moves as in a NetCommand and the angle in degrees; lines starting
+//	with # are skipped.  Without one, a strafing target is made up from the
+//	seed.  The shooter fires every few tics at some point across the width
+//	of the target, as their screen shows it, so every shot should hit; the
+//	output is the same for the same input, so runs can be diffed.
+//
+//	It is linked with the server's own objects (see the Makefile): the
+//	target is moved by P_MovePlayer and P_XYMovement on a level made of a
+//	single open sector, its positions are recorded by Unlag, and every shot
+//	goes through Unlag::setRoundtripDelay, reconcile, getReconciliationOffset
+//	and restore as a hitscan attack does.  Hits are checked against a circle of the player's
+//	radius around where reconcile put the target, not the map, so the
+//	bounding box's corners don't come into it.
+//
+//-----------------------------------------------------------------------------
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "doomstat.h"
+#include "d_player.h"
+#include "m_argv.h"
+#include "p_local.h"
+#include "p_unlag.h"
+#include "r_state.h"
+#include "z_zone.h"
+
+EXTERN_CVAR(sv_maxunlagtime)
+
+void P_MovePlayer(player_t *player);
+void P_XYMovement(AActor *mo);
+
+// i_main.cpp isn't linked, this is what the rest of the server needs of it
+DArgs Args;
+
+void addterm(void (STACK_ARGS *func)(), const char *name) {}
+void STACK_ARGS call_terms() {}
+int PrintString(int printlevel, char const *str) { return 0; }
+void daemon_init() {}
+void instances_init(int count) {}
+
+// the shooter stands this far from where the target starts
+static const double SHOOTER_DISTANCE = 512.0;
+
+static const byte TARGET_ID = 1;
+static const byte SHOOTER_ID = 2;
+
+struct ticcmd_line_t
+{
+	int		forwardmove;
+	int		sidemove;
+	double	angle;		// degrees
+};
+
+struct shot_t
+{
+	int		tic;		// server gametic the shot is fired at
+	int		world;		// the client's world index
+	byte	behind;		// lerp the client sends, 1/256ths of a tic
+	double	aim_x;		// where the client saw the target
+	double	aim_y;
+};
+
+static unsigned int rng;
+
+static unsigned int Random()
+{
+	rng = rng * 1103515245 + 12345;
+	return (rng >> 16) & 0x7FFF;
+}
+
+static double ToDouble(fixed_t x)
+{
+	return x / double(FRACUNIT);
+}
+
+//
+// ReadTiccmds
+//
+static bool ReadTiccmds(const char *filename, std::vector<ticcmd_line_t> &cmds)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f)
+	{
+		fprintf(stderr, "can't open %s\n", filename);
+		return false;
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+
+		ticcmd_line_t cmd;
+		if (sscanf(line, "%d %d %lf", &cmd.forwardmove, &cmd.sidemove, &cmd.angle) != 3)
+		{
+			fprintf(stderr, "%s: bad line: %s", filename, line);
+			fclose(f);
+			return false;
+		}
+		cmds.push_back(cmd);
+	}
+
+	fclose(f);
+	return true;
+}
+
+//
+// MakeTiccmds
+//
+// A target running at full speed and switching between strafing left and
+// right every so often, like someone dodging.
+//
+static void MakeTiccmds(std::vector<ticcmd_line_t> &cmds, int tics)
+{
+	int side = 0x28 << 8;
+	int left = 0;
+
+	for (int i = 0; i < tics; i++)
+	{
+		if (left-- <= 0)
+		{
+			side = -side;
+			left = 8 + Random() % 24;
+		}
+
+		ticcmd_line_t cmd;
+		cmd.forwardmove = (Random() % 3 - 1) * (0x32 << 8);
+		cmd.sidemove = side;
+		cmd.angle = 180.0;		// facing the shooter
+		cmds.push_back(cmd);
+	}
+}
+
+//
+// SetupLevel
+//
+// One sector with no walls, which every point is in since there are no
+// nodes, and no blockmap.
+//
+static void SetupLevel()
+{
+	static sector_t sector;
+	static subsector_t subsector;
+
+	sector.floorheight = 0;
+	sector.ceilingheight = 256 * FRACUNIT;
+
+	sector.floorplane.a = sector.floorplane.b = 0;
+	sector.floorplane.c = sector.floorplane.invc = FRACUNIT;
+	sector.floorplane.d = -sector.floorheight;
+	sector.floorplane.sector = &sector;
+
+	sector.ceilingplane.a = sector.ceilingplane.b = 0;
+	sector.ceilingplane.c = sector.ceilingplane.invc = -FRACUNIT;
+	sector.ceilingplane.d = sector.ceilingheight;
+	sector.ceilingplane.sector = &sector;
+
+	subsector.sector = &sector;
+
+	sectors = &sector;
+	numsectors = 1;
+	subsectors = &subsector;
+	numsubsectors = 1;
+	nodes = NULL;
+	numnodes = 0;
+}
+
+//
+// SpawnPlayer
+//
+static player_t &SpawnPlayer(byte id, fixed_t x, fixed_t y, angle_t angle)
+{
+	players.push_back(player_t());
+
+	player_t &player = players.back();
+	player.id = id;
+	player.playerstate = PST_LIVE;
+	player.userinfo.unlag = true;
+
+	AActor *mo = new AActor(x, y, ONFLOORZ, MT_PLAYER);
+	mo->angle = angle;
+	mo->player = &player;
+	player.mo = mo->ptr();
+
+	return player;
+}
+
+//
+// DestroyPlayers
+//
+// Like SV_SendDisconnectSignal when the server quits.
+//
+static void DestroyPlayers()
+{
+	for (Players::iterator it = players.begin(); it != players.end(); ++it)
+	{
+		if (it->mo)
+			it->mo->Destroy();
+	}
+
+	players.clear();
+
+	// what i_main has run at exit, so no DObject is left for the static
+	// destructors, Args among them
+	DObject::StaticShutdown();
+}
+
+//
+// Hits
+//
+// Does a shot from (sx, sy) through (ax, ay) pass within the player's radius
+// of (tx, ty)?  Returns how far it passes in 'miss'.
+//
+static bool Hits(double sx, double sy, double ax, double ay,
+				 double tx, double ty, double radius, double &miss)
+{
+	double dx = ax - sx, dy = ay - sy;
+	double len = sqrt(dx * dx + dy * dy);
+
+	if (len == 0.0)
+	{
+		miss = 0.0;
+		return true;
+	}
+
+	dx /= len;
+	dy /= len;
+
+	double along = (tx - sx) * dx + (ty - sy) * dy;
+	miss = fabs((tx - sx) * dy - (ty - sy) * dx);
+
+	return along > 0.0 && miss <= radius;
+}
+
+//
+// Rewound
+//
+// Where Unlag moves the target for a shot from the shooter at 'angle', as the
+// server gets it at gametic: 'world' is the world index the client sends and
+// 'behind' its lerp.  Without 'lerp', the client is taken to not send one,
+// like one without NETCAP_RENDERLERP.  The position is worked out from the
+// reconciliation offset, as P_ShootTraverse does for blood, and checked
+// against where reconcile really put the target.
+//
+static bool Rewound(player_t &shooter, player_t &target, const shot_t &shot, bool lerp,
+					angle_t angle, fixed_t &x, fixed_t &y)
+{
+	Unlag &unlag = Unlag::getInstance();
+
+	unlag.setRoundtripDelay(shooter.id, shot.world & 0xFF,
+							lerp ? shot.behind << (FRACBITS - 8) : 0);
+
+	unlag.reconcile(shooter.id, angle, ANG(6), MISSILERANGE);
+
+	fixed_t rewound_x = target.mo->x, rewound_y = target.mo->y;
+
+	fixed_t xoffs, yoffs, zoffs;
+	unlag.getReconciliationOffset(target.id, xoffs, yoffs, zoffs);
+
+	unlag.restore(shooter.id);
+
+	x = target.mo->x - xoffs;
+	y = target.mo->y - yoffs;
+
+	return x == rewound_x && y == rewound_y;
+}
+
+int main(int argc, char **argv)
+{
+	int ping = 200;			// round trip, milliseconds
+	int fps = 60;
+	int firerate = 4;		// chaingun
+	double maxunlagtime = 1.0;
+	bool verbose = false;
+	const char *filename = NULL;
+
+	rng = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-ping") && i + 1 < argc)
+			ping = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-fps") && i + 1 < argc)
+			fps = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-firerate") && i + 1 < argc)
+			firerate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-maxunlagtime") && i + 1 < argc)
+			maxunlagtime = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+			rng = strtoul(argv[++i], NULL, 10);
+		else if (!strcmp(argv[i], "-v"))
+			verbose = true;
+		else if (argv[i][0] != '-' && !filename)
+			filename = argv[i];
+		else
+		{
+			fprintf(stderr, "usage: %s [-ping ms] [-fps n] [-firerate tics] "
+					"[-maxunlagtime secs] [-seed n] [-v] [ticcmds.txt]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (fps < 1 || firerate < 1 || ping < 0)
+	{
+		fprintf(stderr, "-fps and -firerate need to be at least 1, -ping at least 0\n");
+		return 1;
+	}
+
+	std::vector<ticcmd_line_t> cmds;
+	if (filename)
+	{
+		if (!ReadTiccmds(filename, cmds))
+			return 1;
+	}
+	else
+		MakeTiccmds(cmds, 60 * TICRATE);
+
+	Z_Init(false);
+
+	serverside = true;
+	multiplayer = true;
+	sv_maxunlagtime.Set(float(maxunlagtime));
+
+	SetupLevel();
+
+	double sx = -SHOOTER_DISTANCE, sy = 0.0;
+
+	player_t &target = SpawnPlayer(TARGET_ID, 0, 0, ANG180);
+	player_t &shooter = SpawnPlayer(SHOOTER_ID, fixed_t(sx * FRACUNIT), fixed_t(sy * FRACUNIT), 0);
+
+	double radius = ToDouble(target.mo->radius);
+
+	Unlag &unlag = Unlag::getInstance();
+	unlag.reset();
+	unlag.registerPlayer(TARGET_ID);
+	unlag.registerPlayer(SHOOTER_ID);
+
+	// the client shows the world a tic behind the last update it got, and
+	// its commands take the rest of the round trip to arrive
+	int lag = 1 + (ping * TICRATE + 500) / 1000;
+
+	// where the target was at the end of each tic, as the shooter saw it
+	std::vector<fixed_t> xs, ys;
+
+	int hits_whole = 0, hits_lerp = 0, differ = 0, count = 0;
+	double miss_whole = 0.0, miss_lerp = 0.0;
+
+	for (gametic = 0; gametic < int(cmds.size()); gametic++)
+	{
+		const ticcmd_line_t &line = cmds[gametic];
+
+		memset(&target.cmd, 0, sizeof(target.cmd));
+		target.cmd.forwardmove = line.forwardmove;
+		target.cmd.sidemove = line.sidemove;
+		target.mo->angle = angle_t(line.angle / 360.0 * 4294967296.0);
+
+		P_MovePlayer(&target);
+		P_XYMovement(target.mo);
+
+		xs.push_back(target.mo->x);
+		ys.push_back(target.mo->y);
+
+		// what SV_WriteCommands does at the end of every tic
+		unlag.recordPlayerPositions();
+
+		// fire a shot every 'firerate' tics, once there's enough history
+		if (gametic < lag + 1 || (gametic - lag - 1) % firerate)
+			continue;
+
+		shot_t shot;
+		shot.tic = gametic;
+		shot.world = gametic - lag;
+
+		// how far between tics the frame the player aimed with was drawn,
+		// as cl_main works out the lerp it sends
+		fixed_t frame = FRACUNIT;
+		if (fps > TICRATE)
+			frame = fixed_t((Random() % fps) * double(FRACUNIT) / fps);
+
+		fixed_t behind = FRACUNIT - frame;
+		shot.behind = MIN(behind >> (FRACBITS - 8), 255);
+
+		double seen_x = ToDouble(Unlag::interpolate(xs[shot.world], xs[shot.world - 1], behind));
+		double seen_y = ToDouble(Unlag::interpolate(ys[shot.world], ys[shot.world - 1], behind));
+
+		// aim somewhere between the target's edges, across the line of sight
+		double dx = seen_x - sx, dy = seen_y - sy;
+		double len = sqrt(dx * dx + dy * dy);
+		double across = (int(Random() % 1801) - 900) / 1000.0 * radius;
+
+		shot.aim_x = seen_x;
+		shot.aim_y = seen_y;
+		if (len > 0.0)
+		{
+			shot.aim_x -= dy / len * across;
+			shot.aim_y += dx / len * across;
+		}
+
+		angle_t angle = P_PointToAngle(fixed_t(sx * FRACUNIT), fixed_t(sy * FRACUNIT),
+									   fixed_t(shot.aim_x * FRACUNIT),
+									   fixed_t(shot.aim_y * FRACUNIT));
+
+		fixed_t wx, wy, lx, ly;
+		if (!Rewound(shooter, target, shot, false, angle, wx, wy) ||
+			!Rewound(shooter, target, shot, true, angle, lx, ly))
+		{
+			fprintf(stderr, "tic %d: the reconciliation offset doesn't match "
+					"where the target was moved\n", gametic);
+			return 1;
+		}
+
+		double whole, interp;
+		bool hit_whole = Hits(sx, sy, shot.aim_x, shot.aim_y, ToDouble(wx), ToDouble(wy),
+							  radius, whole);
+		bool hit_lerp = Hits(sx, sy, shot.aim_x, shot.aim_y, ToDouble(lx), ToDouble(ly),
+							 radius, interp);
+
+		count++;
+		hits_whole += hit_whole;
+		hits_lerp += hit_lerp;
+		miss_whole += whole;
+		miss_lerp += interp;
+
+		if (hit_whole != hit_lerp)
+			differ++;
+
+		if (verbose)
+			printf("tic %5d world %5d behind %3d  whole %s %6.2f  lerp %s %6.2f\n",
+				   shot.tic, shot.world, shot.behind,
+				   hit_whole ? "hit " : "miss", whole,
+				   hit_lerp ? "hit " : "miss", interp);
+	}
+
+	if (!count)
+	{
+		printf("no shots: %d tics of ticcmds, %d tics of lag\n", (int)cmds.size(), lag);
+		DestroyPlayers();
+		return 0;
+	}
+
+	printf("%d tics, lag %d tics, %d fps, %d shots\n", (int)cmds.size(), lag, fps, count);
+	printf("whole tic rewind:    %5d hits (%5.1f%%), %6.2f units from the centre on average\n",
+		   hits_whole, 100.0 * hits_whole / count, miss_whole / count);
+	printf("interpolated rewind: %5d hits (%5.1f%%), %6.2f units from the centre on average\n",
+		   hits_lerp, 100.0 * hits_lerp / count, miss_lerp / count);
+	printf("shots that differ:   %5d\n", differ);
+
+	DestroyPlayers();
+	return 0;
+}